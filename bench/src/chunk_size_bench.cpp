@@ -0,0 +1,156 @@
+// Measures the `Download` throughput over loopback for a range of chunk sizes.
+//
+// Usage:
+//     $> ./ChunkSizeBench [file size in MiB, default 64] [repetitions, default 3] [--async] [--cache]
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <spdlog/spdlog.h>
+
+#include "audio_server.hpp"
+#include "communication.grpc.pb.h"
+#include "synthetic_wav.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct Measurement
+    {
+        std::size_t bytes;
+        std::size_t messages;
+        double      seconds;
+        double      cpu_seconds; // server and client, they share the process
+    };
+
+    // Streams the whole file once, only counting what arrives
+    Measurement download( Teleaudio::AudioService::Stub & stub, std::string_view const name, std::uint32_t const chunk_size )
+    {
+        grpc::ClientContext context;
+
+        Teleaudio::File request;
+        request.set_name( std::string{ name } );
+        request.set_chunk_size( chunk_size );
+
+        Measurement result{};
+
+        auto const start    { std::chrono::steady_clock::now() };
+        auto const cpu_start{ std::clock() };
+
+        auto reader{ stub.Download( &context, request ) };
+        Teleaudio::AudioData data;
+        while ( reader->Read( &data ) )
+        {
+            result.bytes += data.rawdata().size();
+            ++result.messages;
+        }
+        if ( auto const status{ reader->Finish() }; !status.ok() )
+        {
+            spdlog::error( "Download failed: {}", status.error_message() );
+        }
+
+        result.seconds     = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+        result.cpu_seconds = static_cast< double >( std::clock() - cpu_start ) / CLOCKS_PER_SEC;
+        return result;
+    }
+
+    std::size_t parseNumber( std::string_view const arg, std::size_t const fallback )
+    {
+        std::size_t value{ fallback };
+        std::from_chars( arg.data(), arg.data() + arg.size(), value );
+        return value;
+    }
+}
+
+int main( int argc, char const * argv[] )
+{
+    spdlog::set_level( spdlog::level::warn );
+
+    std::size_t file_size_mib{ 64 };
+    std::size_t repetitions  { 3  };
+    bool        async        { false };
+    bool        cache        { false };
+
+    std::vector< std::string_view > positional;
+    for ( int i{ 1 }; i < argc; ++i )
+    {
+        std::string_view const arg{ argv[ i ] };
+        if ( arg == "--async" )
+        {
+            async = true;
+        }
+        else if ( arg == "--cache" )
+        {
+            cache = true;
+        }
+        else
+        {
+            positional.push_back( arg );
+        }
+    }
+    if ( positional.size() > 0 ) { file_size_mib = parseNumber( positional[ 0 ], file_size_mib ); }
+    if ( positional.size() > 1 ) { repetitions   = parseNumber( positional[ 1 ], repetitions   ); }
+
+    auto const storage{ fs::temp_directory_path() / "teleaudio_chunk_bench" };
+    fs::create_directories( storage );
+
+    auto const song_name{ "bench.wav" };
+    if ( !Bench::writeSyntheticWav( storage / song_name, file_size_mib * 1024 * 1024 ) )
+    {
+        return 1;
+    }
+
+    Teleaudio::ServerOptions options;
+    options.async           = async;
+    options.adaptive_chunks = true; // only applies when the client leaves the chunk size to the server
+    options.max_chunk_size  = 4 * 1024 * 1024 - 1024;
+    options.cache_size      = cache ? 2 * file_size_mib * 1024 * 1024 : 0;
+
+    Teleaudio::Server server{ storage.string(), 0, options };
+
+    auto const channel{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+    auto const stub   { Teleaudio::AudioService::NewStub( channel ) };
+
+    // warming up the page cache and the connection
+    download( *stub, song_name, 64 * 1024 );
+
+    std::printf( "%zu MiB over loopback, best of %zu, %s server, %s\n", file_size_mib, repetitions, async ? "async" : "sync", cache ? "cached" : "streamed from disk" );
+    std::printf( "%12s %12s %12s %12s\n", "chunk [B]", "messages", "MB/s", "CPU s/GB" );
+
+    // 0 lets the server adapt, starting from the default chunk size
+    for ( std::uint32_t const chunk_size : { 1024U, 5 * 1024U, 16 * 1024U, 64 * 1024U, 256 * 1024U, 1024 * 1024U, 4 * 1024 * 1024U - 1024, 0U } )
+    {
+        double      best_throughput{};
+        double      best_cpu_per_gb{ std::numeric_limits< double >::max() };
+        std::size_t messages{};
+        for ( std::size_t i{}; i < repetitions; ++i )
+        {
+            auto const result{ download( *stub, song_name, chunk_size ) };
+            best_throughput = std::max( best_throughput, static_cast< double >( result.bytes ) / result.seconds / 1e6 );
+            best_cpu_per_gb = std::min( best_cpu_per_gb, result.cpu_seconds / ( static_cast< double >( result.bytes ) / 1e9 ) );
+            messages        = result.messages;
+        }
+        if ( chunk_size == 0 )
+        {
+            std::printf( "%12s %12zu %12.1f %12.2f\n", "adaptive", messages, best_throughput, best_cpu_per_gb );
+        }
+        else
+        {
+            std::printf( "%12u %12zu %12.1f %12.2f\n", chunk_size, messages, best_throughput, best_cpu_per_gb );
+        }
+    }
+
+    server.shutdown();
+    fs::remove_all( storage );
+
+    return 0;
+}
@@ -0,0 +1,406 @@
+// Drives a server with many concurrent clients listing and downloading a synthetic storage,
+// reporting the throughput, the latencies and what the server took for it.
+//
+// The server runs in a child process of its own, so its CPU time and peak memory
+// aren't mixed up with the ones of the clients.
+//
+// Usage:
+//     $> ./teleaudio_bench [--clients=<N>] [--downloads=<N>] [--lists=<N>] [--files=<N>] [--sizes=<KiB,...>]
+//                          [--async] [--cache] [--compress] [--io=<uring|pread|stdio>] [--json=<file>]
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <grpcpp/grpcpp.h>
+#include <spdlog/spdlog.h>
+
+#include "audio_server.hpp"
+#include "communication.grpc.pb.h"
+#include "synthetic_wav.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::size_t                  clients  { 8 };
+        std::size_t                  downloads{ 16 }; // per client
+        std::size_t                  lists    { 16 }; // per client
+        std::size_t                  files    { 16 };
+        std::vector< std::size_t >   sizes    { 256, 1024, 8192 }; // KiB, the files take turns
+        bool                         async    { false };
+        bool                         cache    { false };
+        bool                         compress { false };
+        FileUtils::IoBackend         io       { Teleaudio::ServerOptions{}.io_backend };
+        std::string                  json;
+    };
+
+    // the formats the synthetic files take turns in
+    constexpr Bench::SyntheticFormat formats[]
+    {
+        { .sample_rate = 44'100, .num_channels = 2, .bits_per_sample = 16 },
+        { .sample_rate = 48'000, .num_channels = 2, .bits_per_sample = 24 },
+        { .sample_rate = 96'000, .num_channels = 1, .bits_per_sample = 32 },
+        { .sample_rate = 16'000, .num_channels = 1, .bits_per_sample = 8  },
+    };
+
+    // What a single client saw, in seconds
+    struct ClientResults
+    {
+        std::vector< double > list_latencies;
+        std::vector< double > first_bytes;
+        std::vector< double > completions;
+        std::size_t           bytes{};
+        std::size_t           failures{};
+    };
+
+    struct Percentiles
+    {
+        double p50 {};
+        double p99 {};
+        double p999{};
+        double max {};
+    };
+
+    // Nearest rank percentiles, in milliseconds
+    Percentiles percentiles( std::vector< double > samples )
+    {
+        if ( samples.empty() )
+        {
+            return {};
+        }
+        std::sort( samples.begin(), samples.end() );
+
+        auto const rank{ [ & ]( double const percentile )
+        {
+            auto const index{ static_cast< std::size_t >( percentile / 100 * static_cast< double >( samples.size() ) + 0.5 ) };
+            return 1000 * samples[ std::clamp< std::size_t >( index, 1, samples.size() ) - 1 ];
+        } };
+        return { rank( 50 ), rank( 99 ), rank( 99.9 ), 1000 * samples.back() };
+    }
+
+    // Lists and downloads the storage round robin, starting at a file of its own
+    ClientResults runClient( std::string const & address, Options const & options, std::vector< std::string > const & names, std::size_t const id )
+    {
+        // a connection per client, as separate machines would have
+        grpc::ChannelArguments arguments;
+        arguments.SetInt( GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1 );
+        auto const stub{ Teleaudio::AudioService::NewStub( grpc::CreateCustomChannel( address, grpc::InsecureChannelCredentials(), arguments ) ) };
+
+        ClientResults results;
+        for ( std::size_t i{}; i < options.lists; ++i )
+        {
+            grpc::ClientContext  context;
+            Teleaudio::Directory directory;
+            Teleaudio::CmdOutput output;
+
+            auto const start{ Clock::now() };
+            if ( !stub->List( &context, directory, &output ).ok() )
+            {
+                ++results.failures;
+                continue;
+            }
+            results.list_latencies.push_back( std::chrono::duration< double >( Clock::now() - start ).count() );
+        }
+
+        for ( std::size_t i{}; i < options.downloads; ++i )
+        {
+            grpc::ClientContext context;
+            Teleaudio::File     request;
+            request.set_name( names[ ( id + i ) % names.size() ] );
+            request.set_codec( options.compress ? Teleaudio::PAYLOAD_DELTA_RICE : Teleaudio::PAYLOAD_RAW );
+
+            auto const start{ Clock::now() };
+            auto reader{ stub->Download( &context, request ) };
+
+            Teleaudio::AudioData data;
+            bool                 first{ true };
+            while ( reader->Read( &data ) )
+            {
+                if ( first )
+                {
+                    results.first_bytes.push_back( std::chrono::duration< double >( Clock::now() - start ).count() );
+                    first = false;
+                }
+                results.bytes += data.rawdata().size() + data.encodeddata().size();
+            }
+            if ( !reader->Finish().ok() || first )
+            {
+                ++results.failures;
+                continue;
+            }
+            results.completions.push_back( std::chrono::duration< double >( Clock::now() - start ).count() );
+        }
+        return results;
+    }
+
+    // Serves `storage` until `stop` is closed, sends the port over `ready` once it listens
+    [[ noreturn ]] void runServer( fs::path const & storage, Options const & options, int const ready, int const stop )
+    {
+        Teleaudio::ServerOptions server_options;
+        server_options.async      = options.async;
+        server_options.cache_size = options.cache ? std::size_t{ 1024 } * 1024 * 1024 : 0;
+        server_options.io_backend = options.io;
+
+        Teleaudio::Server server{ storage.string(), 0, server_options };
+
+        auto const port{ server.port() };
+        if ( write( ready, &port, sizeof( port ) ) != sizeof( port ) )
+        {
+            _exit( 1 );
+        }
+        close( ready );
+
+        // blocks until the parent is done or gone
+        char byte{};
+        while ( read( stop, &byte, 1 ) > 0 ) {}
+
+        server.shutdown();
+        _exit( 0 );
+    }
+
+    // the value of --io that asks for `backend`
+    std::string_view ioName( FileUtils::IoBackend const backend )
+    {
+        switch ( backend )
+        {
+            case FileUtils::IoBackend::Stdio: return "stdio";
+            case FileUtils::IoBackend::Pread: return "pread";
+            case FileUtils::IoBackend::Uring: return "uring";
+        }
+        return "unknown";
+    }
+
+    bool parseNumber( std::string_view const value, std::size_t & output )
+    {
+        auto const [ ptr, ec ]{ std::from_chars( value.data(), value.data() + value.size(), output ) };
+        return ec == std::errc{} && ptr == value.data() + value.size();
+    }
+
+    bool parseOptions( int const argc, char const * argv[], Options & options )
+    {
+        for ( int i{ 1 }; i < argc; ++i )
+        {
+            std::string_view const arg{ argv[ i ] };
+            auto const separator{ arg.find( '=' ) };
+            auto const name     { arg.substr( 0, separator ) };
+            auto const value    { separator == std::string_view::npos ? std::string_view{} : arg.substr( separator + 1 ) };
+
+            bool valid{ true };
+            if      ( name == "--clients"   ) { valid = parseNumber( value, options.clients   ) && options.clients > 0; }
+            else if ( name == "--downloads" ) { valid = parseNumber( value, options.downloads ); }
+            else if ( name == "--lists"     ) { valid = parseNumber( value, options.lists     ); }
+            else if ( name == "--files"     ) { valid = parseNumber( value, options.files     ) && options.files > 0; }
+            else if ( name == "--async"     ) { options.async    = true; }
+            else if ( name == "--cache"     ) { options.cache    = true; }
+            else if ( name == "--compress"  ) { options.compress = true; }
+            else if ( name == "--json"      ) { options.json     = value; valid = !value.empty(); }
+            else if ( name == "--io"        )
+            {
+                if      ( value == "uring" ) { options.io = FileUtils::IoBackend::Uring; }
+                else if ( value == "pread" ) { options.io = FileUtils::IoBackend::Pread; }
+                else if ( value == "stdio" ) { options.io = FileUtils::IoBackend::Stdio; }
+                else                         { valid = false; }
+            }
+            else if ( name == "--sizes" )
+            {
+                options.sizes.clear();
+                for ( auto rest{ value }; valid && !rest.empty(); )
+                {
+                    auto const comma{ rest.find( ',' ) };
+                    std::size_t kibibytes{};
+                    valid = parseNumber( rest.substr( 0, comma ), kibibytes ) && kibibytes > 0;
+                    options.sizes.push_back( kibibytes );
+                    rest = comma == std::string_view::npos ? std::string_view{} : rest.substr( comma + 1 );
+                }
+                valid = valid && !options.sizes.empty();
+            }
+            else
+            {
+                valid = false;
+            }
+
+            if ( !valid )
+            {
+                spdlog::error( "Invalid argument '{}'", arg );
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string toJson( Percentiles const & value )
+    {
+        return fmt::format( R"({{ "p50": {:.3f}, "p99": {:.3f}, "p999": {:.3f}, "max": {:.3f} }})", value.p50, value.p99, value.p999, value.max );
+    }
+}
+
+int main( int argc, char const * argv[] )
+{
+    spdlog::set_level( spdlog::level::warn );
+
+    Options options;
+    if ( !parseOptions( argc, argv, options ) )
+    {
+        return 1;
+    }
+
+    // a directory of its own, so runs at the same time don't delete each other's files
+    auto directory{ ( fs::temp_directory_path() / "teleaudio_load_bench_XXXXXX" ).string() };
+    if ( ::mkdtemp( directory.data() ) == nullptr )
+    {
+        spdlog::error( "Can't create a directory for the storage in '{}'", fs::temp_directory_path().string() );
+        return 1;
+    }
+    fs::path const storage{ directory };
+    // removed however the run ends, the server process leaves with _exit and doesn't touch it
+    auto const remove_storage{ []( fs::path const * const path ) { std::error_code ec; fs::remove_all( *path, ec ); } };
+    std::unique_ptr< fs::path const, decltype( remove_storage ) > const cleanup{ &storage, remove_storage };
+
+    std::vector< std::string > names;
+    std::size_t                storage_size{};
+    for ( std::size_t i{}; i < options.files; ++i )
+    {
+        auto const & format{ formats[ i % std::size( formats ) ] };
+        auto const   size  { options.sizes[ i % options.sizes.size() ] * 1024 };
+        auto const & name  { names.emplace_back( fmt::format( "bench_{:03}_{}Hz_{}bit_{}ch.wav", i, format.sample_rate, format.bits_per_sample, format.num_channels ) ) };
+        if ( !Bench::writeSyntheticWav( storage / name, size, format ) )
+        {
+            return 1;
+        }
+        storage_size += size;
+    }
+
+    // nothing of gRPC may exist in this process before it forks
+    int ready[ 2 ];
+    int stop [ 2 ];
+    if ( pipe( ready ) != 0 || pipe( stop ) != 0 )
+    {
+        spdlog::error( "Can't create the pipes to the server" );
+        return 1;
+    }
+
+    auto const server{ fork() };
+    if ( server < 0 )
+    {
+        spdlog::error( "Can't start the server" );
+        return 1;
+    }
+    if ( server == 0 )
+    {
+        close( ready[ 0 ] );
+        close( stop[ 1 ] );
+        runServer( storage, options, ready[ 1 ], stop[ 0 ] );
+    }
+    close( ready[ 1 ] );
+    close( stop[ 0 ] );
+
+    std::uint16_t port{};
+    if ( read( ready[ 0 ], &port, sizeof( port ) ) != sizeof( port ) )
+    {
+        spdlog::error( "The server didn't start" );
+        close( stop[ 1 ] );
+        waitpid( server, nullptr, 0 );
+        return 1;
+    }
+    close( ready[ 0 ] );
+
+    auto const address{ "localhost:" + std::to_string( port ) };
+
+    std::vector< ClientResults > results( options.clients );
+    auto const start{ Clock::now() };
+    {
+        std::vector< std::jthread > clients;
+        for ( std::size_t i{}; i < options.clients; ++i )
+        {
+            clients.emplace_back( [ &, i ] { results[ i ] = runClient( address, options, names, i ); } );
+        }
+    }
+    auto const seconds{ std::chrono::duration< double >( Clock::now() - start ).count() };
+
+    close( stop[ 1 ] );
+    int status{};
+    waitpid( server, &status, 0 );
+
+    rusage usage{};
+    getrusage( RUSAGE_CHILDREN, &usage );
+    auto const server_cpu{ static_cast< double >( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) + static_cast< double >( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1e6 };
+#ifdef __APPLE__
+    auto const server_peak_rss{ static_cast< std::size_t >( usage.ru_maxrss ) };
+#else
+    auto const server_peak_rss{ static_cast< std::size_t >( usage.ru_maxrss ) * 1024 };
+#endif
+
+    ClientResults all;
+    for ( auto const & client : results )
+    {
+        all.list_latencies.insert( all.list_latencies.end(), client.list_latencies.begin(), client.list_latencies.end() );
+        all.first_bytes   .insert( all.first_bytes   .end(), client.first_bytes   .begin(), client.first_bytes   .end() );
+        all.completions   .insert( all.completions   .end(), client.completions   .begin(), client.completions   .end() );
+        all.bytes    += client.bytes;
+        all.failures += client.failures;
+    }
+
+    auto const list       { percentiles( all.list_latencies ) };
+    auto const first_byte { percentiles( all.first_bytes    ) };
+    auto const completion { percentiles( all.completions    ) };
+    auto const megabytes_per_second{ static_cast< double >( all.bytes ) / seconds / 1e6 };
+    auto const files_per_second    { static_cast< double >( all.completions.size() ) / seconds };
+
+    std::printf( "%zu clients, %zu lists and %zu downloads each, %zu files of %.1f MiB in total, %s server%s%s\n",
+                 options.clients, options.lists, options.downloads, options.files, static_cast< double >( storage_size ) / 1024 / 1024,
+                 options.async ? "async" : "sync", options.cache ? ", cached" : "", options.compress ? ", compressed" : "" );
+    std::printf( "%12.1f MB/s %12.1f files/s %12zu failures %12.2f s\n", megabytes_per_second, files_per_second, all.failures, seconds );
+    std::printf( "%-16s %10s %10s %10s %10s\n", "[ms]", "p50", "p99", "p99.9", "max" );
+    std::printf( "%-16s %10.3f %10.3f %10.3f %10.3f\n", "list",        list.p50,       list.p99,       list.p999,       list.max       );
+    std::printf( "%-16s %10.3f %10.3f %10.3f %10.3f\n", "first byte",  first_byte.p50, first_byte.p99, first_byte.p999, first_byte.max );
+    std::printf( "%-16s %10.3f %10.3f %10.3f %10.3f\n", "completion",  completion.p50, completion.p99, completion.p999, completion.max );
+    std::printf( "server: %.2f CPU s, %.2f CPU s/GB, %.1f MiB peak RSS\n",
+                 server_cpu, all.bytes > 0 ? server_cpu / ( static_cast< double >( all.bytes ) / 1e9 ) : 0.0, static_cast< double >( server_peak_rss ) / 1024 / 1024 );
+
+    if ( !options.json.empty() )
+    {
+        std::ofstream json{ options.json };
+        json << fmt::format( R"({{
+  "clients": {}, "lists_per_client": {}, "downloads_per_client": {}, "files": {}, "storage_bytes": {},
+  "async": {}, "cache": {}, "compress": {}, "io": "{}",
+  "seconds": {:.6f}, "bytes": {}, "failures": {},
+  "megabytes_per_second": {:.3f}, "files_per_second": {:.3f},
+  "list_ms": {},
+  "first_byte_ms": {},
+  "completion_ms": {},
+  "server_cpu_seconds": {:.3f}, "server_peak_rss_bytes": {}
+}}
+)",
+            options.clients, options.lists, options.downloads, options.files, storage_size,
+            options.async, options.cache, options.compress, ioName( options.io ),
+            seconds, all.bytes, all.failures,
+            megabytes_per_second, files_per_second,
+            toJson( list ), toJson( first_byte ), toJson( completion ),
+            server_cpu, server_peak_rss );
+        if ( !json )
+        {
+            spdlog::error( "Can't write '{}'", options.json );
+        }
+    }
+
+    return WIFEXITED( status ) && WEXITSTATUS( status ) == 0 && all.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+
+#include "wav.hpp"
+
+namespace Bench
+{
+    struct SyntheticFormat
+    {
+        std::uint32_t sample_rate    { 48'000 };
+        std::uint16_t num_channels   { 2      };
+        std::uint16_t bits_per_sample{ 16     };
+    };
+
+    // Writes a PCM .wav file of roughly `size_in_bytes` filled with noise,
+    // returns false if it couldn't be written
+    [[ nodiscard ]] inline bool writeSyntheticWav( std::filesystem::path const & path, std::size_t const size_in_bytes, SyntheticFormat const format = {} )
+    {
+        auto const bits_in_byte{ 8 };
+        auto const block_align { static_cast< std::uint16_t >( format.num_channels * format.bits_per_sample / bits_in_byte ) };
+
+        WAV::FmtSubChunk const fmt
+        {
+            .subchunk1_id    = WAV::MagicBytes::fmt,
+            .subchunk1_size  = 16,
+            .audio_format    = 1, // PCM
+            .num_channels    = format.num_channels,
+            .sample_rate     = format.sample_rate,
+            .byte_rate       = format.sample_rate * block_align,
+            .block_align     = block_align,
+            .bits_per_sample = format.bits_per_sample
+        };
+
+        auto const raw_data_size{ static_cast< std::uint32_t >( size_in_bytes - size_in_bytes % block_align ) };
+
+        WAV::File file{ fmt, raw_data_size };
+
+        // deterministic noise, so every run streams the same bytes
+        std::mt19937 generator{ 1989 };
+        for ( auto & sample : file.samples() )
+        {
+            sample = static_cast< std::byte >( generator() );
+        }
+
+        return file.write( path.string() );
+    }
+} // namespace Bench
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include <memory>
 #include <grpcpp/grpcpp.h>
 #include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
 #include "communication.grpc.pb.h"
+#include "playback.hpp"
 
 // fwd
 namespace WAV { struct File; };
@@ -12,9 +19,45 @@ namespace WAV { struct File; };
 namespace Teleaudio
 {
 
+// Progress of a single file downloaded by `AudioClient::DownloadMany`
+struct DownloadProgress
+{
+    std::string                         file;
+    std::uint64_t                       bytes_received{};
+    std::uint64_t                       bytes_total   {};
+    std::chrono::steady_clock::duration elapsed       {};
+    bool                                done          { false };
+    bool                                ok            { false };
+
+    // Megabytes of samples per second received so far
+    [[ nodiscard ]] double throughput() const;
+};
+
+// What `AudioClient::Sync` had to do to bring a local copy of a file up to date
+struct SyncStatistics
+{
+    bool          unchanged     { false }; // the copy already had the same samples, nothing was downloaded
+    std::size_t   blocks        {};        // checksummed blocks of the file on the server, 0 if it had none
+    std::size_t   blocks_fetched{};
+    std::uint64_t bytes_fetched {};        // of samples
+};
+
+// Format the server converts the samples into before sending them, the zero values keep the one of the file
+struct OutputFormat
+{
+    std::uint32_t sample_rate    {};
+    std::uint16_t bits_per_sample{};
+    std::uint16_t channels       {};
+    bool          floating_point { false }; // 32 bit floats instead of integers
+};
+
 class AudioClient
 {
 public:
+    using ProgressHandler = std::function< void ( DownloadProgress const & ) >;
+    using MetadataHandler = std::function< bool ( AudioMetadata const & ) >;
+    using SamplesHandler  = std::function< bool ( std::span< std::byte const > ) >;
+
     AudioClient( std::shared_ptr< grpc::Channel > channel )
         : stub_{ AudioService::NewStub( channel ) }
     {}
@@ -22,17 +65,90 @@ public:
     // Returns the contents of a directory
     [[ nodiscard ]] std::string List( std::string_view directory = "." ) const;
 
-    // Play the file on an audio device
+    // Returns the format, size and age of every file in a directory, without downloading them
+    [[ nodiscard ]] std::vector< FileInfo > ListDetailed( std::string_view directory = "." ) const;
+
+    // Streams the entries of `request.path()` that pass the filters of the `request` page by page,
+    // returning false from `on_page` stops the listing
+    [[ nodiscard ]] bool ListStream( ListRequest const & request, std::function< bool ( FileInfoList const & ) > const & on_page ) const;
+
+    // Returns the format, size and age of a single file, without downloading it
+    [[ nodiscard ]] std::optional< FileInfo > Stat( std::string_view file ) const;
+
+    // Returns the counters and latency histograms of the server since it started
+    [[ nodiscard ]] std::optional< MetricsReport > GetMetrics() const;
+
+    // Returns the lowest and highest sample and the RMS of every channel over `resolution` buckets of a range of frames,
+    // 0 frames going up to the end, 0 buckets leaving it to the server
+    [[ nodiscard ]] std::optional< Peaks > GetPeaks( std::string_view file, std::uint32_t resolution, std::uint64_t start_frame = 0, std::uint64_t frames = 0 ) const;
+
+    // Play the file on an audio device, on Linux it starts playing while the file is still arriving
     [[ nodiscard ]] bool Play( std::string_view file ) const;
 
-    // Download the file and write it to given 'output_path'
-    [[ nodiscard ]] bool Download ( std::string_view file, std::string_view output_path ) const;
+    // Plays a paced `Stream` of the file into `sink` as it arrives, nullopt if the stream didn't even start
+    [[ nodiscard ]] std::optional< PlaybackStatistics > Play( std::string_view file, AudioSink & sink, PlaybackOptions const & options = {} ) const;
+
+    // Download the file and write it to given 'output_path'.
+    // With `resume` a partial 'output_path' left by an earlier attempt is continued instead of starting over,
+    // and is kept if this attempt fails as well
+    [[ nodiscard ]] bool Download ( std::string_view file, std::string_view output_path, bool resume = false ) const;
+
+    // Downloads a single file over `streams` concurrent `Download` calls, each fetching its own range of the samples
+    // and writing it straight into its place in the output file. 0 picks the number of streams by the size of the file
+    [[ nodiscard ]] bool DownloadParallel( std::string_view file, std::string_view output_path, std::size_t streams = 0 ) const;
+
+    // Brings the copy of `file` at `output_path` up to date: an identical copy is left as it is, otherwise only the blocks
+    // of samples whose checksums differ are downloaded and the rest is taken over from the copy, which is replaced
+    // once the result matches the checksum of the whole file. Without a copy to compare, or without checksums
+    // from the server, the whole file is downloaded, and it too only replaces the copy once it's complete. nullopt if even that fails
+    [[ nodiscard ]] std::optional< SyncStatistics > Sync( std::string_view file, std::string_view output_path ) const;
+
+    // Syncs `files` into `output_directory`, up to `concurrency` of them at a time, in the order they were given
+    [[ nodiscard ]] std::vector< std::optional< SyncStatistics > > SyncMany( std::vector< std::string > const & files, std::string_view output_directory, std::size_t concurrency ) const;
+
+    // Downloads `files` into `output_directory`, keeping up to `concurrency` streams in flight over the one channel.
+    // `on_progress` is called after every received chunk and once more when a file is done,
+    // returns the final progress of every file in the order they were given
+    [[ nodiscard ]] std::vector< DownloadProgress > DownloadMany( std::vector< std::string > const & files, std::string_view output_directory, std::size_t concurrency, ProgressHandler const & on_progress = {} ) const;
+
+    // Streams the file paced like a playback, the server keeps the samples at most `lead` ahead of real time,
+    // 0 leaves it to the server. `on_metadata` is called once before the samples, returning false from either handler stops
+    [[ nodiscard ]] bool Stream( std::string_view file, MetadataHandler const & on_metadata, SamplesHandler const & on_samples, std::chrono::milliseconds lead = {} ) const;
+
+    // Asks the server to stream the samples in chunks of `bytes`, 0 leaves it to the server
+    void SetPreferredChunkSize( std::uint32_t bytes ) { preferred_chunk_size_ = bytes; }
+
+    // Asks the server to encode the samples losslessly, which pays off on slow links.
+    // Off by default, on a fast link or loopback the encoding costs more than it saves
+    void SetCompression( bool enabled ) { compression_ = enabled; }
+
+    // Has the server convert the samples of every download, the downloaded files are in the converted format.
+    // Files the server can't convert are downloaded as they are
+    void SetOutputFormat( OutputFormat const & format ) { output_format_ = format; }
 
 private:
-    // helper for making a connection and receiving the file
+    // the `Download` request for the whole `file` with the preferences of this client
+    [[ nodiscard ]] File makeRequest( std::string_view file ) const;
+
+    // helper for making a connection and passing `length` bytes of samples from `offset` on as they arrive,
+    // a `length` of 0 means up to the end. `on_metadata` is called once before the samples,
+    // returning false from either handler aborts
+    [[ nodiscard ]] bool streamFile( std::string_view file, std::uint64_t offset, std::uint64_t length, MetadataHandler const & on_metadata, SamplesHandler const & on_samples ) const;
+
+    // helper for fetching the metadata a `Download` of the whole `file` starts with, without its samples
+    [[ nodiscard ]] std::optional< AudioMetadata > fetchMetadata( std::string_view file ) const;
+
+    // helper for passing the samples of a `Download` or `Stream` call on as they arrive
+    [[ nodiscard ]] static bool readStream( std::string_view file, grpc::ClientContext & context, grpc::ClientReader< AudioData > & reader, MetadataHandler const & on_metadata, SamplesHandler const & on_samples );
+
+    // helper for making a connection and receiving the whole file into memory
     [[ nodiscard ]] std::optional< WAV::File > receiveFile( std::string_view file ) const;
 
     std::unique_ptr< Teleaudio::AudioService::Stub > stub_;
+
+    std::uint32_t preferred_chunk_size_{};
+    bool          compression_{ false };
+    OutputFormat  output_format_;
 };
 
 } // namespace Teleaudio
@@ -1,9 +1,101 @@
 #pragma once
 
+#include <memory>
+#include <string>
 #include <string_view>
+#include <cstddef>
 #include <cstdint>
 
+#include "read_ahead.hpp"
+
 namespace Teleaudio
 {
-    void run_server( std::string_view directory, std::uint16_t port );
+    struct ServerOptions
+    {
+        // byte budget for keeping mapped files in memory, 0 disables the cache
+        std::size_t cache_size{ 0 };
+
+        // serve `List` and `Download` from completion queues instead of a thread per call
+        bool        async{ false };
+
+        // number of completion queues, 0 means one per core
+        std::size_t completion_queues{ 0 };
+
+        // threads polling each completion queue
+        std::size_t threads_per_queue{ 1 };
+
+        // payload size of the `Download` messages, unless the client asks for another one
+        std::uint32_t chunk_size{ 5 * 1024 };
+
+        // grow the chunks while that keeps improving the throughput of a stream
+        bool          adaptive_chunks{ false };
+
+        // upper bound for both adaptive and client requested chunks
+        std::uint32_t max_chunk_size{ 1024 * 1024 };
+
+        // where whole files are kept already serialized into `Download` messages, empty disables packing
+        std::string   pack_directory;
+
+        // byte budget for the packed files, the least recently used ones are removed beyond it
+        std::uint64_t pack_budget{ 1024 * 1024 * 1024 };
+
+        // how far the samples of a paced `Stream` may run ahead of the playback, unless the client asks otherwise
+        std::uint32_t stream_lead_ms{ 2000 };
+
+        // downloads of a whole file in the same chunks share a single stream of messages, the last this many of them are kept
+        // for subscribers joining late and those falling behind. 0 gives every download a stream of its own
+        std::size_t   broadcast_ring{ 0 };
+
+        // serve the metrics in the Prometheus text format on this port of the loopback interface, 0 disables it
+        std::uint16_t metrics_port{ 0 };
+
+        // threads checksumming the files in the background for `Checksums`
+        std::size_t   checksum_threads{ 2 };
+
+        // where the waveform summaries for `GetPeaks` are kept, empty keeps them in memory only
+        std::string   peaks_directory;
+
+        // byte budget for the summaries kept in memory only, the least recently used ones are dropped beyond it
+        std::uint64_t peaks_budget{ 64 * 1024 * 1024 };
+
+        // how the samples of files that aren't cached are read
+        FileUtils::IoBackend io_backend{ FileUtils::IoBackend::Uring };
+
+        // blocks read ahead of the chunk being sent, and their size
+        std::size_t   read_ahead{ 4 };
+        std::size_t   read_block_size{ 256 * 1024 };
+
+        // files with at least this many bytes of samples are read around the page cache, so archives streamed once
+        // don't push the files served all the time out of it. 0 reads every file through the page cache
+        std::uint64_t direct_io_above{ 0 };
+    };
+
+    // A running server, shut down when destroyed.
+    // The storage directory and the cache are process wide, so only one can run at a time.
+    class Server
+    {
+    public:
+        // Starts listening on all interfaces, port 0 picks a free port
+        Server( std::string_view directory, std::uint16_t port, ServerOptions const & options = {} );
+        ~Server();
+
+        Server( Server const & )             = delete;
+        Server & operator=( Server const & ) = delete;
+
+        [[ nodiscard ]] std::uint16_t port() const;
+
+        // Where the metrics are served over HTTP, 0 if they aren't
+        [[ nodiscard ]] std::uint16_t metrics_port() const;
+
+        // Blocks until `shutdown` is called from another thread
+        void wait();
+
+        void shutdown();
+
+    private:
+        struct Impl;
+        std::unique_ptr< Impl > impl_;
+    };
+
+    void run_server( std::string_view directory, std::uint16_t port, ServerOptions const & options = {} );
 }
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <grpcpp/support/byte_buffer.h>
+
+namespace Teleaudio
+{
+
+// One download shared by everyone asking for the same thing at about the same time.
+// The messages are produced once, by whichever subscriber needs the next one first, into a ring of already
+// serialized ByteBuffers the other subscribers copy them out of, which only takes references to their slices.
+// The producer runs without the lock, only the subscribers waiting for the same message wait for it.
+// The ring never waits for anyone: once it's full the oldest message makes room for the next one,
+// and a subscriber that hadn't read it yet is evicted, it has to carry on without the broadcast.
+class Broadcast
+{
+public:
+    // Fills `message` with the next message and `samples` with the bytes of samples in it, false at the end
+    using Producer = std::function< bool ( grpc::ByteBuffer & message, std::uint32_t & samples ) >;
+
+    enum class Next : std::uint8_t
+    {
+        Message,
+        End,
+        Evicted
+    };
+
+    // A position in the broadcast, meant for a single thread at a time
+    class Subscription
+    {
+    public:
+        explicit Subscription( std::shared_ptr< Broadcast > broadcast ) : broadcast_{ std::move( broadcast ) } {}
+
+        [[ nodiscard ]] grpc::ByteBuffer const & metadata() const { return broadcast_->metadata_; }
+
+        // Copies out the next message, adding its samples to `bytes_received`
+        [[ nodiscard ]] Next next( grpc::ByteBuffer & message );
+
+        // Bytes of samples in the messages handed out so far
+        [[ nodiscard ]] std::uint64_t bytes_received() const { return bytes_received_; }
+
+    private:
+        std::shared_ptr< Broadcast > broadcast_;
+        std::uint64_t                position_{};
+        std::uint64_t                bytes_received_{};
+    };
+
+    // Keeps the last `capacity` messages
+    Broadcast( grpc::ByteBuffer metadata, Producer producer, std::size_t capacity );
+
+    // Nullopt once the start of the broadcast is gone, a late subscriber would miss it
+    [[ nodiscard ]] static std::optional< Subscription > subscribe( std::shared_ptr< Broadcast > const & broadcast );
+
+    [[ nodiscard ]] std::uint64_t evictions() const;
+
+private:
+    struct Slot
+    {
+        grpc::ByteBuffer message;
+        std::uint32_t    samples{};
+    };
+
+    grpc::ByteBuffer const metadata_;
+
+    mutable std::mutex      mutex_;
+    std::condition_variable produced_; // a message was added or the broadcast ended
+    Producer                producer_;
+    std::vector< Slot >     ring_;
+    std::uint64_t           head_{}; // the next message to produce
+    std::uint64_t           tail_{}; // the oldest message still in the ring
+    bool                    producing_{ false };
+    bool                    ended_{ false };
+    std::uint64_t           evictions_{};
+};
+
+// Finds the broadcasts of the downloads in progress
+class Broadcaster
+{
+public:
+    using Starter = std::function< std::shared_ptr< Broadcast > () >;
+
+    // Subscribes to the broadcast of `key` if it still has its start, or to a new one made by `start` otherwise,
+    // nullopt if that fails
+    [[ nodiscard ]] std::optional< Broadcast::Subscription > subscribe( std::string const & key, Starter const & start );
+
+private:
+    std::mutex                                                 mutex_;
+    std::unordered_map< std::string, std::weak_ptr< Broadcast > > broadcasts_;
+};
+
+} // namespace Teleaudio
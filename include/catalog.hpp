@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// What the headers of a .wav file in the storage say about it
+struct CatalogEntry
+{
+    std::string      name;
+    std::uintmax_t   size{};
+    std::int64_t     mtime{}; // seconds since the epoch
+    WAV::FmtSubChunk format{};
+    std::uint64_t    raw_data_size{};
+    bool             valid{ false }; // false if the headers can't be streamed
+
+    [[ nodiscard ]] double duration() const
+    {
+        return format.byte_rate > 0 ? static_cast< double >( raw_data_size ) / format.byte_rate : 0.0;
+    }
+};
+
+// Narrows down the entries of a listing, the zero values match everything
+struct CatalogFilter
+{
+    std::string   prefix;
+    std::uint32_t channels       {};
+    std::uint32_t sample_rate    {};
+    std::uint32_t bits_per_sample{};
+    double        min_duration   {};
+    double        max_duration   {};
+
+    [[ nodiscard ]] bool matches( CatalogEntry const & entry ) const;
+};
+
+// In-memory index of every .wav file under the storage directory, built from their headers only.
+// On Linux it follows the changes to the directory tree through inotify, elsewhere it's only
+// refreshed file by file when a `stat` misses.
+class Catalog
+{
+public:
+    explicit Catalog( std::filesystem::path root );
+    ~Catalog();
+
+    Catalog( Catalog const & )             = delete;
+    Catalog & operator=( Catalog const & ) = delete;
+
+    // Entries of the `directory` relative to the root, sorted by name, nullopt if there's no such directory
+    [[ nodiscard ]] std::optional< std::vector< CatalogEntry > > list( std::string_view directory ) const;
+
+    // Up to `count` entries of the `directory` that pass the `filter`, sorted by name and starting after `start_after`,
+    // nullopt if there's no such directory. Only the returned entries are copied.
+    [[ nodiscard ]] std::optional< std::vector< CatalogEntry > > page( std::string_view directory, std::string_view start_after, std::size_t count, CatalogFilter const & filter ) const;
+
+    // The entry of the file relative to the root, nullopt if it isn't a .wav file
+    [[ nodiscard ]] std::optional< CatalogEntry > stat( std::string_view path );
+
+    // Number of files in the whole catalog
+    [[ nodiscard ]] std::size_t size() const;
+
+private:
+    // transparent, so pages can start at a string_view
+    using Directory = std::map< std::string, CatalogEntry, std::less<> >;
+
+    // re-reads a single file, dropping it if it's gone
+    void refresh( std::filesystem::path const & relative_path );
+
+    // (re)scans a directory and all the directories below it
+    void scan( std::filesystem::path const & relative_path );
+
+    // forgets a directory and all the directories below it
+    void forget( std::string const & key );
+
+    // turns a path relative to the root into the key of its directory
+    [[ nodiscard ]] static std::string key( std::filesystem::path const & relative_path );
+
+    std::filesystem::path const root_;
+
+    mutable std::shared_mutex                      mutex_;
+    std::unordered_map< std::string, Directory >   directories_;
+
+#ifdef __linux__
+    void watch( std::stop_token const & stop );
+
+    int                                            inotify_fd_{ -1 };
+    int                                            wakeup_fd_ { -1 };
+    std::unordered_map< int, std::string >         watches_; // only touched by the constructor and the watcher
+    std::jthread                                   watcher_;
+#endif
+};
+
+} // namespace Teleaudio
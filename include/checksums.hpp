@@ -0,0 +1,95 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace WAV { struct FileReader; }
+
+namespace Teleaudio
+{
+
+// CRC-32C (Castagnoli) of `data`, continuing the CRC of whatever came before it.
+// Uses the crc32 instruction of SSE4.2 where the CPU has it, three streams at a time
+[[ nodiscard ]] std::uint32_t crc32c( std::span< std::byte const > data, std::uint32_t crc = 0 );
+
+// The operator appending `length` bytes to a CRC, for `crc32cCombine`
+[[ nodiscard ]] std::uint32_t crc32cShift( std::uint64_t length );
+
+// The CRC of two pieces one after the other, from the CRCs of each and the `crc32cShift` of the length of the second
+[[ nodiscard ]] std::uint32_t crc32cCombine( std::uint32_t first, std::uint32_t second, std::uint32_t shift );
+
+// About how many bytes of samples a single checksum covers
+inline constexpr std::uint32_t checksum_block_size{ 64 * 1024 };
+
+// CRCs of the samples of a file, as a whole and in blocks
+struct SampleChecksums
+{
+    std::uint64_t                size      {}; // bytes of samples
+    std::uint32_t                block_size{}; // whole sample frames, the last block may be shorter
+    std::uint32_t                crc       {}; // of all the samples
+    std::vector< std::uint32_t > blocks;
+
+    // Bytes of samples in the block `index`
+    [[ nodiscard ]] std::uint32_t blockLength( std::size_t index ) const;
+};
+
+// Whole sample frames of `block_align` bytes, as close to `checksum_block_size` as they get
+[[ nodiscard ]] std::uint32_t checksumBlockSize( std::uint16_t block_align );
+
+// Checksums the next `length` bytes of samples of `reader`, nullopt if it can't read that many
+[[ nodiscard ]] std::optional< SampleChecksums > checksumSamples( WAV::FileReader & reader, std::uint64_t length, std::uint32_t block_size );
+
+// Checksums of the files of the storage, computed by a pool of background threads
+// and kept for as long as the file keeps its size and modification time
+class ChecksumCache
+{
+public:
+    using ChecksumsPtr = std::shared_ptr< SampleChecksums const >;
+
+    explicit ChecksumCache( std::size_t threads );
+    ~ChecksumCache();
+
+    ChecksumCache( ChecksumCache const & )             = delete;
+    ChecksumCache & operator=( ChecksumCache const & ) = delete;
+
+    // The checksums of the file as it is now, waiting for them unless they're already known.
+    // Concurrent calls for the same file wait for the same computation, nullptr if it can't be read
+    [[ nodiscard ]] ChecksumsPtr get( std::filesystem::path const & file );
+
+private:
+    struct Entry
+    {
+        std::int64_t                       mtime;
+        std::uint64_t                      size;
+        std::shared_future< ChecksumsPtr > checksums;
+    };
+
+    struct Job
+    {
+        std::filesystem::path        file;
+        std::promise< ChecksumsPtr > checksums;
+    };
+
+    void work( std::stop_token const & stop );
+
+    std::mutex                                  mutex_;
+    std::unordered_map< std::string, Entry >    entries_; // by path
+
+    std::deque< Job >                           queue_;
+    std::condition_variable_any                 queue_changed_;
+    std::vector< std::jthread >                 workers_;
+};
+
+} // namespace Teleaudio
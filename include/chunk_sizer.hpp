@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace Teleaudio
+{
+
+// Picks the payload size of the `Download` messages.
+// In adaptive mode the chunk keeps doubling, up to `maximum`, for as long as
+// bigger chunks don't lower the throughput observed over the last few writes.
+class ChunkSizer
+{
+public:
+    ChunkSizer( std::uint32_t initial, std::uint32_t maximum, bool adaptive );
+
+    [[ nodiscard ]] std::uint32_t current() const { return chunk_size_; }
+
+    // Records that writing a chunk of `bytes` took `duration`
+    void record( std::size_t bytes, std::chrono::nanoseconds duration );
+
+private:
+    // writes measured before deciding on the next chunk size
+    static constexpr std::uint32_t writes_per_step{ 16 };
+
+    std::uint32_t chunk_size_;
+    std::uint32_t maximum_;
+    bool          adapting_;
+
+    std::size_t              step_bytes_ {};
+    std::chrono::nanoseconds step_time_  {};
+    std::uint32_t            step_writes_{};
+
+    // bytes per second measured with half of the current chunk size
+    double previous_throughput_{};
+};
+
+} // namespace Teleaudio
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// Lossless codec for the samples of the `Download` chunks.
+// Every sample is replaced by its difference to the previous sample of the same channel,
+// and the differences are Rice coded with a parameter picked per channel for every few hundred frames.
+// A chunk is encoded on its own, so ranges and parallel streams can be decoded independently.
+//
+// An encoded chunk is the size of the decoded samples (4 bytes, little endian), the Rice coded
+// whole frames padded to a byte and whatever is left of the last, partial frame as is.
+class DeltaRiceCodec
+{
+public:
+    explicit DeltaRiceCodec( WAV::FmtSubChunk const & format );
+
+    // Integer PCM of 8 to 32 bits, with the samples filling up the frames
+    [[ nodiscard ]] static bool supports( WAV::FmtSubChunk const & format );
+
+    // Encodes a chunk of samples, it doesn't have to end on a whole frame
+    [[ nodiscard ]] std::vector< std::byte > encode( std::span< std::byte const > samples ) const;
+
+    // Decodes a chunk made by `encode` into `samples`, false if it's malformed
+    [[ nodiscard ]] bool decode( std::span< std::byte const > encoded, std::vector< std::byte > & samples ) const;
+
+private:
+    // frames sharing a Rice parameter
+    static constexpr std::size_t frames_per_partition{ 256 };
+
+    std::uint16_t channels_;
+    std::uint16_t bytes_per_sample_;
+};
+
+} // namespace Teleaudio
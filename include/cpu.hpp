@@ -0,0 +1,32 @@
+#pragma once
+
+// The vector instructions the kernels can be built for. SSE2 is part of every x86-64 CPU, the AVX2 and SSE4.2
+// kernels are built for those alone and only called when the CPU has them, the rest of the binary keeps running on any x86-64 CPU
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#include <immintrin.h>
+#define TELEAUDIO_SSE2
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define TELEAUDIO_AVX2  __attribute__(( target( "avx2,fma" ) ))
+#define TELEAUDIO_SSE42 __attribute__(( target( "sse4.2" ) ))
+#endif
+#endif
+
+namespace Teleaudio::Cpu
+{
+#ifdef TELEAUDIO_AVX2
+    // AVX2 together with FMA, the AVX2 kernels use both
+    [[ nodiscard ]] inline bool hasAvx2()
+    {
+        static bool const avx2{ __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) };
+        return avx2;
+    }
+#endif
+
+#ifdef TELEAUDIO_SSE42
+    [[ nodiscard ]] inline bool hasSse42()
+    {
+        static bool const sse42{ __builtin_cpu_supports( "sse4.2" ) != 0 };
+        return sse42;
+    }
+#endif
+} // namespace Teleaudio::Cpu
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// fwd
+namespace WAV { struct MappedFile; };
+
+namespace Teleaudio
+{
+
+// Keeps mapped .wav files around so concurrent and repeated downloads share them,
+// least recently used files are dropped once the byte budget is exceeded
+class FileCache
+{
+public:
+    struct Statistics
+    {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+        std::size_t   bytes_used;
+    };
+
+    using FilePtr = std::shared_ptr< WAV::MappedFile const >;
+
+    explicit FileCache( std::size_t byte_budget )
+        : byte_budget_{ byte_budget }
+    {}
+
+    // Returns the mapped file, mapping it on a miss, nullptr if it cannot be mapped.
+    // Concurrent callers asking for the same file wait for a single load.
+    [[ nodiscard ]] FilePtr get( std::filesystem::path const & path );
+
+    [[ nodiscard ]] Statistics statistics() const;
+
+private:
+    // a modified file gets a different key, the stale entry ages out of the cache
+    struct Key
+    {
+        std::string                     path;
+        std::filesystem::file_time_type mtime;
+        std::uintmax_t                  size;
+
+        bool operator==( Key const & ) const = default;
+    };
+
+    struct KeyHash
+    {
+        [[ nodiscard ]] std::size_t operator()( Key const & key ) const;
+    };
+
+    struct Entry
+    {
+        std::shared_future< FilePtr > file;
+
+        // only loaded files are in the LRU list
+        std::list< Key >::iterator    lru_position;
+        bool                          loaded{ false };
+    };
+
+    // expects `mutex_` to be held
+    void evict();
+
+    std::size_t const byte_budget_;
+
+    mutable std::mutex                         mutex_;
+    std::list< Key >                           lru_; // most recently used in front
+    std::unordered_map< Key, Entry, KeyHash >  entries_;
+    Statistics                                 statistics_{};
+};
+
+} // namespace Teleaudio
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+#include "communication.pb.h"
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// The metadata message in front of the samples of a `Download` stream,
+// the `length` bytes of samples from `offset` on out of `raw_data_size`
+[[ nodiscard ]] AudioMetadata makeMetadata( WAV::FmtSubChunk const & format, std::uint64_t raw_data_size, std::uint64_t offset, std::uint64_t length, PayloadCodec codec );
+
+} // namespace Teleaudio
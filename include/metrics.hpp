@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Teleaudio::Metrics
+{
+
+enum class Counter : std::uint8_t
+{
+    ListCalls,
+    DownloadCalls,
+    StreamCalls,
+    BytesSent,       // samples, before they're encoded
+    MessagesSent,
+    ActiveStreams,   // a gauge, the calls add and take away one
+    PackedDownloads, // served from a pack instead of the .wav file
+    FileCacheHits,
+    FileCacheMisses,
+    FileCacheEvictions,
+    Count
+};
+
+enum class Histogram : std::uint8_t
+{
+    ListLatency,
+    FirstByte,        // from accepting the call to the metadata being written
+    DownloadDuration, // from accepting the call to the last chunk being written
+    WriteStall,       // how long writing a single chunk took
+    FileLoad,         // opening, parsing and mapping the file, or subscribing to its broadcast
+    Count
+};
+
+inline constexpr std::size_t counter_count  { static_cast< std::size_t >( Counter::Count   ) };
+inline constexpr std::size_t histogram_count{ static_cast< std::size_t >( Histogram::Count ) };
+
+// Nanoseconds in log-linear buckets like HDR histograms: 16 linear sub-buckets in every power of two,
+// so a value is off by less than 1/16 of it, from 1 ns up to about 4.9 hours
+inline constexpr unsigned    sub_bucket_bits{ 4 };
+inline constexpr std::size_t sub_buckets    { std::size_t{ 1 } << sub_bucket_bits };
+inline constexpr unsigned    max_value_bits { 44 };
+inline constexpr std::size_t bucket_count   { ( max_value_bits - sub_bucket_bits + 1 ) * sub_buckets };
+
+[[ nodiscard ]] constexpr std::size_t bucketOf( std::uint64_t value )
+{
+    value = std::min( value, ( std::uint64_t{ 1 } << max_value_bits ) - 1 );
+    if ( value < sub_buckets )
+    {
+        return static_cast< std::size_t >( value );
+    }
+    auto const exponent{ static_cast< unsigned >( std::bit_width( value ) ) - 1 };
+    auto const shift   { exponent - sub_bucket_bits };
+    return ( shift + 1 ) * sub_buckets + static_cast< std::size_t >( ( value >> shift ) & ( sub_buckets - 1 ) );
+}
+
+// The first value past the bucket
+[[ nodiscard ]] constexpr std::uint64_t bucketEnd( std::size_t const bucket )
+{
+    if ( bucket < sub_buckets )
+    {
+        return bucket + 1;
+    }
+    auto const shift{ static_cast< unsigned >( bucket / sub_buckets - 1 ) };
+    return ( sub_buckets + bucket % sub_buckets + 1 ) << shift;
+}
+
+// What every thread has recorded, summed up
+struct HistogramSnapshot
+{
+    std::array< std::uint64_t, bucket_count > buckets{};
+    std::uint64_t                             count{};
+    std::uint64_t                             sum{}; // nanoseconds
+    std::uint64_t                             max{};
+
+    // The end of the bucket holding the `quantile` of the values, 0 when there are none
+    [[ nodiscard ]] std::chrono::nanoseconds percentile( double quantile ) const;
+};
+
+struct Snapshot
+{
+    std::array< std::int64_t, counter_count >        counters{};
+    std::array< HistogramSnapshot, histogram_count > histograms{};
+
+    [[ nodiscard ]] std::int64_t              counter  ( Counter   const which ) const { return counters  [ static_cast< std::size_t >( which ) ]; }
+    [[ nodiscard ]] HistogramSnapshot const & histogram( Histogram const which ) const { return histograms[ static_cast< std::size_t >( which ) ]; }
+};
+
+// The values of a single thread, only that thread ever writes them, so an update
+// is a plain load and store without a locked instruction, and readers never block it
+struct Shard
+{
+    std::array< std::atomic< std::int64_t >, counter_count > counters{};
+
+    struct Histogram
+    {
+        std::array< std::atomic< std::uint64_t >, bucket_count > buckets{};
+        std::atomic< std::uint64_t >                             count{};
+        std::atomic< std::uint64_t >                             sum{};
+        std::atomic< std::uint64_t >                             max{};
+    };
+    std::array< Histogram, histogram_count > histograms{};
+};
+
+// The shard of the calling thread, registered on first use and folded into the totals when the thread exits
+[[ nodiscard ]] Shard & localShard();
+
+inline void add( Counter const which, std::int64_t const value = 1 )
+{
+    auto & counter{ localShard().counters[ static_cast< std::size_t >( which ) ] };
+    counter.store( counter.load( std::memory_order_relaxed ) + value, std::memory_order_relaxed );
+}
+
+inline void record( Histogram const which, std::chrono::nanoseconds const duration )
+{
+    auto & histogram{ localShard().histograms[ static_cast< std::size_t >( which ) ] };
+    auto const value{ static_cast< std::uint64_t >( std::max( duration.count(), std::int64_t{ 0 } ) ) };
+
+    auto & bucket{ histogram.buckets[ bucketOf( value ) ] };
+    bucket         .store( bucket         .load( std::memory_order_relaxed ) + 1,     std::memory_order_relaxed );
+    histogram.count.store( histogram.count.load( std::memory_order_relaxed ) + 1,     std::memory_order_relaxed );
+    histogram.sum  .store( histogram.sum  .load( std::memory_order_relaxed ) + value, std::memory_order_relaxed );
+    if ( value > histogram.max.load( std::memory_order_relaxed ) )
+    {
+        histogram.max.store( value, std::memory_order_relaxed );
+    }
+}
+
+// Sums up the shards of all the threads there ever were
+[[ nodiscard ]] Snapshot collect();
+
+[[ nodiscard ]] std::string_view name( Counter   which );
+[[ nodiscard ]] std::string_view name( Histogram which );
+
+// The snapshot in the Prometheus text exposition format, the histograms in seconds with a bucket per power of two
+[[ nodiscard ]] std::string prometheus( Snapshot const & snapshot );
+
+// Serves `prometheus( collect() )` over plain HTTP on a local port, to any request
+class Exporter
+{
+public:
+    // Port 0 picks a free port
+    explicit Exporter( std::uint16_t port );
+    ~Exporter();
+
+    Exporter( Exporter const & )             = delete;
+    Exporter & operator=( Exporter const & ) = delete;
+
+    // 0 if it couldn't listen
+    [[ nodiscard ]] std::uint16_t port() const { return port_; }
+
+private:
+    void serve( std::stop_token const & stop );
+
+    int           listener_{ -1 };
+    int           wakeup_[ 2 ]{ -1, -1 };
+    std::uint16_t port_{};
+    std::jthread  worker_;
+};
+
+} // namespace Teleaudio::Metrics
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utils.hpp"
+
+namespace Teleaudio
+{
+
+// Keeps the `Download` streams of the storage already serialized, in one sidecar file per .wav file:
+// an index of where every message starts, followed by the metadata message and the chunk messages of the
+// whole file framed exactly as they go on the wire. A packed file is served straight from its mapped sidecar,
+// without opening the .wav file, parsing its headers or framing a single message.
+// Sidecars are written to a temporary file that's renamed into place, so a partial one is never seen,
+// and are only used while the .wav file has the size and modification time they were packed from.
+// A sidecar is mapped and checked once, then kept mapped for the following downloads until it's out of date.
+// Once the sidecars take up more than the byte budget, the least recently used ones are removed.
+class PackStore
+{
+public:
+    // A mapped sidecar
+    class Pack
+    {
+    public:
+        Pack( FileUtils::MappedRegion region, std::uint32_t chunk_size, std::uint32_t messages, std::uint32_t raw_data_size );
+
+        // The metadata message comes first, the chunks of samples after it
+        [[ nodiscard ]] std::size_t                  messages()                   const { return messages_; }
+        [[ nodiscard ]] std::span< std::byte const > message( std::size_t index ) const;
+
+        // Bytes of samples in the message `index`, 0 for the metadata
+        [[ nodiscard ]] std::uint32_t                samples( std::size_t index ) const;
+
+        [[ nodiscard ]] std::uint32_t                raw_data_size()              const { return raw_data_size_; }
+
+    private:
+        FileUtils::MappedRegion region_;
+        std::uint32_t           chunk_size_;
+        std::uint32_t           messages_;
+        std::uint32_t           raw_data_size_;
+    };
+
+    using PackPtr = std::shared_ptr< Pack const >;
+
+    // Sidecars of the files under `storage` go to `directory`, with the samples in chunks of `chunk_size`
+    PackStore( std::filesystem::path storage, std::filesystem::path directory, std::uint32_t chunk_size, std::uint64_t byte_budget );
+    ~PackStore();
+
+    PackStore( PackStore const & )             = delete;
+    PackStore & operator=( PackStore const & ) = delete;
+
+    // The up to date pack of a file relative to the storage. Without one it returns nullptr
+    // and the file is packed in the background, so the next download can use it
+    [[ nodiscard ]] PackPtr get( std::string_view relative_path );
+
+    // Packs a file relative to the storage unless its pack is up to date, false if it can't be packed
+    [[ nodiscard ]] bool pack( std::string_view relative_path );
+
+    // Packs every .wav file under the storage, returns how many are packed afterwards
+    std::size_t packAll();
+
+    [[ nodiscard ]] std::uint32_t chunk_size() const { return chunk_size_; }
+
+    // Size of all the sidecars
+    [[ nodiscard ]] std::uint64_t bytes_used() const;
+
+private:
+    struct Usage
+    {
+        std::uint64_t size;
+        std::uint64_t last_used; // a tick of `clock_`, higher is more recent
+    };
+
+    struct Loaded
+    {
+        std::int64_t  source_mtime;
+        std::uint64_t source_size;
+        PackPtr       pack;
+    };
+
+    // the sidecar of a relative path, nullopt if the path leaves the storage
+    [[ nodiscard ]] std::optional< std::filesystem::path > sidecar( std::string_view relative_path ) const;
+
+    // maps the sidecar if it was packed from the file as it is now
+    [[ nodiscard ]] PackPtr load( std::filesystem::path const & source, std::filesystem::path const & sidecar ) const;
+
+    // the pack mapped already while the file hasn't changed since, otherwise it's loaded
+    [[ nodiscard ]] PackPtr cached( std::string const & key, std::filesystem::path const & source, std::filesystem::path const & sidecar );
+
+    // removes the least recently used sidecars until they fit into the budget, never `keep`
+    void evict( std::string const & keep );
+
+    void work( std::stop_token const & stop );
+
+    std::filesystem::path const storage_;
+    std::filesystem::path const directory_;
+    std::uint32_t         const chunk_size_;
+    std::uint64_t         const byte_budget_;
+
+    mutable std::mutex                          mutex_;
+    std::unordered_map< std::string, Usage >    usage_;  // by relative path
+    std::unordered_map< std::string, Loaded >   loaded_; // by relative path
+    std::uint64_t                               bytes_used_{};
+    std::uint64_t                               clock_{};
+
+    // files waiting to be packed in the background
+    std::deque< std::string >                   queue_;
+    std::unordered_set< std::string >           queued_;
+    std::condition_variable_any                 queue_changed_;
+    std::jthread                                worker_;
+};
+
+} // namespace Teleaudio
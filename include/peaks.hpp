@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// The lowest and highest sample of a channel over a run of frames and the mean of their squares, samples between -1 and 1
+struct Peak
+{
+    float min;
+    float max;
+    float mean_square;
+};
+
+// A waveform overview: `frames` frames from `start_frame` on spread over `buckets` buckets,
+// bucket `i` starting at frame `start_frame + i * frames / buckets`
+struct PeakOverview
+{
+    WAV::FmtSubChunk    format{};
+    std::uint64_t       start_frame{};
+    std::uint64_t       frames{};
+    std::size_t         buckets{};
+    std::vector< Peak > peaks; // bucket after bucket, channel after channel
+};
+
+// Keeps waveform summaries of the files of the storage at several resolutions, one sidecar per .wav file:
+// a peak per channel for every `base_frames` frames, and for `level_factor` times as many frames on every
+// level above that, up to the top level of at most `top_buckets` peaks.
+// An overview is merged from the coarsest level that still has `level_factor` peaks per bucket, so zooming in
+// and out never reads the samples again, only buckets finer than the first level are computed from the samples.
+// The summaries are computed by the first request for a file and only used while the file keeps its size and
+// modification time. A summary written to its sidecar is used mapped from there, without a directory the summaries
+// are only kept in memory, and the least recently used ones are dropped once they take up more than the byte budget.
+class PeakStore
+{
+public:
+    static constexpr std::uint32_t base_frames { 512 };
+    static constexpr std::uint32_t level_factor{ 4 };
+    static constexpr std::uint64_t top_buckets { 256 };
+
+    // Summaries of the files under `storage` go to `directory`, if there is one
+    PeakStore( std::filesystem::path storage, std::filesystem::path directory, std::uint64_t byte_budget );
+    ~PeakStore();
+
+    PeakStore( PeakStore const & )             = delete;
+    PeakStore & operator=( PeakStore const & ) = delete;
+
+    // The overview of `frames` frames from `start_frame` on of a file relative to the storage in `resolution` buckets,
+    // 0 frames going up to the end. Fewer frames than buckets get a bucket each.
+    // nullopt if the file can't be read or its samples can't be converted
+    [[ nodiscard ]] std::optional< PeakOverview > overview( std::string_view relative_path, std::uint64_t start_frame, std::uint64_t frames, std::size_t resolution );
+
+    // Size of the summaries only kept in memory
+    [[ nodiscard ]] std::uint64_t bytes_used() const;
+
+private:
+    class Summary;
+    using SummaryPtr = std::shared_ptr< Summary const >;
+
+    struct Entry
+    {
+        std::int64_t                     mtime;
+        std::uint64_t                    size;
+        std::shared_future< SummaryPtr > summary;
+
+        // only built summaries are in the LRU list
+        std::list< std::string >::iterator lru_position;
+        std::uint64_t                      bytes{}; // held in memory rather than mapped
+        bool                               loaded{ false };
+    };
+
+    // the summary of the file as it is now, loaded from its sidecar or computed
+    [[ nodiscard ]] SummaryPtr summary( std::filesystem::path const & relative );
+
+    [[ nodiscard ]] SummaryPtr build( std::filesystem::path const & relative, std::int64_t mtime, std::uint64_t size ) const;
+
+    // expects `mutex_` to be held
+    void evict();
+
+    std::filesystem::path const storage_;
+    std::filesystem::path const directory_;
+    std::uint64_t         const byte_budget_;
+
+    mutable std::mutex                          mutex_;
+    std::list< std::string >                    lru_;     // most recently used in front
+    std::unordered_map< std::string, Entry >    entries_; // by relative path
+    std::uint64_t                               bytes_used_{};
+};
+
+} // namespace Teleaudio
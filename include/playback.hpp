@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.hpp"
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// Where the played samples end up
+class AudioSink
+{
+public:
+    virtual ~AudioSink() = default;
+
+    // Gets ready for `bytes` bytes of samples in `format`, false if it can't play them
+    [[ nodiscard ]] virtual bool open( WAV::FmtSubChunk const & format, std::uint64_t bytes ) = 0;
+
+    // Plays whole frames, blocking for as long as the device has no room for them
+    [[ nodiscard ]] virtual bool write( std::span< std::byte const > samples ) = 0;
+
+    // Waits until everything written has been played
+    virtual void drain() {}
+
+    // Underruns the device reported on its own, on top of the ones of the ring
+    [[ nodiscard ]] virtual std::uint64_t underruns() const { return 0; }
+};
+
+// Plays into nothing. With `realtime` it takes as long as playing the samples would, like a device does,
+// and samples written after the device would have run dry are played from then on
+class NullSink final : public AudioSink
+{
+public:
+    explicit NullSink( bool realtime = true ) : realtime_{ realtime } {}
+
+    [[ nodiscard ]] bool open( WAV::FmtSubChunk const & format, std::uint64_t bytes ) override;
+    [[ nodiscard ]] bool write( std::span< std::byte const > samples ) override;
+
+    [[ nodiscard ]] std::uint64_t bytes_played() const { return bytes_played_; }
+
+private:
+    bool                                  realtime_;
+    std::uint32_t                         byte_rate_{};
+    std::uint64_t                         bytes_played_{};
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Plays into a .wav file, silence included, and just as slowly as `NullSink` unless `realtime` is off.
+// The header is written once the playback is drained, only then is the size of the samples known
+class FileSink final : public AudioSink
+{
+public:
+    explicit FileSink( std::string path, bool realtime = true ) : path_{ std::move( path ) }, realtime_{ realtime } {}
+
+    [[ nodiscard ]] bool open( WAV::FmtSubChunk const & format, std::uint64_t bytes ) override;
+    [[ nodiscard ]] bool write( std::span< std::byte const > samples ) override;
+    void drain() override;
+
+private:
+    std::string                           path_;
+    bool                                  realtime_;
+    FileUtils::FilePtr                    file_{ nullptr, &std::fclose };
+    WAV::FmtSubChunk                      format_{};
+    std::uint64_t                         bytes_played_{};
+    std::chrono::steady_clock::time_point start_;
+};
+
+// The default sound card through ALSA, nullptr where teleaudio was built without it
+[[ nodiscard ]] std::unique_ptr< AudioSink > makeDeviceSink();
+
+struct PlaybackOptions
+{
+    // played samples buffered before the playback starts, and again after an underrun
+    std::chrono::milliseconds jitter_buffer{ 200 };
+
+    // samples the ring between the network and the sink holds at most
+    std::chrono::milliseconds ring{ 2000 };
+
+    // how much is handed to the sink at a time
+    std::chrono::milliseconds period{ 10 };
+};
+
+struct PlaybackStatistics
+{
+    std::uint64_t            bytes_played  {};
+    std::uint64_t            silence_played{}; // bytes of silence filling in for samples that didn't arrive in time
+    std::uint64_t            underruns     {}; // the ring ran dry, or the device did
+    std::chrono::nanoseconds startup       {}; // from the first samples to the start of the playback
+    bool                     ok            { false };
+};
+
+// Plays a stream of samples while it's still arriving. The thread receiving the samples pushes them into
+// a lock-free ring, a playback thread of its own takes them out a period at a time and writes them to the sink.
+// The playback starts once the jitter buffer is full. When the ring runs dry the missing samples are played
+// as silence, counted as an underrun, and the sink keeps getting a period of silence for every period
+// that passes until the jitter buffer is full again.
+class Player
+{
+public:
+    Player( AudioSink & sink, WAV::FmtSubChunk const & format, PlaybackOptions const & options = {} );
+
+    // Stops the playback without waiting for the rest
+    ~Player();
+
+    Player( Player const & )             = delete;
+    Player & operator=( Player const & ) = delete;
+
+    // Opens the sink and starts the playback thread, `bytes` is the size of the whole stream
+    [[ nodiscard ]] bool start( std::uint64_t bytes );
+
+    // Queues samples, waiting while the ring is full. False once the playback failed
+    [[ nodiscard ]] bool push( std::span< std::byte const > samples );
+
+    // There are no more samples, waits until the queued ones have been played
+    PlaybackStatistics finish();
+
+private:
+    void play();
+
+    // wakes up the other side after the ring or the state changed
+    void notify();
+
+    AudioSink &               sink_;
+    WAV::FmtSubChunk          format_;
+    std::size_t               jitter_bytes_;
+    std::size_t               period_bytes_;
+    std::chrono::milliseconds period_;
+
+    RingBuffer       ring_;
+
+    std::atomic< bool > finished_{ false }; // no more samples are coming
+    std::atomic< bool > stopped_ { false }; // the playback is to end right away
+    std::atomic< bool > failed_  { false }; // the sink gave up
+
+    // only for waiting, the ring is never locked
+    std::mutex              mutex_;
+    std::condition_variable changed_;
+
+    std::chrono::steady_clock::time_point started_;
+    PlaybackStatistics                    statistics_; // written by the playback thread until it's joined
+
+    std::jthread     thread_;
+};
+
+} // namespace Teleaudio
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace FileUtils
+{
+    // How the samples of files that aren't mapped are read
+    enum class IoBackend : std::uint8_t
+    {
+        // a blocking `fread` of every chunk, on the thread that sends it
+        Stdio,
+        // `pread` of whole blocks, asking the kernel to read the next ones in the meantime
+        Pread,
+        // io_uring keeping the next blocks in flight while the current one is sent, Linux only
+        Uring
+    };
+
+    // Alignment of the offsets, lengths and buffers of the reads, enough for `O_DIRECT` on the common file systems
+    inline constexpr std::size_t io_alignment{ 4096 };
+
+    // Block-aligned read buffers, on Linux together with an io_uring they're registered with,
+    // kept for the next file once a read is done, so a download doesn't set up either of them.
+    // Falls back to `Pread` where the kernel has no io_uring
+    class ReadPool
+    {
+    public:
+        // Every read keeps `depth` blocks of `block_size` bytes, rounded up to the alignment
+        ReadPool( IoBackend backend, std::size_t block_size, std::size_t depth );
+        ~ReadPool();
+
+        ReadPool( ReadPool const & )             = delete;
+        ReadPool & operator=( ReadPool const & ) = delete;
+
+        [[ nodiscard ]] IoBackend   backend()    const { return backend_;    }
+        [[ nodiscard ]] std::size_t block_size() const { return block_size_; }
+        [[ nodiscard ]] std::size_t depth()      const { return depth_;      }
+
+    private:
+        friend class ReadAhead;
+
+        struct Context;
+        using ContextPtr = std::unique_ptr< Context >;
+
+        [[ nodiscard ]] ContextPtr acquire();
+        void release( ContextPtr context );
+
+        IoBackend                 backend_;
+        std::size_t const         block_size_;
+        std::size_t const         depth_;
+
+        std::mutex                mutex_;
+        std::vector< ContextPtr > idle_;
+    };
+
+    // Reads a range of a file block by block, with the blocks after the one being read already on their way
+    class ReadAhead
+    {
+    public:
+        // Starts reading `length` bytes from `offset` on, `direct` bypasses the page cache where the file system allows it
+        ReadAhead( ReadPool & pool, std::string_view path, std::uint64_t offset, std::uint64_t length, bool direct );
+        ~ReadAhead();
+
+        ReadAhead( ReadAhead const & )             = delete;
+        ReadAhead & operator=( ReadAhead const & ) = delete;
+
+        [[ nodiscard ]] bool valid() const { return fd_ >= 0; }
+
+        // Copies the next bytes of the range into `buffer`, returns how many,
+        // zero once the whole range has been read or a read failed
+        [[ nodiscard ]] std::size_t read( std::span< std::byte > buffer );
+
+        [[ nodiscard ]] std::uint64_t bytes_remaining() const { return remaining_; }
+
+    private:
+        struct Block
+        {
+            std::uint64_t offset   {}; // in the file
+            std::size_t   length   {}; // asked for
+            std::size_t   filled   {}; // read so far
+            std::size_t   consumed {}; // handed out
+            bool          in_flight{ false };
+            bool          failed   { false };
+        };
+
+        // Starts reading the next block of the file into the block `index`
+        void submit( std::size_t index );
+
+        // Waits until the block `index` is read, false if that failed
+        [[ nodiscard ]] bool wait( std::size_t index );
+
+        // Asks for the rest of a block that was read short
+        void resume( std::size_t index );
+
+        ReadPool &           pool_;
+        ReadPool::ContextPtr context_;
+        int                  fd_{ -1 };
+        bool                 direct_{ false };
+
+        std::vector< Block > blocks_;
+        std::size_t          head_{};        // the block being read from
+        std::uint64_t        next_offset_{}; // of the next block to submit
+        std::uint64_t        end_{};         // of the range in the file
+        std::uint64_t        remaining_{};
+    };
+} // namespace FileUtils
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+
+namespace Teleaudio
+{
+
+// Bytes handed from one producer thread to one consumer thread without locks.
+// Both sides only ever move their own position forward and read the other one's,
+// so neither can be blocked by the other, which makes it safe to read from a real-time audio thread.
+class RingBuffer
+{
+public:
+    // Rounded up to a power of two
+    explicit RingBuffer( std::size_t capacity );
+
+    RingBuffer( RingBuffer const & )             = delete;
+    RingBuffer & operator=( RingBuffer const & ) = delete;
+
+    // Producer: copies in as much of `data` as there's room for, returns how much that was
+    [[ nodiscard ]] std::size_t write( std::span< std::byte const > data );
+
+    // Consumer: copies out up to `data.size()` bytes, returns how many
+    [[ nodiscard ]] std::size_t read( std::span< std::byte > data );
+
+    // Bytes the consumer can read, at least this many as seen from the consumer
+    [[ nodiscard ]] std::size_t readable() const;
+
+    // Bytes the producer can write, at least this many as seen from the producer
+    [[ nodiscard ]] std::size_t writable() const { return capacity_ - readable(); }
+
+    [[ nodiscard ]] std::size_t capacity() const { return capacity_; }
+
+private:
+    // the positions on their own cache lines, so the two threads don't keep taking the line from each other
+    static constexpr std::size_t cache_line{ 64 };
+
+    std::size_t const              capacity_;
+    std::unique_ptr< std::byte[] > data_;
+
+    // only ever growing, the index into `data_` is the position modulo the capacity
+    alignas( cache_line ) std::atomic< std::size_t > write_position_{};
+    alignas( cache_line ) std::atomic< std::size_t > read_position_ {};
+};
+
+} // namespace Teleaudio
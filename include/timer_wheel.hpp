@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Teleaudio
+{
+
+// Runs tasks at given times on a single thread, however many of them are pending.
+// The time is cut into ticks of `resolution` spread over a ring of slots, a task goes into the slot of its tick
+// and every tick only the tasks of one slot are looked at, so scheduling and expiring a task is O(1).
+// Tasks run at most one tick late, on the thread of the wheel, and should hand any real work off to another thread.
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Task  = std::function< void () >;
+
+    explicit TimerWheel( std::chrono::milliseconds resolution = std::chrono::milliseconds{ 5 }, std::size_t slots = 512 );
+
+    // Runs whatever is still pending
+    ~TimerWheel();
+
+    TimerWheel( TimerWheel const & )             = delete;
+    TimerWheel & operator=( TimerWheel const & ) = delete;
+
+    // Runs `task` once `when` has passed, a time in the past runs it on the next tick.
+    // False after `stop`, the task is dropped then
+    [[ nodiscard ]] bool schedule( Clock::time_point when, Task task );
+
+    // Stops the thread and runs the pending tasks without waiting for their time
+    void stop();
+
+    [[ nodiscard ]] std::size_t pending() const;
+
+private:
+    struct Timer
+    {
+        std::uint64_t tick;
+        Task          task;
+    };
+
+    [[ nodiscard ]] std::uint64_t tickOf( Clock::time_point when ) const;
+
+    void work( std::stop_token const & stop );
+
+    Clock::duration const resolution_;
+    Clock::time_point const start_{ Clock::now() };
+
+    mutable std::mutex                  mutex_;
+    std::condition_variable_any         scheduled_;
+    std::vector< std::vector< Timer > > slots_;
+    std::uint64_t                       next_tick_{}; // the tick the thread expires next
+    std::size_t                         pending_  {};
+    bool                                stopped_  { false };
+
+    std::jthread                        worker_;
+};
+
+} // namespace Teleaudio
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "wav.hpp"
+
+namespace Teleaudio
+{
+
+// Converts `count` samples of a format the `Transcoder` supports into floats between -1 and 1, with its kernels
+void samplesToFloat( WAV::FmtSubChunk const & format, std::byte const * in, float * out, std::size_t count );
+
+// Converts a stream of samples into another format chunk by chunk: the sample type (8 to 32 bit integers
+// and 32 bit floats), the number of channels and the sample rate. The sample types, 24 bit ones included, are
+// converted with SSE2 kernels, or AVX2 ones where the CPU has it, and the rate by a polyphase windowed-sinc resampler.
+// An output frame only depends on the input frames around it, so any range of the output can be transcoded
+// on its own and still match the same range of the whole stream bit for bit.
+class Transcoder
+{
+public:
+    // Integer PCM of 8 to 32 bits and 32 bit IEEE floats, up to 768 kHz
+    [[ nodiscard ]] static bool supports( WAV::FmtSubChunk const & format );
+
+    // `source` with its sample rate, bits per sample and channels replaced by the non-zero ones,
+    // nullopt if either format isn't supported
+    [[ nodiscard ]] static std::optional< WAV::FmtSubChunk > outputFormat( WAV::FmtSubChunk const & source, std::uint32_t sample_rate, std::uint16_t bits_per_sample, std::uint16_t channels, bool floating_point );
+
+    // Both formats have to be supported. The channels are mixed by their place in the frame, not by their speakers:
+    // input channel i goes into output channel i % outputs, the inputs of a last incomplete group of outputs
+    // go into all of them, so 3 channels mixed into 2 are (0 + 2) / 2 and (1 + 2) / 2.
+    // An upmix repeats the input channels, output channel i is input channel i % inputs
+    Transcoder( WAV::FmtSubChunk const & source, WAV::FmtSubChunk const & target );
+
+    // Number of output frames made out of `input_frames`
+    [[ nodiscard ]] std::uint64_t outputFrames( std::uint64_t input_frames ) const;
+
+    // Starts the output at `output_frame`, returns the input frame the samples have to be pushed from
+    std::uint64_t seek( std::uint64_t output_frame );
+
+    // Converts whole input frames, appending the output to `output`
+    void push( std::span< std::byte const > input, std::vector< std::byte > & output );
+
+    // Flushes what's left in the resampler once the last input frame was pushed
+    void finish( std::vector< std::byte > & output );
+
+private:
+    // resamples the mixed frames that have all their neighbours, converting them into `output`
+    void resample( std::vector< std::byte > & output );
+
+    WAV::FmtSubChunk source_;
+    WAV::FmtSubChunk target_;
+
+    // the input channels averaged into each output channel
+    std::vector< std::vector< std::size_t > > mix_sources_;
+
+    // the output rate is `up_ / down_` of the input rate
+    std::uint64_t up_  { 1 };
+    std::uint64_t down_{ 1 };
+
+    // `phases_` rows of `taps_` coefficients, the input frame of a tap is the nearest one
+    // before the output frame, minus `taps_ / 2 - 1`, plus the tap index
+    std::size_t          taps_  {};
+    std::size_t          phases_{};
+    std::vector< float > coefficients_;
+
+    // mixed input frames, one buffer per output channel, starting at input frame `history_start_`,
+    // which is negative at the start of a stream
+    std::vector< std::vector< float > > history_;
+    std::int64_t                        history_start_{};
+
+    // the next output frame, as the input frame before it and how far past it in 1/`up_` of a frame
+    std::uint64_t next_input_{};
+    std::uint64_t next_phase_{};
+
+    std::vector< float > input_scratch_;
+    std::vector< float > output_scratch_;
+};
+
+} // namespace Teleaudio
@@ -2,7 +2,11 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <filesystem>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
 
 namespace FileUtils
@@ -14,18 +18,20 @@ namespace FileUtils
         ReadText,
         ReadBinary,
         WriteText,
-        WriteBinary
+        WriteBinary,
+        UpdateBinary
     };
 
     [[ nodiscard ]] inline constexpr auto fileOpenModeToString( FileOpenMode const fom )
     {
         switch( fom )
         {
-            case FileOpenMode::ReadText:    return "r";
-            case FileOpenMode::ReadBinary:  return "rb";
-            case FileOpenMode::WriteText:   return "w";
-            case FileOpenMode::WriteBinary: return "wb";
-            default:                        return "r";
+            case FileOpenMode::ReadText:     return "r";
+            case FileOpenMode::ReadBinary:   return "rb";
+            case FileOpenMode::WriteText:    return "w";
+            case FileOpenMode::WriteBinary:  return "wb";
+            case FileOpenMode::UpdateBinary: return "r+b";
+            default:                         return "r";
         }
     }
 
@@ -37,6 +43,91 @@ namespace FileUtils
             &std::fclose
         };
     }
+
+    // Moves to `offset` bytes from the beginning of the file, past the 2 GiB a `long` can address
+    [[ nodiscard ]] inline bool seek( FILE * const file, std::uint64_t const offset )
+    {
+#ifdef _WIN32
+        return ::_fseeki64( file, static_cast< __int64 >( offset ), SEEK_SET ) == 0;
+#else
+        return ::fseeko( file, static_cast< off_t >( offset ), SEEK_SET ) == 0;
+#endif
+    }
+
+    // Writes all of `data` at the current position of `file`
+    [[ nodiscard ]] inline bool write( FILE * const file, std::span< std::byte const > const data )
+    {
+        return std::fwrite( data.data(), 1, data.size(), file ) == data.size();
+    }
+
+    // Writes `data` at `offset` without moving the position of `file`,
+    // safe to call from several threads at once for distinct ranges
+    [[ nodiscard ]] bool writeAt( FILE * file, std::uint64_t offset, std::span< std::byte const > data );
+
+    // Flushes `file` and has the kernel put it on the disk, so renaming it into place never exposes a partial file
+    [[ nodiscard ]] bool sync( FILE * file );
+
+    // A name next to `path` for writing a file that is renamed over `path` once complete,
+    // no other process or thread gets the same one
+    [[ nodiscard ]] std::string temporaryPath( std::string_view path );
+
+    // The size and modification time of a file, what a cached result derived from the file has to match to be used
+    struct Stamp
+    {
+        std::int64_t  mtime{};
+        std::uint64_t size {};
+
+        bool operator==( Stamp const & ) const = default;
+    };
+
+    // No value when the file is missing or can't be examined
+    [[ nodiscard ]] std::optional< Stamp > stamp( std::filesystem::path const & file );
+
+    enum class AccessHint : std::uint8_t
+    {
+        Normal,
+        Sequential,
+        Random,
+        WillNeed
+    };
+
+    // Read-only mapping of a whole file into memory
+    class MappedRegion
+    {
+    public:
+        MappedRegion() = default;
+
+        // Maps the file at `path`, check `valid()` afterwards
+        explicit MappedRegion( std::string_view path );
+
+        MappedRegion( MappedRegion const & )             = delete;
+        MappedRegion & operator=( MappedRegion const & ) = delete;
+
+        MappedRegion( MappedRegion && other ) noexcept;
+        MappedRegion & operator=( MappedRegion && other ) noexcept;
+
+        ~MappedRegion();
+
+        [[ nodiscard ]] bool valid() const { return address_ != nullptr; }
+
+        [[ nodiscard ]] std::span< std::byte const > bytes() const
+        {
+            return { static_cast< std::byte const * >( address_ ), size_ };
+        }
+
+        // Tells the kernel how the given range is going to be accessed,
+        // a no-op on platforms without `madvise`
+        void advise( std::size_t offset, std::size_t length, AccessHint hint ) const;
+
+    private:
+        void unmap();
+
+        void *      address_{ nullptr };
+        std::size_t size_   {};
+#ifdef _WIN32
+        void *      mapping_handle_{ nullptr };
+#endif
+    };
 } // namespace FileUtils
 
 namespace Utils
@@ -44,10 +135,13 @@ namespace Utils
     struct OwningBuffer
     {
         std::unique_ptr< std::byte[] > data;
-        std::size_t                    size;
+        std::size_t                    size{};
+
+        OwningBuffer() = default;
 
+        // The contents are left uninitialized, the caller is expected to fill them
         OwningBuffer( std::size_t const size )
-            : data{ std::make_unique< std::byte[] >( size ) }, size{ size }
+            : data{ std::make_unique_for_overwrite< std::byte[] >( size ) }, size{ size }
         {}
 
         std::byte       * get()       { return data.get(); }
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
 
 #include <spdlog/spdlog.h>
 
@@ -18,8 +22,13 @@ namespace MagicBytes
     inline constexpr std::array< std::byte, 4 > WAVE = { std::byte{ 0x57 }, std::byte{ 0x41 }, std::byte{ 0x56 }, std::byte{ 0x45 } };
     inline constexpr std::array< std::byte, 4 > fmt  = { std::byte{ 0x66 }, std::byte{ 0x6d }, std::byte{ 0x74 }, std::byte{ 0x20 } };
     inline constexpr std::array< std::byte, 4 > data = { std::byte{ 0x64 }, std::byte{ 0x61 }, std::byte{ 0x74 }, std::byte{ 0x61 } };
+    inline constexpr std::array< std::byte, 4 > RF64 = { std::byte{ 0x52 }, std::byte{ 0x46 }, std::byte{ 0x36 }, std::byte{ 0x34 } };
+    inline constexpr std::array< std::byte, 4 > ds64 = { std::byte{ 0x64 }, std::byte{ 0x73 }, std::byte{ 0x36 }, std::byte{ 0x34 } };
 };
 
+// `audio_format` of a fmt chunk holding the actual format in its extension
+inline constexpr std::uint16_t format_extensible{ 0xFFFE };
+
 struct RiffChunk
 {
     std::array< std::byte, 4 > id{ MagicBytes::RIFF };
@@ -29,7 +38,7 @@ struct RiffChunk
     RiffChunk() = default;
     RiffChunk( std::uint32_t const size ) : size{ size } {}
 
-    // Checks the magic bytes
+    // Checks the magic bytes, RF64 files are fine too
     [[ nodiscard ]] bool valid() const;
 };
 
@@ -51,54 +60,190 @@ struct FmtSubChunk
     [[ nodiscard ]] bool valid() const;
 };
 
-struct DataSubChunk
+// Non-owning view of the data subchunk, `data` points at the samples
+struct DataSubChunkView
 {
-    std::array< std::byte, 4 >     subchunk2_id{ MagicBytes::data };
-    std::uint32_t                  subchunk2_size;
+    std::array< std::byte, 4 >   subchunk2_id{ MagicBytes::data };
+    std::uint32_t                subchunk2_size{};
 
-    // DataSubChunk is the owner of the data
-    std::unique_ptr< std::byte[] > data;
+    std::span< std::byte const > data;
 
     // Checks the magic bytes
     [[ nodiscard ]] bool valid() const;
+};
+
+// Size of the RIFF, fmt and data headers preceding the samples
+inline constexpr std::size_t header_size{ sizeof( RiffChunk ) + sizeof( FmtSubChunk ) + MagicBytes::data.size() + sizeof( std::uint32_t ) };
+
+// Same for an RF64 file, which has a ds64 chunk with the 64 bit sizes after the RIFF header
+inline constexpr std::size_t ds64_size       { 28 };
+inline constexpr std::size_t rf64_header_size{ header_size + MagicBytes::ds64.size() + sizeof( std::uint32_t ) + ds64_size };
+
+// Whether `data_size` bytes of samples make the RIFF size overflow, so they need an RF64 file
+[[ nodiscard ]] constexpr bool needsRf64( std::uint64_t const data_size )
+{
+    return data_size > UINT32_MAX - ( header_size - 8 );
+}
 
-    // Deep copy
-    [[ nodiscard ]] DataSubChunk copy() const;
+// Size of the headers `FileWriter` puts in front of `data_size` bytes of samples
+[[ nodiscard ]] constexpr std::size_t headerSize( std::uint64_t const data_size )
+{
+    return needsRf64( data_size ) ? rf64_header_size : header_size;
+}
+
+// A chunk of a .wav file, `offset` is where its body starts in the file
+struct ChunkInfo
+{
+    std::array< std::byte, 4 > id{};
+    std::uint64_t              offset{};
+    std::uint64_t              size{};
 };
 
-struct File
+// Where everything is in a .wav file, found by walking its chunks in whatever order they come:
+// `LIST`, `fact` and any other chunk are skipped over, only their place is kept in the index.
+// RF64 files take their 64 bit sizes from the ds64 chunk.
+struct Layout
 {
-    RiffChunk    riff;
-    FmtSubChunk  format;
-    DataSubChunk data;
+    static constexpr std::size_t max_chunks{ 16 };
 
-    File() = default;
+    // WAVE_FORMAT_EXTENSIBLE is reported as the PCM or float format it holds, with a plain 16 byte fmt chunk
+    FmtSubChunk   format{};
+    std::uint16_t valid_bits_per_sample{};
+    std::uint32_t channel_mask{};
+    bool          rf64{};
+
+    // the samples, as announced by the headers, the file may hold less of them
+    std::uint64_t data_offset{};
+    std::uint64_t data_size{};
 
-    File( FmtSubChunk const metadata, DataSubChunk && audiodata )
-        : format{ metadata }, data{ std::move( audiodata ) }
-    {}
+    // the first `max_chunks` chunks of the file, including the fmt and data ones
+    std::array< ChunkInfo, max_chunks > chunks{};
+    std::size_t                         chunk_count{};
 
-    // Takes ownership of the raw data
-    File( FmtSubChunk metadata, std::byte * raw_data, std::uint32_t subchunk2_size );
+    [[ nodiscard ]] std::span< ChunkInfo const > index() const { return { chunks.data(), chunk_count }; }
 
-    // Loads up a .wav file
+    // The first chunk with `id` in the index, nullptr if there's none
+    [[ nodiscard ]] ChunkInfo const * find( std::array< std::byte, 4 > const & id ) const;
+};
+
+// Walks the chunks of a .wav file held in memory without allocating,
+// nullopt if it isn't one or it's missing the fmt or the data chunk
+[[ nodiscard ]] std::optional< Layout > parseLayout( std::span< std::byte const > bytes );
+
+// Same, reading only the chunk headers from `file`, the position in it is left anywhere
+[[ nodiscard ]] std::optional< Layout > parseLayout( FILE * file );
+
+// A .wav file held in a single buffer laid out exactly as on disk,
+// the chunks are views into it so writing or playing the file needs no copies
+struct File
+{
+    File() = default;
+
+    // Allocates room for `subchunk2_size` bytes of samples and fills in the headers,
+    // the samples are meant to be filled in through `samples()`
+    File( FmtSubChunk const & metadata, std::uint32_t subchunk2_size );
+
+    // Loads up a .wav file, its headers are normalized into the ones above, whatever chunks surround the samples
     File( std::string_view filename );
 
-    [[ nodiscard ]] std::uint32_t size_in_bytes() const
+    // The headers can only be looked at when the file has been loaded, see `valid()`
+    [[ nodiscard ]] RiffChunk   const & riff()   const { return *reinterpret_cast< RiffChunk   const * >( buffer_.get() ); }
+    [[ nodiscard ]] FmtSubChunk const & format() const { return *reinterpret_cast< FmtSubChunk const * >( buffer_.get() + sizeof( RiffChunk ) ); }
+    [[ nodiscard ]] DataSubChunkView    data()   const;
+
+    [[ nodiscard ]] std::span< std::byte > samples()
     {
-        return static_cast< std::uint32_t >( riff.id.size()      )
-             + static_cast< std::uint32_t >( sizeof( riff.size ) )
-             + riff.size;
+        return { buffer_.get() + header_size, buffer_.size - header_size };
     }
 
+    // The whole file, headers included
+    [[ nodiscard ]] std::span< std::byte const > bytes() const { return { buffer_.get(), buffer_.size }; }
+
+    [[ nodiscard ]] std::uint32_t size_in_bytes() const { return static_cast< std::uint32_t >( buffer_.size ); }
+
     // Checks the validity of all subchunks
     [[ nodiscard ]] bool valid() const;
 
     // Writes to given path
     [[ nodiscard ]] bool write( std::string_view path ) const;
 
-    // Layouts the file in memory as it would be when written onto a disk
-    Utils::OwningBuffer copyInMemory() const;
+private:
+    Utils::OwningBuffer buffer_;
+};
+
+// A .wav file mapped into memory, `data` points straight into the mapping
+// so the samples are read from the page cache instead of being copied
+struct MappedFile
+{
+    Layout           layout;
+    FmtSubChunk      format;
+    DataSubChunkView data;
+
+    // Maps a .wav file, hinting the kernel that the samples will be read sequentially
+    MappedFile( std::string_view filename );
+
+    // Checks the validity of all subchunks
+    [[ nodiscard ]] bool valid() const;
+
+private:
+    FileUtils::MappedRegion region_;
+};
+
+// Reads a .wav file piece by piece, only the headers are kept in memory
+struct FileReader
+{
+    Layout             layout;
+    FmtSubChunk        format;
+    std::uint64_t      data_size{};
+
+    // Opens the file and walks its chunks, the samples are left on disk
+    FileReader( std::string_view filename );
+
+    // Checks the validity of all the headers
+    [[ nodiscard ]] bool valid() const;
+
+    // Reads the next samples into `buffer`, returns the number of bytes read,
+    // zero once the whole data subchunk has been read
+    [[ nodiscard ]] std::size_t read( std::span< std::byte > buffer );
+
+    // Moves to `offset` bytes into the samples, false if that's past their end
+    [[ nodiscard ]] bool seek( std::uint64_t offset );
+
+    [[ nodiscard ]] std::uint64_t bytes_remaining() const { return bytes_remaining_; }
+
+private:
+    FileUtils::FilePtr file_{ nullptr, &std::fclose };
+    std::uint64_t      bytes_remaining_{};
+};
+
+// Writes a .wav file piece by piece, the header goes out first and the samples as they come.
+// Files with more samples than the 32 bit sizes of a RIFF file allow are written as RF64 ones
+struct FileWriter
+{
+    // Creates the file, writes the header and reserves room for `subchunk2_size` bytes of samples
+    FileWriter( std::string_view filename, FmtSubChunk const & format, std::uint64_t subchunk2_size );
+
+    // Continues a file already holding the header and the first `bytes_written` bytes of samples
+    FileWriter( std::string_view filename, std::uint64_t subchunk2_size, std::uint64_t bytes_written );
+
+    [[ nodiscard ]] bool valid() const { return file_ != nullptr; }
+
+    // Appends the next samples, false on failure or if they exceed the announced size
+    [[ nodiscard ]] bool write( std::span< std::byte const > samples );
+
+    // Puts samples at `offset` bytes into the data subchunk, several threads may write distinct ranges at once
+    [[ nodiscard ]] bool writeAt( std::uint64_t offset, std::span< std::byte const > samples );
+
+    // Flushes the file, false if it's missing samples
+    [[ nodiscard ]] bool finish();
+
+    [[ nodiscard ]] std::uint64_t bytes_written() const { return bytes_written_; }
+
+private:
+    FileUtils::FilePtr           file_{ nullptr, &std::fclose };
+    std::uint64_t                subchunk2_size_{};
+    std::size_t                  header_size_{};
+    std::atomic< std::uint64_t > bytes_written_{};
 };
 
 } // namespace WAV
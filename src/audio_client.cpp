@@ -1,8 +1,14 @@
 #include "audio_client.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
 #include <spdlog/spdlog.h>
 
 #include "audio_server.hpp"
+#include "checksums.hpp"
+#include "codec.hpp"
 #include "wav.hpp"
 
 #include "utils.hpp"
@@ -22,7 +28,7 @@ namespace
         {
             .subchunk1_id    = WAV::MagicBytes::fmt,
             .subchunk1_size  = pulse_code_modulation_chunk_size,
-            .audio_format    = pulse_code_modulation,
+            .audio_format    = static_cast< std::uint16_t >( metadata.audioformat() != 0 ? metadata.audioformat() : pulse_code_modulation ),
             .num_channels    = static_cast< std::uint16_t >( metadata.channels()              ),
             .sample_rate     =                             ( metadata.samplerate()            ),
             .byte_rate       =                             ( metadata.averagebytespersecond() ),
@@ -30,10 +36,255 @@ namespace
             .bits_per_sample = static_cast< std::uint16_t >( metadata.bitspersample()         )
         };
     }
+
+    // Hands out the samples of every received chunk, decoding the ones the server encoded
+    class PayloadDecoder
+    {
+    public:
+        // Picks up the codec the server settled on for the stream
+        void start( Teleaudio::AudioMetadata const & metadata )
+        {
+            if ( metadata.codec() == Teleaudio::PAYLOAD_DELTA_RICE )
+            {
+                codec_.emplace( parseMetadata( metadata ) );
+            }
+        }
+
+        // The samples of the chunk in `data`, valid until the next call, nullopt if they can't be decoded
+        [[ nodiscard ]] std::optional< std::span< std::byte const > > samples( Teleaudio::AudioData const & data )
+        {
+            if ( !data.has_encodeddata() )
+            {
+                auto const & payload{ data.rawdata() };
+                payload_bytes_ += payload.size();
+                sample_bytes_  += payload.size();
+                return std::span{ reinterpret_cast< std::byte const * >( payload.data() ), payload.size() };
+            }
+
+            auto const & payload{ data.encodeddata() };
+            if ( !codec_ )
+            {
+                spdlog::error( "Received an encoded chunk, but no codec was agreed on" );
+                return std::nullopt;
+            }
+
+            auto const decode_start{ std::chrono::steady_clock::now() };
+            if ( !codec_->decode( { reinterpret_cast< std::byte const * >( payload.data() ), payload.size() }, decoded_ ) )
+            {
+                spdlog::error( "Received a malformed encoded chunk" );
+                return std::nullopt;
+            }
+            decode_time_ += std::chrono::steady_clock::now() - decode_start;
+
+            payload_bytes_ += payload.size();
+            sample_bytes_  += decoded_.size();
+            decoded_bytes_ += decoded_.size();
+            return decoded_;
+        }
+
+        // Logs how well and how fast the samples of `file` were decoded
+        void report( std::string_view const file ) const
+        {
+            if ( !codec_ || payload_bytes_ == 0 )
+            {
+                return;
+            }
+            auto const seconds{ std::chrono::duration< double >( decode_time_ ).count() };
+            spdlog::info( "Received {} bytes of samples of '{}' as {} bytes, ratio {:.2f}, decoded at {:.1f} MB/s", sample_bytes_, file, payload_bytes_,
+                          static_cast< double >( sample_bytes_ ) / static_cast< double >( payload_bytes_ ),
+                          seconds > 0 ? static_cast< double >( decoded_bytes_ ) / seconds / 1e6 : 0.0 );
+        }
+
+    private:
+        std::optional< Teleaudio::DeltaRiceCodec > codec_;
+        std::vector< std::byte >                   decoded_;
+
+        std::uint64_t                              payload_bytes_{};
+        std::uint64_t                              sample_bytes_ {};
+        std::uint64_t                              decoded_bytes_{};
+        std::chrono::nanoseconds                   decode_time_  {};
+    };
+
+    // Where a file the server listed goes in `directory`, nullopt if its name would leave it
+    [[ nodiscard ]] std::optional< std::filesystem::path > outputPath( std::string_view const directory, std::string_view const name )
+    {
+        auto const relative{ std::filesystem::path{ name }.lexically_normal() };
+        if ( relative.empty() || relative.has_root_path() || *relative.begin() == ".." || relative == "." )
+        {
+            spdlog::error( "Refusing to write '{}' outside of the output directory '{}'.", name, directory );
+            return std::nullopt;
+        }
+        return std::filesystem::path{ directory } / relative;
+    }
+
+    // One `Download` stream of a batch, driven by the completion queue of `DownloadMany`.
+    // Every completed operation is handed to `proceed`, which starts the next one.
+    class PendingDownload
+    {
+    public:
+        PendingDownload( Teleaudio::DownloadProgress & progress, std::filesystem::path output_path, Teleaudio::AudioClient::ProgressHandler const & on_progress )
+            : progress_{ progress }, output_path_{ std::move( output_path ) }, on_progress_{ on_progress }
+        {}
+
+        void start( Teleaudio::AudioService::Stub & stub, grpc::CompletionQueue & cq, Teleaudio::File const & request )
+        {
+            start_  = std::chrono::steady_clock::now();
+            reader_ = stub.PrepareAsyncDownload( &context_, request, &cq );
+            reader_->StartCall( this );
+        }
+
+        // Returns true once the download is over and the object can be dropped
+        [[ nodiscard ]] bool proceed( bool const ok )
+        {
+            switch ( state_ )
+            {
+                case State::Starting:
+                {
+                    if ( !ok )
+                    {
+                        return finish();
+                    }
+                    state_ = State::ReadingMetadata;
+                    reader_->Read( &data_, this );
+                    return false;
+                }
+                case State::ReadingMetadata:
+                {
+                    if ( !ok )
+                    {
+                        // the server refused, its status tells why
+                        spdlog::error( "Error while downloading the file '{}', no metadata received.", progress_.file );
+                        failed_ = true;
+                        return finish();
+                    }
+                    if ( !data_.has_metadata() )
+                    {
+                        spdlog::error( "Error while downloading the file '{}', no metadata received.", progress_.file );
+                        return abort();
+                    }
+
+                    auto const format{ parseMetadata( data_.metadata() ) };
+                    progress_.bytes_total = data_.metadata().rawdatasize();
+                    if ( !format.valid() )
+                    {
+                        spdlog::error( "Received file {} isn't valid", progress_.file );
+                        return abort();
+                    }
+                    writer_.emplace( output_path_.string(), format, progress_.bytes_total );
+                    if ( !writer_->valid() )
+                    {
+                        return abort();
+                    }
+                    decoder_.start( data_.metadata() );
+
+                    state_ = State::Reading;
+                    reader_->Read( &data_, this );
+                    return false;
+                }
+                case State::Reading:
+                {
+                    if ( !ok )
+                    {
+                        // the server is done sending
+                        return finish();
+                    }
+
+                    auto const samples{ decoder_.samples( data_ ) };
+                    if ( !samples.has_value() || !writer_->write( *samples ) )
+                    {
+                        return abort();
+                    }
+                    report( samples->size() );
+
+                    reader_->Read( &data_, this );
+                    return false;
+                }
+                case State::Finishing:
+                {
+                    progress_.done    = true;
+                    progress_.elapsed = std::chrono::steady_clock::now() - start_;
+                    progress_.ok      = !failed_ && status_.ok() && writer_.has_value() && writer_->finish();
+                    if ( !status_.ok() )
+                    {
+                        spdlog::error( "Error while downloading the file '{}', error: {}", progress_.file, status_.error_message() );
+                    }
+
+                    if ( progress_.ok )
+                    {
+                        decoder_.report( progress_.file );
+                        spdlog::info( "Downloaded '{}', {} bytes in {:.3f}s, {:.1f} MB/s", progress_.file, progress_.bytes_received,
+                                      std::chrono::duration< double >( progress_.elapsed ).count(), progress_.throughput() );
+                    }
+                    else if ( writer_.has_value() )
+                    {
+                        // not leaving a truncated file behind
+                        writer_.reset();
+                        std::filesystem::remove( output_path_ );
+                    }
+
+                    if ( on_progress_ )
+                    {
+                        on_progress_( progress_ );
+                    }
+                    return true;
+                }
+            }
+            return true;
+        }
+
+    private:
+        enum class State { Starting, ReadingMetadata, Reading, Finishing };
+
+        void report( std::size_t const bytes )
+        {
+            progress_.bytes_received += bytes;
+            progress_.elapsed         = std::chrono::steady_clock::now() - start_;
+            if ( on_progress_ )
+            {
+                on_progress_( progress_ );
+            }
+        }
+
+        // stops receiving, the stream still has to be finished before it can be dropped
+        bool abort()
+        {
+            failed_ = true;
+            context_.TryCancel();
+            return finish();
+        }
+
+        bool finish()
+        {
+            state_ = State::Finishing;
+            reader_->Finish( &status_, this );
+            return false;
+        }
+
+        Teleaudio::DownloadProgress                                     & progress_;
+        std::filesystem::path                                             output_path_;
+        Teleaudio::AudioClient::ProgressHandler const                   & on_progress_;
+
+        grpc::ClientContext                                               context_;
+        std::unique_ptr< grpc::ClientAsyncReader< Teleaudio::AudioData > > reader_;
+        Teleaudio::AudioData                                              data_;
+        grpc::Status                                                      status_;
+        std::optional< WAV::FileWriter >                                  writer_;
+        PayloadDecoder                                                    decoder_;
+
+        State                                                             state_ { State::Starting };
+        bool                                                              failed_{ false };
+        std::chrono::steady_clock::time_point                             start_;
+    };
 }
 
 namespace Teleaudio
 {
+    double DownloadProgress::throughput() const
+    {
+        auto const seconds{ std::chrono::duration< double >( elapsed ).count() };
+        return seconds > 0 ? static_cast< double >( bytes_received ) / seconds / 1e6 : 0.0;
+    }
+
     std::string AudioClient::List( std::string_view const directory ) const
     {
         grpc::ClientContext context;
@@ -54,60 +305,271 @@ namespace Teleaudio
         return response.text();
     }
 
-    std::optional< WAV::File > AudioClient::receiveFile( std::string_view const filename ) const
+    std::vector< FileInfo > AudioClient::ListDetailed( std::string_view const directory ) const
+    {
+        grpc::ClientContext context;
+
+        Directory request;
+        request.set_path( std::string{ directory } );
+
+        FileInfoList response;
+
+        grpc::Status const status{ stub_->ListDetailed( &context, request, &response ) };
+
+        if ( !status.ok() )
+        {
+            spdlog::error( "Detailed listing of '{}' failed with error: {}", directory, status.error_message() );
+            return {};
+        }
+
+        return { std::make_move_iterator( response.mutable_files()->begin() ), std::make_move_iterator( response.mutable_files()->end() ) };
+    }
+
+    bool AudioClient::ListStream( ListRequest const & request, std::function< bool ( FileInfoList const & ) > const & on_page ) const
+    {
+        grpc::ClientContext context;
+
+        std::unique_ptr< grpc::ClientReader< FileInfoList > > reader{ stub_->ListStream( &context, request ) };
+
+        FileInfoList page;
+        while ( reader->Read( &page ) )
+        {
+            if ( !on_page( page ) )
+            {
+                context.TryCancel();
+                break;
+            }
+        }
+
+        grpc::Status const status{ reader->Finish() };
+        if ( !status.ok() && status.error_code() != grpc::StatusCode::CANCELLED )
+        {
+            spdlog::error( "Streamed listing of '{}' failed with error: {}", request.path(), status.error_message() );
+            return false;
+        }
+
+        return true;
+    }
+
+    std::optional< FileInfo > AudioClient::Stat( std::string_view const file ) const
+    {
+        grpc::ClientContext context;
+
+        File request;
+        request.set_name( std::string{ file } );
+
+        FileInfo response;
+
+        grpc::Status const status{ stub_->Stat( &context, request, &response ) };
+
+        if ( !status.ok() )
+        {
+            spdlog::error( "'stat {}' failed with error: {}", file, status.error_message() );
+            return std::nullopt;
+        }
+
+        return response;
+    }
+
+    std::optional< MetricsReport > AudioClient::GetMetrics() const
     {
         grpc::ClientContext context;
 
+        MetricsReport response;
+
+        grpc::Status const status{ stub_->GetMetrics( &context, MetricsRequest{}, &response ) };
+
+        if ( !status.ok() )
+        {
+            spdlog::error( "'metrics' failed with error: {}", status.error_message() );
+            return std::nullopt;
+        }
+
+        return response;
+    }
+
+    std::optional< Peaks > AudioClient::GetPeaks( std::string_view const file, std::uint32_t const resolution, std::uint64_t const start_frame, std::uint64_t const frames ) const
+    {
+        grpc::ClientContext context;
+
+        PeaksRequest request;
+        request.set_name       ( std::string{ file } );
+        request.set_resolution ( resolution  );
+        request.set_start_frame( start_frame );
+        request.set_frames     ( frames      );
+
+        Peaks response;
+
+        grpc::Status const status{ stub_->GetPeaks( &context, request, &response ) };
+
+        if ( !status.ok() )
+        {
+            spdlog::error( "'peaks {}' failed with error: {}", file, status.error_message() );
+            return std::nullopt;
+        }
+
+        return response;
+    }
+
+    File AudioClient::makeRequest( std::string_view const file ) const
+    {
         File request;
-        request.set_name( filename.data() );
+        request.set_name           ( std::string{ file } );
+        request.set_chunk_size     ( preferred_chunk_size_ );
+        request.set_codec          ( compression_ ? PAYLOAD_DELTA_RICE : PAYLOAD_RAW );
+        request.set_sample_rate    ( output_format_.sample_rate     );
+        request.set_bits_per_sample( output_format_.bits_per_sample );
+        request.set_channels       ( output_format_.channels        );
+        request.set_floating_point ( output_format_.floating_point  );
+        return request;
+    }
+
+    bool AudioClient::streamFile( std::string_view const filename, std::uint64_t const offset, std::uint64_t const length, MetadataHandler const & on_metadata, SamplesHandler const & on_samples ) const
+    {
+        grpc::ClientContext context;
+
+        auto request{ makeRequest( filename ) };
+        request.set_offset( offset );
+        request.set_length( length );
 
         std::unique_ptr< grpc::ClientReader< AudioData > > reader{ stub_->Download( &context, request ) };
+        return readStream( filename, context, *reader, on_metadata, on_samples );
+    }
+
+    std::optional< AudioMetadata > AudioClient::fetchMetadata( std::string_view const filename ) const
+    {
+        grpc::ClientContext context;
+
+        auto request{ makeRequest( filename ) };
+        request.set_metadata_only( true );
+
+        std::optional< AudioMetadata > metadata;
+        std::unique_ptr< grpc::ClientReader< AudioData > > reader{ stub_->Download( &context, request ) };
+        auto const received
+        {
+            readStream
+            (
+                filename,
+                context,
+                *reader,
+                [ & ]( AudioMetadata const & received_metadata ) { metadata = received_metadata; return true; },
+                []( std::span< std::byte const > ) { return true; }
+            )
+        };
+        if ( !received )
+        {
+            return std::nullopt;
+        }
+        return metadata;
+    }
 
+    bool AudioClient::Stream( std::string_view const filename, MetadataHandler const & on_metadata, SamplesHandler const & on_samples, std::chrono::milliseconds const lead ) const
+    {
+        grpc::ClientContext context;
+
+        StreamRequest request;
+        *request.mutable_file() = makeRequest( filename );
+        request.set_lead_milliseconds( static_cast< std::uint32_t >( std::clamp< std::chrono::milliseconds::rep >( lead.count(), 0, UINT32_MAX ) ) );
+
+        std::unique_ptr< grpc::ClientReader< AudioData > > reader{ stub_->Stream( &context, request ) };
+        return readStream( filename, context, *reader, on_metadata, on_samples );
+    }
+
+    bool AudioClient::readStream( std::string_view const filename, grpc::ClientContext & context, grpc::ClientReader< AudioData > & reader, MetadataHandler const & on_metadata, SamplesHandler const & on_samples )
+    {
         // reading metadata first
         AudioData data;
-        reader->Read( &data );
-
-        auto const metadata{ data.metadata() };
+        if ( !reader.Read( &data ) || !data.has_metadata() )
+        {
+            auto const status{ reader.Finish() };
+            spdlog::error( "Error while downloading the file '{}', no metadata received. {}", filename, status.error_message() );
+            return false;
+        }
 
         spdlog::info( "Metadata: {}ch {}Hz {}bps", data.metadata().channels(), data.metadata().samplerate(), data.metadata().bitspersample() );
 
-        auto const raw_data_size  { static_cast< std::uint32_t >( data.metadata().rawdatasize() ) };
-        auto       raw_data_buffer{ std::make_unique< std::byte[] >( raw_data_size )              };
-        std::uint32_t bytes_read{};
-        // reading the raw audio data
-        while ( reader->Read( &data ) )
-        {   
-            auto const payload_size{ static_cast< std::uint32_t >( data.rawdata().size() ) };
-            std::copy_n
-            (
-                reinterpret_cast< std::byte * >( data.mutable_rawdata()->data() ),
-                payload_size,
-                raw_data_buffer.get() + bytes_read
-            );
-            bytes_read += payload_size;
+        auto const range_size{ data.metadata().length() };
+        if ( !on_metadata( data.metadata() ) )
+        {
+            context.TryCancel();
+            return false;
         }
-        if ( bytes_read != raw_data_size )
+
+        PayloadDecoder decoder;
+        decoder.start( data.metadata() );
+
+        std::uint64_t bytes_read{};
+        // reading the raw audio data, every chunk is passed on straight away
+        while ( reader.Read( &data ) )
         {
-            spdlog::error( "Read {} bytes, but raw data size is {}", bytes_read, raw_data_size );
+            auto const samples{ decoder.samples( data ) };
+            if ( !samples.has_value() || !on_samples( *samples ) )
+            {
+                context.TryCancel();
+                return false;
+            }
+            bytes_read += samples->size();
+        }
+        if ( bytes_read != range_size )
+        {
+            spdlog::error( "Read {} bytes, but {} were announced", bytes_read, range_size );
         }
 
-        grpc::Status const status{ reader->Finish() };
+        grpc::Status const status{ reader.Finish() };
         if ( !status.ok() )
         {
             spdlog::error( "Error while downloading the file '{}', error: {}", filename, status.error_message() );
-            return std::nullopt;
+            return false;
         }
 
-        auto * rawdata{ raw_data_buffer.release() };
+        decoder.report( filename );
+        return true;
+    }
 
-        WAV::File file
+    std::optional< WAV::File > AudioClient::receiveFile( std::string_view const filename ) const
+    {
+        // the samples are received straight into their place behind the headers
+        std::optional< WAV::File > file;
+        std::size_t                bytes_read{};
+
+        auto const received
         {
-            parseMetadata( metadata ),
-            rawdata, // takes ownership
-            raw_data_size
+            streamFile
+            (
+                filename,
+                0,
+                0,
+                [ & ]( AudioMetadata const & metadata )
+                {
+                    // the file is held in a single buffer with the 32 bit sizes of a RIFF file
+                    if ( metadata.rawdatasize() > UINT32_MAX - WAV::header_size )
+                    {
+                        spdlog::error( "'{}' holds {} bytes of samples, too many to be held in memory", filename, metadata.rawdatasize() );
+                        return false;
+                    }
+                    file.emplace( parseMetadata( metadata ), static_cast< std::uint32_t >( metadata.rawdatasize() ) );
+                    return true;
+                },
+                [ & ]( std::span< std::byte const > const samples )
+                {
+                    auto const destination{ file->samples().subspan( bytes_read ) };
+                    if ( samples.size() > destination.size() )
+                    {
+                        spdlog::error( "Received more than the announced {} bytes", file->samples().size() );
+                        return false;
+                    }
+                    std::copy( samples.begin(), samples.end(), destination.begin() );
+                    bytes_read += samples.size();
+                    return true;
+                }
+            )
         };
+        if ( !received || bytes_read != file->samples().size() )
+        {
+            return std::nullopt;
+        }
 
-        if ( !file.valid() )
+        if ( !file->valid() )
         {
             spdlog::error( "Received file is not valid!" );
             return std::nullopt;
@@ -130,32 +592,548 @@ namespace Teleaudio
         {
             spdlog::error( "Cannot play file {}, it is not a supported .WAV file", file );
         }
-        auto const buffer{ wav_file->copyInMemory() };
-        auto const status{ PlaySound( reinterpret_cast< char * >( buffer.data.get() ), NULL, SND_MEMORY | SND_SYNC ) };
+        // the file is already laid out as on disk, so it's handed over as is
+        auto const status{ PlaySound( reinterpret_cast< char const * >( wav_file->bytes().data() ), NULL, SND_MEMORY | SND_SYNC ) };
         if ( !status )
         {
             spdlog::error( "Failed to play sound for some reason" );
         }
         return true;
 #else
-        spdlog::warn( "Playing is not supported on a non-Windows OS." );
-        return false;
+        auto const sink{ makeDeviceSink() };
+        if ( !sink )
+        {
+            spdlog::warn( "Playing is not supported, teleaudio was built without ALSA." );
+            return false;
+        }
+
+        auto const statistics{ Play( file, *sink ) };
+        return statistics.has_value() && statistics->ok;
 #endif
     }
 
-    bool AudioClient::Download( std::string_view const file, std::string_view const output_path ) const
+    std::optional< PlaybackStatistics > AudioClient::Play( std::string_view const file, AudioSink & sink, PlaybackOptions const & options ) const
     {
-        auto const wav_file{ receiveFile( file ) };
-        if ( !wav_file.has_value() )
+        // created once the format is known, the samples are pushed from this thread while the player's thread plays them
+        std::optional< Player > player;
+
+        auto const streamed
+        {
+            Stream
+            (
+                file,
+                [ & ]( AudioMetadata const & metadata )
+                {
+                    player.emplace( sink, parseMetadata( metadata ), options );
+                    return player->start( metadata.length() );
+                },
+                [ & ]( std::span< std::byte const > const samples )
+                {
+                    return player->push( samples );
+                },
+                // the server doesn't run further ahead than the ring holds
+                options.ring
+            )
+        };
+
+        if ( !player.has_value() )
+        {
+            return std::nullopt;
+        }
+
+        auto statistics{ player->finish() };
+        statistics.ok = statistics.ok && streamed;
+
+        spdlog::info( "Played {} bytes of '{}', started after {:.1f} ms, {} underruns with {} bytes of silence", statistics.bytes_played, file,
+                      std::chrono::duration< double, std::milli >( statistics.startup ).count(), statistics.underruns, statistics.silence_played );
+        return statistics;
+    }
+
+    bool AudioClient::Download( std::string_view const file, std::string_view const output_path, bool const resume ) const
+    {
+        // what an earlier attempt left behind, the samples on disk are continued from the last whole frame
+        std::optional< WAV::FmtSubChunk > partial_format;
+        std::uint64_t                     partial_size{};
+        std::uint64_t                     resume_from {};
+        if ( resume )
+        {
+            WAV::FileReader const partial{ output_path };
+            std::error_code       error;
+            auto const            file_size{ std::filesystem::file_size( output_path, error ) };
+            if ( partial.valid() && !error && partial.layout.data_offset == WAV::headerSize( partial.data_size ) && file_size >= partial.layout.data_offset )
+            {
+                auto const samples_on_disk{ std::min< std::uintmax_t >( file_size - partial.layout.data_offset, partial.data_size ) };
+                auto const block_align    { std::max< std::uint16_t >( partial.format.block_align, 1 ) };
+
+                partial_format = partial.format;
+                partial_size   = partial.data_size;
+                resume_from    = samples_on_disk - samples_on_disk % block_align;
+                spdlog::info( "Resuming '{}' after {} of {} bytes of samples", output_path, resume_from, partial_size );
+            }
+        }
+
+        // the samples go to the disk as they arrive, only one chunk is ever held in memory
+        std::optional< WAV::FileWriter > writer;
+        bool                             start_over{ false };
+
+        auto const received
+        {
+            streamFile
+            (
+                file,
+                resume_from,
+                0,
+                [ & ]( AudioMetadata const & metadata )
+                {
+                    auto const format{ parseMetadata( metadata ) };
+                    if ( !format.valid() )
+                    {
+                        spdlog::error( "Received file {} isn't valid", file );
+                        return false;
+                    }
+
+                    auto const raw_data_size{ metadata.rawdatasize() };
+                    if ( partial_format.has_value() )
+                    {
+                        // the file on the server might have changed since
+                        start_over = raw_data_size != partial_size
+                                  || metadata.offset() != resume_from
+                                  || std::memcmp( &format, &*partial_format, sizeof( format ) ) != 0;
+                        if ( start_over )
+                        {
+                            spdlog::warn( "'{}' doesn't match the file on the server, starting over", output_path );
+                            return false;
+                        }
+                        writer.emplace( output_path, raw_data_size, resume_from );
+                    }
+                    else
+                    {
+                        writer.emplace( output_path, format, raw_data_size );
+                    }
+                    return writer->valid();
+                },
+                [ & ]( std::span< std::byte const > const samples )
+                {
+                    return writer->write( samples );
+                }
+            )
+        };
+
+        if ( start_over )
+        {
+            return Download( file, output_path, false );
+        }
+
+        if ( !received || !writer->finish() )
+        {
+            spdlog::error( "Writing file to {} failed", output_path );
+            if ( writer.has_value() && !resume )
+            {
+                // not leaving a truncated file behind
+                writer.reset();
+                std::remove( std::string{ output_path }.c_str() );
+            }
+            return false;
+        }
+
+        spdlog::info( "Written {} bytes of samples to '{}'", writer->bytes_written() - resume_from, output_path );
+        return true;
+    }
+
+    bool AudioClient::DownloadParallel( std::string_view const file, std::string_view const output_path, std::size_t streams ) const
+    {
+        auto const metadata{ fetchMetadata( file ) };
+        if ( !metadata.has_value() )
+        {
+            return false;
+        }
+
+        auto const format{ parseMetadata( *metadata ) };
+        if ( !format.valid() )
         {
             spdlog::error( "Received file {} isn't valid", file );
             return false;
         }
-        if ( !wav_file->write( output_path ) )
+
+        auto const raw_data_size{ metadata->rawdatasize() };
+        if ( streams == 0 )
+        {
+            // below a few MiB per stream the extra calls cost more than they bring
+            std::uint64_t const bytes_per_stream{ 32 * 1024 * 1024 };
+            std::size_t   const max_streams     { 8 };
+            streams = std::clamp< std::size_t >( raw_data_size / bytes_per_stream, 1, max_streams );
+        }
+
+        // header written and the whole file preallocated before any samples arrive
+        WAV::FileWriter writer{ output_path, format, raw_data_size };
+        if ( !writer.valid() )
+        {
+            return false;
+        }
+
+        // every range but the last one is the same number of whole sample frames
+        std::uint64_t const block_align{ std::max< std::uint16_t >( format.block_align, 1 ) };
+        std::uint64_t const frames     { raw_data_size / block_align };
+        std::uint64_t const range_size { ( frames + streams - 1 ) / streams * block_align };
+
+        std::atomic< bool > failed{ false };
+        {
+            std::vector< std::jthread > workers;
+            for ( std::uint64_t range_start{}; range_start < raw_data_size && range_size > 0; range_start += range_size )
+            {
+                workers.emplace_back( [ &, range_start ]
+                {
+                    auto const length{ std::min( range_size, raw_data_size - range_start ) };
+
+                    std::uint64_t received{};
+                    auto const ok
+                    {
+                        streamFile
+                        (
+                            file,
+                            range_start,
+                            length,
+                            [ & ]( AudioMetadata const & range )
+                            {
+                                // the file could have been replaced since the metadata call
+                                return range.rawdatasize() == raw_data_size && range.offset() == range_start && range.length() == length;
+                            },
+                            [ & ]( std::span< std::byte const > const samples )
+                            {
+                                if ( failed || samples.size() > length - received )
+                                {
+                                    return false;
+                                }
+                                auto const written{ writer.writeAt( range_start + received, samples ) };
+                                received += samples.size();
+                                return written;
+                            }
+                        )
+                    };
+                    if ( !ok || received != length )
+                    {
+                        spdlog::error( "Range {} to {} of '{}' failed", range_start, range_start + length, file );
+                        failed = true;
+                    }
+                } );
+            }
+            spdlog::info( "Downloading '{}' over {} streams", file, workers.size() );
+        }
+
+        // closing the file before anything else, it might have to be removed
+        auto const complete{ writer.finish() && !failed };
+        if ( !complete )
         {
             spdlog::error( "Writing file to {} failed", output_path );
+            std::remove( std::string{ output_path }.c_str() );
             return false;
         }
+
+        spdlog::info( "Written {} bytes of samples to '{}'", raw_data_size, output_path );
         return true;
     }
+
+    std::optional< SyncStatistics > AudioClient::Sync( std::string_view const file, std::string_view const output_path ) const
+    {
+        SyncStatistics statistics;
+
+        // the copy is only replaced once the new one is complete and on the disk, no other sync writes the same file
+        auto const temporary{ FileUtils::temporaryPath( output_path ) };
+        auto const replace  { [ & ]
+        {
+            std::error_code error;
+            auto const      written{ FileUtils::openFile( temporary, FileUtils::FileOpenMode::UpdateBinary ) };
+            if ( !written || !FileUtils::sync( written.get() ) )
+            {
+                spdlog::error( "Cannot flush '{}' to the disk", temporary );
+                std::filesystem::remove( temporary, error );
+                return false;
+            }
+
+            std::filesystem::rename( temporary, output_path, error );
+            if ( error )
+            {
+                spdlog::error( "Cannot replace '{}': {}", output_path, error.message() );
+                std::filesystem::remove( temporary, error );
+                return false;
+            }
+            return true;
+        } };
+
+        auto const download_all{ [ & ]() -> std::optional< SyncStatistics >
+        {
+            // a failed download only removes the temporary file, the copy stays as it was
+            if ( !Download( file, temporary ) )
+            {
+                return std::nullopt;
+            }
+            statistics.blocks_fetched = statistics.blocks;
+            statistics.bytes_fetched  = WAV::FileReader{ temporary }.data_size;
+            if ( !replace() )
+            {
+                return std::nullopt;
+            }
+            return statistics;
+        } };
+
+        // the server only checksums the samples as they are in the file
+        if ( output_format_.sample_rate != 0 || output_format_.bits_per_sample != 0 || output_format_.channels != 0 || output_format_.floating_point )
+        {
+            spdlog::warn( "Converted files can't be synced, downloading all of '{}'", file );
+            return download_all();
+        }
+
+        FileChecksums remote;
+        {
+            grpc::ClientContext context;
+
+            File request;
+            request.set_name( std::string{ file } );
+
+            grpc::Status const status{ stub_->Checksums( &context, request, &remote ) };
+            if ( !status.ok() )
+            {
+                spdlog::warn( "No checksums of '{}': {}, downloading all of it", file, status.error_message() );
+                return download_all();
+            }
+        }
+
+        auto const          format       { parseMetadata( remote.metadata() ) };
+        std::uint64_t const raw_data_size{ remote.metadata().rawdatasize() };
+        std::uint32_t const block_size   { remote.block_size() };
+        statistics.blocks = static_cast< std::size_t >( remote.blocks_size() );
+        if ( !format.valid() || block_size == 0 || statistics.blocks != ( raw_data_size + block_size - 1 ) / block_size )
+        {
+            spdlog::warn( "The checksums of '{}' don't add up, downloading all of it", file );
+            return download_all();
+        }
+
+        // the samples the copy has, as far as it got
+        std::optional< SampleChecksums > local;
+        {
+            WAV::FileReader reader{ output_path };
+            std::error_code error;
+            auto const      file_size{ std::filesystem::file_size( output_path, error ) };
+            if ( reader.valid() && !error && reader.layout.data_offset == WAV::headerSize( reader.data_size ) && file_size >= reader.layout.data_offset
+              && std::memcmp( &reader.format, &format, sizeof( format ) ) == 0 )
+            {
+                local = checksumSamples( reader, std::min< std::uint64_t >( file_size - reader.layout.data_offset, reader.data_size ), block_size );
+                if ( local.has_value() && reader.data_size == raw_data_size && local->size == raw_data_size && local->crc == remote.crc32c() )
+                {
+                    statistics.unchanged = true;
+                    spdlog::info( "'{}' is up to date", output_path );
+                    return statistics;
+                }
+            }
+        }
+
+        std::optional< WAV::FileWriter > writer{ std::in_place, temporary, format, raw_data_size };
+        if ( !writer->valid() )
+        {
+            return std::nullopt;
+        }
+
+        // the matching blocks are copied over, runs of the others are fetched in a single range each
+        std::vector< std::pair< std::uint64_t, std::uint64_t > > ranges;
+        {
+            WAV::FileReader          reader{ output_path };
+            std::vector< std::byte > buffer( block_size );
+            for ( std::size_t i{}; i < statistics.blocks; ++i )
+            {
+                auto const offset{ std::uint64_t{ block_size } * i };
+                auto const length{ static_cast< std::size_t >( std::min< std::uint64_t >( block_size, raw_data_size - offset ) ) };
+                auto const block { std::span{ buffer }.first( length ) };
+
+                auto const same{ local.has_value() && i < local->blocks.size() && local->blockLength( i ) == length
+                              && local->blocks[ i ] == remote.blocks( static_cast< int >( i ) ) };
+                if ( same && reader.seek( offset ) && reader.read( block ) == length && writer->writeAt( offset, block ) )
+                {
+                    continue;
+                }
+
+                if ( !ranges.empty() && ranges.back().first + ranges.back().second == offset )
+                {
+                    ranges.back().second += length;
+                }
+                else
+                {
+                    ranges.emplace_back( offset, length );
+                }
+                ++statistics.blocks_fetched;
+                statistics.bytes_fetched += length;
+            }
+        }
+
+        bool failed{ false };
+        for ( auto const & [ offset, length ] : ranges )
+        {
+            std::uint64_t received{};
+            auto const ok
+            {
+                streamFile
+                (
+                    file,
+                    offset,
+                    length,
+                    [ &, offset = offset, length = length ]( AudioMetadata const & range )
+                    {
+                        // the file could have been replaced since it was checksummed
+                        return range.rawdatasize() == raw_data_size && range.offset() == offset && range.length() == length;
+                    },
+                    [ &, offset = offset, length = length ]( std::span< std::byte const > const samples )
+                    {
+                        if ( samples.size() > length - received )
+                        {
+                            return false;
+                        }
+                        auto const written{ writer->writeAt( offset + received, samples ) };
+                        received += samples.size();
+                        return written;
+                    }
+                )
+            };
+            if ( !ok || received != length )
+            {
+                failed = true;
+                break;
+            }
+        }
+
+        // what came together has to be the file the server checksummed
+        std::optional< SampleChecksums > result;
+        if ( writer->finish() && !failed )
+        {
+            WAV::FileReader copy{ temporary };
+            if ( copy.valid() )
+            {
+                result = checksumSamples( copy, copy.data_size, block_size );
+            }
+        }
+        writer.reset();
+
+        if ( !result.has_value() || result->crc != remote.crc32c() )
+        {
+            std::error_code error;
+            std::filesystem::remove( temporary, error );
+            spdlog::warn( "Syncing '{}' failed, it may have changed on the server, downloading all of it", file );
+            return download_all();
+        }
+
+        if ( !replace() )
+        {
+            return std::nullopt;
+        }
+
+        spdlog::info( "Synced '{}', fetched {} of {} blocks, {} bytes of samples", output_path, statistics.blocks_fetched, statistics.blocks, statistics.bytes_fetched );
+        return statistics;
+    }
+
+    std::vector< std::optional< SyncStatistics > > AudioClient::SyncMany( std::vector< std::string > const & files, std::string_view const output_directory, std::size_t const concurrency ) const
+    {
+        std::vector< std::optional< SyncStatistics > > results( files.size() );
+
+        std::error_code error;
+        std::filesystem::create_directories( output_directory, error );
+        if ( error )
+        {
+            spdlog::error( "Cannot create the output directory '{}': {}", output_directory, error.message() );
+            return results;
+        }
+
+        // a sync is mostly waiting for checksums and short ranges, so every one of them gets a thread
+        std::atomic< std::size_t > next{};
+        {
+            std::vector< std::jthread > workers;
+            for ( std::size_t i{}; i < std::min( std::max< std::size_t >( concurrency, 1 ), files.size() ); ++i )
+            {
+                workers.emplace_back( [ & ]
+                {
+                    for ( auto index{ next++ }; index < files.size(); index = next++ )
+                    {
+                        if ( auto const output_path{ outputPath( output_directory, files[ index ] ) } )
+                        {
+                            results[ index ] = Sync( files[ index ], output_path->string() );
+                        }
+                    }
+                } );
+            }
+        }
+        return results;
+    }
+
+    std::vector< DownloadProgress > AudioClient::DownloadMany( std::vector< std::string > const & files, std::string_view const output_directory, std::size_t const concurrency, ProgressHandler const & on_progress ) const
+    {
+        std::vector< DownloadProgress > progress( files.size() );
+        for ( std::size_t i{}; i < files.size(); ++i )
+        {
+            progress[ i ].file = files[ i ];
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories( output_directory, error );
+        if ( error )
+        {
+            spdlog::error( "Cannot create the output directory '{}': {}", output_directory, error.message() );
+            return progress;
+        }
+
+        // all the streams share the channel of the stub, HTTP/2 multiplexes them over one connection
+        grpc::CompletionQueue cq;
+
+        std::size_t next     {};
+        std::size_t in_flight{};
+
+        // a download is owned by the completion queue until it reports being done
+        auto const start_next{ [ & ]
+        {
+            auto const output_path{ outputPath( output_directory, files[ next ] ) };
+            if ( !output_path )
+            {
+                progress[ next ].done = true;
+                if ( on_progress )
+                {
+                    on_progress( progress[ next ] );
+                }
+                ++next;
+                return;
+            }
+
+            auto const download{ new PendingDownload{ progress[ next ], *output_path, on_progress } };
+            download->start( *stub_, cq, makeRequest( files[ next ] ) );
+            ++next;
+            ++in_flight;
+        } };
+
+        // a refused name doesn't take a slot, so the next file is started in its place
+        auto const fill{ [ & ]
+        {
+            while ( next < files.size() && in_flight < std::max< std::size_t >( concurrency, 1 ) )
+            {
+                start_next();
+            }
+        } };
+
+        fill();
+
+        void * tag{};
+        bool   ok {};
+        while ( in_flight > 0 && cq.Next( &tag, &ok ) )
+        {
+            auto const download{ static_cast< PendingDownload * >( tag ) };
+            if ( !download->proceed( ok ) )
+            {
+                continue;
+            }
+
+            --in_flight;
+            delete download;
+
+            fill();
+        }
+
+        cq.Shutdown();
+        while ( cq.Next( &tag, &ok ) ) {}
+
+        return progress;
+    }
 } // namespace Teleaudio
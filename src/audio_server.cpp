@@ -1,15 +1,40 @@
 
 #include "audio_server.hpp"
+#include "broadcaster.hpp"
+#include "catalog.hpp"
+#include "checksums.hpp"
+#include "chunk_sizer.hpp"
+#include "codec.hpp"
 #include "communication.grpc.pb.h"
+#include "file_cache.hpp"
+#include "metrics.hpp"
+#include "metadata.hpp"
+#include "pack_store.hpp"
+#include "peaks.hpp"
+#include "read_ahead.hpp"
+#include "timer_wheel.hpp"
+#include "transcoder.hpp"
 #include "wav.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <future>
+#include <google/protobuf/descriptor.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/grpcpp.h>
 #include <memory>
+#include <optional>
+#include <span>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -17,13 +42,42 @@ namespace fs = std::filesystem;
 // the directory where the audio files are
 static fs::path storage_directory;
 
+// mapped files shared between downloads, null if caching is turned off
+static std::unique_ptr< Teleaudio::FileCache > file_cache;
+
+static Teleaudio::ServerOptions server_options;
+
+// headers of every file in the storage, answers `Stat` and `ListDetailed`
+static std::unique_ptr< Teleaudio::Catalog > catalog;
+
+// whole files already serialized into messages, null if packing is turned off
+static std::unique_ptr< Teleaudio::PackStore > pack_store;
+
+// wakes up the paced `Stream` calls when their next chunk is due
+static std::unique_ptr< Teleaudio::TimerWheel > timer_wheel;
+
+// downloads of the same file at about the same time share their messages, null if that's turned off
+static std::unique_ptr< Teleaudio::Broadcaster > broadcaster;
+
+// checksums of the files, kept while they don't change
+static std::unique_ptr< Teleaudio::ChecksumCache > checksum_cache;
+
+// buffers and rings reading the files that aren't mapped ahead of the sends, null when they're read with `fread`
+static std::unique_ptr< FileUtils::ReadPool > read_pool;
+
+// waveform summaries of the files, answers `GetPeaks`
+static std::unique_ptr< Teleaudio::PeakStore > peak_store;
+
+// the metrics for scrapers, null if that's turned off
+static std::unique_ptr< Teleaudio::Metrics::Exporter > metrics_exporter;
+
 namespace
 {
     [[ nodiscard ]] std::string ls( std::string_view const directory )
     {
         std::stringstream ss;
         spdlog::debug( "Looking for all files in the directory {}", ( storage_directory / directory ).string() );
-        for ( auto const & entry : fs::directory_iterator( storage_directory / directory ) ) 
+        for ( auto const & entry : fs::directory_iterator( storage_directory / directory ) )
         {
             if ( entry.is_regular_file() && entry.path().extension() == ".wav" )
             {
@@ -33,121 +87,1489 @@ namespace
         return ss.str();
     }
 
-    [[ nodiscard ]] Teleaudio::AudioMetadata setMetadata( WAV::FmtSubChunk const fmt )
+    // Frames `payload` as an AudioData message with only the bytes field `field_number` set, which on the wire
+    // is the field tag and the payload length followed by the payload itself
+    [[ nodiscard ]] grpc::ByteBuffer frameData( int const field_number, grpc::Slice && payload )
+    {
+        auto const length_delimited{ 2 };
+
+        std::array< std::uint8_t, 6 > header; // a tag byte and a varint of up to 5 bytes
+        std::size_t header_size{};
+
+        header[ header_size++ ] = static_cast< std::uint8_t >( ( field_number << 3 ) | length_delimited );
+        for ( auto length{ payload.size() }; ; length >>= 7 )
+        {
+            if ( length < 0x80 )
+            {
+                header[ header_size++ ] = static_cast< std::uint8_t >( length );
+                break;
+            }
+            header[ header_size++ ] = static_cast< std::uint8_t >( ( length & 0x7f ) | 0x80 );
+        }
+
+        // the header is small enough to be stored inline in the slice, no allocation
+        std::array< grpc::Slice, 2 > const slices
+        {
+            grpc::Slice{ header.data(), header_size },
+            std::move( payload )
+        };
+        return grpc::ByteBuffer{ slices.data(), slices.size() };
+    }
+
+    // The index the generated service registers `method` under, which is its place in the service in the .proto
+    [[ nodiscard ]] std::optional< int > methodIndex( std::string const & method )
+    {
+        auto const service{ google::protobuf::DescriptorPool::generated_pool()->FindServiceByName( Teleaudio::AudioService::service_full_name() ) };
+        auto const found  { service != nullptr ? service->FindMethodByName( method ) : nullptr };
+        if ( found == nullptr )
+        {
+            spdlog::critical( "The service has no method '{}', it's left unimplemented", method );
+            return std::nullopt;
+        }
+        return found->index();
+    }
+
+    // Produces the messages of a single download, the metadata first and then the requested range of samples in chunks.
+    // The chunks are handed to gRPC as already serialized ByteBuffers whose payload slices point either
+    // straight into the cached mapping or into the buffer the samples were read into from the disk,
+    // so the samples are never copied into a protobuf message and serialized again.
+    // If the client asked for it, the samples are converted into another format on the way
+    // and the chunks are encoded, each one on its own.
+    // A request for a whole file as it is, in the chunks the files are packed in, is served from its pack.
+    // Requests for a whole file as it is in the same chunks subscribe to a broadcast of it, which only one of them produces,
+    // a subscriber falling too far behind carries on with a stream of its own.
+    class DownloadStream
+    {
+    public:
+        // Unless `shared`, the stream is produced for this request alone, starting `resume_from` bytes into the samples
+        DownloadStream( fs::path const & path, Teleaudio::File const & request, bool const shared = true, std::uint64_t const resume_from = 0 )
+            : chunk_sizer_
+            {
+                request.chunk_size() > 0 ? request.chunk_size() : server_options.chunk_size,
+                server_options.max_chunk_size,
+                // the client's preference is only capped at the maximum, never adapted
+                request.chunk_size() == 0 && server_options.adaptive_chunks
+            }
+        {
+            auto const whole_file{ request.offset() == 0 && request.length() == 0 && resume_from == 0 && !request.metadata_only() };
+            auto const as_it_is  { request.sample_rate() == 0 && request.bits_per_sample() == 0 && request.channels() == 0 && !request.floating_point() };
+            auto const adaptive  { request.chunk_size() == 0 && server_options.adaptive_chunks };
+            if ( broadcaster && shared && whole_file && as_it_is && !adaptive )
+            {
+                auto const key{ fmt::format( "{}:{}:{}", path.string(), chunk_sizer_.current(), static_cast< int >( request.codec() ) ) };
+                subscription_ = broadcaster->subscribe( key, [ & ]
+                {
+                    auto producer{ std::make_shared< DownloadStream >( path, request, false ) };
+                    return std::make_shared< Teleaudio::Broadcast >
+                    (
+                        producer->metadata(),
+                        [ producer ]( grpc::ByteBuffer & message, std::uint32_t & samples )
+                        {
+                            auto const before{ producer->bytes_sent() };
+                            if ( !producer->next( message ) )
+                            {
+                                return false;
+                            }
+                            samples = static_cast< std::uint32_t >( producer->bytes_sent() - before );
+                            return true;
+                        },
+                        server_options.broadcast_ring
+                    );
+                } );
+                if ( subscription_ )
+                {
+                    path_    = path;
+                    request_ = request;
+                    describe( subscription_->metadata() );
+                    return;
+                }
+            }
+
+            if ( pack_store && whole_file && as_it_is && request.codec() == Teleaudio::PAYLOAD_RAW && !adaptive && chunk_sizer_.current() == pack_store->chunk_size() )
+            {
+                pack_ = pack_store->get( request.name() );
+                if ( pack_ )
+                {
+                    Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::PackedDownloads );
+                    describe( packedMessage( 0 ) );
+                    return;
+                }
+            }
+
+            if ( file_cache )
+            {
+                mapped_song_ = file_cache->get( path );
+            }
+
+            WAV::FmtSubChunk format;
+            std::uint64_t    data_size;
+            if ( mapped_song_ )
+            {
+                format    = mapped_song_->format;
+                data_size = mapped_song_->layout.data_size;
+            }
+            else
+            {
+                // only the chunk headers are read up front, the samples are read from their offset
+                auto const & song{ song_reader_.emplace( path.string() ) };
+                if ( !song.valid() )
+                {
+                    spdlog::debug( "Loaded file is not valid" );
+                }
+                format    = song.format;
+                data_size = song.data_size;
+            }
+
+            raw_data_size_ = data_size;
+
+            // from here on the format and the size are the ones of the streamed samples
+            auto const source_format{ format };
+            if ( request.sample_rate() > 0 || request.bits_per_sample() > 0 || request.channels() > 0 || request.floating_point() )
+            {
+                auto const target
+                {
+                    Teleaudio::Transcoder::outputFormat
+                    (
+                        format,
+                        request.sample_rate(),
+                        static_cast< std::uint16_t >( std::min< std::uint32_t >( request.bits_per_sample(), UINT16_MAX ) ),
+                        static_cast< std::uint16_t >( std::min< std::uint32_t >( request.channels(),        UINT16_MAX ) ),
+                        request.floating_point()
+                    )
+                };
+                if ( !target.has_value() )
+                {
+                    spdlog::warn( "Can't convert '{}' into {} Hz, {} bits, {} channels, sending it as it is",
+                                  path.filename().string(), request.sample_rate(), request.bits_per_sample(), request.channels() );
+                }
+                else if ( std::memcmp( &*target, &format, sizeof( format ) ) != 0 )
+                {
+                    auto & transcoder{ transcoder_.emplace( format, *target ) };
+                    spdlog::info( "Converting '{}' from {} Hz, {} bits, {} channels into {} Hz, {} bits, {} channels", path.filename().string(),
+                                  format.sample_rate, format.bits_per_sample, format.num_channels, target->sample_rate, target->bits_per_sample, target->num_channels );
+                    raw_data_size_ = transcoder.outputFrames( raw_data_size_ / format.block_align ) * target->block_align;
+                    format         = *target;
+                }
+            }
+
+            // the range covers every whole sample frame the requested bytes touch, its start is rounded down and its end up
+            std::uint64_t const block_align{ std::max< std::uint16_t >( format.block_align, 1 ) };
+            std::uint64_t const offset     { request.offset() };
+            std::uint64_t const length     { request.length() };
+            std::uint64_t const end        { length == 0 || length > raw_data_size_ - std::min( offset, raw_data_size_ ) ? raw_data_size_ : offset + length };
+
+            range_start_ = std::min( offset - offset % block_align, raw_data_size_ );
+            range_size_  = std::min( ( end + block_align - 1 ) / block_align * block_align, raw_data_size_ ) - range_start_;
+            if ( request.metadata_only() )
+            {
+                range_size_ = 0;
+            }
+
+            // where a broadcast left off, which is where its last chunk ended rather than on a whole frame
+            if ( resume_from > 0 && !transcoder_ )
+            {
+                auto const skipped{ std::min( resume_from, range_size_ ) };
+                range_start_ += skipped;
+                range_size_  -= skipped;
+            }
+
+            // a converted range starts earlier in the file, the resampler needs the frames leading up to it
+            source_block_align_ = std::max< std::uint16_t >( source_format.block_align, 1 );
+            source_position_    = transcoder_ ? transcoder_->seek( range_start_ / block_align ) * source_block_align_ : range_start_;
+
+            if ( song_reader_ && source_position_ > 0 && !song_reader_->seek( source_position_ ) )
+            {
+                range_size_ = 0;
+            }
+
+            // the samples of the range are read ahead while the chunks before them go out, the converted ones up to the end
+            if ( song_reader_ && song_reader_->valid() && read_pool && range_size_ > 0 )
+            {
+                auto const length{ transcoder_ ? data_size - source_position_ : range_size_ };
+                auto const direct{ server_options.direct_io_above > 0 && data_size >= server_options.direct_io_above };
+                read_ahead_.emplace( *read_pool, path.string(), song_reader_->layout.data_offset + source_position_, length, direct );
+                if ( !read_ahead_->valid() )
+                {
+                    read_ahead_.reset();
+                }
+            }
+
+            if ( request.codec() == Teleaudio::PAYLOAD_DELTA_RICE )
+            {
+                if ( Teleaudio::DeltaRiceCodec::supports( format ) )
+                {
+                    codec_.emplace( format );
+                }
+                else
+                {
+                    spdlog::debug( "Can't encode {} bit samples in format {}, sending them raw", format.bits_per_sample, format.audio_format );
+                }
+            }
+
+            byte_rate_ = format.byte_rate;
+
+            Teleaudio::AudioData metadata;
+            *metadata.mutable_metadata() = Teleaudio::makeMetadata( format, raw_data_size_, range_start_, range_size_, codec_ ? Teleaudio::PAYLOAD_DELTA_RICE : Teleaudio::PAYLOAD_RAW );
+
+            bool own_buffer{};
+            grpc::SerializationTraits< Teleaudio::AudioData >::Serialize( metadata, &metadata_, &own_buffer );
+        }
+
+        [[ nodiscard ]] grpc::ByteBuffer const & metadata() const { return metadata_; }
+
+        // Fills `message` with the next chunk of samples, false once everything has been sent
+        [[ nodiscard ]] bool next( grpc::ByteBuffer & message )
+        {
+            if ( bytes_sent_ >= range_size_ )
+            {
+                return false;
+            }
+
+            if ( subscription_ )
+            {
+                switch ( subscription_->next( message ) )
+                {
+                    case Teleaudio::Broadcast::Next::Message:
+                    {
+                        bytes_sent_ = subscription_->bytes_received();
+                        return true;
+                    }
+                    case Teleaudio::Broadcast::Next::End:
+                    {
+                        return false;
+                    }
+                    case Teleaudio::Broadcast::Next::Evicted:
+                    {
+                        spdlog::info( "Fell behind the broadcast of '{}' after {} bytes, carrying on alone", path_.filename().string(), bytes_sent_ );
+                        subscription_.reset();
+                        own_ = std::make_unique< DownloadStream >( path_, request_, false, bytes_sent_ );
+                        own_start_ = bytes_sent_;
+                        break;
+                    }
+                }
+            }
+
+            if ( own_ )
+            {
+                if ( !own_->next( message ) )
+                {
+                    return false;
+                }
+                bytes_sent_ = own_start_ + own_->bytes_sent();
+                return true;
+            }
+
+            if ( pack_ )
+            {
+                if ( ++packed_message_ >= pack_->messages() )
+                {
+                    return false;
+                }
+                last_chunk_size_  = pack_->samples( packed_message_ );
+                bytes_sent_      += pack_->samples( packed_message_ );
+                message = packedMessage( packed_message_ );
+                return true;
+            }
+
+            auto const chunk_size{ static_cast< std::size_t >( std::min< std::uint64_t >( chunk_sizer_.current(), range_size_ - bytes_sent_ ) ) };
+
+            grpc::Slice                  payload;
+            std::span< std::byte const > samples;
+            if ( transcoder_ )
+            {
+                if ( !transcode( chunk_size, payload, samples ) )
+                {
+                    return false;
+                }
+            }
+            else if ( mapped_song_ )
+            {
+                auto const mapped  { mapped_song_->data.data };
+                auto const position{ std::min< std::size_t >( range_start_ + bytes_sent_, mapped.size() ) };
+                auto const chunk   { mapped.subspan( position, std::min< std::size_t >( chunk_size, mapped.size() - position ) ) };
+                if ( chunk.empty() )
+                {
+                    return false;
+                }
+
+                // every slice holds a reference to the mapping until the transport is done with it,
+                // the mapping is read-only so casting away the const is fine
+                samples = chunk;
+                payload = grpc::Slice
+                {
+                    const_cast< std::byte * >( chunk.data() ),
+                    chunk.size(),
+                    []( void * const pin ) { delete static_cast< Teleaudio::FileCache::FilePtr * >( pin ); },
+                    new Teleaudio::FileCache::FilePtr{ mapped_song_ }
+                };
+            }
+            else
+            {
+                auto       buffer   { std::make_unique_for_overwrite< std::byte[] >( chunk_size )            };
+                auto const read_size{ readSamples( { buffer.get(), chunk_size } ) };
+                if ( read_size == 0 )
+                {
+                    return false;
+                }
+
+                // the buffer is released once gRPC has sent it
+                samples = { buffer.get(), read_size };
+                payload = grpc::Slice
+                {
+                    buffer.release(),
+                    read_size,
+                    []( void * const data ) { delete[] static_cast< std::byte * >( data ); }
+                };
+            }
+
+            bytes_sent_ += samples.size();
+            last_chunk_size_ = samples.size();
+
+            auto field{ Teleaudio::AudioData::kRawDataFieldNumber };
+            if ( codec_ )
+            {
+                auto const encode_start{ std::chrono::steady_clock::now() };
+                auto encoded{ std::make_unique< std::vector< std::byte > >( codec_->encode( samples ) ) };
+                encode_time_ += std::chrono::steady_clock::now() - encode_start;
+
+                // noise doesn't shrink, it's cheaper to send it as it is
+                if ( encoded->size() < samples.size() )
+                {
+                    field   = Teleaudio::AudioData::kEncodedDataFieldNumber;
+                    payload = grpc::Slice
+                    {
+                        encoded->data(),
+                        encoded->size(),
+                        []( void * const data ) { delete static_cast< std::vector< std::byte > * >( data ); },
+                        encoded.get()
+                    };
+                    encoded.release();
+                }
+                payload_bytes_sent_ += payload.size();
+            }
+
+            auto frame{ frameData( field, std::move( payload ) ) };
+            message.Swap( &frame );
+            return true;
+        }
+
+        // Feeds the time it took to send the last chunk to the adaptive chunk sizing
+        void written( std::chrono::nanoseconds const duration )
+        {
+            chunk_sizer_.record( last_chunk_size_, duration );
+            sent( duration );
+        }
+
+        // Counts the last chunk as sent, it took `duration` to write
+        void sent( std::chrono::nanoseconds const duration )
+        {
+            Teleaudio::Metrics::record( Teleaudio::Metrics::Histogram::WriteStall, duration );
+            Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::MessagesSent );
+            Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::BytesSent, bytes_sent_ - bytes_counted_ );
+            bytes_counted_ = bytes_sent_;
+        }
+
+        [[ nodiscard ]] std::uint64_t bytes_sent()    const { return bytes_sent_;    }
+        [[ nodiscard ]] std::uint64_t range_size()    const { return range_size_;    }
+
+        // Bytes per second of the streamed samples, as they're played back
+        [[ nodiscard ]] std::uint32_t byte_rate()     const { return byte_rate_;     }
+
+        // Logs how much was sent and, for encoded streams, how well and how fast it was encoded
+        void report() const
+        {
+            spdlog::info( "Sent {}/{} bytes in total", bytes_sent_, range_size_ );
+            if ( codec_ && payload_bytes_sent_ > 0 )
+            {
+                auto const seconds{ std::chrono::duration< double >( encode_time_ ).count() };
+                spdlog::info( "Encoded into {} bytes, ratio {:.2f}, at {:.1f} MB/s", payload_bytes_sent_,
+                              static_cast< double >( bytes_sent_ ) / static_cast< double >( payload_bytes_sent_ ),
+                              seconds > 0 ? static_cast< double >( bytes_sent_ ) / seconds / 1e6 : 0.0 );
+            }
+        }
+
+    private:
+        // Takes the sizes and the byte rate of the samples from a metadata message made elsewhere
+        void describe( grpc::ByteBuffer const & metadata )
+        {
+            metadata_ = metadata;
+
+            // deserializing consumes the buffer
+            grpc::ByteBuffer     copy{ metadata };
+            Teleaudio::AudioData parsed;
+            if ( grpc::SerializationTraits< Teleaudio::AudioData >::Deserialize( &copy, &parsed ).ok() )
+            {
+                raw_data_size_ = parsed.metadata().rawdatasize();
+                range_start_   = parsed.metadata().offset();
+                range_size_    = parsed.metadata().length();
+                byte_rate_     = parsed.metadata().averagebytespersecond();
+            }
+        }
+
+        // A message of the pack as it is, holding a reference to the mapping until the transport is done with it
+        [[ nodiscard ]] grpc::ByteBuffer packedMessage( std::size_t const index ) const
+        {
+            auto const bytes{ pack_->message( index ) };
+            grpc::Slice slice
+            {
+                const_cast< std::byte * >( bytes.data() ),
+                bytes.size(),
+                []( void * const pin ) { delete static_cast< Teleaudio::PackStore::PackPtr * >( pin ); },
+                new Teleaudio::PackStore::PackPtr{ pack_ }
+            };
+            return grpc::ByteBuffer{ &slice, 1 };
+        }
+
+        // The next samples of a file that isn't mapped, read ahead when there's a pool for that
+        [[ nodiscard ]] std::size_t readSamples( std::span< std::byte > const buffer )
+        {
+            return read_ahead_ ? read_ahead_->read( buffer ) : song_reader_->read( buffer );
+        }
+
+        // Converts samples of the file until there's a chunk of output, which it hands out as `payload`
+        [[ nodiscard ]] bool transcode( std::size_t const chunk_size, grpc::Slice & payload, std::span< std::byte const > & samples )
+        {
+            while ( converted_.size() - converted_offset_ < chunk_size && !source_done_ )
+            {
+                // about a chunk of the file at a time, in whole frames
+                auto const read_size{ std::max< std::size_t >( chunk_size / source_block_align_, 1 ) * source_block_align_ };
+
+                std::span< std::byte const > input;
+                if ( mapped_song_ )
+                {
+                    auto const mapped  { mapped_song_->data.data };
+                    auto const position{ std::min< std::size_t >( source_position_, mapped.size() ) };
+                    input = mapped.subspan( position, std::min( read_size, mapped.size() - position ) );
+                }
+                else
+                {
+                    input_.resize( read_size );
+                    input = std::span{ input_ }.first( readSamples( input_ ) );
+                }
+                input = input.first( input.size() - input.size() % source_block_align_ );
+
+                if ( input.empty() )
+                {
+                    transcoder_->finish( converted_ );
+                    source_done_ = true;
+                    break;
+                }
+                source_position_ += input.size();
+                transcoder_->push( input, converted_ );
+            }
+
+            auto const size{ std::min( chunk_size, converted_.size() - converted_offset_ ) };
+            if ( size == 0 )
+            {
+                return false;
+            }
+
+            auto buffer{ std::make_unique_for_overwrite< std::byte[] >( size ) };
+            std::copy_n( converted_.begin() + static_cast< std::ptrdiff_t >( converted_offset_ ), size, buffer.get() );
+            converted_offset_ += size;
+
+            // keeping only what's left for the next chunks
+            if ( converted_offset_ * 2 >= converted_.size() )
+            {
+                converted_.erase( converted_.begin(), converted_.begin() + static_cast< std::ptrdiff_t >( converted_offset_ ) );
+                converted_offset_ = 0;
+            }
+
+            samples = { buffer.get(), size };
+            payload = grpc::Slice
+            {
+                buffer.release(),
+                size,
+                []( void * const data ) { delete[] static_cast< std::byte * >( data ); }
+            };
+            return true;
+        }
+
+        Teleaudio::ChunkSizer              chunk_sizer_;
+
+        Teleaudio::FileCache::FilePtr      mapped_song_;
+        std::optional< WAV::FileReader >   song_reader_;
+        std::optional< FileUtils::ReadAhead > read_ahead_;
+
+        Teleaudio::PackStore::PackPtr      pack_;
+        std::size_t                        packed_message_{};
+
+        // the broadcast this stream is subscribed to, or the stream of its own it fell back to
+        std::optional< Teleaudio::Broadcast::Subscription > subscription_;
+        std::unique_ptr< DownloadStream >                   own_;
+        std::uint64_t                                       own_start_{};
+        fs::path                                            path_;
+        Teleaudio::File                                     request_;
+
+        grpc::ByteBuffer                   metadata_;
+        std::uint32_t                      byte_rate_{};
+        std::uint64_t                      raw_data_size_{};
+        std::uint64_t                      range_start_{};
+        std::uint64_t                      range_size_{};
+        std::uint64_t                      bytes_sent_{};
+        std::uint64_t                      bytes_counted_{}; // by the metrics
+        std::size_t                        last_chunk_size_{};
+
+        std::optional< Teleaudio::DeltaRiceCodec > codec_;
+        std::uint64_t                              payload_bytes_sent_{};
+        std::chrono::nanoseconds                   encode_time_{};
+
+        // where the next samples of the file are read from, which is ahead of the range when they're converted
+        std::optional< Teleaudio::Transcoder >     transcoder_;
+        std::uint64_t                              source_position_{};
+        std::uint16_t                              source_block_align_{ 1 };
+        bool                                       source_done_{ false };
+        std::vector< std::byte >                   input_;
+        std::vector< std::byte >                   converted_;
+        std::size_t                                converted_offset_{};
+    };
+
+    // Decides when the chunks of a paced stream may go out: the samples sent so far can run up to `lead`
+    // ahead of a playback that started when the stream did
+    class Pacer
+    {
+    public:
+        using Clock = Teleaudio::TimerWheel::Clock;
+
+        Pacer( std::uint32_t const byte_rate, std::chrono::milliseconds const lead )
+            : byte_rate_{ byte_rate }, lead_{ lead }
+        {}
+
+        // When the next chunk is due, with `bytes_sent` bytes of samples sent before it
+        [[ nodiscard ]] Clock::time_point due( std::uint64_t const bytes_sent ) const
+        {
+            // nothing to pace against
+            if ( byte_rate_ == 0 )
+            {
+                return start_;
+            }
+            auto const played{ std::chrono::duration< double >( static_cast< double >( bytes_sent ) / byte_rate_ ) };
+            return start_ + std::chrono::duration_cast< Clock::duration >( played ) - lead_;
+        }
+
+    private:
+        std::uint32_t             byte_rate_;
+        std::chrono::milliseconds lead_;
+        Clock::time_point         start_{ Clock::now() };
+    };
+
+    [[ nodiscard ]] std::chrono::milliseconds streamLead( Teleaudio::StreamRequest const & request )
+    {
+        return std::chrono::milliseconds{ request.lead_milliseconds() > 0 ? request.lead_milliseconds() : server_options.stream_lead_ms };
+    }
+
+    // Counts a `Download` or `Stream` as active for as long as it lives, and records how long its steps took
+    class CallMetrics
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit CallMetrics( Teleaudio::Metrics::Counter const calls )
+        {
+            Teleaudio::Metrics::add( calls );
+            Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::ActiveStreams );
+        }
+
+        ~CallMetrics()
+        {
+            Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::ActiveStreams, -1 );
+        }
+
+        CallMetrics( CallMetrics const & )             = delete;
+        CallMetrics & operator=( CallMetrics const & ) = delete;
+
+        // The file is ready to be streamed
+        void loaded()    const { Teleaudio::Metrics::record( Teleaudio::Metrics::Histogram::FileLoad,         Clock::now() - start_ ); }
+
+        // The metadata is written
+        void firstByte() const { Teleaudio::Metrics::record( Teleaudio::Metrics::Histogram::FirstByte,        Clock::now() - start_ ); }
+
+        // The last chunk is written
+        void done()      const { Teleaudio::Metrics::record( Teleaudio::Metrics::Histogram::DownloadDuration, Clock::now() - start_ ); }
+
+    private:
+        Clock::time_point const start_{ Clock::now() };
+    };
+
+    [[ nodiscard ]] std::string timedLs( std::string_view const directory )
+    {
+        auto const start{ std::chrono::steady_clock::now() };
+        auto       text { ls( directory ) };
+        Teleaudio::Metrics::add( Teleaudio::Metrics::Counter::ListCalls );
+        Teleaudio::Metrics::record( Teleaudio::Metrics::Histogram::ListLatency, std::chrono::steady_clock::now() - start );
+        return text;
+    }
+
+    [[ nodiscard ]] Teleaudio::FileInfo toFileInfo( Teleaudio::CatalogEntry const & entry )
     {
-        Teleaudio::AudioMetadata ret;
-        ret.set_averagebytespersecond( fmt.byte_rate       );
-        ret.set_bitspersample        ( fmt.bits_per_sample );
-        ret.set_blockalign           ( fmt.block_align     );
-        ret.set_channels             ( fmt.num_channels    );
-        ret.set_samplerate           ( fmt.sample_rate     );
+        Teleaudio::FileInfo info;
+        info.set_name           ( entry.name                   );
+        info.set_size           ( entry.size                   );
+        info.set_channels       ( entry.format.num_channels    );
+        info.set_sample_rate    ( entry.format.sample_rate     );
+        info.set_bits_per_sample( entry.format.bits_per_sample );
+        info.set_duration       ( entry.duration()             );
+        info.set_mtime          ( entry.mtime                  );
+        info.set_raw_data_size  ( entry.raw_data_size          );
+        info.set_block_align    ( entry.format.block_align     );
+        info.set_valid          ( entry.valid                  );
+        return info;
+    }
 
-        return ret;
+    [[ nodiscard ]] std::optional< fs::path > findSong( std::string_view const name )
+    {
+        auto const file{ storage_directory / name };
+        if ( !fs::exists( file ) )
+        {
+            spdlog::error( "File '{}' not available for playing.", file.string() );
+            return std::nullopt;
+        }
+        return file;
     }
 }
 
 namespace Teleaudio
 {
 
-class TeleaudioImpl final : public AudioService::Service
+// `Download` is not implemented here, each server flavour plugs in a handler
+// that writes the already serialized ByteBuffers of a DownloadStream
+class TeleaudioImpl : public AudioService::Service
 {
 
     grpc::Status List( grpc::ServerContext *, Directory const * request, CmdOutput * response ) override
     {
-        response->set_text( ls( request->path() ) );
+        response->set_text( timedLs( request->path() ) );
         return grpc::Status::OK;
     }
 
-    grpc::Status Download( grpc::ServerContext *, File const * request, grpc::ServerWriter< AudioData > * writer ) override
+    grpc::Status Checksums( grpc::ServerContext *, File const * request, FileChecksums * response ) override
     {
-        auto const file{ storage_directory / request->name() };
-        if ( !fs::exists( file ) )
+        auto const file{ findSong( request->name() ) };
+        if ( !file.has_value() )
         {
-            spdlog::error( "File '{}' not available for playing.", file.string() );
-            return grpc::Status::OK;
+            return grpc::Status{ grpc::StatusCode::NOT_FOUND, "No such file" };
         }
 
-        WAV::File song{ file.string() };
-        if ( !song.valid() )
+        // only the headers are read here, the samples were checksummed by the pool
+        auto const             checksums{ checksum_cache->get( *file ) };
+        WAV::FileReader const  reader   { file->string() };
+        if ( !checksums || !reader.valid() || reader.data_size != checksums->size )
         {
-            // TODO: there are 40 bytes extra in the file AWESOME.wav somewhere
-            // the math doesn't add up
-            // TODO: parsing LINE sections
-            spdlog::debug( "Loaded file is not valid" );
+            return grpc::Status{ grpc::StatusCode::FAILED_PRECONDITION, "The file can't be checksummed" };
         }
 
-        // sending metadata first
-        AudioMetadata metadata{ setMetadata( song.format ) };
-        metadata.set_rawdatasize( song.data.subchunk2_size );
+        *response->mutable_metadata() = makeMetadata( reader.format, checksums->size, 0, checksums->size, PAYLOAD_RAW );
+        response->set_crc32c    ( checksums->crc        );
+        response->set_block_size( checksums->block_size );
+        response->mutable_blocks()->Add( checksums->blocks.begin(), checksums->blocks.end() );
+        return grpc::Status::OK;
+    }
+
+    grpc::Status GetPeaks( grpc::ServerContext *, PeaksRequest const * request, Peaks * response ) override
+    {
+        // about a screen wide, and no more than fit into a message
+        std::size_t const default_resolution{ 1024 };
+        std::size_t const max_resolution    { 64 * 1024 };
+        auto const resolution{ request->resolution() == 0 ? default_resolution : std::min< std::size_t >( request->resolution(), max_resolution ) };
+
+        if ( !findSong( request->name() ).has_value() )
+        {
+            return grpc::Status{ grpc::StatusCode::NOT_FOUND, "No such file" };
+        }
+
+        auto const overview{ peak_store->overview( request->name(), request->start_frame(), request->frames(), resolution ) };
+        if ( !overview.has_value() )
+        {
+            return grpc::Status{ grpc::StatusCode::FAILED_PRECONDITION, "The samples of the file can't be summarized" };
+        }
 
-        AudioData metadata_response;
-        *metadata_response.mutable_metadata() = metadata;
+        response->set_channels   ( overview->format.num_channels );
+        response->set_sample_rate( overview->format.sample_rate  );
+        response->set_start_frame( overview->start_frame );
+        response->set_frames     ( overview->frames      );
+        response->set_buckets    ( static_cast< std::uint32_t >( overview->buckets ) );
 
-        if ( !writer->Write( metadata_response ) )
+        auto const count{ static_cast< int >( overview->peaks.size() ) };
+        response->mutable_min()->Reserve( count );
+        response->mutable_max()->Reserve( count );
+        response->mutable_rms()->Reserve( count );
+        for ( auto const & peak : overview->peaks )
+        {
+            response->add_min( peak.min );
+            response->add_max( peak.max );
+            response->add_rms( std::sqrt( peak.mean_square ) );
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status GetMetrics( grpc::ServerContext *, MetricsRequest const *, MetricsReport * response ) override
+    {
+        auto const snapshot{ Metrics::collect() };
+        for ( std::size_t i{}; i < Metrics::counter_count; ++i )
+        {
+            auto & counter{ *response->add_counters() };
+            counter.set_name ( std::string{ Metrics::name( static_cast< Metrics::Counter >( i ) ) } );
+            counter.set_value( snapshot.counters[ i ] );
+        }
+
+        auto const seconds{ []( std::chrono::nanoseconds const duration ) { return std::chrono::duration< double >( duration ).count(); } };
+        for ( std::size_t i{}; i < Metrics::histogram_count; ++i )
+        {
+            auto const & values   { snapshot.histograms[ i ] };
+            auto       & histogram{ *response->add_histograms() };
+            histogram.set_name ( std::string{ Metrics::name( static_cast< Metrics::Histogram >( i ) ) } );
+            histogram.set_count( values.count );
+            histogram.set_sum  ( static_cast< double >( values.sum ) / 1e9 );
+            histogram.set_p50  ( seconds( values.percentile( 0.5   ) ) );
+            histogram.set_p90  ( seconds( values.percentile( 0.9   ) ) );
+            histogram.set_p99  ( seconds( values.percentile( 0.99  ) ) );
+            histogram.set_p999 ( seconds( values.percentile( 0.999 ) ) );
+            histogram.set_max  ( static_cast< double >( values.max ) / 1e9 );
+        }
+
+        response->set_prometheus( Metrics::prometheus( snapshot ) );
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Stat( grpc::ServerContext *, File const * request, FileInfo * response ) override
+    {
+        auto const entry{ catalog->stat( request->name() ) };
+        if ( !entry.has_value() )
+        {
+            return grpc::Status{ grpc::StatusCode::NOT_FOUND, "No such file" };
+        }
+
+        *response = toFileInfo( *entry );
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ListDetailed( grpc::ServerContext *, Directory const * request, FileInfoList * response ) override
+    {
+        auto const entries{ catalog->list( request->path() ) };
+        if ( !entries.has_value() )
+        {
+            return grpc::Status{ grpc::StatusCode::NOT_FOUND, "No such directory" };
+        }
+
+        response->mutable_files()->Reserve( static_cast< int >( entries->size() ) );
+        for ( auto const & entry : *entries )
+        {
+            *response->add_files() = toFileInfo( entry );
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ListStream( grpc::ServerContext * context, ListRequest const * request, grpc::ServerWriter< FileInfoList > * writer ) override
+    {
+        // big enough to keep the number of messages down, small enough to stay far below the message size limit
+        std::uint32_t const default_page_size{ 1000  };
+        std::uint32_t const max_page_size    { 10000 };
+        auto const page_size{ request->page_size() == 0 ? default_page_size : std::min( request->page_size(), max_page_size ) };
+
+        CatalogFilter const filter
+        {
+            .prefix          = request->prefix(),
+            .channels        = request->channels(),
+            .sample_rate     = request->sample_rate(),
+            .bits_per_sample = request->bits_per_sample(),
+            .min_duration    = request->min_duration(),
+            .max_duration    = request->max_duration()
+        };
+
+        // only one page is held at a time, the catalog is locked just while it's being copied
+        std::string start_after{ request->start_after() };
+        while ( !context->IsCancelled() )
+        {
+            auto const entries{ catalog->page( request->path(), start_after, page_size, filter ) };
+            if ( !entries.has_value() )
+            {
+                return grpc::Status{ grpc::StatusCode::NOT_FOUND, "No such directory" };
+            }
+            if ( entries->empty() )
+            {
+                break;
+            }
+
+            FileInfoList page;
+            page.mutable_files()->Reserve( static_cast< int >( entries->size() ) );
+            for ( auto const & entry : *entries )
+            {
+                *page.add_files() = toFileInfo( entry );
+            }
+            if ( !writer->Write( page ) )
+            {
+                return grpc::Status::CANCELLED;
+            }
+
+            if ( entries->size() < page_size )
+            {
+                break;
+            }
+            start_after = entries->back().name;
+        }
+
+        return grpc::Status::OK;
+    }
+
+}; // class TeleaudioImpl
+
+class SyncTeleaudioService final : public TeleaudioImpl
+{
+public:
+    SyncTeleaudioService()
+    {
+        // same as the generated `WithSplitStreamingMethod_Download`, just writing raw bytes.
+        // The generated code hardcodes the indices of the methods, they're looked up so they follow the .proto
+        if ( auto const download_method_index{ methodIndex( "Download" ) } )
+        {
+            MarkMethodStreamed
+            (
+                *download_method_index,
+                new grpc::internal::SplitServerStreamingHandler< File, grpc::ByteBuffer >
+                (
+                    [ this ]( grpc::ServerContext * context, grpc::ServerSplitStreamer< File, grpc::ByteBuffer > * stream )
+                    {
+                        return Download( context, stream );
+                    }
+                )
+            );
+        }
+
+        // the same for `Stream`
+        if ( auto const stream_method_index{ methodIndex( "Stream" ) } )
+        {
+            MarkMethodStreamed
+            (
+                *stream_method_index,
+                new grpc::internal::SplitServerStreamingHandler< StreamRequest, grpc::ByteBuffer >
+                (
+                    [ this ]( grpc::ServerContext * context, grpc::ServerSplitStreamer< StreamRequest, grpc::ByteBuffer > * stream )
+                    {
+                        return Stream( context, stream );
+                    }
+                )
+            );
+        }
+    }
+
+private:
+    grpc::Status Download( grpc::ServerContext *, grpc::ServerSplitStreamer< File, grpc::ByteBuffer > * stream )
+    {
+        CallMetrics const metrics{ Metrics::Counter::DownloadCalls };
+
+        File request;
+        if ( !stream->Read( &request ) )
+        {
+            return grpc::Status::CANCELLED;
+        }
+
+        auto const file{ findSong( request.name() ) };
+        if ( !file.has_value() )
+        {
+            return grpc::Status::OK;
+        }
+
+        DownloadStream song{ *file, request };
+        metrics.loaded();
+
+        // sending metadata first
+        if ( !stream->Write( song.metadata() ) )
         {
             spdlog::error( "Sending metadata failed, exiting" );
             return grpc::Status::OK;
         }
+        metrics.firstByte();
 
-        // sending the raw data, chunking if bigger than `chunk_size`
+        // sending the raw data
+        grpc::ByteBuffer rawdata_response;
+        while ( song.next( rawdata_response ) )
+        {
+            auto const write_start{ std::chrono::steady_clock::now() };
+            if ( !stream->Write( rawdata_response ) )
+            {
+                spdlog::error( "Failed to write raw data." );
+                return grpc::Status::CANCELLED;
+            }
+            song.written( std::chrono::steady_clock::now() - write_start );
+        }
+        metrics.done();
 
-        std::uint32_t const chunk_size     { 5 * 1024 }; // 5 KiB
-        std::uint32_t       bytes_remaining{ song.data.subchunk2_size };
-        std::uint32_t       byte_offset    {};
+        song.report();
 
-        auto const payload_data{ reinterpret_cast< char const * >( song.data.data.get() ) };
+        return grpc::Status::OK;
+    }
 
-        AudioData rawdata_response;
-        while ( bytes_remaining > 0 )
+    // The thread of the call waits for the timer wheel between the chunks
+    grpc::Status Stream( grpc::ServerContext * context, grpc::ServerSplitStreamer< StreamRequest, grpc::ByteBuffer > * stream )
+    {
+        CallMetrics const metrics{ Metrics::Counter::StreamCalls };
+
+        StreamRequest request;
+        if ( !stream->Read( &request ) )
+        {
+            return grpc::Status::CANCELLED;
+        }
+
+        auto const file{ findSong( request.file().name() ) };
+        if ( !file.has_value() )
+        {
+            return grpc::Status::OK;
+        }
+
+        DownloadStream song{ *file, request.file() };
+        Pacer const    pacer{ song.byte_rate(), streamLead( request ) };
+        metrics.loaded();
+
+        if ( !stream->Write( song.metadata() ) )
         {
-            auto const payload_size{ std::min( bytes_remaining, chunk_size ) };
+            spdlog::error( "Sending metadata failed, exiting" );
+            return grpc::Status::OK;
+        }
+        metrics.firstByte();
 
-            rawdata_response.set_rawdata( payload_data + byte_offset, payload_size );
+        grpc::ByteBuffer rawdata_response;
+        while ( !context->IsCancelled() )
+        {
+            // a stopped wheel means the server is shutting down, there's no point in waiting
+            std::promise< void > woken;
+            auto const due{ pacer.due( song.bytes_sent() ) };
+            if ( due > Pacer::Clock::now() && timer_wheel->schedule( due, [ &woken ] { woken.set_value(); } ) )
+            {
+                woken.get_future().wait();
+            }
 
-            if ( !writer->Write( rawdata_response ) )
+            if ( !song.next( rawdata_response ) )
+            {
+                break;
+            }
+            auto const write_start{ std::chrono::steady_clock::now() };
+            if ( !stream->Write( rawdata_response ) )
             {
                 spdlog::error( "Failed to write raw data." );
                 return grpc::Status::CANCELLED;
             }
-
-            bytes_remaining -= payload_size;
-            byte_offset     += payload_size;
+            song.sent( std::chrono::steady_clock::now() - write_start );
         }
 
-        spdlog::info( "Sent {}/{} bytes in total", byte_offset, song.data.subchunk2_size );
+        song.report();
 
         return grpc::Status::OK;
     }
+}; // class SyncTeleaudioService
 
-}; // class TeleaudioImpl
+// `List`, `Download` and `Stream` are served from completion queues, anything else stays synchronous
+using AsyncTeleaudioService = AudioService::WithAsyncMethod_List< AudioService::WithRawMethod_Download< AudioService::WithRawMethod_Stream< TeleaudioImpl > > >;
+
+// A single in-flight asynchronous call, `proceed` is invoked whenever
+// one of its operations completes on the completion queue
+class CallData
+{
+public:
+    virtual ~CallData() = default;
+
+    virtual void proceed( bool ok ) = 0;
+};
+
+class ListCall final : public CallData
+{
+public:
+    ListCall( AsyncTeleaudioService * const service, grpc::ServerCompletionQueue * const cq )
+        : service_{ service }, cq_{ cq }
+    {
+        service_->RequestList( &context_, &request_, &responder_, cq_, cq_, this );
+    }
+
+    void proceed( bool const ok ) override
+    {
+        switch ( state_ )
+        {
+            case State::Waiting:
+            {
+                // the queue is shutting down
+                if ( !ok )
+                {
+                    delete this;
+                    return;
+                }
 
+                // keep accepting new calls while this one is being served
+                new ListCall( service_, cq_ );
 
-void run_server( std::string_view const directory, std::uint16_t const port )
+                response_.set_text( timedLs( request_.path() ) );
+
+                state_ = State::Finishing;
+                responder_.Finish( response_, grpc::Status::OK, this );
+                break;
+            }
+            case State::Finishing:
+            {
+                delete this;
+                break;
+            }
+        }
+    }
+
+private:
+    enum class State : std::uint8_t
+    {
+        Waiting,
+        Finishing
+    };
+
+    AsyncTeleaudioService       * service_;
+    grpc::ServerCompletionQueue * cq_;
+
+    grpc::ServerContext                          context_;
+    Directory                                    request_;
+    CmdOutput                                    response_;
+    grpc::ServerAsyncResponseWriter< CmdOutput > responder_{ &context_ };
+
+    State state_{ State::Waiting };
+};
+
+class DownloadCall final : public CallData
+{
+public:
+    DownloadCall( AsyncTeleaudioService * const service, grpc::ServerCompletionQueue * const cq )
+        : service_{ service }, cq_{ cq }
+    {
+        service_->RequestDownload( &context_, &raw_request_, &writer_, cq_, cq_, this );
+    }
+
+    void proceed( bool const ok ) override
+    {
+        switch ( state_ )
+        {
+            case State::Waiting:
+            {
+                // the queue is shutting down
+                if ( !ok )
+                {
+                    delete this;
+                    return;
+                }
+
+                // keep accepting new calls while this one is being served
+                new DownloadCall( service_, cq_ );
+                metrics_.emplace( Metrics::Counter::DownloadCalls );
+
+                File request;
+                if ( !grpc::SerializationTraits< File >::Deserialize( &raw_request_, &request ).ok() )
+                {
+                    finish( grpc::Status{ grpc::StatusCode::INVALID_ARGUMENT, "Malformed request" } );
+                    return;
+                }
+
+                auto const file{ findSong( request.name() ) };
+                if ( !file.has_value() )
+                {
+                    finish( grpc::Status::OK );
+                    return;
+                }
+
+                // sending metadata first
+                song_.emplace( *file, request );
+                metrics_->loaded();
+                state_ = State::Writing;
+                writer_.Write( song_->metadata(), this );
+                break;
+            }
+            case State::Writing:
+            {
+                // the stream is broken, finishing it still hands the call back to be deleted
+                if ( !ok )
+                {
+                    spdlog::error( "Failed to write raw data." );
+                    finish( grpc::Status::CANCELLED );
+                    return;
+                }
+
+                if ( song_->bytes_sent() > 0 )
+                {
+                    song_->written( std::chrono::steady_clock::now() - write_start_ );
+                }
+                else
+                {
+                    metrics_->firstByte();
+                }
+
+                // the previous write is done with the message, it can be refilled
+                if ( song_->next( rawdata_response_ ) )
+                {
+                    write_start_ = std::chrono::steady_clock::now();
+                    writer_.Write( rawdata_response_, this );
+                    return;
+                }
+
+                metrics_->done();
+                song_->report();
+                finish( grpc::Status::OK );
+                break;
+            }
+            case State::Finishing:
+            {
+                delete this;
+                break;
+            }
+        }
+    }
+
+private:
+    enum class State : std::uint8_t
+    {
+        Waiting,
+        Writing,
+        Finishing
+    };
+
+    void finish( grpc::Status const & status )
+    {
+        state_ = State::Finishing;
+        writer_.Finish( status, this );
+    }
+
+    AsyncTeleaudioService       * service_;
+    grpc::ServerCompletionQueue * cq_;
+
+    grpc::ServerContext                         context_;
+    grpc::ByteBuffer                            raw_request_;
+    grpc::ServerAsyncWriter< grpc::ByteBuffer > writer_{ &context_ };
+
+    std::optional< CallMetrics >                metrics_;
+    std::optional< DownloadStream >             song_;
+    grpc::ByteBuffer                            rawdata_response_;
+    std::chrono::steady_clock::time_point       write_start_;
+
+    State state_{ State::Waiting };
+};
+
+// A paced `Stream`. Between the chunks it sits in the timer wheel, which only sets off an alarm
+// on the completion queue once the next chunk is due, so the chunks are read on the polling threads
+class StreamCall final : public CallData
+{
+public:
+    StreamCall( AsyncTeleaudioService * const service, grpc::ServerCompletionQueue * const cq )
+        : service_{ service }, cq_{ cq }
+    {
+        service_->RequestStream( &context_, &raw_request_, &writer_, cq_, cq_, this );
+    }
+
+    void proceed( bool const ok ) override
+    {
+        switch ( state_ )
+        {
+            case State::Waiting:
+            {
+                // the queue is shutting down
+                if ( !ok )
+                {
+                    delete this;
+                    return;
+                }
+
+                // keep accepting new calls while this one is being served
+                new StreamCall( service_, cq_ );
+                metrics_.emplace( Metrics::Counter::StreamCalls );
+
+                StreamRequest request;
+                if ( !grpc::SerializationTraits< StreamRequest >::Deserialize( &raw_request_, &request ).ok() )
+                {
+                    finish( grpc::Status{ grpc::StatusCode::INVALID_ARGUMENT, "Malformed request" } );
+                    return;
+                }
+
+                auto const file{ findSong( request.file().name() ) };
+                if ( !file.has_value() )
+                {
+                    finish( grpc::Status::OK );
+                    return;
+                }
+
+                song_.emplace( *file, request.file() );
+                pacer_.emplace( song_->byte_rate(), streamLead( request ) );
+                metrics_->loaded();
+                state_ = State::Writing;
+                writer_.Write( song_->metadata(), this );
+                break;
+            }
+            case State::Writing:
+            {
+                // the stream is broken, finishing it still hands the call back to be deleted
+                if ( !ok )
+                {
+                    spdlog::error( "Failed to write raw data." );
+                    finish( grpc::Status::CANCELLED );
+                    return;
+                }
+
+                if ( song_->bytes_sent() > 0 )
+                {
+                    song_->sent( std::chrono::steady_clock::now() - write_start_ );
+                }
+                else
+                {
+                    metrics_->firstByte();
+                }
+
+                // the wheel may fire before `schedule` even returns
+                auto const due{ pacer_->due( song_->bytes_sent() ) };
+                state_ = State::Pacing;
+                if ( due > Pacer::Clock::now() && timer_wheel->schedule( due, [ this ] { alarm_.Set( cq_, gpr_now( GPR_CLOCK_MONOTONIC ), this ); } ) )
+                {
+                    return;
+                }
+                send();
+                break;
+            }
+            case State::Pacing:
+            {
+                send();
+                break;
+            }
+            case State::Finishing:
+            {
+                delete this;
+                break;
+            }
+        }
+    }
+
+private:
+    enum class State : std::uint8_t
+    {
+        Waiting,
+        Writing,
+        Pacing,
+        Finishing
+    };
+
+    // the previous write is done with the message, it can be refilled
+    void send()
+    {
+        if ( song_->next( rawdata_response_ ) )
+        {
+            state_       = State::Writing;
+            write_start_ = std::chrono::steady_clock::now();
+            writer_.Write( rawdata_response_, this );
+            return;
+        }
+
+        song_->report();
+        finish( grpc::Status::OK );
+    }
+
+    void finish( grpc::Status const & status )
+    {
+        state_ = State::Finishing;
+        writer_.Finish( status, this );
+    }
+
+    AsyncTeleaudioService       * service_;
+    grpc::ServerCompletionQueue * cq_;
+
+    grpc::ServerContext                         context_;
+    grpc::ByteBuffer                            raw_request_;
+    grpc::ServerAsyncWriter< grpc::ByteBuffer > writer_{ &context_ };
+
+    std::optional< CallMetrics >                metrics_;
+    std::optional< DownloadStream >             song_;
+    std::optional< Pacer >                      pacer_;
+    grpc::Alarm                                 alarm_;
+    grpc::ByteBuffer                            rawdata_response_;
+    std::chrono::steady_clock::time_point       write_start_;
+
+    State state_{ State::Waiting };
+};
+
+void poll_completion_queue( grpc::ServerCompletionQueue * const cq )
+{
+    void * tag{};
+    bool   ok {};
+    while ( cq->Next( &tag, &ok ) )
+    {
+        static_cast< CallData * >( tag )->proceed( ok );
+    }
+}
+
+struct Server::Impl
+{
+    std::unique_ptr< SyncTeleaudioService >                       sync_service;
+    std::unique_ptr< AsyncTeleaudioService >                      async_service;
+    std::vector< std::unique_ptr< grpc::ServerCompletionQueue > > queues;
+
+    std::unique_ptr< grpc::Server >                               server;
+    std::vector< std::jthread >                                   pollers;
+    int                                                           port{};
+};
+
+Server::Server( std::string_view const directory, std::uint16_t const port, ServerOptions const & options )
+    : impl_{ std::make_unique< Impl >() }
 {
     storage_directory = directory;
+    server_options    = options;
 
-    auto const server_address{ "0.0.0.0:" + std::to_string( port ) };
+    catalog = std::make_unique< Catalog >( storage_directory );
+
+    file_cache.reset();
+    if ( options.cache_size > 0 )
+    {
+        file_cache = std::make_unique< FileCache >( options.cache_size );
+        spdlog::info( "Caching up to {} bytes of audio files", options.cache_size );
+    }
+
+    timer_wheel = std::make_unique< TimerWheel >();
 
-    Teleaudio::TeleaudioImpl service;
+    checksum_cache = std::make_unique< ChecksumCache >( options.checksum_threads );
+
+    peak_store = std::make_unique< PeakStore >( storage_directory, options.peaks_directory, options.peaks_budget );
+
+    read_pool.reset();
+    if ( options.io_backend != FileUtils::IoBackend::Stdio )
+    {
+        read_pool = std::make_unique< FileUtils::ReadPool >( options.io_backend, options.read_block_size, options.read_ahead );
+        spdlog::info( "Reading the files with {}, {} blocks of {} bytes ahead", read_pool->backend() == FileUtils::IoBackend::Uring ? "io_uring" : "pread",
+                      read_pool->depth(), read_pool->block_size() );
+    }
+
+    broadcaster.reset();
+    if ( options.broadcast_ring > 0 )
+    {
+        broadcaster = std::make_unique< Broadcaster >();
+        spdlog::info( "Broadcasting downloads of the same file, keeping {} messages for late subscribers", options.broadcast_ring );
+    }
+
+    metrics_exporter.reset();
+    if ( options.metrics_port > 0 )
+    {
+        metrics_exporter = std::make_unique< Metrics::Exporter >( options.metrics_port );
+    }
+
+    pack_store.reset();
+    if ( !options.pack_directory.empty() )
+    {
+        pack_store = std::make_unique< PackStore >( storage_directory, options.pack_directory, options.chunk_size, options.pack_budget );
+        spdlog::info( "Packing files into '{}', up to {} bytes", options.pack_directory, options.pack_budget );
+    }
+
+    auto const server_address{ "0.0.0.0:" + std::to_string( port ) };
 
     grpc::ServerBuilder builder;
 
     // Listen on the given address without any authentication mechanism.
-    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials(), &impl_->port);
+
+    if ( !options.async )
+    {
+        impl_->sync_service = std::make_unique< SyncTeleaudioService >();
+
+        // Register "service" as the instance through which we'll synchronously
+        // communicate with clients.
+        builder.RegisterService(impl_->sync_service.get());
+
+        // Finally assemble and start the server.
+        impl_->server = builder.BuildAndStart();
+
+        spdlog::info( "Server listening on {}", server_address );
+        return;
+    }
+
+    impl_->async_service = std::make_unique< AsyncTeleaudioService >();
+    builder.RegisterService( impl_->async_service.get() );
+
+    auto const queue_count{ options.completion_queues > 0 ? options.completion_queues : std::max( 1U, std::thread::hardware_concurrency() ) };
+    auto const queue_threads{ std::max< std::size_t >( 1, options.threads_per_queue ) };
+
+    for ( std::size_t i{}; i < queue_count; ++i )
+    {
+        impl_->queues.push_back( builder.AddCompletionQueue() );
+    }
+
+    impl_->server = builder.BuildAndStart();
+
+    spdlog::info( "Server listening on {}, serving from {} completion queues with {} threads each", server_address, queue_count, queue_threads );
+
+    for ( auto const & cq : impl_->queues )
+    {
+        for ( std::size_t i{}; i < queue_threads; ++i )
+        {
+            // one pending call of each kind per thread, every accepted call requests its successor
+            new ListCall    ( impl_->async_service.get(), cq.get() );
+            new DownloadCall( impl_->async_service.get(), cq.get() );
+            new StreamCall  ( impl_->async_service.get(), cq.get() );
+
+            impl_->pollers.emplace_back( poll_completion_queue, cq.get() );
+        }
+    }
+}
+
+Server::~Server()
+{
+    shutdown();
+}
+
+std::uint16_t Server::port() const
+{
+    return static_cast< std::uint16_t >( impl_->port );
+}
+
+std::uint16_t Server::metrics_port() const
+{
+    return metrics_exporter ? metrics_exporter->port() : std::uint16_t{};
+}
+
+void Server::wait()
+{
+    impl_->server->Wait();
+}
+
+void Server::shutdown()
+{
+    if ( !impl_->server )
+    {
+        return;
+    }
 
-    // Register "service" as the instance through which we'll synchronously
-    // communicate with clients.
-    builder.RegisterService(&service);
+    // the paced streams go on unpaced until the shutdown cancels them
+    timer_wheel->stop();
 
-    // Finally assemble and start the server.
-    std::unique_ptr< grpc::Server > server( builder.BuildAndStart() );
+    impl_->server->Shutdown();
 
-    spdlog::info( "Server listening on {}", server_address );
+    // the queues can only be drained after the server is shut down
+    for ( auto const & cq : impl_->queues )
+    {
+        cq->Shutdown();
+    }
+    impl_->pollers.clear();
+
+    impl_->server.reset();
+
+    // stops following the storage
+    catalog.reset();
+
+    // stops packing in the background
+    pack_store.reset();
+
+    broadcaster.reset();
+
+    metrics_exporter.reset();
+
+    checksum_cache.reset();
+
+    peak_store.reset();
+
+    timer_wheel.reset();
+
+    // after the streams reading through it
+    read_pool.reset();
+}
+
+void run_server( std::string_view const directory, std::uint16_t const port, ServerOptions const & options )
+{
+    Server server{ directory, port, options };
 
     // Wait for the server to shutdown. Note that some other thread must be
     // responsible for shutting down the server for this call to ever return.
-    // TODO: shut the server down in tests
-    server->Wait();
+    server.wait();
 }
 
 } // namespace Teleaudio
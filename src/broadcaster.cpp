@@ -0,0 +1,118 @@
+#include "broadcaster.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace Teleaudio
+{
+    Broadcast::Broadcast( grpc::ByteBuffer metadata, Producer producer, std::size_t const capacity )
+        : metadata_{ std::move( metadata ) }
+        , producer_{ std::move( producer ) }
+        , ring_    ( std::max< std::size_t >( capacity, 1 ) )
+    {}
+
+    std::optional< Broadcast::Subscription > Broadcast::subscribe( std::shared_ptr< Broadcast > const & broadcast )
+    {
+        std::lock_guard lock{ broadcast->mutex_ };
+        if ( broadcast->tail_ > 0 )
+        {
+            return std::nullopt;
+        }
+        return Subscription{ broadcast };
+    }
+
+    std::uint64_t Broadcast::evictions() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return evictions_;
+    }
+
+    Broadcast::Next Broadcast::Subscription::next( grpc::ByteBuffer & message )
+    {
+        auto & broadcast{ *broadcast_ };
+
+        std::unique_lock lock{ broadcast.mutex_ };
+        while ( true )
+        {
+            // overwritten by the faster ones
+            if ( position_ < broadcast.tail_ )
+            {
+                ++broadcast.evictions_;
+                return Next::Evicted;
+            }
+
+            if ( position_ < broadcast.head_ )
+            {
+                break;
+            }
+
+            if ( broadcast.ended_ )
+            {
+                return Next::End;
+            }
+
+            // someone else is already producing it
+            if ( broadcast.producing_ )
+            {
+                broadcast.produced_.wait( lock );
+                continue;
+            }
+
+            // the first one to get here produces the message for everyone, the others keep reading the ring meanwhile.
+            // It goes into a slot of its own, the one in the ring may still be read until it's replaced
+            broadcast.producing_ = true;
+            lock.unlock();
+
+            Slot       produced;
+            auto const ok{ broadcast.producer_( produced.message, produced.samples ) };
+
+            lock.lock();
+            broadcast.producing_ = false;
+            if ( !ok )
+            {
+                broadcast.ended_    = true;
+                broadcast.producer_ = nullptr;
+                broadcast.produced_.notify_all();
+                return Next::End;
+            }
+
+            broadcast.ring_[ broadcast.head_ % broadcast.ring_.size() ] = std::move( produced );
+            ++broadcast.head_;
+            broadcast.tail_ = std::max( broadcast.tail_, broadcast.head_ - std::min< std::uint64_t >( broadcast.head_, broadcast.ring_.size() ) );
+            broadcast.produced_.notify_all();
+        }
+
+        // a copy only takes references to the slices
+        auto const & slot{ broadcast.ring_[ position_ % broadcast.ring_.size() ] };
+        message          = slot.message;
+        bytes_received_ += slot.samples;
+        ++position_;
+        return Next::Message;
+    }
+
+    std::optional< Broadcast::Subscription > Broadcaster::subscribe( std::string const & key, Starter const & start )
+    {
+        std::lock_guard lock{ mutex_ };
+
+        // the downloads that are over
+        std::erase_if( broadcasts_, []( auto const & entry ) { return entry.second.expired(); } );
+
+        if ( auto const running{ broadcasts_[ key ].lock() } )
+        {
+            if ( auto subscription{ Broadcast::subscribe( running ) } )
+            {
+                return subscription;
+            }
+        }
+
+        // too late to join, the next ones can join this one instead
+        auto const broadcast{ start() };
+        if ( !broadcast )
+        {
+            broadcasts_.erase( key );
+            return std::nullopt;
+        }
+        broadcasts_[ key ] = broadcast;
+        return Broadcast::subscribe( broadcast );
+    }
+} // namespace Teleaudio
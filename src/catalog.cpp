@@ -0,0 +1,384 @@
+#include "catalog.hpp"
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <system_error>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    [[ nodiscard ]] bool isWav( fs::path const & path )
+    {
+        return path.extension() == ".wav";
+    }
+
+    // Reads only what's needed for the entry, the headers and what the file system knows
+    [[ nodiscard ]] Teleaudio::CatalogEntry readEntry( fs::path const & path )
+    {
+        Teleaudio::CatalogEntry entry{ .name = path.filename().string() };
+
+        std::error_code error;
+        auto const size{ fs::file_size( path, error ) };
+        if ( error )
+        {
+            spdlog::error( "Cannot stat '{}': {}", path.string(), error.message() );
+            return entry;
+        }
+        auto const mtime{ fs::last_write_time( path, error ) };
+        if ( error )
+        {
+            spdlog::error( "Cannot stat '{}': {}", path.string(), error.message() );
+            return entry;
+        }
+        entry.size = size;
+        entry.mtime = std::chrono::duration_cast< std::chrono::seconds >( std::chrono::file_clock::to_sys( mtime ).time_since_epoch() ).count();
+
+        WAV::FileReader const reader{ path.string() };
+        entry.format        = reader.format;
+        entry.raw_data_size = reader.data_size;
+        entry.valid         = reader.valid();
+        return entry;
+    }
+}
+
+namespace Teleaudio
+{
+    bool CatalogFilter::matches( CatalogEntry const & entry ) const
+    {
+        return entry.name.starts_with( prefix )
+            && ( channels        == 0 || entry.format.num_channels    == channels        )
+            && ( sample_rate     == 0 || entry.format.sample_rate     == sample_rate     )
+            && ( bits_per_sample == 0 || entry.format.bits_per_sample == bits_per_sample )
+            && ( min_duration    <= 0 || entry.duration()             >= min_duration    )
+            && ( max_duration    <= 0 || entry.duration()             <= max_duration    );
+    }
+
+    Catalog::Catalog( fs::path root )
+        : root_{ std::move( root ) }
+    {
+#ifdef __linux__
+        inotify_fd_ = ::inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+        wakeup_fd_  = ::eventfd( 0, EFD_CLOEXEC );
+        if ( inotify_fd_ < 0 || wakeup_fd_ < 0 )
+        {
+            spdlog::warn( "Cannot watch '{}', the catalog won't follow its changes", root_.string() );
+        }
+#endif
+
+        auto const start{ std::chrono::steady_clock::now() };
+        scan( {} );
+        spdlog::info( "Catalogued {} files in {:.3f}s", size(), std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() );
+
+#ifdef __linux__
+        if ( inotify_fd_ >= 0 && wakeup_fd_ >= 0 )
+        {
+            watcher_ = std::jthread{ [ this ]( std::stop_token const stop ) { watch( stop ); } };
+        }
+#endif
+    }
+
+    Catalog::~Catalog()
+    {
+#ifdef __linux__
+        if ( watcher_.joinable() )
+        {
+            watcher_.request_stop();
+
+            std::uint64_t const wakeup{ 1 };
+            [[ maybe_unused ]] auto const res{ ::write( wakeup_fd_, &wakeup, sizeof( wakeup ) ) };
+            watcher_.join();
+        }
+        if ( inotify_fd_ >= 0 ) { ::close( inotify_fd_ ); }
+        if ( wakeup_fd_  >= 0 ) { ::close( wakeup_fd_  ); }
+#endif
+    }
+
+    std::optional< std::vector< CatalogEntry > > Catalog::list( std::string_view const directory ) const
+    {
+        std::shared_lock const lock{ mutex_ };
+
+        auto const it{ directories_.find( key( directory ) ) };
+        if ( it == directories_.end() )
+        {
+            return std::nullopt;
+        }
+
+        std::vector< CatalogEntry > entries;
+        entries.reserve( it->second.size() );
+        for ( auto const & [ name, entry ] : it->second )
+        {
+            entries.push_back( entry );
+        }
+        return entries;
+    }
+
+    std::optional< std::vector< CatalogEntry > > Catalog::page( std::string_view const directory, std::string_view const start_after, std::size_t const count, CatalogFilter const & filter ) const
+    {
+        std::shared_lock const lock{ mutex_ };
+
+        auto const it{ directories_.find( key( directory ) ) };
+        if ( it == directories_.end() )
+        {
+            return std::nullopt;
+        }
+        auto const & entries{ it->second };
+
+        // the names sharing the prefix are next to each other, there's no need to look at the rest
+        auto first{ entries.upper_bound( start_after ) };
+        if ( !filter.prefix.empty() && ( first == entries.end() || first->first < filter.prefix ) )
+        {
+            first = entries.lower_bound( filter.prefix );
+        }
+
+        std::vector< CatalogEntry > page;
+        for ( auto entry{ first }; entry != entries.end() && page.size() < count; ++entry )
+        {
+            if ( !entry->first.starts_with( filter.prefix ) )
+            {
+                break;
+            }
+            if ( filter.matches( entry->second ) )
+            {
+                page.push_back( entry->second );
+            }
+        }
+        return page;
+    }
+
+    std::optional< CatalogEntry > Catalog::stat( std::string_view const path )
+    {
+        auto const relative{ fs::path{ path }.lexically_normal() };
+        if ( relative.empty() || relative.is_absolute() || *relative.begin() == ".." || !isWav( relative ) )
+        {
+            return std::nullopt;
+        }
+
+        auto const find{ [ & ]() -> std::optional< CatalogEntry >
+        {
+            std::shared_lock const lock{ mutex_ };
+
+            auto const directory{ directories_.find( key( relative.parent_path() ) ) };
+            if ( directory == directories_.end() )
+            {
+                return std::nullopt;
+            }
+            auto const entry{ directory->second.find( relative.filename().string() ) };
+            if ( entry == directory->second.end() )
+            {
+                return std::nullopt;
+            }
+            return entry->second;
+        } };
+
+        if ( auto entry{ find() }; entry.has_value() )
+        {
+            return entry;
+        }
+
+        // the file might be newer than the last change the catalog has seen
+        refresh( relative );
+        return find();
+    }
+
+    std::size_t Catalog::size() const
+    {
+        std::shared_lock const lock{ mutex_ };
+
+        std::size_t files{};
+        for ( auto const & [ name, directory ] : directories_ )
+        {
+            files += directory.size();
+        }
+        return files;
+    }
+
+    void Catalog::refresh( fs::path const & relative_path )
+    {
+        auto const path{ root_ / relative_path };
+
+        std::error_code error;
+        if ( isWav( path ) && fs::is_regular_file( path, error ) )
+        {
+            auto entry{ readEntry( path ) };
+
+            std::unique_lock const lock{ mutex_ };
+            auto const name{ entry.name };
+            directories_[ key( relative_path.parent_path() ) ][ name ] = std::move( entry );
+            return;
+        }
+
+        std::unique_lock const lock{ mutex_ };
+        if ( auto const directory{ directories_.find( key( relative_path.parent_path() ) ) }; directory != directories_.end() )
+        {
+            directory->second.erase( relative_path.filename().string() );
+        }
+    }
+
+    void Catalog::scan( fs::path const & relative_path )
+    {
+        auto const path{ root_ / relative_path };
+
+#ifdef __linux__
+        // watching before listing, so nothing created in between slips through
+        if ( inotify_fd_ >= 0 )
+        {
+            auto const mask{ IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ONLYDIR };
+            if ( auto const wd{ ::inotify_add_watch( inotify_fd_, path.c_str(), mask ) }; wd >= 0 )
+            {
+                watches_[ wd ] = key( relative_path );
+            }
+            else
+            {
+                spdlog::warn( "Cannot watch '{}', errno {}", path.string(), errno );
+            }
+        }
+#endif
+
+        Directory                 entries;
+        std::vector< fs::path >   subdirectories;
+
+        std::error_code error;
+        for ( auto const & item : fs::directory_iterator( path, error ) )
+        {
+            if ( item.is_directory( error ) )
+            {
+                subdirectories.push_back( relative_path / item.path().filename() );
+            }
+            else if ( item.is_regular_file( error ) && isWav( item.path() ) )
+            {
+                auto entry{ readEntry( item.path() ) };
+                auto const name{ entry.name };
+                entries.emplace( name, std::move( entry ) );
+            }
+        }
+        if ( error )
+        {
+            spdlog::error( "Cannot list '{}': {}", path.string(), error.message() );
+        }
+
+        {
+            std::unique_lock const lock{ mutex_ };
+            directories_[ key( relative_path ) ] = std::move( entries );
+        }
+
+        for ( auto const & subdirectory : subdirectories )
+        {
+            scan( subdirectory );
+        }
+    }
+
+    void Catalog::forget( std::string const & directory )
+    {
+        std::unique_lock const lock{ mutex_ };
+
+        auto const prefix{ directory + '/' };
+        std::erase_if( directories_, [ & ]( auto const & item )
+        {
+            return directory.empty() || item.first == directory || item.first.starts_with( prefix );
+        } );
+    }
+
+    std::string Catalog::key( fs::path const & relative_path )
+    {
+        auto normalized{ relative_path.lexically_normal().generic_string() };
+        while ( normalized.ends_with( '/' ) )
+        {
+            normalized.pop_back();
+        }
+        return normalized == "." ? std::string{} : normalized;
+    }
+
+#ifdef __linux__
+    void Catalog::watch( std::stop_token const & stop )
+    {
+        alignas( inotify_event ) std::array< char, 64 * 1024 > buffer;
+
+        while ( !stop.stop_requested() )
+        {
+            std::array< pollfd, 2 > fds
+            { {
+                { .fd = inotify_fd_, .events = POLLIN, .revents = 0 },
+                { .fd = wakeup_fd_,  .events = POLLIN, .revents = 0 }
+            } };
+            if ( ::poll( fds.data(), fds.size(), -1 ) < 0 )
+            {
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                spdlog::error( "Watching the storage failed, errno {}", errno );
+                return;
+            }
+            if ( fds[ 1 ].revents != 0 )
+            {
+                return;
+            }
+
+            auto const length{ ::read( inotify_fd_, buffer.data(), buffer.size() ) };
+            if ( length <= 0 )
+            {
+                continue;
+            }
+
+            for ( std::size_t offset{}; offset < static_cast< std::size_t >( length ); )
+            {
+                auto const event{ reinterpret_cast< inotify_event const * >( buffer.data() + offset ) };
+                offset += sizeof( inotify_event ) + event->len;
+
+                if ( event->mask & IN_Q_OVERFLOW )
+                {
+                    spdlog::warn( "Missed some changes to the storage, cataloguing it again" );
+                    forget( {} );
+                    scan( {} );
+                    continue;
+                }
+
+                auto const watch{ watches_.find( event->wd ) };
+                if ( watch == watches_.end() )
+                {
+                    continue;
+                }
+                if ( event->mask & IN_IGNORED )
+                {
+                    // the directory is gone
+                    watches_.erase( watch );
+                    continue;
+                }
+                if ( event->len == 0 )
+                {
+                    continue;
+                }
+
+                auto const relative_path{ fs::path{ watch->second } / event->name };
+                if ( event->mask & IN_ISDIR )
+                {
+                    if ( event->mask & ( IN_CREATE | IN_MOVED_TO ) )
+                    {
+                        scan( relative_path );
+                    }
+                    else if ( event->mask & ( IN_DELETE | IN_MOVED_FROM ) )
+                    {
+                        forget( key( relative_path ) );
+                    }
+                }
+                // a freshly created file is still empty, it's read once it's closed
+                else if ( !( event->mask & IN_CREATE ) )
+                {
+                    refresh( relative_path );
+                }
+            }
+        }
+    }
+#endif
+} // namespace Teleaudio
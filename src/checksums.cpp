@@ -0,0 +1,312 @@
+#include "checksums.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "cpu.hpp"
+#include "utils.hpp"
+#include "wav.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // reflected, as the crc32 instruction uses it
+    constexpr std::uint32_t polynomial{ 0x82F63B78 };
+
+    // slice-by-8, table k is the CRC of a byte followed by k zero bytes
+    constexpr auto tables{ []
+    {
+        std::array< std::array< std::uint32_t, 256 >, 8 > result{};
+        for ( std::uint32_t i{}; i < 256; ++i )
+        {
+            auto crc{ i };
+            for ( int bit{}; bit < 8; ++bit )
+            {
+                crc = ( crc & 1 ) != 0 ? ( crc >> 1 ) ^ polynomial : crc >> 1;
+            }
+            result[ 0 ][ i ] = crc;
+        }
+        for ( std::size_t k{ 1 }; k < result.size(); ++k )
+        {
+            for ( std::size_t i{}; i < 256; ++i )
+            {
+                result[ k ][ i ] = ( result[ k - 1 ][ i ] >> 8 ) ^ result[ 0 ][ result[ k - 1 ][ i ] & 0xFF ];
+            }
+        }
+        return result;
+    }() };
+
+    // a times b modulo the polynomial, both reflected
+    [[ nodiscard ]] constexpr std::uint32_t multiply( std::uint32_t const a, std::uint32_t b )
+    {
+        std::uint32_t product{};
+        for ( std::uint32_t bit{ 1U << 31 }; bit != 0; bit >>= 1 )
+        {
+            if ( ( a & bit ) != 0 )
+            {
+                product ^= b;
+            }
+            b = ( b & 1 ) != 0 ? ( b >> 1 ) ^ polynomial : b >> 1;
+        }
+        return product;
+    }
+
+    // x^(2^k) modulo the polynomial, they repeat after 32
+    constexpr auto powers{ []
+    {
+        std::array< std::uint32_t, 32 > result{};
+        result[ 0 ] = 1U << 30; // x^1
+        for ( std::size_t k{ 1 }; k < result.size(); ++k )
+        {
+            result[ k ] = multiply( result[ k - 1 ], result[ k - 1 ] );
+        }
+        return result;
+    }() };
+
+    // the state of a CRC is its complement
+    [[ nodiscard ]] std::uint32_t updateSoftware( std::uint32_t state, std::byte const * data, std::size_t size )
+    {
+        if constexpr ( std::endian::native == std::endian::little )
+        {
+            for ( ; size >= 8; data += 8, size -= 8 )
+            {
+                std::uint64_t word;
+                std::memcpy( &word, data, sizeof( word ) );
+                word ^= state;
+                state = tables[ 7 ][   word         & 0xFF ] ^ tables[ 6 ][ ( word >>  8 ) & 0xFF ]
+                      ^ tables[ 5 ][ ( word >> 16 ) & 0xFF ] ^ tables[ 4 ][ ( word >> 24 ) & 0xFF ]
+                      ^ tables[ 3 ][ ( word >> 32 ) & 0xFF ] ^ tables[ 2 ][ ( word >> 40 ) & 0xFF ]
+                      ^ tables[ 1 ][ ( word >> 48 ) & 0xFF ] ^ tables[ 0 ][   word >> 56         ];
+            }
+        }
+        for ( ; size > 0; ++data, --size )
+        {
+            state = tables[ 0 ][ ( state ^ static_cast< std::uint32_t >( *data ) ) & 0xFF ] ^ ( state >> 8 );
+        }
+        return state;
+    }
+
+#ifdef TELEAUDIO_SSE42
+    [[ nodiscard ]] inline std::uint64_t load( std::byte const * const data )
+    {
+        std::uint64_t word;
+        std::memcpy( &word, data, sizeof( word ) );
+        return word;
+    }
+
+    TELEAUDIO_SSE42 std::uint32_t updateHardware( std::uint32_t state, std::byte const * data, std::size_t size )
+    {
+        // the instruction takes 3 cycles, but a new one can start every cycle,
+        // so three thirds of the data are checksummed side by side and combined afterwards
+        if ( size >= 3 * 1024 )
+        {
+            auto const lane{ size / 3 / 8 * 8 };
+
+            std::uint64_t first { state };
+            std::uint64_t second{ 0xFFFFFFFF };
+            std::uint64_t third { 0xFFFFFFFF };
+            for ( std::size_t i{}; i < lane; i += 8 )
+            {
+                first  = _mm_crc32_u64( first,  load( data + i            ) );
+                second = _mm_crc32_u64( second, load( data + i + lane     ) );
+                third  = _mm_crc32_u64( third,  load( data + i + 2 * lane ) );
+            }
+
+            auto const shift{ Teleaudio::crc32cShift( lane ) };
+            auto const crc  { Teleaudio::crc32cCombine( Teleaudio::crc32cCombine( ~static_cast< std::uint32_t >( first ), ~static_cast< std::uint32_t >( second ), shift ),
+                                                        ~static_cast< std::uint32_t >( third ), shift ) };
+            state = ~crc;
+            data += 3 * lane;
+            size -= 3 * lane;
+        }
+
+        std::uint64_t wide{ state };
+        for ( ; size >= 8; data += 8, size -= 8 )
+        {
+            wide = _mm_crc32_u64( wide, load( data ) );
+        }
+        state = static_cast< std::uint32_t >( wide );
+        for ( ; size > 0; ++data, --size )
+        {
+            state = _mm_crc32_u8( state, static_cast< std::uint8_t >( *data ) );
+        }
+        return state;
+    }
+#endif
+
+    [[ nodiscard ]] Teleaudio::ChecksumCache::ChecksumsPtr compute( fs::path const & file )
+    {
+        auto const before{ FileUtils::stamp( file ) };
+
+        WAV::FileReader reader{ file.string() };
+        if ( !reader.valid() )
+        {
+            spdlog::warn( "Not checksumming '{}', its headers are not valid", file.string() );
+            return nullptr;
+        }
+
+        auto const start    { std::chrono::steady_clock::now() };
+        auto       checksums{ Teleaudio::checksumSamples( reader, reader.data_size, Teleaudio::checksumBlockSize( reader.format.block_align ) ) };
+        if ( !checksums.has_value() || FileUtils::stamp( file ) != before )
+        {
+            spdlog::warn( "Not checksumming '{}', it changed while being read", file.string() );
+            return nullptr;
+        }
+
+        auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() };
+        spdlog::debug( "Checksummed '{}', {} blocks in {:.3f}s, {:.1f} MB/s", file.string(), checksums->blocks.size(), seconds,
+                       seconds > 0 ? static_cast< double >( checksums->size ) / seconds / 1e6 : 0.0 );
+        return std::make_shared< Teleaudio::SampleChecksums const >( std::move( *checksums ) );
+    }
+}
+
+namespace Teleaudio
+{
+    std::uint32_t crc32c( std::span< std::byte const > const data, std::uint32_t const crc )
+    {
+#ifdef TELEAUDIO_SSE42
+        if ( Teleaudio::Cpu::hasSse42() )
+        {
+            return ~updateHardware( ~crc, data.data(), data.size() );
+        }
+#endif
+        return ~updateSoftware( ~crc, data.data(), data.size() );
+    }
+
+    std::uint32_t crc32cShift( std::uint64_t length )
+    {
+        // x^(8 * length), a bit at a time of the length
+        std::uint32_t shift{ 1U << 31 };
+        for ( std::size_t k{ 3 }; length != 0; length >>= 1, ++k )
+        {
+            if ( ( length & 1 ) != 0 )
+            {
+                shift = multiply( powers[ k % powers.size() ], shift );
+            }
+        }
+        return shift;
+    }
+
+    std::uint32_t crc32cCombine( std::uint32_t const first, std::uint32_t const second, std::uint32_t const shift )
+    {
+        return multiply( shift, first ) ^ second;
+    }
+
+    std::uint32_t SampleChecksums::blockLength( std::size_t const index ) const
+    {
+        if ( index + 1 < blocks.size() )
+        {
+            return block_size;
+        }
+        return static_cast< std::uint32_t >( size - std::uint64_t{ block_size } * index );
+    }
+
+    std::uint32_t checksumBlockSize( std::uint16_t const block_align )
+    {
+        std::uint32_t const frame{ std::max< std::uint16_t >( block_align, 1 ) };
+        return std::max< std::uint32_t >( checksum_block_size / frame, 1 ) * frame;
+    }
+
+    std::optional< SampleChecksums > checksumSamples( WAV::FileReader & reader, std::uint64_t const length, std::uint32_t const block_size )
+    {
+        SampleChecksums checksums{ .size = length, .block_size = std::max< std::uint32_t >( block_size, 1 ), .crc = 0, .blocks = {} };
+        checksums.blocks.reserve( static_cast< std::size_t >( length / checksums.block_size + 1 ) );
+
+        auto const shift{ crc32cShift( checksums.block_size ) };
+
+        // whole blocks at a time, only the very last one can be cut short
+        auto const blocks_per_read{ std::max< std::uint32_t >( 1024 * 1024 / checksums.block_size, 1 ) };
+        std::vector< std::byte > buffer( std::size_t{ blocks_per_read } * checksums.block_size );
+
+        for ( std::uint64_t done{}; done < length; )
+        {
+            auto const wanted{ static_cast< std::size_t >( std::min< std::uint64_t >( buffer.size(), length - done ) ) };
+            auto const read  { reader.read( std::span{ buffer }.first( wanted ) ) };
+            if ( read != wanted )
+            {
+                return std::nullopt;
+            }
+
+            for ( std::size_t offset{}; offset < read; offset += checksums.block_size )
+            {
+                auto const block{ std::span< std::byte const >{ buffer }.subspan( offset, std::min< std::size_t >( checksums.block_size, read - offset ) ) };
+                auto const crc  { crc32c( block ) };
+                checksums.crc = crc32cCombine( checksums.crc, crc, block.size() == checksums.block_size ? shift : crc32cShift( block.size() ) );
+                checksums.blocks.push_back( crc );
+            }
+            done += read;
+        }
+        return checksums;
+    }
+
+    ChecksumCache::ChecksumCache( std::size_t const threads )
+    {
+        for ( std::size_t i{}; i < std::max< std::size_t >( threads, 1 ); ++i )
+        {
+            workers_.emplace_back( [ this ]( std::stop_token const stop ) { work( stop ); } );
+        }
+    }
+
+    ChecksumCache::~ChecksumCache()
+    {
+        // the files being checksummed are finished first
+        for ( auto & worker : workers_ )
+        {
+            worker.request_stop();
+        }
+        workers_.clear();
+
+        // nobody waits for the rest forever
+        for ( auto & job : queue_ )
+        {
+            job.checksums.set_value( nullptr );
+        }
+    }
+
+    ChecksumCache::ChecksumsPtr ChecksumCache::get( fs::path const & file )
+    {
+        auto const now{ FileUtils::stamp( file ) };
+        if ( !now.has_value() )
+        {
+            return nullptr;
+        }
+
+        std::shared_future< ChecksumsPtr > checksums;
+        {
+            std::lock_guard lock{ mutex_ };
+            auto & entry{ entries_[ file.string() ] };
+            if ( !entry.checksums.valid() || FileUtils::Stamp{ entry.mtime, entry.size } != *now )
+            {
+                Job job{ file, {} };
+                entry = Entry{ now->mtime, now->size, job.checksums.get_future().share() };
+                queue_.push_back( std::move( job ) );
+                queue_changed_.notify_one();
+            }
+            checksums = entry.checksums;
+        }
+        return checksums.get();
+    }
+
+    void ChecksumCache::work( std::stop_token const & stop )
+    {
+        while ( true )
+        {
+            Job job;
+            {
+                std::unique_lock lock{ mutex_ };
+                if ( !queue_changed_.wait( lock, stop, [ this ] { return !queue_.empty(); } ) )
+                {
+                    return;
+                }
+                job = std::move( queue_.front() );
+                queue_.pop_front();
+            }
+            job.checksums.set_value( compute( job.file ) );
+        }
+    }
+} // namespace Teleaudio
@@ -0,0 +1,48 @@
+#include "chunk_sizer.hpp"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace Teleaudio
+{
+    ChunkSizer::ChunkSizer( std::uint32_t const initial, std::uint32_t const maximum, bool const adaptive )
+        : chunk_size_{ std::min( initial, maximum ) }, maximum_{ maximum }, adapting_{ adaptive && initial < maximum }
+    {}
+
+    void ChunkSizer::record( std::size_t const bytes, std::chrono::nanoseconds const duration )
+    {
+        if ( !adapting_ )
+        {
+            return;
+        }
+
+        step_bytes_ += bytes;
+        step_time_  += duration;
+        if ( ++step_writes_ < writes_per_step )
+        {
+            return;
+        }
+
+        auto const seconds   { std::chrono::duration< double >( step_time_ ).count() };
+        auto const throughput{ seconds > 0 ? static_cast< double >( step_bytes_ ) / seconds : 0.0 };
+
+        step_bytes_  = 0;
+        step_time_   = {};
+        step_writes_ = 0;
+
+        // a noticeably slower step means the previous size was the sweet spot
+        auto const tolerance{ 0.9 };
+        if ( throughput < previous_throughput_ * tolerance )
+        {
+            chunk_size_ /= 2;
+            adapting_    = false;
+            spdlog::debug( "Chunk size settled at {} bytes", chunk_size_ );
+            return;
+        }
+
+        previous_throughput_ = throughput;
+        chunk_size_          = std::min( chunk_size_ * 2, maximum_ );
+        adapting_            = chunk_size_ < maximum_;
+        spdlog::debug( "Chunk size grown to {} bytes at {:.1f} MB/s", chunk_size_, throughput / 1e6 );
+    }
+} // namespace Teleaudio
@@ -0,0 +1,321 @@
+#include "codec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+namespace
+{
+    // bits of the Rice parameter in front of every partition of a channel
+    constexpr unsigned parameter_bits{ 6 };
+
+    // quotients this long are sent as the plain residual instead, so noise can't blow a chunk up
+    constexpr unsigned escape_quotient{ 24 };
+
+    // Appends bits to `out`, the first bit in the most significant one of a byte
+    class BitWriter
+    {
+    public:
+        explicit BitWriter( std::vector< std::byte > & out ) : out_{ out } {}
+
+        // `count` is at most 40
+        void put( std::uint64_t const value, unsigned const count )
+        {
+            pending_  = ( pending_ << count ) | value;
+            pending_bits_ += count;
+            while ( pending_bits_ >= 8 )
+            {
+                pending_bits_ -= 8;
+                out_.push_back( static_cast< std::byte >( pending_ >> pending_bits_ ) );
+            }
+        }
+
+        // pads the last byte with zeros
+        void flush()
+        {
+            if ( pending_bits_ > 0 )
+            {
+                out_.push_back( static_cast< std::byte >( pending_ << ( 8 - pending_bits_ ) ) );
+                pending_bits_ = 0;
+            }
+        }
+
+    private:
+        std::vector< std::byte > & out_;
+        std::uint64_t              pending_{};
+        unsigned                   pending_bits_{};
+    };
+
+    // Reads what a BitWriter wrote, the next bit is always the most significant one of `bits_`
+    class BitReader
+    {
+    public:
+        explicit BitReader( std::span< std::byte const > const data ) : data_{ data } {}
+
+        // `count` is at most 32
+        [[ nodiscard ]] bool get( unsigned const count, std::uint64_t & value )
+        {
+            refill();
+            if ( available_ < count )
+            {
+                return false;
+            }
+            value = count == 0 ? 0 : bits_ >> ( 64 - count );
+            bits_ = count == 0 ? bits_ : bits_ << count;
+            available_ -= count;
+            return true;
+        }
+
+        // Counts the ones up to the next zero, stopping without a zero at `limit`
+        [[ nodiscard ]] bool unary( unsigned const limit, unsigned & ones )
+        {
+            ones = 0;
+            while ( true )
+            {
+                refill();
+                if ( available_ == 0 )
+                {
+                    return false;
+                }
+
+                auto const leading{ std::min( static_cast< unsigned >( std::countl_one( bits_ ) ), available_ ) };
+                if ( ones + leading >= limit )
+                {
+                    auto const taken{ limit - ones };
+                    bits_      <<= taken;
+                    available_  -= taken;
+                    ones         = limit;
+                    return true;
+                }
+                if ( leading < available_ )
+                {
+                    // the ones and the zero that ends them
+                    bits_      <<= leading + 1;
+                    available_  -= leading + 1;
+                    ones        += leading;
+                    return true;
+                }
+                ones      += leading;
+                bits_      = 0;
+                available_ = 0;
+            }
+        }
+
+        // bytes read so far, counting the padded last one
+        [[ nodiscard ]] std::size_t consumed() const { return position_ - available_ / 8; }
+
+    private:
+        void refill()
+        {
+            while ( available_ <= 56 && position_ < data_.size() )
+            {
+                bits_      |= static_cast< std::uint64_t >( data_[ position_++ ] ) << ( 56 - available_ );
+                available_ += 8;
+            }
+        }
+
+        std::span< std::byte const > data_;
+        std::size_t                  position_{};
+        std::uint64_t                bits_{};
+        unsigned                     available_{};
+    };
+
+    [[ nodiscard ]] std::uint32_t load( std::byte const * const sample, std::size_t const bytes )
+    {
+        std::uint32_t value{};
+        for ( std::size_t i{}; i < bytes; ++i )
+        {
+            value |= static_cast< std::uint32_t >( sample[ i ] ) << ( 8 * i );
+        }
+        return value;
+    }
+
+    void store( std::byte * const sample, std::size_t const bytes, std::uint32_t const value )
+    {
+        for ( std::size_t i{}; i < bytes; ++i )
+        {
+            sample[ i ] = static_cast< std::byte >( value >> ( 8 * i ) );
+        }
+    }
+
+    // the difference of two samples wrapped around to the sample width, mapped to 0, -1, 1, -2, 2...
+    [[ nodiscard ]] std::uint32_t zigzag( std::uint32_t const difference, unsigned const sample_bits )
+    {
+        auto const sign_bit{ std::uint64_t{ 1 } << ( sample_bits - 1 ) };
+        auto const signed_difference{ static_cast< std::int64_t >( ( difference ^ sign_bit ) ) - static_cast< std::int64_t >( sign_bit ) };
+        return static_cast< std::uint32_t >( signed_difference >= 0 ? 2 * signed_difference : -2 * signed_difference - 1 );
+    }
+
+    [[ nodiscard ]] std::uint32_t unzigzag( std::uint64_t const value )
+    {
+        auto const signed_difference{ ( value & 1 ) != 0 ? -static_cast< std::int64_t >( value >> 1 ) - 1 : static_cast< std::int64_t >( value >> 1 ) };
+        return static_cast< std::uint32_t >( signed_difference );
+    }
+}
+
+namespace Teleaudio
+{
+    DeltaRiceCodec::DeltaRiceCodec( WAV::FmtSubChunk const & format )
+        : channels_        { std::max< std::uint16_t >( format.num_channels, 1 ) }
+        , bytes_per_sample_{ static_cast< std::uint16_t >( std::clamp( format.bits_per_sample / 8, 1, 4 ) ) }
+    {}
+
+    bool DeltaRiceCodec::supports( WAV::FmtSubChunk const & format )
+    {
+        auto const pulse_code_modulation{ 1 };
+        return format.audio_format == pulse_code_modulation
+            && format.num_channels > 0
+            && format.bits_per_sample % 8 == 0
+            && format.bits_per_sample >= 8 && format.bits_per_sample <= 32
+            && format.block_align == format.num_channels * format.bits_per_sample / 8;
+    }
+
+    std::vector< std::byte > DeltaRiceCodec::encode( std::span< std::byte const > const samples ) const
+    {
+        std::size_t const block_align{ std::size_t{ channels_ } * bytes_per_sample_ };
+        std::size_t const frames     { samples.size() / block_align };
+        unsigned    const sample_bits{ 8u * bytes_per_sample_ };
+        std::uint64_t const mask     { ( std::uint64_t{ 1 } << sample_bits ) - 1 };
+
+        std::vector< std::byte > encoded;
+        // speech and music usually shrink to about a half, this saves most of the reallocations
+        encoded.reserve( samples.size() / 2 + 16 );
+
+        auto const size{ static_cast< std::uint32_t >( samples.size() ) };
+        encoded.resize( sizeof( size ) );
+        store( encoded.data(), sizeof( size ), size );
+
+        BitWriter writer{ encoded };
+
+        std::vector< std::uint32_t > previous( channels_ );
+
+        std::array< std::uint32_t, frames_per_partition > residuals;
+        for ( std::size_t first{}; first < frames; first += frames_per_partition )
+        {
+            auto const count{ std::min( frames_per_partition, frames - first ) };
+            for ( std::size_t channel{}; channel < channels_; ++channel )
+            {
+                std::uint64_t sum{};
+                auto const * sample{ samples.data() + first * block_align + channel * bytes_per_sample_ };
+                for ( std::size_t i{}; i < count; ++i, sample += block_align )
+                {
+                    auto const value{ load( sample, bytes_per_sample_ ) };
+                    residuals[ i ] = zigzag( static_cast< std::uint32_t >( ( value - previous[ channel ] ) & mask ), sample_bits );
+                    previous[ channel ] = value;
+                    sum += residuals[ i ];
+                }
+
+                // the parameter that makes the average residual take about one bit of quotient
+                unsigned parameter{};
+                while ( parameter < sample_bits && ( std::uint64_t{ count } << parameter ) < sum )
+                {
+                    ++parameter;
+                }
+                writer.put( parameter, parameter_bits );
+
+                for ( std::size_t i{}; i < count; ++i )
+                {
+                    auto const quotient{ residuals[ i ] >> parameter };
+                    if ( quotient < escape_quotient )
+                    {
+                        writer.put( ( ( std::uint64_t{ 1 } << quotient ) - 1 ) << 1, quotient + 1 );
+                        writer.put( residuals[ i ] & ( ( std::uint64_t{ 1 } << parameter ) - 1 ), parameter );
+                    }
+                    else
+                    {
+                        writer.put( ( std::uint64_t{ 1 } << escape_quotient ) - 1, escape_quotient );
+                        writer.put( residuals[ i ], sample_bits );
+                    }
+                }
+            }
+        }
+        writer.flush();
+
+        // the partial frame at the end goes as is
+        auto const tail{ samples.subspan( frames * block_align ) };
+        encoded.insert( encoded.end(), tail.begin(), tail.end() );
+        return encoded;
+    }
+
+    bool DeltaRiceCodec::decode( std::span< std::byte const > const encoded, std::vector< std::byte > & samples ) const
+    {
+        std::uint32_t size{};
+        if ( encoded.size() < sizeof( size ) )
+        {
+            return false;
+        }
+        size = load( encoded.data(), sizeof( size ) );
+
+        std::size_t const block_align{ std::size_t{ channels_ } * bytes_per_sample_ };
+        std::size_t const frames     { size / block_align };
+        unsigned    const sample_bits{ 8u * bytes_per_sample_ };
+        std::uint64_t const mask     { ( std::uint64_t{ 1 } << sample_bits ) - 1 };
+
+        // every sample takes at least a bit, a bogus size must not allocate gigabytes
+        if ( frames * channels_ > 8 * encoded.size() )
+        {
+            return false;
+        }
+        samples.resize( size );
+
+        auto const bitstream{ encoded.subspan( sizeof( size ) ) };
+        BitReader  reader{ bitstream };
+
+        std::vector< std::uint32_t > previous( channels_ );
+        for ( std::size_t first{}; first < frames; first += frames_per_partition )
+        {
+            auto const count{ std::min( frames_per_partition, frames - first ) };
+            for ( std::size_t channel{}; channel < channels_; ++channel )
+            {
+                std::uint64_t parameter{};
+                if ( !reader.get( parameter_bits, parameter ) || parameter > sample_bits )
+                {
+                    return false;
+                }
+
+                auto * sample{ samples.data() + first * block_align + channel * bytes_per_sample_ };
+                for ( std::size_t i{}; i < count; ++i, sample += block_align )
+                {
+                    unsigned      quotient{};
+                    std::uint64_t residual{};
+                    if ( !reader.unary( escape_quotient, quotient ) )
+                    {
+                        return false;
+                    }
+                    if ( quotient == escape_quotient )
+                    {
+                        if ( !reader.get( sample_bits, residual ) )
+                        {
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        std::uint64_t remainder{};
+                        if ( !reader.get( static_cast< unsigned >( parameter ), remainder ) )
+                        {
+                            return false;
+                        }
+                        residual = ( std::uint64_t{ quotient } << parameter ) | remainder;
+                    }
+                    if ( residual > mask )
+                    {
+                        return false;
+                    }
+
+                    previous[ channel ] = static_cast< std::uint32_t >( ( previous[ channel ] + unzigzag( residual ) ) & mask );
+                    store( sample, bytes_per_sample_, previous[ channel ] );
+                }
+            }
+        }
+
+        auto const tail_size{ size - frames * block_align };
+        auto const tail_start{ reader.consumed() };
+        if ( tail_start + tail_size != bitstream.size() )
+        {
+            return false;
+        }
+        std::copy( bitstream.begin() + static_cast< std::ptrdiff_t >( tail_start ), bitstream.end(), samples.begin() + static_cast< std::ptrdiff_t >( frames * block_align ) );
+        return true;
+    }
+} // namespace Teleaudio
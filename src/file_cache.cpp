@@ -0,0 +1,126 @@
+#include "file_cache.hpp"
+
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <system_error>
+
+#include "metrics.hpp"
+#include "wav.hpp"
+
+namespace fs = std::filesystem;
+
+namespace Teleaudio
+{
+    std::size_t FileCache::KeyHash::operator()( Key const & key ) const
+    {
+        auto const hash_combine{ []( std::size_t const seed, std::size_t const value )
+        {
+            return seed ^ ( value + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 ) );
+        } };
+
+        auto hash{ std::hash< std::string >{}( key.path ) };
+        hash = hash_combine( hash, std::hash< std::int64_t  >{}( static_cast< std::int64_t >( key.mtime.time_since_epoch().count() ) ) );
+        hash = hash_combine( hash, std::hash< std::uintmax_t >{}( key.size ) );
+        return hash;
+    }
+
+    FileCache::FilePtr FileCache::get( fs::path const & path )
+    {
+        std::error_code error;
+        auto const mtime{ fs::last_write_time( path, error ) };
+        if ( error )
+        {
+            spdlog::error( "Cannot stat '{}': {}", path.string(), error.message() );
+            return nullptr;
+        }
+        auto const size{ fs::file_size( path, error ) };
+        if ( error )
+        {
+            spdlog::error( "Cannot stat '{}': {}", path.string(), error.message() );
+            return nullptr;
+        }
+
+        Key key
+        {
+            .path  = path.string(),
+            .mtime = mtime,
+            .size  = size
+        };
+
+        std::unique_lock lock{ mutex_ };
+
+        if ( auto const it{ entries_.find( key ) }; it != entries_.end() )
+        {
+            ++statistics_.hits;
+            Metrics::add( Metrics::Counter::FileCacheHits );
+            auto & entry{ it->second };
+            if ( entry.loaded )
+            {
+                lru_.splice( lru_.begin(), lru_, entry.lru_position );
+            }
+            auto const file{ entry.file };
+
+            // the file might still be loading, waiting for it outside of the lock
+            lock.unlock();
+            return file.get();
+        }
+
+        ++statistics_.misses;
+        Metrics::add( Metrics::Counter::FileCacheMisses );
+
+        std::promise< FilePtr > promise;
+        entries_.emplace( key, Entry{ .file = promise.get_future().share(), .lru_position = lru_.end(), .loaded = false } );
+
+        lock.unlock();
+
+        // everyone else asking for this file waits on the future in the meantime
+        auto file{ std::make_shared< WAV::MappedFile const >( key.path ) };
+        if ( !file->valid() )
+        {
+            spdlog::error( "Not caching '{}', it is not a valid .wav file.", key.path );
+            file.reset();
+        }
+        promise.set_value( file );
+
+        lock.lock();
+
+        auto const it{ entries_.find( key ) };
+        if ( !file )
+        {
+            entries_.erase( it );
+            return nullptr;
+        }
+
+        lru_.push_front( key );
+        it->second.lru_position = lru_.begin();
+        it->second.loaded       = true;
+
+        statistics_.bytes_used += key.size;
+        evict();
+
+        return file;
+    }
+
+    void FileCache::evict()
+    {
+        while ( statistics_.bytes_used > byte_budget_ && !lru_.empty() )
+        {
+            auto const & key{ lru_.back() };
+            spdlog::debug( "Evicting '{}' from the cache", key.path );
+
+            statistics_.bytes_used -= key.size;
+            ++statistics_.evictions;
+            Metrics::add( Metrics::Counter::FileCacheEvictions );
+
+            // whoever is still streaming the file keeps it alive
+            entries_.erase( key );
+            lru_.pop_back();
+        }
+    }
+
+    FileCache::Statistics FileCache::statistics() const
+    {
+        std::scoped_lock const lock{ mutex_ };
+        return statistics_;
+    }
+} // namespace Teleaudio
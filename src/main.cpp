@@ -1,9 +1,15 @@
 #include <charconv>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <vector>
 
 #include "audio_client.hpp"
 #include "audio_server.hpp"
+#include "pack_store.hpp"
 #include "wav.hpp"
 
 #include "spdlog/spdlog.h"
@@ -16,7 +22,237 @@ std::shared_ptr< spdlog::logger > logger{};
 
 void print_help()
 {
-    spdlog::error( "\nUsage:\n\t$> ./teleaudio server /path/to/wav/files <port>\nOr:\n\t$> ./teleaudio <port> <destination-folder>" );
+    spdlog::error( "\nUsage:\n\t$> ./teleaudio server <port> /path/to/wav/files [options]\nOr:\n\t$> ./teleaudio <port> <destination-folder>"
+                   "\nOr:\n\t$> ./teleaudio download <port> <destination-folder> [options] [file...]"
+                   "\nOr:\n\t$> ./teleaudio play <port> <file> [--jitter-buffer=<ms>] [--output=<file.wav>|--null]"
+                   "\nOr:\n\t$> ./teleaudio pack /path/to/wav/files <pack-folder> [--chunk-size=<bytes>] [--pack-budget=<MiB>]"
+                   "\nOr:\n\t$> ./teleaudio metrics <port>"
+                   "\nOr:\n\t$> ./teleaudio peaks <port> <file> [buckets]"
+                   "\nDownload options:"
+                   "\n\t--concurrency=<N>           number of files downloaded at the same time (default: 8)"
+                   "\n\t--compress                  have the samples losslessly encoded for the transfer"
+                   "\n\t--sync                      only download the blocks of samples that differ from the files already there"
+                   "\n\t--sample-rate=<Hz>          have the server resample the files (default: as they are)"
+                   "\n\t--bits-per-sample=<N>       have the server convert the samples into 8, 16, 24 or 32 bit integers"
+                   "\n\t--channels=<N>              have the server mix the channels down or up"
+                   "\n\t--float                     have the server convert the samples into 32 bit floats"
+                   "\n\t[file...]                   files to download (default: every file the server lists)"
+                   "\nServer options:"
+                   "\n\t--cache-size=<MiB>         keep up to <MiB> of audio files mapped in memory (default: 0, no caching)"
+                   "\n\t--async                    serve calls from completion queues instead of a thread per call"
+                   "\n\t--completion-queues=<N>    number of completion queues in async mode (default: one per core)"
+                   "\n\t--threads-per-queue=<N>    threads polling each completion queue (default: 1)"
+                   "\n\t--chunk-size=<bytes>       payload size of the streamed chunks (default: 5120)"
+                   "\n\t--adaptive-chunks          grow the chunks while it improves the throughput of a stream"
+                   "\n\t--max-chunk-size=<bytes>   upper bound for adaptive and client requested chunks (default: 1048576)"
+                   "\n\t--pack-dir=<folder>        serve whole files from packs kept in <folder>, packing them as they're downloaded"
+                   "\n\t--pack-budget=<MiB>        remove the least recently used packs beyond <MiB> (default: 1024)"
+                   "\n\t--stream-lead=<ms>         how far paced streams may run ahead of the playback (default: 2000)"
+                   "\n\t--broadcast-ring=<N>       share downloads of the same file, keeping the last <N> messages (default: 0, off)"
+                   "\n\t--metrics-port=<port>      serve the metrics in the Prometheus text format on 127.0.0.1:<port> (default: off)"
+                   "\n\t--checksum-threads=<N>     threads checksumming files for clients that sync (default: 2)"
+                   "\n\t--peaks-dir=<folder>       keep the waveform summaries in <folder> across restarts (default: in memory)"
+                   "\n\t--peaks-budget=<MiB>       keep up to <MiB> of the summaries that are only in memory (default: 64)"
+                   "\n\t--io=<backend>             read the files with uring, pread or stdio (default: uring, pread without io_uring)"
+                   "\n\t--read-ahead=<N>           blocks read ahead of the chunk being sent (default: 4)"
+                   "\n\t--read-block=<KiB>         size of the blocks read ahead (default: 256)"
+                   "\n\t--direct-io-above=<MiB>    read files with at least <MiB> of samples around the page cache (default: 0, never)" );
+}
+
+// Parses the `--name=value` options that follow the positional server arguments
+std::optional< Teleaudio::ServerOptions > parse_server_options( int const argc, char const * argv [] )
+{
+    Teleaudio::ServerOptions options;
+
+    auto const parse_number{ []( std::string_view const value, std::size_t & output )
+    {
+        auto const [ ptr, ec ]{ std::from_chars( value.data(), value.data() + value.size(), output ) };
+        return ec == std::errc{} && ptr == value.data() + value.size();
+    } };
+
+    for ( int i{ 4 }; i < argc; ++i )
+    {
+        std::string_view const arg{ argv[ i ] };
+        auto const separator{ arg.find( '=' ) };
+        auto const name     { arg.substr( 0, separator ) };
+        auto const value    { separator == std::string_view::npos ? std::string_view{} : arg.substr( separator + 1 ) };
+
+        if ( name == "--cache-size" )
+        {
+            std::size_t mebibytes{};
+            if ( !parse_number( value, mebibytes ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.cache_size = mebibytes * 1024 * 1024;
+        }
+        else if ( name == "--pack-budget" )
+        {
+            std::size_t mebibytes{};
+            if ( !parse_number( value, mebibytes ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.pack_budget = std::uint64_t{ mebibytes } * 1024 * 1024;
+        }
+        else if ( name == "--stream-lead" )
+        {
+            std::size_t milliseconds{};
+            if ( !parse_number( value, milliseconds ) || milliseconds == 0 || milliseconds > UINT32_MAX )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.stream_lead_ms = static_cast< std::uint32_t >( milliseconds );
+        }
+        else if ( name == "--broadcast-ring" )
+        {
+            std::size_t messages{};
+            if ( !parse_number( value, messages ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.broadcast_ring = messages;
+        }
+        else if ( name == "--checksum-threads" )
+        {
+            std::size_t threads{};
+            if ( !parse_number( value, threads ) || threads == 0 )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.checksum_threads = threads;
+        }
+        else if ( name == "--metrics-port" )
+        {
+            std::size_t port{};
+            if ( !parse_number( value, port ) || port == 0 || port > UINT16_MAX )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.metrics_port = static_cast< std::uint16_t >( port );
+        }
+        else if ( name == "--pack-dir" )
+        {
+            if ( value.empty() )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.pack_directory = value;
+        }
+        else if ( name == "--io" )
+        {
+            if ( value == "uring" )
+            {
+                options.io_backend = FileUtils::IoBackend::Uring;
+            }
+            else if ( value == "pread" )
+            {
+                options.io_backend = FileUtils::IoBackend::Pread;
+            }
+            else if ( value == "stdio" )
+            {
+                options.io_backend = FileUtils::IoBackend::Stdio;
+            }
+            else
+            {
+                spdlog::error( "Invalid value '{}' for {}, expected uring, pread or stdio", value, name );
+                return std::nullopt;
+            }
+        }
+        else if ( name == "--read-ahead" )
+        {
+            std::size_t blocks{};
+            if ( !parse_number( value, blocks ) || blocks == 0 || blocks > 64 )
+            {
+                spdlog::error( "Invalid value '{}' for {}, expected 1 to 64 blocks", value, name );
+                return std::nullopt;
+            }
+            options.read_ahead = blocks;
+        }
+        else if ( name == "--read-block" )
+        {
+            std::size_t kibibytes{};
+            if ( !parse_number( value, kibibytes ) || kibibytes == 0 || kibibytes > 64 * 1024 )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.read_block_size = kibibytes * 1024;
+        }
+        else if ( name == "--direct-io-above" )
+        {
+            std::size_t mebibytes{};
+            if ( !parse_number( value, mebibytes ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.direct_io_above = std::uint64_t{ mebibytes } * 1024 * 1024;
+        }
+        else if ( name == "--peaks-dir" )
+        {
+            if ( value.empty() )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.peaks_directory = value;
+        }
+        else if ( name == "--peaks-budget" )
+        {
+            std::size_t mebibytes{};
+            if ( !parse_number( value, mebibytes ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+            options.peaks_budget = std::uint64_t{ mebibytes } * 1024 * 1024;
+        }
+        else if ( name == "--async" )
+        {
+            options.async = true;
+        }
+        else if ( name == "--adaptive-chunks" )
+        {
+            options.adaptive_chunks = true;
+        }
+        else if ( name == "--chunk-size" || name == "--max-chunk-size" )
+        {
+            // has to fit into a single gRPC message, which are capped at 4 MiB by default
+            std::size_t const largest_chunk{ 4 * 1024 * 1024 - 1024 };
+
+            std::size_t bytes{};
+            if ( !parse_number( value, bytes ) || bytes == 0 || bytes > largest_chunk )
+            {
+                spdlog::error( "Invalid value '{}' for {}, expected 1 to {} bytes", value, name, largest_chunk );
+                return std::nullopt;
+            }
+            ( name == "--chunk-size" ? options.chunk_size : options.max_chunk_size ) = static_cast< std::uint32_t >( bytes );
+        }
+        else if ( name == "--completion-queues" || name == "--threads-per-queue" )
+        {
+            auto & output{ name == "--completion-queues" ? options.completion_queues : options.threads_per_queue };
+            if ( !parse_number( value, output ) )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            spdlog::error( "Unknown option '{}'", arg );
+            return std::nullopt;
+        }
+    }
+
+    return options;
 }
 
 int run_client( char const * argv [] )
@@ -68,7 +304,171 @@ int run_client( char const * argv [] )
     return 0;
 }
 
-int run_server( char const * argv [] )
+// Downloads many files at once, every file the server has unless they're listed explicitly
+int run_batch_download( int const argc, char const * argv [] )
+{
+    if ( argc < 4 )
+    {
+        spdlog::error( "Wrong number of parameters!" );
+        print_help();
+        return 1;
+    }
+
+    auto const parse_number{ []( std::string_view const value, auto & output )
+    {
+        auto const [ ptr, ec ]{ std::from_chars( value.data(), value.data() + value.size(), output ) };
+        return ec == std::errc{} && ptr == value.data() + value.size();
+    } };
+
+    std::string_view const port_arg{ argv[ 2 ] };
+    std::size_t port{};
+    if ( !parse_number( port_arg, port ) || port == 0 || port > UINT16_MAX )
+    {
+        spdlog::error( "Invalid port '{}'", port_arg );
+        print_help();
+        return 1;
+    }
+
+    auto const output_directory{ argv[ 3 ] };
+
+    std::size_t                concurrency{ 8 };
+    bool                       compress   { false };
+    bool                       sync       { false };
+    Teleaudio::OutputFormat    format;
+    std::vector< std::string > files;
+
+    for ( int i{ 4 }; i < argc; ++i )
+    {
+        std::string_view const arg{ argv[ i ] };
+        auto const separator{ arg.find( '=' ) };
+        auto const name     { arg.substr( 0, separator ) };
+        auto const value    { separator == std::string_view::npos ? std::string_view{} : arg.substr( separator + 1 ) };
+
+        auto const invalid{ [ & ]
+        {
+            spdlog::error( "Invalid value '{}' for {}", value, name );
+            return 1;
+        } };
+
+        if ( name == "--concurrency" )
+        {
+            if ( !parse_number( value, concurrency ) || concurrency == 0 )
+            {
+                return invalid();
+            }
+        }
+        else if ( name == "--sample-rate" )
+        {
+            if ( !parse_number( value, format.sample_rate ) )
+            {
+                return invalid();
+            }
+        }
+        else if ( name == "--bits-per-sample" || name == "--channels" )
+        {
+            if ( !parse_number( value, name == "--channels" ? format.channels : format.bits_per_sample ) )
+            {
+                return invalid();
+            }
+        }
+        else if ( arg == "--compress" )
+        {
+            compress = true;
+        }
+        else if ( arg == "--sync" )
+        {
+            sync = true;
+        }
+        else if ( arg == "--float" )
+        {
+            format.floating_point = true;
+        }
+        else if ( arg.starts_with( "--" ) )
+        {
+            spdlog::error( "Unknown option '{}'", arg );
+            print_help();
+            return 1;
+        }
+        else
+        {
+            files.emplace_back( arg );
+        }
+    }
+
+    Teleaudio::AudioClient c{ grpc::CreateChannel( "localhost:" + std::to_string( port ), grpc::InsecureChannelCredentials() ) };
+    c.SetCompression( compress );
+    c.SetOutputFormat( format );
+
+    if ( files.empty() )
+    {
+        // one quoted file name per line
+        std::istringstream listing{ c.List() };
+        for ( std::string line; std::getline( listing, line ); )
+        {
+            if ( line.size() > 2 && line.front() == '"' && line.back() == '"' )
+            {
+                line = line.substr( 1, line.size() - 2 );
+            }
+            if ( !line.empty() )
+            {
+                files.push_back( std::move( line ) );
+            }
+        }
+    }
+
+    auto const start{ std::chrono::steady_clock::now() };
+
+    if ( sync )
+    {
+        auto const synced{ c.SyncMany( files, output_directory, concurrency ) };
+        auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() };
+
+        std::size_t   succeeded{};
+        std::size_t   unchanged{};
+        std::size_t   blocks   {};
+        std::size_t   fetched  {};
+        std::uint64_t bytes    {};
+        for ( std::size_t i{}; i < synced.size(); ++i )
+        {
+            if ( !synced[ i ].has_value() )
+            {
+                spdlog::error( "Failed to sync '{}'", files[ i ] );
+                continue;
+            }
+            ++succeeded;
+            unchanged += synced[ i ]->unchanged ? 1 : 0;
+            blocks    += synced[ i ]->blocks;
+            fetched   += synced[ i ]->blocks_fetched;
+            bytes     += synced[ i ]->bytes_fetched;
+        }
+
+        spdlog::info( "Synced {}/{} files, {} unchanged, fetched {} of {} blocks, {} bytes in {:.3f}s", succeeded, synced.size(), unchanged, fetched, blocks, bytes, seconds );
+        return succeeded == synced.size() ? 0 : 1;
+    }
+
+    auto const results{ c.DownloadMany( files, output_directory, concurrency ) };
+    auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() };
+
+    std::size_t   succeeded{};
+    std::uint64_t bytes    {};
+    for ( auto const & result : results )
+    {
+        if ( result.ok )
+        {
+            ++succeeded;
+            bytes += result.bytes_received;
+        }
+        else
+        {
+            spdlog::error( "Failed to download '{}'", result.file );
+        }
+    }
+
+    spdlog::info( "Downloaded {}/{} files, {} bytes in {:.3f}s, {:.1f} MB/s", succeeded, results.size(), bytes, seconds, seconds > 0 ? static_cast< double >( bytes ) / seconds / 1e6 : 0.0 );
+    return succeeded == results.size() ? 0 : 1;
+}
+
+int run_server( int const argc, char const * argv [] )
 {
     if ( argv[ 1 ] != std::string{ "server" } )
     {
@@ -80,10 +480,187 @@ int run_server( char const * argv [] )
     std::string const port_arg{ argv[ 2 ] };
     auto const storage{ argv[ 3 ] };
 
+    auto const options{ parse_server_options( argc, argv ) };
+    if ( !options.has_value() )
+    {
+        print_help();
+        return 1;
+    }
+
+    int port{};
+    std::from_chars( port_arg.data(), port_arg.data() + port_arg.size(), port );
+    Teleaudio::run_server( storage, static_cast< std::uint16_t >( port ), *options );
+
+    return 0;
+}
+
+// Plays a file while it's streamed, on the sound card unless it's asked to play into a file or into nothing
+int run_play( int const argc, char const * argv [] )
+{
+    if ( argc < 4 )
+    {
+        spdlog::error( "Wrong number of parameters!" );
+        print_help();
+        return 1;
+    }
+
+    std::string const port_arg{ argv[ 2 ] };
+    int port{};
+    std::from_chars( port_arg.data(), port_arg.data() + port_arg.size(), port );
+
+    auto const file{ argv[ 3 ] };
+
+    Teleaudio::PlaybackOptions              options;
+    std::unique_ptr< Teleaudio::AudioSink > sink;
+    for ( int i{ 4 }; i < argc; ++i )
+    {
+        std::string_view const arg{ argv[ i ] };
+        auto const separator{ arg.find( '=' ) };
+        auto const name     { arg.substr( 0, separator ) };
+        auto const value    { separator == std::string_view::npos ? std::string_view{} : arg.substr( separator + 1 ) };
+
+        if ( name == "--jitter-buffer" )
+        {
+            std::uint32_t milliseconds{};
+            auto const [ ptr, ec ]{ std::from_chars( value.data(), value.data() + value.size(), milliseconds ) };
+            if ( ec != std::errc{} || ptr != value.data() + value.size() )
+            {
+                spdlog::error( "Invalid value '{}' for {}", value, name );
+                return 1;
+            }
+            options.jitter_buffer = std::chrono::milliseconds{ milliseconds };
+        }
+        else if ( name == "--output" && !value.empty() )
+        {
+            sink = std::make_unique< Teleaudio::FileSink >( std::string{ value } );
+        }
+        else if ( arg == "--null" )
+        {
+            sink = std::make_unique< Teleaudio::NullSink >();
+        }
+        else
+        {
+            spdlog::error( "Unknown option '{}'", arg );
+            return 1;
+        }
+    }
+
+    if ( !sink )
+    {
+        sink = Teleaudio::makeDeviceSink();
+        if ( !sink )
+        {
+            spdlog::error( "teleaudio was built without ALSA, play with --output or --null instead" );
+            return 1;
+        }
+    }
+
+    Teleaudio::AudioClient c{ grpc::CreateChannel( "localhost:" + std::to_string( port ), grpc::InsecureChannelCredentials() ) };
+
+    auto const statistics{ c.Play( file, *sink, options ) };
+    return statistics.has_value() && statistics->ok ? 0 : 1;
+}
+
+// Packs every file of the storage ahead of time, so a server using the same packs and chunk size serves them right away
+int run_pack( int const argc, char const * argv [] )
+{
+    if ( argc < 4 )
+    {
+        spdlog::error( "Wrong number of parameters!" );
+        print_help();
+        return 1;
+    }
+
+    auto const storage  { argv[ 2 ] };
+    auto const directory{ argv[ 3 ] };
+
+    auto const options{ parse_server_options( argc, argv ) };
+    if ( !options.has_value() )
+    {
+        print_help();
+        return 1;
+    }
+
+    auto const start{ std::chrono::steady_clock::now() };
+
+    Teleaudio::PackStore store{ storage, directory, options->chunk_size, options->pack_budget };
+    auto const packed{ store.packAll() };
+
+    auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() };
+    spdlog::info( "Packed {} files into '{}', {} bytes in {:.3f}s", packed, directory, store.bytes_used(), seconds );
+    return 0;
+}
+
+// Prints the metrics of a running server in the Prometheus text format
+int run_metrics( int const argc, char const * argv [] )
+{
+    if ( argc != 3 )
+    {
+        spdlog::error( "Wrong number of parameters!" );
+        print_help();
+        return 1;
+    }
+
+    std::string const port_arg{ argv[ 2 ] };
     int port{};
     std::from_chars( port_arg.data(), port_arg.data() + port_arg.size(), port );
-    Teleaudio::run_server( storage, static_cast< std::uint16_t >( port ) );
 
+    Teleaudio::AudioClient c{ grpc::CreateChannel( "localhost:" + std::to_string( port ), grpc::InsecureChannelCredentials() ) };
+
+    auto const report{ c.GetMetrics() };
+    if ( !report.has_value() )
+    {
+        return 1;
+    }
+    std::fputs( report->prometheus().c_str(), stdout );
+    return 0;
+}
+
+// Prints the waveform overview of a file, a line per bucket with the lowest, highest and RMS sample of every channel
+int run_peaks( int const argc, char const * argv [] )
+{
+    if ( argc != 4 && argc != 5 )
+    {
+        spdlog::error( "Wrong number of parameters!" );
+        print_help();
+        return 1;
+    }
+
+    std::string const port_arg{ argv[ 2 ] };
+    int port{};
+    std::from_chars( port_arg.data(), port_arg.data() + port_arg.size(), port );
+
+    std::uint32_t buckets{ 64 };
+    if ( argc == 5 )
+    {
+        std::string_view const buckets_arg{ argv[ 4 ] };
+        auto const [ ptr, ec ]{ std::from_chars( buckets_arg.data(), buckets_arg.data() + buckets_arg.size(), buckets ) };
+        if ( ec != std::errc{} || ptr != buckets_arg.data() + buckets_arg.size() || buckets == 0 )
+        {
+            spdlog::error( "Invalid number of buckets '{}'", buckets_arg );
+            return 1;
+        }
+    }
+
+    Teleaudio::AudioClient c{ grpc::CreateChannel( "localhost:" + std::to_string( port ), grpc::InsecureChannelCredentials() ) };
+
+    auto const peaks{ c.GetPeaks( argv[ 3 ], buckets ) };
+    if ( !peaks.has_value() )
+    {
+        return 1;
+    }
+
+    for ( std::uint32_t bucket{}; bucket < peaks->buckets(); ++bucket )
+    {
+        auto const first{ peaks->start_frame() + bucket * peaks->frames() / peaks->buckets() };
+        std::string line{ fmt::format( "{:>12}", first ) };
+        for ( std::uint32_t channel{}; channel < peaks->channels(); ++channel )
+        {
+            auto const i{ static_cast< int >( bucket * peaks->channels() + channel ) };
+            line += fmt::format( "  {:+.4f} {:+.4f} {:.4f}", peaks->min( i ), peaks->max( i ), peaks->rms( i ) );
+        }
+        std::puts( line.c_str() );
+    }
     return 0;
 }
 
@@ -116,15 +693,40 @@ int main( int argc, char const * argv[] )
 {
     create_logger_with_multiple_sinks();
 
+    // batch download
+    if ( argc >= 2 && argv[ 1 ] == std::string_view{ "download" } )
+    {
+        return run_batch_download( argc, argv );
+    }
+    // playing while streaming
+    else if ( argc >= 2 && argv[ 1 ] == std::string_view{ "play" } )
+    {
+        return run_play( argc, argv );
+    }
+    // pre-warming the packs
+    else if ( argc >= 2 && argv[ 1 ] == std::string_view{ "pack" } )
+    {
+        return run_pack( argc, argv );
+    }
+    // asking a server how it's doing
+    else if ( argc >= 2 && argv[ 1 ] == std::string_view{ "metrics" } )
+    {
+        return run_metrics( argc, argv );
+    }
+    // drawing a waveform
+    else if ( argc >= 2 && argv[ 1 ] == std::string_view{ "peaks" } )
+    {
+        return run_peaks( argc, argv );
+    }
     //  client
-    if ( argc == 3 )
+    else if ( argc == 3 )
     {
         return run_client( argv );
     }
     // server
-    else if ( argc == 4 )
+    else if ( argc >= 4 )
     {
-        return run_server( argv );
+        return run_server( argc, argv );
     }
 
     print_help();
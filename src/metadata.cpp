@@ -0,0 +1,21 @@
+#include "metadata.hpp"
+
+namespace Teleaudio
+{
+    AudioMetadata makeMetadata( WAV::FmtSubChunk const & format, std::uint64_t const raw_data_size, std::uint64_t const offset, std::uint64_t const length, PayloadCodec const codec )
+    {
+        AudioMetadata ret;
+        ret.set_averagebytespersecond( format.byte_rate       );
+        ret.set_bitspersample        ( format.bits_per_sample );
+        ret.set_blockalign           ( format.block_align     );
+        ret.set_channels             ( format.num_channels    );
+        ret.set_samplerate           ( format.sample_rate     );
+        ret.set_audioformat          ( format.audio_format    );
+        ret.set_rawdatasize          ( raw_data_size          );
+        ret.set_offset               ( offset                 );
+        ret.set_length               ( length                 );
+        ret.set_codec                ( codec                  );
+
+        return ret;
+    }
+} // namespace Teleaudio
@@ -0,0 +1,306 @@
+#include "metrics.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// a scraper hanging up mustn't kill the server
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace
+{
+    using namespace Teleaudio::Metrics;
+
+    struct Registry
+    {
+        std::mutex            mutex;
+        std::vector< Shard * > shards;
+        Snapshot              retired; // of the threads that are gone
+    };
+
+    // never destroyed, threads may exit after the statics are gone
+    [[ nodiscard ]] Registry & registry()
+    {
+        static auto * const instance{ new Registry };
+        return *instance;
+    }
+
+    void addTo( Snapshot & total, Shard const & shard )
+    {
+        for ( std::size_t i{}; i < counter_count; ++i )
+        {
+            total.counters[ i ] += shard.counters[ i ].load( std::memory_order_relaxed );
+        }
+        for ( std::size_t i{}; i < histogram_count; ++i )
+        {
+            auto       & sum  { total.histograms[ i ] };
+            auto const & local{ shard.histograms[ i ] };
+            for ( std::size_t bucket{}; bucket < bucket_count; ++bucket )
+            {
+                sum.buckets[ bucket ] += local.buckets[ bucket ].load( std::memory_order_relaxed );
+            }
+            sum.count += local.count.load( std::memory_order_relaxed );
+            sum.sum   += local.sum  .load( std::memory_order_relaxed );
+            sum.max    = std::max( sum.max, local.max.load( std::memory_order_relaxed ) );
+        }
+    }
+
+    // The shard of a thread for as long as it lives
+    struct LocalShard
+    {
+        std::unique_ptr< Shard > shard{ std::make_unique< Shard >() };
+
+        LocalShard()
+        {
+            auto & shared{ registry() };
+            std::lock_guard lock{ shared.mutex };
+            shared.shards.push_back( shard.get() );
+        }
+
+        ~LocalShard()
+        {
+            auto & shared{ registry() };
+            std::lock_guard lock{ shared.mutex };
+            addTo( shared.retired, *shard );
+            std::erase( shared.shards, shard.get() );
+        }
+    };
+
+    // the lowest bound of the exported histograms, 1.024 microseconds
+    constexpr unsigned min_exported_bits{ 10 };
+
+    constexpr std::array< std::string_view, counter_count > counter_names
+    {
+        "list_calls_total",
+        "download_calls_total",
+        "stream_calls_total",
+        "sent_bytes_total",
+        "sent_messages_total",
+        "active_streams",
+        "packed_downloads_total",
+        "file_cache_hits_total",
+        "file_cache_misses_total",
+        "file_cache_evictions_total",
+    };
+
+    constexpr std::array< std::string_view, histogram_count > histogram_names
+    {
+        "list_latency_seconds",
+        "first_byte_seconds",
+        "download_duration_seconds",
+        "write_stall_seconds",
+        "file_load_seconds",
+    };
+}
+
+namespace Teleaudio::Metrics
+{
+    Shard & localShard()
+    {
+        thread_local LocalShard local;
+        return *local.shard;
+    }
+
+    std::chrono::nanoseconds HistogramSnapshot::percentile( double const quantile ) const
+    {
+        if ( count == 0 )
+        {
+            return {};
+        }
+
+        auto const rank{ std::max< std::uint64_t >( 1, static_cast< std::uint64_t >( std::ceil( std::clamp( quantile, 0.0, 1.0 ) * static_cast< double >( count ) ) ) ) };
+
+        std::uint64_t seen{};
+        for ( std::size_t bucket{}; bucket < bucket_count; ++bucket )
+        {
+            seen += buckets[ bucket ];
+            if ( seen >= rank )
+            {
+                return std::chrono::nanoseconds{ static_cast< std::int64_t >( std::min( bucketEnd( bucket ) - 1, max ) ) };
+            }
+        }
+        return std::chrono::nanoseconds{ static_cast< std::int64_t >( max ) };
+    }
+
+    Snapshot collect()
+    {
+        auto & shared{ registry() };
+        std::lock_guard lock{ shared.mutex };
+
+        auto total{ shared.retired };
+        for ( auto const * const shard : shared.shards )
+        {
+            addTo( total, *shard );
+        }
+        return total;
+    }
+
+    std::string_view name( Counter const which )
+    {
+        return counter_names[ static_cast< std::size_t >( which ) ];
+    }
+
+    std::string_view name( Histogram const which )
+    {
+        return histogram_names[ static_cast< std::size_t >( which ) ];
+    }
+
+    std::string prometheus( Snapshot const & snapshot )
+    {
+        std::string text;
+        for ( std::size_t i{}; i < counter_count; ++i )
+        {
+            auto const counter{ static_cast< Counter >( i ) };
+            text += fmt::format( "# TYPE teleaudio_{} {}\nteleaudio_{} {}\n", name( counter ), counter == Counter::ActiveStreams ? "gauge" : "counter",
+                                 name( counter ), snapshot.counters[ i ] );
+        }
+
+        for ( std::size_t i{}; i < histogram_count; ++i )
+        {
+            auto const   metric   { name( static_cast< Histogram >( i ) ) };
+            auto const & histogram{ snapshot.histograms[ i ] };
+            text += fmt::format( "# TYPE teleaudio_{} histogram\n", metric );
+
+            // every bucket ends on a power of two or below it, so they add up into one per power of two.
+            // Every scrape has the same bounds, from about a microsecond up, or rates over them come out wrong
+            std::uint64_t cumulative{};
+            std::size_t   bucket    {};
+            for ( unsigned bits{}; bits <= max_value_bits; ++bits )
+            {
+                auto const bound{ std::uint64_t{ 1 } << bits };
+                for ( ; bucket < bucket_count && bucketEnd( bucket ) <= bound; ++bucket )
+                {
+                    cumulative += histogram.buckets[ bucket ];
+                }
+                if ( bits >= min_exported_bits )
+                {
+                    text += fmt::format( "teleaudio_{}_bucket{{le=\"{:g}\"}} {}\n", metric, static_cast< double >( bound ) / 1e9, cumulative );
+                }
+            }
+            text += fmt::format( "teleaudio_{}_bucket{{le=\"+Inf\"}} {}\n", metric, histogram.count );
+            text += fmt::format( "teleaudio_{}_sum {:.9f}\n", metric, static_cast< double >( histogram.sum ) / 1e9 );
+            text += fmt::format( "teleaudio_{}_count {}\n", metric, histogram.count );
+        }
+        return text;
+    }
+
+#ifdef _WIN32
+    Exporter::Exporter( std::uint16_t const )
+    {
+        spdlog::warn( "Serving the metrics over HTTP is not supported on Windows" );
+    }
+
+    Exporter::~Exporter() = default;
+
+    void Exporter::serve( std::stop_token const & ) {}
+#else
+    Exporter::Exporter( std::uint16_t const port )
+    {
+        listener_ = ::socket( AF_INET, SOCK_STREAM, 0 );
+        if ( listener_ < 0 || ::pipe( wakeup_ ) != 0 )
+        {
+            spdlog::error( "Cannot serve the metrics: {}", std::strerror( errno ) );
+            return;
+        }
+
+        int const reuse{ 1 };
+        ::setsockopt( listener_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+
+        // only for the machine itself
+        sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_port        = htons( port );
+        address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+        socklen_t length{ sizeof( address ) };
+        if ( ::bind( listener_, reinterpret_cast< sockaddr const * >( &address ), sizeof( address ) ) != 0
+          || ::listen( listener_, 16 ) != 0
+          || ::getsockname( listener_, reinterpret_cast< sockaddr * >( &address ), &length ) != 0 )
+        {
+            spdlog::error( "Cannot serve the metrics on port {}: {}", port, std::strerror( errno ) );
+            return;
+        }
+
+        port_   = ntohs( address.sin_port );
+        worker_ = std::jthread{ [ this ]( std::stop_token const stop ) { serve( stop ); } };
+        spdlog::info( "Serving the metrics on http://127.0.0.1:{}/metrics", port_ );
+    }
+
+    Exporter::~Exporter()
+    {
+        if ( worker_.joinable() )
+        {
+            worker_.request_stop();
+            char const byte{};
+            [[ maybe_unused ]] auto const woken{ ::write( wakeup_[ 1 ], &byte, 1 ) };
+            worker_.join();
+        }
+        for ( auto const fd : { listener_, wakeup_[ 0 ], wakeup_[ 1 ] } )
+        {
+            if ( fd >= 0 )
+            {
+                ::close( fd );
+            }
+        }
+    }
+
+    void Exporter::serve( std::stop_token const & stop )
+    {
+        while ( !stop.stop_requested() )
+        {
+            std::array< pollfd, 2 > fds
+            {
+                pollfd{ .fd = listener_,    .events = POLLIN, .revents = 0 },
+                pollfd{ .fd = wakeup_[ 0 ], .events = POLLIN, .revents = 0 },
+            };
+            if ( ::poll( fds.data(), fds.size(), -1 ) < 0 || ( fds[ 1 ].revents & POLLIN ) != 0 )
+            {
+                continue;
+            }
+
+            auto const client{ ::accept( listener_, nullptr, nullptr ) };
+            if ( client < 0 )
+            {
+                continue;
+            }
+
+            // whatever was asked for, the answer is the same, a scraper waiting for it gets a second
+            pollfd request{ .fd = client, .events = POLLIN, .revents = 0 };
+            if ( ::poll( &request, 1, 1000 ) > 0 )
+            {
+                std::array< char, 4096 > ignored;
+                [[ maybe_unused ]] auto const received{ ::recv( client, ignored.data(), ignored.size(), 0 ) };
+            }
+
+            auto const body    { prometheus( collect() ) };
+            auto const response{ fmt::format( "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}", body.size(), body ) };
+
+            std::size_t sent{};
+            while ( sent < response.size() )
+            {
+                auto const written{ ::send( client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL ) };
+                if ( written <= 0 )
+                {
+                    break;
+                }
+                sent += static_cast< std::size_t >( written );
+            }
+            ::close( client );
+        }
+    }
+#endif
+} // namespace Teleaudio::Metrics
@@ -0,0 +1,499 @@
+#include "pack_store.hpp"
+#include "communication.pb.h"
+#include "metadata.hpp"
+#include "wav.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr std::array< char, 4 > pack_magic{ 'T', 'A', 'P', 'K' };
+    constexpr std::uint32_t         pack_version{ 1 };
+
+    // a temporary file not written to for that long was left by a server that's gone
+    constexpr std::chrono::hours stale_temporary_age{ 1 };
+
+    // In front of every sidecar, followed by the offsets of the `messages` messages
+    // and of the end of the last one, then by the messages themselves
+    struct PackHeader
+    {
+        std::array< char, 4 > magic{ pack_magic };
+        std::uint32_t         version{ pack_version };
+        std::int64_t          source_mtime{};
+        std::uint64_t         source_size{};
+        std::uint32_t         chunk_size{};
+        std::uint32_t         messages{};
+        std::uint32_t         raw_data_size{};
+        std::uint32_t         reserved{};
+    };
+    static_assert( sizeof( PackHeader ) == 40 );
+
+    [[ nodiscard ]] std::uint64_t messageOffset( std::span< std::byte const > const sidecar, std::size_t const index )
+    {
+        std::uint64_t offset;
+        std::memcpy( &offset, sidecar.data() + sizeof( PackHeader ) + index * sizeof( offset ), sizeof( offset ) );
+        return offset;
+    }
+}
+
+namespace Teleaudio
+{
+    PackStore::Pack::Pack( FileUtils::MappedRegion region, std::uint32_t const chunk_size, std::uint32_t const messages, std::uint32_t const raw_data_size )
+        : region_       { std::move( region ) }
+        , chunk_size_   { chunk_size          }
+        , messages_     { messages            }
+        , raw_data_size_{ raw_data_size       }
+    {}
+
+    std::span< std::byte const > PackStore::Pack::message( std::size_t const index ) const
+    {
+        auto const bytes{ region_.bytes() };
+        auto const begin{ messageOffset( bytes, index     ) };
+        auto const end  { messageOffset( bytes, index + 1 ) };
+        return bytes.subspan( begin, end - begin );
+    }
+
+    std::uint32_t PackStore::Pack::samples( std::size_t const index ) const
+    {
+        if ( index == 0 )
+        {
+            return 0;
+        }
+        auto const start{ static_cast< std::uint64_t >( index - 1 ) * chunk_size_ };
+        return static_cast< std::uint32_t >( std::min< std::uint64_t >( chunk_size_, raw_data_size_ - start ) );
+    }
+
+    PackStore::PackStore( fs::path storage, fs::path directory, std::uint32_t const chunk_size, std::uint64_t const byte_budget )
+        : storage_    { std::move( storage )   }
+        , directory_  { std::move( directory ) }
+        , chunk_size_ { std::max( chunk_size, 1U ) }
+        , byte_budget_{ byte_budget }
+    {
+        std::error_code ec;
+        fs::create_directories( directory_, ec );
+        if ( ec )
+        {
+            spdlog::error( "Cannot create the pack directory '{}': {}", directory_.string(), ec.message() );
+        }
+
+        // the sidecars left from before, the older ones are the first to go
+        std::vector< std::pair< fs::file_time_type, std::string > > found;
+        for ( auto it{ fs::recursive_directory_iterator( directory_, ec ) }; !ec && it != fs::recursive_directory_iterator{}; it.increment( ec ) )
+        {
+            if ( !it->is_regular_file( ec ) )
+            {
+                continue;
+            }
+
+            auto const & path{ it->path() };
+            if ( path.extension() == ".tmp" )
+            {
+                // a pack that was interrupted, the recent ones may still be written by another server sharing the directory
+                std::error_code time_ec;
+                auto const written{ it->last_write_time( time_ec ) };
+                if ( !time_ec && fs::file_time_type::clock::now() - written > stale_temporary_age )
+                {
+                    fs::remove( path, ec );
+                }
+            }
+            else if ( path.extension() == ".pack" )
+            {
+                auto relative{ fs::relative( path, directory_, ec ) };
+                relative.replace_extension();
+
+                std::lock_guard lock{ mutex_ };
+                auto const size{ it->file_size( ec ) };
+                usage_[ relative.generic_string() ] = Usage{ size, 0 };
+                bytes_used_ += size;
+                found.emplace_back( it->last_write_time( ec ), relative.generic_string() );
+            }
+        }
+        std::sort( found.begin(), found.end() );
+
+        {
+            std::lock_guard lock{ mutex_ };
+            for ( auto const & [ mtime, relative ] : found )
+            {
+                usage_[ relative ].last_used = ++clock_;
+            }
+            evict( {} );
+            spdlog::info( "Found {} packed files, {} bytes", usage_.size(), bytes_used_ );
+        }
+
+        worker_ = std::jthread{ [ this ]( std::stop_token const stop ) { work( stop ); } };
+    }
+
+    PackStore::~PackStore()
+    {
+        // a file being packed is finished first
+        worker_.request_stop();
+        worker_.join();
+    }
+
+    PackStore::PackPtr PackStore::get( std::string_view const relative_path )
+    {
+        auto const sidecar_path{ sidecar( relative_path ) };
+        if ( !sidecar_path.has_value() )
+        {
+            return nullptr;
+        }
+
+        auto const relative{ fs::path{ relative_path }.lexically_normal() };
+        auto const source  { storage_ / relative };
+        auto const key     { relative.generic_string() };
+
+        auto pack{ cached( key, source, *sidecar_path ) };
+
+        std::lock_guard lock{ mutex_ };
+        if ( pack )
+        {
+            auto & usage{ usage_[ key ] };
+            if ( usage.size == 0 )
+            {
+                // packed by another process
+                std::error_code ec;
+                usage.size   = fs::file_size( *sidecar_path, ec );
+                bytes_used_ += usage.size;
+            }
+            usage.last_used = ++clock_;
+            return pack;
+        }
+
+        std::error_code ec;
+        if ( fs::is_regular_file( source, ec ) && queued_.insert( key ).second )
+        {
+            queue_.push_back( key );
+            queue_changed_.notify_one();
+        }
+        return nullptr;
+    }
+
+    bool PackStore::pack( std::string_view const relative_path )
+    {
+        auto const sidecar_path{ sidecar( relative_path ) };
+        if ( !sidecar_path.has_value() )
+        {
+            spdlog::error( "Cannot pack '{}', it is outside of the storage", relative_path );
+            return false;
+        }
+
+        auto const relative{ fs::path{ relative_path }.lexically_normal() };
+        auto const source  { storage_ / relative };
+        auto const key     { relative.generic_string() };
+
+        if ( cached( key, source, *sidecar_path ) )
+        {
+            return true;
+        }
+
+        auto const before{ FileUtils::stamp( source ) };
+        if ( !before.has_value() )
+        {
+            spdlog::error( "Cannot pack '{}', it doesn't exist", source.string() );
+            return false;
+        }
+
+        WAV::FileReader reader{ source.string() };
+        if ( !reader.valid() )
+        {
+            spdlog::warn( "Not packing '{}', its headers are not valid", source.string() );
+            return false;
+        }
+
+        if ( reader.data_size > UINT32_MAX )
+        {
+            spdlog::warn( "Not packing '{}', its {} bytes of samples are more than a download can announce", source.string(), reader.data_size );
+            return false;
+        }
+
+        auto const raw_data_size{ static_cast< std::uint32_t >( reader.data_size ) };
+        auto const chunks       { ( std::uint64_t{ raw_data_size } + chunk_size_ - 1 ) / chunk_size_ };
+
+        PackHeader header;
+        header.source_mtime  = before->mtime;
+        header.source_size   = before->size;
+        header.chunk_size    = chunk_size_;
+        header.messages      = static_cast< std::uint32_t >( chunks + 1 );
+        header.raw_data_size = raw_data_size;
+
+        std::error_code ec;
+        fs::create_directories( sidecar_path->parent_path(), ec );
+
+        // a pack of the same file from another process or thread gets its own temporary file
+        fs::path const temporary{ FileUtils::temporaryPath( sidecar_path->string() ) };
+
+        auto const discard{ [ & ]
+        {
+            std::error_code ignored;
+            fs::remove( temporary, ignored );
+            return false;
+        } };
+
+        std::vector< std::uint64_t > offsets( header.messages + 1 );
+        auto position{ sizeof( PackHeader ) + offsets.size() * sizeof( std::uint64_t ) };
+        {
+            auto const file{ FileUtils::openFile( temporary.string(), FileUtils::FileOpenMode::WriteBinary ) };
+            if ( !file )
+            {
+                spdlog::error( "Cannot create '{}'", temporary.string() );
+                return false;
+            }
+
+            // the header and the offsets are filled in once the messages are written
+            if ( !FileUtils::seek( file.get(), position ) )
+            {
+                return discard();
+            }
+
+            // the same messages `Download` sends for the whole file
+            AudioData message;
+            *message.mutable_metadata() = makeMetadata( reader.format, raw_data_size, 0, raw_data_size, PAYLOAD_RAW );
+
+            std::vector< std::byte > samples( chunk_size_ );
+            for ( std::size_t index{}; index < header.messages; ++index )
+            {
+                if ( index > 0 )
+                {
+                    auto const read_size{ reader.read( samples ) };
+                    if ( read_size == 0 )
+                    {
+                        spdlog::warn( "Not packing '{}', it is missing samples", source.string() );
+                        return discard();
+                    }
+                    message.set_rawdata( samples.data(), read_size );
+                }
+
+                auto const serialized{ message.SerializeAsString() };
+                if ( !FileUtils::write( file.get(), std::as_bytes( std::span{ serialized } ) ) )
+                {
+                    spdlog::error( "Writing '{}' failed", temporary.string() );
+                    return discard();
+                }
+                offsets[ index ] = position;
+                position        += serialized.size();
+            }
+            offsets.back() = position;
+
+            if ( std::fflush( file.get() ) != 0
+              || !FileUtils::writeAt( file.get(), 0,                    std::as_bytes( std::span{ &header, 1 } ) )
+              || !FileUtils::writeAt( file.get(), sizeof( PackHeader ), std::as_bytes( std::span{ offsets     } ) )
+              || !FileUtils::sync( file.get() ) )
+            {
+                spdlog::error( "Writing '{}' failed", temporary.string() );
+                return discard();
+            }
+        }
+
+        // the file changed while it was being read, the pack may mix both versions
+        if ( FileUtils::stamp( source ) != before )
+        {
+            spdlog::warn( "Not packing '{}', it changed while being packed", source.string() );
+            return discard();
+        }
+
+        fs::rename( temporary, *sidecar_path, ec );
+        if ( ec )
+        {
+            spdlog::error( "Cannot move '{}' into place: {}", temporary.string(), ec.message() );
+            return discard();
+        }
+
+        spdlog::debug( "Packed '{}' into {} messages, {} bytes", key, header.messages, position );
+
+        std::lock_guard lock{ mutex_ };
+        loaded_.erase( key );
+        auto & usage{ usage_[ key ] };
+        bytes_used_    -= usage.size;
+        usage.size      = position;
+        usage.last_used = ++clock_;
+        bytes_used_    += usage.size;
+        evict( key );
+        return true;
+    }
+
+    std::size_t PackStore::packAll()
+    {
+        std::size_t packed{};
+
+        std::error_code ec;
+        for ( auto it{ fs::recursive_directory_iterator( storage_, ec ) }; !ec && it != fs::recursive_directory_iterator{}; it.increment( ec ) )
+        {
+            if ( it->is_regular_file( ec ) && it->path().extension() == ".wav" )
+            {
+                auto const relative{ fs::relative( it->path(), storage_, ec ) };
+                if ( !ec && pack( relative.generic_string() ) )
+                {
+                    ++packed;
+                }
+            }
+        }
+        return packed;
+    }
+
+    std::uint64_t PackStore::bytes_used() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return bytes_used_;
+    }
+
+    std::optional< fs::path > PackStore::sidecar( std::string_view const relative_path ) const
+    {
+        auto const relative{ fs::path{ relative_path }.lexically_normal() };
+        if ( relative.empty() || relative.has_root_path() || *relative.begin() == ".." )
+        {
+            return std::nullopt;
+        }
+        return directory_ / ( relative.string() + ".pack" );
+    }
+
+    PackStore::PackPtr PackStore::load( fs::path const & source, fs::path const & sidecar ) const
+    {
+        std::error_code ec;
+        if ( !fs::is_regular_file( sidecar, ec ) )
+        {
+            return nullptr;
+        }
+
+        auto const current{ FileUtils::stamp( source ) };
+        if ( !current.has_value() )
+        {
+            return nullptr;
+        }
+
+        FileUtils::MappedRegion region{ sidecar.string() };
+        auto const bytes{ region.bytes() };
+        if ( !region.valid() || bytes.size() < sizeof( PackHeader ) )
+        {
+            return nullptr;
+        }
+
+        PackHeader header;
+        std::memcpy( &header, bytes.data(), sizeof( header ) );
+        if ( header.magic != pack_magic || header.version != pack_version )
+        {
+            spdlog::warn( "'{}' is not a pack", sidecar.string() );
+            return nullptr;
+        }
+        if ( header.source_mtime != current->mtime || header.source_size != current->size || header.chunk_size != chunk_size_ )
+        {
+            spdlog::debug( "'{}' is out of date", sidecar.string() );
+            return nullptr;
+        }
+
+        // a pack of a modified storage or a different build must not send garbage
+        auto const index_end{ sizeof( PackHeader ) + ( std::uint64_t{ header.messages } + 1 ) * sizeof( std::uint64_t ) };
+        auto const chunks   { ( std::uint64_t{ header.raw_data_size } + chunk_size_ - 1 ) / chunk_size_ };
+        if ( header.messages != chunks + 1 || bytes.size() < index_end || messageOffset( bytes, 0 ) != index_end || messageOffset( bytes, header.messages ) != bytes.size() )
+        {
+            spdlog::warn( "'{}' is corrupt", sidecar.string() );
+            return nullptr;
+        }
+        for ( std::size_t i{}; i < header.messages; ++i )
+        {
+            if ( messageOffset( bytes, i ) > messageOffset( bytes, i + 1 ) )
+            {
+                spdlog::warn( "'{}' is corrupt", sidecar.string() );
+                return nullptr;
+            }
+        }
+
+        // the whole pack is about to be streamed
+        region.advise( 0, bytes.size(), FileUtils::AccessHint::Sequential );
+        return std::make_shared< Pack const >( std::move( region ), header.chunk_size, header.messages, header.raw_data_size );
+    }
+
+    PackStore::PackPtr PackStore::cached( std::string const & key, fs::path const & source, fs::path const & sidecar )
+    {
+        auto const current{ FileUtils::stamp( source ) };
+        if ( !current.has_value() )
+        {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard lock{ mutex_ };
+            auto const it{ loaded_.find( key ) };
+            if ( it != loaded_.end() && it->second.source_mtime == current->mtime && it->second.source_size == current->size )
+            {
+                return it->second.pack;
+            }
+        }
+
+        // a file changed since `current` was taken gets a pack that doesn't match it, so it's loaded again next time
+        auto pack{ load( source, sidecar ) };
+        std::lock_guard lock{ mutex_ };
+        if ( pack )
+        {
+            loaded_.insert_or_assign( key, Loaded{ current->mtime, current->size, pack } );
+        }
+        else
+        {
+            loaded_.erase( key );
+        }
+        return pack;
+    }
+
+    void PackStore::evict( std::string const & keep )
+    {
+        while ( bytes_used_ > byte_budget_ )
+        {
+            auto oldest{ usage_.end() };
+            for ( auto it{ usage_.begin() }; it != usage_.end(); ++it )
+            {
+                if ( it->first != keep && ( oldest == usage_.end() || it->second.last_used < oldest->second.last_used ) )
+                {
+                    oldest = it;
+                }
+            }
+            if ( oldest == usage_.end() )
+            {
+                break;
+            }
+
+            // downloads still streaming it keep their mapping
+            std::error_code ec;
+            fs::remove( directory_ / ( oldest->first + ".pack" ), ec );
+            spdlog::debug( "Evicted the pack of '{}'", oldest->first );
+
+            bytes_used_ -= oldest->second.size;
+            loaded_.erase( oldest->first );
+            usage_.erase( oldest );
+        }
+    }
+
+    void PackStore::work( std::stop_token const & stop )
+    {
+        while ( true )
+        {
+            std::string relative;
+            {
+                std::unique_lock lock{ mutex_ };
+                if ( !queue_changed_.wait( lock, stop, [ this ] { return !queue_.empty(); } ) )
+                {
+                    return;
+                }
+                relative = std::move( queue_.front() );
+                queue_.pop_front();
+            }
+
+            if ( !pack( relative ) )
+            {
+                spdlog::debug( "Packing '{}' in the background failed", relative );
+            }
+
+            // until now a download of the file doesn't queue it again
+            std::lock_guard lock{ mutex_ };
+            queued_.erase( relative );
+        }
+    }
+} // namespace Teleaudio
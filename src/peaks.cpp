@@ -0,0 +1,602 @@
+#include "peaks.hpp"
+#include "cpu.hpp"
+#include "transcoder.hpp"
+#include "utils.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr std::array< char, 4 > summary_magic{ 'T', 'A', 'P', 'S' };
+    constexpr std::uint32_t         summary_version{ 1 };
+
+    // In front of every sidecar, followed by the headers of the `levels` levels, then by their peaks
+    struct SummaryHeader
+    {
+        std::array< char, 4 > magic{ summary_magic };
+        std::uint32_t         version{ summary_version };
+        std::int64_t          source_mtime{};
+        std::uint64_t         source_size{};
+        std::uint64_t         frames{};
+        WAV::FmtSubChunk      format{};
+        std::uint32_t         levels{};
+        std::uint32_t         reserved{};
+    };
+    static_assert( sizeof( SummaryHeader ) == 64 );
+
+    struct LevelHeader
+    {
+        std::uint64_t frames_per_bucket{};
+        std::uint64_t buckets{};
+        std::uint64_t offset{}; // of the first peak in the sidecar
+    };
+    static_assert( sizeof( LevelHeader ) == 24 );
+
+    // frames read and converted at a time, whole buckets of the first level
+    constexpr std::uint64_t chunk_frames{ std::uint64_t{ Teleaudio::PeakStore::base_frames } * 64 };
+
+    // The running peak of a channel
+    struct Accumulator
+    {
+        float  min    {  std::numeric_limits< float >::infinity() };
+        float  max    { -std::numeric_limits< float >::infinity() };
+        double squares{};
+
+        [[ nodiscard ]] Teleaudio::Peak peak( std::uint64_t const frames ) const
+        {
+            return { min, max, frames > 0 ? static_cast< float >( squares / static_cast< double >( frames ) ) : 0.0f };
+        }
+    };
+
+    // folds the lanes of the vectorized kernels into the channels they held
+    void foldLanes( float const * const minimum, float const * const maximum, float const * const squares, std::size_t const lanes,
+                    std::uint16_t const channels, Accumulator * const out )
+    {
+        for ( std::size_t lane{}; lane < lanes; ++lane )
+        {
+            auto & channel{ out[ lane % channels ] };
+            channel.min      = std::min( channel.min, minimum[ lane ] );
+            channel.max      = std::max( channel.max, maximum[ lane ] );
+            channel.squares += squares[ lane ];
+        }
+    }
+
+#ifdef TELEAUDIO_AVX2
+    // The kernels take as many interleaved samples as fill whole vectors and return how many,
+    // the channels divide the width of a vector, so every lane always holds the same channel
+    TELEAUDIO_AVX2 std::size_t accumulateAvx2( float const * const in, std::size_t const count, std::uint16_t const channels, Accumulator * const out )
+    {
+        auto minimum{ _mm256_set1_ps(  std::numeric_limits< float >::infinity() ) };
+        auto maximum{ _mm256_set1_ps( -std::numeric_limits< float >::infinity() ) };
+        auto squares{ _mm256_setzero_ps() };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_loadu_ps( in + i ) };
+            minimum = _mm256_min_ps( minimum, samples );
+            maximum = _mm256_max_ps( maximum, samples );
+            squares = _mm256_fmadd_ps( samples, samples, squares );
+        }
+
+        std::array< float, 8 > lanes_min, lanes_max, lanes_squares;
+        _mm256_storeu_ps( lanes_min.data(),     minimum );
+        _mm256_storeu_ps( lanes_max.data(),     maximum );
+        _mm256_storeu_ps( lanes_squares.data(), squares );
+        foldLanes( lanes_min.data(), lanes_max.data(), lanes_squares.data(), 8, channels, out );
+        return i;
+    }
+#endif
+
+#ifdef TELEAUDIO_SSE2
+    std::size_t accumulateSse2( float const * const in, std::size_t const count, std::uint16_t const channels, Accumulator * const out )
+    {
+        auto minimum{ _mm_set1_ps(  std::numeric_limits< float >::infinity() ) };
+        auto maximum{ _mm_set1_ps( -std::numeric_limits< float >::infinity() ) };
+        auto squares{ _mm_setzero_ps() };
+        std::size_t i{};
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            auto const samples{ _mm_loadu_ps( in + i ) };
+            minimum = _mm_min_ps( minimum, samples );
+            maximum = _mm_max_ps( maximum, samples );
+            squares = _mm_add_ps( squares, _mm_mul_ps( samples, samples ) );
+        }
+
+        std::array< float, 4 > lanes_min, lanes_max, lanes_squares;
+        _mm_storeu_ps( lanes_min.data(),     minimum );
+        _mm_storeu_ps( lanes_max.data(),     maximum );
+        _mm_storeu_ps( lanes_squares.data(), squares );
+        foldLanes( lanes_min.data(), lanes_max.data(), lanes_squares.data(), 4, channels, out );
+        return i;
+    }
+#endif
+
+    // Folds `frames` interleaved frames into the accumulator of every channel
+    void accumulate( float const * const samples, std::size_t const frames, std::uint16_t const channels, Accumulator * const out )
+    {
+        auto const  count{ frames * channels };
+        std::size_t done {};
+#ifdef TELEAUDIO_AVX2
+        if ( Teleaudio::Cpu::hasAvx2() && 8 % channels == 0 )
+        {
+            done = accumulateAvx2( samples, count, channels, out );
+        }
+#endif
+#ifdef TELEAUDIO_SSE2
+        if ( done == 0 && 4 % channels == 0 )
+        {
+            done = accumulateSse2( samples, count, channels, out );
+        }
+#endif
+        for ( auto i{ done }; i < count; ++i )
+        {
+            auto & channel{ out[ i % channels ] };
+            channel.min      = std::min( channel.min, samples[ i ] );
+            channel.max      = std::max( channel.max, samples[ i ] );
+            channel.squares += static_cast< double >( samples[ i ] ) * samples[ i ];
+        }
+    }
+
+    // Folds a peak of `frames` frames into an accumulator
+    void merge( Accumulator & accumulator, Teleaudio::Peak const & peak, std::uint64_t const frames )
+    {
+        accumulator.min      = std::min( accumulator.min, peak.min );
+        accumulator.max      = std::max( accumulator.max, peak.max );
+        accumulator.squares += static_cast< double >( peak.mean_square ) * static_cast< double >( frames );
+    }
+}
+
+namespace Teleaudio
+{
+    // A serialized summary, either built in memory or mapped from its sidecar
+    class PeakStore::Summary
+    {
+    public:
+        explicit Summary( std::vector< std::byte > bytes )
+            : owned_{ std::move( bytes ) }, bytes_{ owned_ }
+        {}
+
+        explicit Summary( FileUtils::MappedRegion region )
+            : mapped_{ std::move( region ) }, bytes_{ mapped_.bytes() }
+        {}
+
+        // Checks that the levels are where the header says, false if the sidecar is corrupt
+        [[ nodiscard ]] bool parse()
+        {
+            if ( bytes_.size() < sizeof( SummaryHeader ) )
+            {
+                return false;
+            }
+            std::memcpy( &header_, bytes_.data(), sizeof( header_ ) );
+            if ( header_.magic != summary_magic || header_.version != summary_version || header_.format.num_channels == 0 || header_.levels == 0 )
+            {
+                return false;
+            }
+
+            levels_.resize( header_.levels );
+            if ( bytes_.size() < sizeof( SummaryHeader ) + levels_.size() * sizeof( LevelHeader ) )
+            {
+                return false;
+            }
+            std::memcpy( levels_.data(), bytes_.data() + sizeof( SummaryHeader ), levels_.size() * sizeof( LevelHeader ) );
+
+            auto frames_per_bucket{ std::uint64_t{ base_frames } };
+            for ( auto const & level : levels_ )
+            {
+                auto const peaks{ level.buckets * header_.format.num_channels };
+                if ( level.frames_per_bucket != frames_per_bucket || level.buckets != ( header_.frames + frames_per_bucket - 1 ) / frames_per_bucket
+                  || level.offset > bytes_.size() || peaks > ( bytes_.size() - level.offset ) / sizeof( Peak ) )
+                {
+                    return false;
+                }
+                frames_per_bucket *= level_factor;
+            }
+            return true;
+        }
+
+        [[ nodiscard ]] SummaryHeader const &           header() const { return header_; }
+        [[ nodiscard ]] std::span< LevelHeader const > levels() const { return levels_; }
+
+        [[ nodiscard ]] Peak peak( LevelHeader const & level, std::uint64_t const bucket, std::uint16_t const channel ) const
+        {
+            Peak peak;
+            std::memcpy( &peak, bytes_.data() + level.offset + ( bucket * header_.format.num_channels + channel ) * sizeof( Peak ), sizeof( peak ) );
+            return peak;
+        }
+
+        // Frames in a bucket of the level, only the last one can be shorter
+        [[ nodiscard ]] std::uint64_t frames( LevelHeader const & level, std::uint64_t const bucket ) const
+        {
+            return std::min( level.frames_per_bucket, header_.frames - bucket * level.frames_per_bucket );
+        }
+
+        // Bytes held in memory, nothing for a mapped sidecar
+        [[ nodiscard ]] std::uint64_t memory() const { return owned_.size(); }
+
+    private:
+        std::vector< std::byte >       owned_;
+        FileUtils::MappedRegion        mapped_;
+        std::span< std::byte const >   bytes_;
+        SummaryHeader                  header_;
+        std::vector< LevelHeader >     levels_;
+    };
+
+    PeakStore::PeakStore( fs::path storage, fs::path directory, std::uint64_t const byte_budget )
+        : storage_    { std::move( storage )   }
+        , directory_  { std::move( directory ) }
+        , byte_budget_{ byte_budget }
+    {
+        if ( directory_.empty() )
+        {
+            return;
+        }
+
+        std::error_code ec;
+        fs::create_directories( directory_, ec );
+        if ( ec )
+        {
+            spdlog::error( "Cannot create the peaks directory '{}': {}", directory_.string(), ec.message() );
+        }
+    }
+
+    PeakStore::~PeakStore() = default;
+
+    std::uint64_t PeakStore::bytes_used() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return bytes_used_;
+    }
+
+    std::optional< PeakOverview > PeakStore::overview( std::string_view const relative_path, std::uint64_t const start_frame, std::uint64_t const frames, std::size_t const resolution )
+    {
+        auto const relative{ fs::path{ relative_path }.lexically_normal() };
+        if ( relative.empty() || relative.has_root_path() || *relative.begin() == ".." )
+        {
+            return std::nullopt;
+        }
+
+        auto const summary{ this->summary( relative ) };
+        if ( !summary )
+        {
+            return std::nullopt;
+        }
+
+        auto const & header  { summary->header() };
+        auto const   channels{ header.format.num_channels };
+
+        PeakOverview overview;
+        overview.format      = header.format;
+        overview.start_frame = std::min( start_frame, header.frames );
+        overview.frames      = frames == 0 ? header.frames - overview.start_frame : std::min( frames, header.frames - overview.start_frame );
+        overview.buckets     = static_cast< std::size_t >( std::min< std::uint64_t >( std::max< std::size_t >( resolution, 1 ), overview.frames ) );
+        overview.peaks.resize( overview.buckets * channels );
+        if ( overview.buckets == 0 )
+        {
+            return overview;
+        }
+
+        auto const bucketStart{ [ & ]( std::uint64_t const bucket ) { return overview.start_frame + bucket * overview.frames / overview.buckets; } };
+
+        // the coarsest level with enough peaks in every bucket to keep its edges close, or at least the first one
+        auto const smallest_bucket{ overview.frames / overview.buckets };
+        auto const levels         { summary->levels() };
+        auto       level          { std::find_if( levels.rbegin(), levels.rend(), [ & ]( LevelHeader const & candidate )
+        {
+            return candidate.frames_per_bucket * level_factor <= smallest_bucket;
+        } ) };
+        if ( level == levels.rend() && base_frames <= smallest_bucket )
+        {
+            level = std::prev( levels.rend() );
+        }
+
+        std::vector< Accumulator > accumulators( channels );
+        if ( level != levels.rend() )
+        {
+            for ( std::size_t bucket{}; bucket < overview.buckets; ++bucket )
+            {
+                // every peak overlapping the bucket, so a peak is never lost at an edge
+                auto const first{ bucketStart( bucket ) / level->frames_per_bucket };
+                auto const last { std::min( ( bucketStart( bucket + 1 ) + level->frames_per_bucket - 1 ) / level->frames_per_bucket, level->buckets ) };
+
+                std::fill( accumulators.begin(), accumulators.end(), Accumulator{} );
+                std::uint64_t merged{};
+                for ( auto index{ first }; index < last; ++index )
+                {
+                    auto const length{ summary->frames( *level, index ) };
+                    for ( std::uint16_t channel{}; channel < channels; ++channel )
+                    {
+                        merge( accumulators[ channel ], summary->peak( *level, index, channel ), length );
+                    }
+                    merged += length;
+                }
+                for ( std::uint16_t channel{}; channel < channels; ++channel )
+                {
+                    overview.peaks[ bucket * channels + channel ] = accumulators[ channel ].peak( merged );
+                }
+            }
+            return overview;
+        }
+
+        // zoomed in further than the first level, only the range is read
+        WAV::FileReader reader{ ( storage_ / relative ).string() };
+        auto const      block_align{ header.format.block_align };
+        if ( !reader.valid() || !reader.seek( overview.start_frame * block_align ) )
+        {
+            return std::nullopt;
+        }
+
+        std::vector< std::byte > bytes  ( chunk_frames * block_align );
+        std::vector< float >     samples( chunk_frames * channels    );
+
+        std::size_t bucket{};
+        auto        position  { overview.start_frame };
+        auto        bucket_end{ bucketStart( 1 ) };
+        std::fill( accumulators.begin(), accumulators.end(), Accumulator{} );
+        while ( bucket < overview.buckets )
+        {
+            auto const chunk{ std::min( chunk_frames, overview.start_frame + overview.frames - position ) };
+            if ( reader.read( std::span{ bytes }.first( chunk * block_align ) ) != chunk * block_align )
+            {
+                return std::nullopt;
+            }
+            samplesToFloat( header.format, bytes.data(), samples.data(), chunk * channels );
+
+            for ( std::uint64_t done{}; done < chunk; )
+            {
+                auto const length{ std::min( chunk - done, bucket_end - position ) };
+                accumulate( samples.data() + done * channels, length, channels, accumulators.data() );
+                done     += length;
+                position += length;
+
+                if ( position == bucket_end )
+                {
+                    auto const bucket_frames{ bucket_end - bucketStart( bucket ) };
+                    for ( std::uint16_t channel{}; channel < channels; ++channel )
+                    {
+                        overview.peaks[ bucket * channels + channel ] = accumulators[ channel ].peak( bucket_frames );
+                    }
+                    std::fill( accumulators.begin(), accumulators.end(), Accumulator{} );
+                    ++bucket;
+                    bucket_end = bucketStart( bucket + 1 );
+                }
+            }
+        }
+        return overview;
+    }
+
+    PeakStore::SummaryPtr PeakStore::summary( fs::path const & relative )
+    {
+        auto const now{ FileUtils::stamp( storage_ / relative ) };
+        if ( !now.has_value() )
+        {
+            return nullptr;
+        }
+
+        // the first request computes it, the ones coming in meanwhile wait for it
+        auto const                       key{ relative.generic_string() };
+        std::promise< SummaryPtr >       promise;
+        std::shared_future< SummaryPtr > summary;
+        bool                             mine{ false };
+        {
+            std::lock_guard lock{ mutex_ };
+            auto & entry{ entries_[ key ] };
+            if ( !entry.summary.valid() || FileUtils::Stamp{ entry.mtime, entry.size } != *now )
+            {
+                if ( entry.loaded )
+                {
+                    bytes_used_ -= entry.bytes;
+                    lru_.erase( entry.lru_position );
+                }
+                entry = Entry{ .mtime = now->mtime, .size = now->size, .summary = promise.get_future().share(), .lru_position = lru_.end() };
+                mine  = true;
+            }
+            else if ( entry.loaded )
+            {
+                lru_.splice( lru_.begin(), lru_, entry.lru_position );
+            }
+            summary = entry.summary;
+        }
+
+        if ( !mine )
+        {
+            return summary.get();
+        }
+
+        auto built{ build( relative, now->mtime, now->size ) };
+        promise.set_value( built );
+
+        // unless a newer version of the file took its place meanwhile
+        std::lock_guard lock{ mutex_ };
+        auto const it{ entries_.find( key ) };
+        if ( it != entries_.end() && !it->second.loaded && FileUtils::Stamp{ it->second.mtime, it->second.size } == *now )
+        {
+            lru_.push_front( key );
+            it->second.lru_position = lru_.begin();
+            it->second.bytes        = built ? built->memory() : 0;
+            it->second.loaded       = true;
+            bytes_used_            += it->second.bytes;
+            evict();
+        }
+        return built;
+    }
+
+    void PeakStore::evict()
+    {
+        while ( bytes_used_ > byte_budget_ && !lru_.empty() )
+        {
+            auto const it{ entries_.find( lru_.back() ) };
+            spdlog::debug( "Dropping the peaks of '{}' from memory", lru_.back() );
+
+            // whoever is still merging an overview from it keeps it alive
+            bytes_used_ -= it->second.bytes;
+            entries_.erase( it );
+            lru_.pop_back();
+        }
+    }
+
+    PeakStore::SummaryPtr PeakStore::build( fs::path const & relative, std::int64_t const mtime, std::uint64_t const size ) const
+    {
+        auto const source { storage_ / relative };
+        auto const sidecar{ directory_.empty() ? fs::path{} : directory_ / ( relative.string() + ".peaks" ) };
+
+        std::error_code ec;
+        if ( !sidecar.empty() && fs::is_regular_file( sidecar, ec ) )
+        {
+            auto loaded{ std::make_shared< Summary >( FileUtils::MappedRegion{ sidecar.string() } ) };
+            if ( loaded->parse() && loaded->header().source_mtime == mtime && loaded->header().source_size == size )
+            {
+                return loaded;
+            }
+            spdlog::debug( "'{}' is out of date", sidecar.string() );
+        }
+
+        WAV::FileReader reader{ source.string() };
+        if ( !reader.valid() || !Transcoder::supports( reader.format ) )
+        {
+            spdlog::warn( "No peaks of '{}', its samples can't be converted", source.string() );
+            return nullptr;
+        }
+
+        auto const start      { std::chrono::steady_clock::now() };
+        auto const channels   { reader.format.num_channels };
+        auto const block_align{ reader.format.block_align };
+        auto const frames     { reader.data_size / block_align };
+
+        // the first level straight from the samples
+        std::vector< std::vector< Peak > > levels( 1 );
+        levels[ 0 ].reserve( static_cast< std::size_t >( ( frames + base_frames - 1 ) / base_frames * channels ) );
+        {
+            std::vector< std::byte >   bytes       ( chunk_frames * block_align );
+            std::vector< float >       samples     ( chunk_frames * channels    );
+            std::vector< Accumulator > accumulators( channels );
+            for ( std::uint64_t done{}; done < frames; )
+            {
+                auto const chunk{ std::min( chunk_frames, frames - done ) };
+                if ( reader.read( std::span{ bytes }.first( chunk * block_align ) ) != chunk * block_align )
+                {
+                    spdlog::warn( "No peaks of '{}', it is missing samples", source.string() );
+                    return nullptr;
+                }
+                samplesToFloat( reader.format, bytes.data(), samples.data(), chunk * channels );
+
+                for ( std::uint64_t first{}; first < chunk; first += base_frames )
+                {
+                    auto const length{ std::min< std::uint64_t >( base_frames, chunk - first ) };
+                    std::fill( accumulators.begin(), accumulators.end(), Accumulator{} );
+                    accumulate( samples.data() + first * channels, length, channels, accumulators.data() );
+                    for ( auto const & accumulator : accumulators )
+                    {
+                        levels[ 0 ].push_back( accumulator.peak( length ) );
+                    }
+                }
+                done += chunk;
+            }
+        }
+
+        // every level above merges `level_factor` peaks of the one below
+        for ( std::uint64_t frames_per_bucket{ base_frames }; levels.back().size() / channels > top_buckets; frames_per_bucket *= level_factor )
+        {
+            auto const & below  { levels.back() };
+            auto const   buckets{ below.size() / channels };
+
+            std::vector< Peak > level;
+            level.reserve( ( buckets + level_factor - 1 ) / level_factor * channels );
+            for ( std::size_t first{}; first < buckets; first += level_factor )
+            {
+                for ( std::uint16_t channel{}; channel < channels; ++channel )
+                {
+                    Accumulator   accumulator;
+                    std::uint64_t merged{};
+                    for ( auto index{ first }; index < std::min< std::size_t >( first + level_factor, buckets ); ++index )
+                    {
+                        auto const length{ std::min( frames_per_bucket, frames - index * frames_per_bucket ) };
+                        merge( accumulator, below[ index * channels + channel ], length );
+                        merged += length;
+                    }
+                    level.push_back( accumulator.peak( merged ) );
+                }
+            }
+            levels.push_back( std::move( level ) );
+        }
+
+        SummaryHeader header;
+        header.source_mtime = mtime;
+        header.source_size  = size;
+        header.frames       = frames;
+        header.format       = reader.format;
+        header.levels       = static_cast< std::uint32_t >( levels.size() );
+
+        std::vector< LevelHeader > level_headers( levels.size() );
+        auto position         { sizeof( SummaryHeader ) + level_headers.size() * sizeof( LevelHeader ) };
+        auto frames_per_bucket{ std::uint64_t{ base_frames } };
+        for ( std::size_t i{}; i < levels.size(); ++i )
+        {
+            level_headers[ i ] = { frames_per_bucket, levels[ i ].size() / channels, position };
+            position          += levels[ i ].size() * sizeof( Peak );
+            frames_per_bucket *= level_factor;
+        }
+
+        std::vector< std::byte > bytes;
+        bytes.reserve( position );
+        auto const append{ [ & ]( auto const data ) { bytes.insert( bytes.end(), data.begin(), data.end() ); } };
+        append( std::as_bytes( std::span{ &header, 1 } ) );
+        append( std::as_bytes( std::span{ level_headers } ) );
+        for ( auto const & level : levels )
+        {
+            append( std::as_bytes( std::span{ level } ) );
+        }
+
+        auto const seconds{ std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count() };
+        spdlog::debug( "Summarized '{}' into {} levels, {} bytes in {:.3f}s", source.string(), levels.size(), bytes.size(), seconds );
+
+        // the file changed while it was being read, the summary may mix both versions
+        if ( FileUtils::stamp( source ) != FileUtils::Stamp{ mtime, size } )
+        {
+            spdlog::warn( "No peaks of '{}', it changed while being read", source.string() );
+            return nullptr;
+        }
+
+        if ( !sidecar.empty() )
+        {
+            fs::create_directories( sidecar.parent_path(), ec );
+
+            // a summary of the same file from another process or thread gets its own temporary file
+            fs::path const temporary{ FileUtils::temporaryPath( sidecar.string() ) };
+            bool           written  { false };
+            {
+                // closed before the rename, which fails on Windows for an open file
+                auto const file{ FileUtils::openFile( temporary.string(), FileUtils::FileOpenMode::WriteBinary ) };
+                written = file && FileUtils::write( file.get(), bytes ) && FileUtils::sync( file.get() );
+            }
+            if ( !written || ( fs::rename( temporary, sidecar, ec ), ec ) )
+            {
+                spdlog::error( "Cannot write '{}', the peaks are only kept in memory", sidecar.string() );
+                fs::remove( temporary, ec );
+            }
+            else
+            {
+                // served from the page cache from now on, like a sidecar left from before
+                auto mapped{ std::make_shared< Summary >( FileUtils::MappedRegion{ sidecar.string() } ) };
+                if ( mapped->parse() )
+                {
+                    return mapped;
+                }
+            }
+        }
+
+        auto summary{ std::make_shared< Summary >( std::move( bytes ) ) };
+        if ( !summary->parse() )
+        {
+            return nullptr;
+        }
+        return summary;
+    }
+} // namespace Teleaudio
@@ -0,0 +1,401 @@
+#include "playback.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <thread>
+
+#ifdef TELEAUDIO_HAS_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+namespace
+{
+    // Whole frames of `format` lasting about `duration`, at least one
+    [[ nodiscard ]] std::size_t bytesFor( WAV::FmtSubChunk const & format, std::chrono::milliseconds const duration )
+    {
+        std::size_t const block_align{ std::max< std::uint16_t >( format.block_align, 1 ) };
+        auto const bytes{ static_cast< std::uint64_t >( format.byte_rate ) * static_cast< std::uint64_t >( std::max< std::chrono::milliseconds::rep >( duration.count(), 0 ) ) / 1000 };
+        return std::max< std::size_t >( bytes / block_align, 1 ) * block_align;
+    }
+
+    // Waits until a device playing from `start` on would have played `bytes_played` bytes. When that's past already
+    // the device ran dry in between, it restarts now, so `start` moves on by the time it spent waiting for samples
+    void pace( std::chrono::steady_clock::time_point & start, std::uint32_t const byte_rate, std::uint64_t const bytes_played )
+    {
+        if ( byte_rate == 0 )
+        {
+            return;
+        }
+
+        auto const played{ std::chrono::duration< double >( static_cast< double >( bytes_played ) / byte_rate ) };
+        auto const due   { start + std::chrono::duration_cast< std::chrono::steady_clock::duration >( played ) };
+        auto const now   { std::chrono::steady_clock::now() };
+        if ( now > due )
+        {
+            start += now - due;
+            return;
+        }
+        std::this_thread::sleep_until( due );
+    }
+
+#ifdef TELEAUDIO_HAS_ALSA
+    [[ nodiscard ]] snd_pcm_format_t alsaFormat( WAV::FmtSubChunk const & format )
+    {
+        auto const pulse_code_modulation{ 1 };
+        auto const ieee_float           { 3 };
+        if ( format.audio_format == ieee_float && format.bits_per_sample == 32 )
+        {
+            return SND_PCM_FORMAT_FLOAT_LE;
+        }
+        if ( format.audio_format != pulse_code_modulation )
+        {
+            return SND_PCM_FORMAT_UNKNOWN;
+        }
+        switch ( format.bits_per_sample )
+        {
+            case 8:  return SND_PCM_FORMAT_U8;
+            case 16: return SND_PCM_FORMAT_S16_LE;
+            case 24: return SND_PCM_FORMAT_S24_3LE;
+            case 32: return SND_PCM_FORMAT_S32_LE;
+            default: return SND_PCM_FORMAT_UNKNOWN;
+        }
+    }
+
+    // The default PCM device, written to in blocking mode
+    class AlsaSink final : public Teleaudio::AudioSink
+    {
+    public:
+        ~AlsaSink() override
+        {
+            if ( pcm_ != nullptr )
+            {
+                snd_pcm_close( pcm_ );
+            }
+        }
+
+        [[ nodiscard ]] bool open( WAV::FmtSubChunk const & format, std::uint64_t ) override
+        {
+            auto const pcm_format{ alsaFormat( format ) };
+            if ( pcm_format == SND_PCM_FORMAT_UNKNOWN || format.block_align == 0 )
+            {
+                spdlog::error( "ALSA can't play {} bit samples in format {}", format.bits_per_sample, format.audio_format );
+                return false;
+            }
+
+            if ( auto const res{ snd_pcm_open( &pcm_, "default", SND_PCM_STREAM_PLAYBACK, 0 ) }; res < 0 )
+            {
+                spdlog::error( "Cannot open the default ALSA device: {}", snd_strerror( res ) );
+                pcm_ = nullptr;
+                return false;
+            }
+
+            // the jitter buffer of the player sits in front of the device, it doesn't need to buffer much on its own
+            auto const latency_us{ 100'000U };
+            auto const resample  { 1 };
+            if ( auto const res{ snd_pcm_set_params( pcm_, pcm_format, SND_PCM_ACCESS_RW_INTERLEAVED, format.num_channels, format.sample_rate, resample, latency_us ) }; res < 0 )
+            {
+                spdlog::error( "ALSA can't play {} channels at {} Hz: {}", format.num_channels, format.sample_rate, snd_strerror( res ) );
+                return false;
+            }
+
+            block_align_ = format.block_align;
+            return true;
+        }
+
+        [[ nodiscard ]] bool write( std::span< std::byte const > const samples ) override
+        {
+            auto const * data  { samples.data() };
+            auto         frames{ static_cast< snd_pcm_uframes_t >( samples.size() / block_align_ ) };
+            while ( frames > 0 )
+            {
+                auto const written{ snd_pcm_writei( pcm_, data, frames ) };
+                if ( written < 0 )
+                {
+                    // the device ran dry in between, it's restarted
+                    if ( written == -EPIPE )
+                    {
+                        ++underruns_;
+                    }
+                    if ( auto const res{ snd_pcm_recover( pcm_, static_cast< int >( written ), 1 ) }; res < 0 )
+                    {
+                        spdlog::error( "Writing to the ALSA device failed: {}", snd_strerror( res ) );
+                        return false;
+                    }
+                    continue;
+                }
+                frames -= static_cast< snd_pcm_uframes_t >( written );
+                data   += static_cast< std::size_t >( written ) * block_align_;
+            }
+            return true;
+        }
+
+        void drain() override
+        {
+            snd_pcm_drain( pcm_ );
+        }
+
+        [[ nodiscard ]] std::uint64_t underruns() const override { return underruns_; }
+
+    private:
+        snd_pcm_t *   pcm_{ nullptr };
+        std::size_t   block_align_{ 1 };
+        std::uint64_t underruns_{};
+    };
+#endif
+}
+
+namespace Teleaudio
+{
+    bool NullSink::open( WAV::FmtSubChunk const & format, std::uint64_t )
+    {
+        byte_rate_    = format.byte_rate;
+        bytes_played_ = 0;
+        return true;
+    }
+
+    bool NullSink::write( std::span< std::byte const > const samples )
+    {
+        // the clock of the device starts with the playback, and again after running dry
+        if ( realtime_ )
+        {
+            pace( start_, byte_rate_, bytes_played_ );
+        }
+        bytes_played_ += samples.size();
+        return true;
+    }
+
+    bool FileSink::open( WAV::FmtSubChunk const & format, std::uint64_t )
+    {
+        file_ = FileUtils::openFile( path_, FileUtils::FileOpenMode::WriteBinary );
+        if ( !file_ || !FileUtils::seek( file_.get(), WAV::header_size ) )
+        {
+            spdlog::error( "Cannot open output file '{}' for writing.", path_ );
+            file_.reset();
+            return false;
+        }
+
+        format_       = format;
+        bytes_played_ = 0;
+        return true;
+    }
+
+    bool FileSink::write( std::span< std::byte const > const samples )
+    {
+        if ( !file_ )
+        {
+            return false;
+        }
+        if ( realtime_ )
+        {
+            pace( start_, format_.byte_rate, bytes_played_ );
+        }
+
+        if ( std::fwrite( samples.data(), 1, samples.size(), file_.get() ) != samples.size() )
+        {
+            spdlog::error( "Writing {} bytes to '{}' failed.", samples.size(), path_ );
+            return false;
+        }
+        bytes_played_ += samples.size();
+        return true;
+    }
+
+    void FileSink::drain()
+    {
+        if ( !file_ )
+        {
+            return;
+        }
+
+        // the subchunk sizes denote the size of the _rest of the current chunk_
+        auto const size{ static_cast< std::uint32_t >( std::min< std::uint64_t >( bytes_played_, UINT32_MAX - WAV::header_size ) ) };
+        WAV::RiffChunk const riff{ static_cast< std::uint32_t >( WAV::header_size - 8 + size ) };
+
+        std::array< std::byte, WAV::header_size > header;
+
+        auto output_iterator{ header.data() };
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &riff    ), sizeof( riff    ), output_iterator );
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &format_ ), sizeof( format_ ), output_iterator );
+        output_iterator = std::copy_n( WAV::MagicBytes::data.data()                     , WAV::MagicBytes::data.size(), output_iterator );
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &size    ), sizeof( size    ), output_iterator );
+
+        if ( std::fflush( file_.get() ) != 0 || !FileUtils::writeAt( file_.get(), 0, header ) )
+        {
+            spdlog::error( "Writing the header of '{}' failed.", path_ );
+        }
+        file_.reset();
+    }
+
+    std::unique_ptr< AudioSink > makeDeviceSink()
+    {
+#ifdef TELEAUDIO_HAS_ALSA
+        return std::make_unique< AlsaSink >();
+#else
+        return nullptr;
+#endif
+    }
+
+    Player::Player( AudioSink & sink, WAV::FmtSubChunk const & format, PlaybackOptions const & options )
+        : sink_        { sink }
+        , format_      { format }
+        , jitter_bytes_{ bytesFor( format, options.jitter_buffer ) }
+        , period_bytes_{ bytesFor( format, options.period        ) }
+        , period_      { std::max( options.period, std::chrono::milliseconds{ 1 } ) }
+        , ring_        { std::max( bytesFor( format, options.ring ), jitter_bytes_ + period_bytes_ ) }
+    {}
+
+    Player::~Player()
+    {
+        stopped_ = true;
+        notify();
+    }
+
+    bool Player::start( std::uint64_t const bytes )
+    {
+        if ( !sink_.open( format_, bytes ) )
+        {
+            return false;
+        }
+
+        started_ = std::chrono::steady_clock::now();
+        thread_  = std::jthread{ [ this ] { play(); } };
+        return true;
+    }
+
+    bool Player::push( std::span< std::byte const > samples )
+    {
+        while ( !samples.empty() )
+        {
+            if ( failed_ || stopped_ || !thread_.joinable() )
+            {
+                return false;
+            }
+
+            auto const written{ ring_.write( samples ) };
+            samples = samples.subspan( written );
+            if ( written > 0 )
+            {
+                notify();
+            }
+
+            // the playback thread frees a period at a time
+            if ( !samples.empty() )
+            {
+                std::unique_lock lock{ mutex_ };
+                changed_.wait( lock, [ this ] { return failed_ || stopped_ || ring_.writable() > 0; } );
+            }
+        }
+        return true;
+    }
+
+    PlaybackStatistics Player::finish()
+    {
+        finished_ = true;
+        notify();
+        if ( !thread_.joinable() )
+        {
+            return statistics_;
+        }
+        thread_.join();
+
+        statistics_.ok = !failed_;
+        return statistics_;
+    }
+
+    void Player::play()
+    {
+        std::size_t const block_align{ std::max< std::uint16_t >( format_.block_align, 1 ) };
+
+        auto const pulse_code_modulation{ 1 };
+        auto const silence{ format_.audio_format == pulse_code_modulation && format_.bits_per_sample == 8 ? std::byte{ 0x80 } : std::byte{ 0 } };
+
+        std::vector< std::byte > period( period_bytes_ );
+
+        auto const ready{ [ this ] { return stopped_ || finished_ || ring_.readable() >= jitter_bytes_; } };
+
+        bool buffering{ true };
+        bool playing  { false };
+        while ( !stopped_ )
+        {
+            if ( buffering )
+            {
+                std::unique_lock lock{ mutex_ };
+                if ( !playing )
+                {
+                    changed_.wait( lock, ready );
+                    playing             = true;
+                    statistics_.startup = std::chrono::steady_clock::now() - started_;
+                }
+                else if ( !changed_.wait_for( lock, period_, ready ) )
+                {
+                    // a period passed without enough samples, the device is fed silence for it rather than starved
+                    lock.unlock();
+                    std::fill( period.begin(), period.end(), silence );
+                    if ( !sink_.write( period ) )
+                    {
+                        failed_ = true;
+                        break;
+                    }
+                    statistics_.silence_played += period_bytes_;
+                    continue;
+                }
+                buffering = false;
+            }
+
+            // before looking at the ring, whatever is in it afterwards is all there is
+            auto const done     { finished_.load() };
+            auto const available{ ring_.readable() };
+
+            // only the end of the stream may hold a partial frame
+            auto const wanted{ done ? std::min( period_bytes_, available ) : std::min( period_bytes_, available - available % block_align ) };
+            auto const size  { ring_.read( std::span{ period }.first( wanted ) ) };
+            if ( size > 0 )
+            {
+                notify();
+            }
+
+            if ( size < period_bytes_ && done )
+            {
+                if ( size > 0 && !sink_.write( std::span{ period }.first( size ) ) )
+                {
+                    failed_ = true;
+                }
+                statistics_.bytes_played += size;
+                break;
+            }
+
+            if ( size < period_bytes_ )
+            {
+                // the device is fed silence rather than starved, and keeps getting it until the jitter buffer is full again
+                std::fill( period.begin() + static_cast< std::ptrdiff_t >( size ), period.end(), silence );
+                ++statistics_.underruns;
+                statistics_.silence_played += period_bytes_ - size;
+                buffering = true;
+            }
+
+            if ( !sink_.write( period ) )
+            {
+                failed_ = true;
+                break;
+            }
+            statistics_.bytes_played += size;
+        }
+
+        sink_.drain();
+        statistics_.underruns += sink_.underruns();
+
+        // a push waiting for room gives up once the playback failed
+        notify();
+    }
+
+    void Player::notify()
+    {
+        // a waiter checks the state under the lock, so taking it orders the change before its next check
+        {
+            std::lock_guard lock{ mutex_ };
+        }
+        changed_.notify_all();
+    }
+} // namespace Teleaudio
@@ -0,0 +1,564 @@
+#include "read_ahead.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined( __linux__ ) && __has_include( <linux/io_uring.h> )
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// the system calls are made directly, there's no liburing to depend on
+#define TELEAUDIO_IO_URING
+#endif
+
+namespace
+{
+    // Freed with the alignment it was allocated with
+    struct AlignedDelete
+    {
+        void operator()( std::byte * const data ) const
+        {
+            ::operator delete[]( data, std::align_val_t{ FileUtils::io_alignment } );
+        }
+    };
+    using AlignedBuffer = std::unique_ptr< std::byte[], AlignedDelete >;
+
+    [[ nodiscard ]] AlignedBuffer allocateAligned( std::size_t const size )
+    {
+        return AlignedBuffer{ static_cast< std::byte * >( ::operator new[]( size, std::align_val_t{ FileUtils::io_alignment } ) ) };
+    }
+
+    [[ nodiscard ]] constexpr std::uint64_t alignUp( std::uint64_t const value )
+    {
+        return ( value + FileUtils::io_alignment - 1 ) / FileUtils::io_alignment * FileUtils::io_alignment;
+    }
+
+    // Reads at `offset` without moving the position of the file, returns the bytes read or -1 on errors
+    [[ nodiscard ]] std::int64_t readAt( int const fd, std::byte * const buffer, std::size_t const length, std::uint64_t const offset )
+    {
+#ifdef _WIN32
+        if ( ::_lseeki64( fd, static_cast< __int64 >( offset ), SEEK_SET ) < 0 )
+        {
+            return -1;
+        }
+        return ::_read( fd, buffer, static_cast< unsigned >( std::min< std::size_t >( length, INT_MAX ) ) );
+#else
+        for ( ;; )
+        {
+            auto const res{ ::pread( fd, buffer, length, static_cast< off_t >( offset ) ) };
+            if ( res >= 0 || errno != EINTR )
+            {
+                return res;
+            }
+        }
+#endif
+    }
+
+    void closeFile( int const fd )
+    {
+#ifdef _WIN32
+        ::_close( fd );
+#else
+        ::close( fd );
+#endif
+    }
+
+#ifdef TELEAUDIO_IO_URING
+    [[ nodiscard ]] int enter( int const fd, unsigned const to_submit, unsigned const min_complete, unsigned const flags )
+    {
+        return static_cast< int >( ::syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0 ) );
+    }
+
+    // A submission and a completion queue of a single thread, one read at a time goes in and comes out
+    class Ring
+    {
+    public:
+        explicit Ring( unsigned const entries )
+        {
+            io_uring_params params{};
+            fd_ = static_cast< int >( ::syscall( __NR_io_uring_setup, entries, &params ) );
+            if ( fd_ < 0 )
+            {
+                spdlog::debug( "io_uring_setup failed, errno {}", errno );
+                return;
+            }
+
+            sq_size_ = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+            cq_size_ = params.cq_off.cqes  + params.cq_entries * sizeof( io_uring_cqe );
+            auto const single_mmap{ ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0 };
+            if ( single_mmap )
+            {
+                sq_size_ = cq_size_ = std::max( sq_size_, cq_size_ );
+            }
+
+            sq_ = ::mmap( nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING );
+            cq_ = single_mmap ? sq_ : ::mmap( nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING );
+            sqes_size_ = params.sq_entries * sizeof( io_uring_sqe );
+            auto * const sqes{ ::mmap( nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES ) };
+            if ( sq_ == MAP_FAILED || cq_ == MAP_FAILED || sqes == MAP_FAILED )
+            {
+                spdlog::debug( "Mapping the io_uring failed, errno {}", errno );
+                sqes_ = sqes == MAP_FAILED ? nullptr : static_cast< io_uring_sqe * >( sqes );
+                close();
+                return;
+            }
+            sqes_ = static_cast< io_uring_sqe * >( sqes );
+
+            auto * const sq{ static_cast< std::byte * >( sq_ ) };
+            auto * const cq{ static_cast< std::byte * >( cq_ ) };
+            sq_head_  = reinterpret_cast< unsigned * >( sq + params.sq_off.head         );
+            sq_tail_  = reinterpret_cast< unsigned * >( sq + params.sq_off.tail         );
+            sq_mask_  = *reinterpret_cast< unsigned * >( sq + params.sq_off.ring_mask   );
+            sq_array_ = reinterpret_cast< unsigned * >( sq + params.sq_off.array        );
+            cq_head_  = reinterpret_cast< unsigned * >( cq + params.cq_off.head         );
+            cq_tail_  = reinterpret_cast< unsigned * >( cq + params.cq_off.tail         );
+            cq_mask_  = *reinterpret_cast< unsigned * >( cq + params.cq_off.ring_mask   );
+            cqes_     = reinterpret_cast< io_uring_cqe * >( cq + params.cq_off.cqes     );
+            entries_  = params.sq_entries;
+        }
+
+        ~Ring()
+        {
+            close();
+        }
+
+        Ring( Ring const & )             = delete;
+        Ring & operator=( Ring const & ) = delete;
+
+        [[ nodiscard ]] bool valid() const { return fd_ >= 0; }
+
+        // Pins the buffers for `IORING_OP_READ_FIXED`, false if the kernel won't, which leaves plain reads
+        [[ nodiscard ]] bool registerBuffers( std::span< iovec const > const buffers ) const
+        {
+            return ::syscall( __NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(), static_cast< unsigned >( buffers.size() ) ) == 0;
+        }
+
+        // Submits a read into the registered buffer `buffer_index`, or a plain one if that's negative
+        [[ nodiscard ]] bool read( int const fd, std::byte * const buffer, std::size_t const length, std::uint64_t const offset,
+                                   int const buffer_index, std::uint64_t const user_data )
+        {
+            auto const tail{ *sq_tail_ };
+            if ( tail - __atomic_load_n( sq_head_, __ATOMIC_ACQUIRE ) >= entries_ )
+            {
+                return false;
+            }
+
+            auto const index{ tail & sq_mask_ };
+            auto     & sqe  { sqes_[ index ] };
+            std::memset( &sqe, 0, sizeof( sqe ) );
+            sqe.opcode    = static_cast< std::uint8_t >( buffer_index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ );
+            sqe.fd        = fd;
+            sqe.addr      = reinterpret_cast< std::uint64_t >( buffer );
+            sqe.len       = static_cast< std::uint32_t >( length );
+            sqe.off       = offset;
+            sqe.buf_index = static_cast< std::uint16_t >( std::max( buffer_index, 0 ) );
+            sqe.user_data = user_data;
+            sq_array_[ index ] = index;
+            __atomic_store_n( sq_tail_, tail + 1, __ATOMIC_RELEASE );
+
+            for ( ;; )
+            {
+                auto const submitted{ enter( fd_, 1, 0, 0 ) };
+                if ( submitted >= 0 || errno != EINTR )
+                {
+                    return submitted == 1;
+                }
+            }
+        }
+
+        // Waits for the next completion, false if the ring is broken
+        [[ nodiscard ]] bool complete( io_uring_cqe & cqe )
+        {
+            for ( ;; )
+            {
+                auto const head{ *cq_head_ };
+                if ( head != __atomic_load_n( cq_tail_, __ATOMIC_ACQUIRE ) )
+                {
+                    cqe = cqes_[ head & cq_mask_ ];
+                    __atomic_store_n( cq_head_, head + 1, __ATOMIC_RELEASE );
+                    return true;
+                }
+                if ( enter( fd_, 0, 1, IORING_ENTER_GETEVENTS ) < 0 && errno != EINTR )
+                {
+                    return false;
+                }
+            }
+        }
+
+    private:
+        void close()
+        {
+            if ( sqes_ != nullptr )
+            {
+                ::munmap( sqes_, sqes_size_ );
+            }
+            if ( cq_ != nullptr && cq_ != MAP_FAILED && cq_ != sq_ )
+            {
+                ::munmap( cq_, cq_size_ );
+            }
+            if ( sq_ != nullptr && sq_ != MAP_FAILED )
+            {
+                ::munmap( sq_, sq_size_ );
+            }
+            if ( fd_ >= 0 )
+            {
+                ::close( fd_ );
+            }
+            sqes_ = nullptr;
+            sq_   = cq_ = nullptr;
+            fd_   = -1;
+        }
+
+        int            fd_{ -1 };
+        void *         sq_{ nullptr };
+        void *         cq_{ nullptr };
+        std::size_t    sq_size_{};
+        std::size_t    cq_size_{};
+        io_uring_sqe * sqes_{ nullptr };
+        std::size_t    sqes_size_{};
+
+        unsigned *     sq_head_ { nullptr };
+        unsigned *     sq_tail_ { nullptr };
+        unsigned *     sq_array_{ nullptr };
+        unsigned       sq_mask_ {};
+        unsigned *     cq_head_ { nullptr };
+        unsigned *     cq_tail_ { nullptr };
+        unsigned       cq_mask_ {};
+        io_uring_cqe * cqes_    { nullptr };
+        unsigned       entries_ {};
+    };
+#endif
+}
+
+namespace FileUtils
+{
+    struct ReadPool::Context
+    {
+        std::vector< AlignedBuffer > buffers;
+#ifdef TELEAUDIO_IO_URING
+        std::unique_ptr< Ring >      ring;
+        bool                         registered{ false };
+        // a read of the ring went wrong, it isn't handed out again
+        bool                         broken    { false };
+#endif
+    };
+
+    ReadPool::ReadPool( IoBackend const backend, std::size_t const block_size, std::size_t const depth )
+        : backend_   { backend }
+        , block_size_{ static_cast< std::size_t >( alignUp( std::max< std::size_t >( block_size, 1 ) ) ) }
+        , depth_     { std::max< std::size_t >( depth, 1 ) }
+    {
+#ifdef TELEAUDIO_IO_URING
+        if ( backend_ == IoBackend::Uring && !Ring{ 1 }.valid() )
+        {
+            spdlog::warn( "The kernel has no io_uring, reading with pread instead" );
+            backend_ = IoBackend::Pread;
+        }
+#else
+        if ( backend_ == IoBackend::Uring )
+        {
+            spdlog::warn( "io_uring is only there on Linux, reading with pread instead" );
+            backend_ = IoBackend::Pread;
+        }
+#endif
+    }
+
+    ReadPool::~ReadPool() = default;
+
+    ReadPool::ContextPtr ReadPool::acquire()
+    {
+        {
+            std::lock_guard lock{ mutex_ };
+            if ( !idle_.empty() )
+            {
+                auto context{ std::move( idle_.back() ) };
+                idle_.pop_back();
+                return context;
+            }
+        }
+
+        auto context{ std::make_unique< Context >() };
+        context->buffers.reserve( depth_ );
+        for ( std::size_t i{}; i < depth_; ++i )
+        {
+            context->buffers.push_back( allocateAligned( block_size_ ) );
+        }
+
+#ifdef TELEAUDIO_IO_URING
+        if ( backend_ == IoBackend::Uring )
+        {
+            context->ring = std::make_unique< Ring >( static_cast< unsigned >( depth_ ) );
+            if ( !context->ring->valid() )
+            {
+                return nullptr;
+            }
+
+            std::vector< iovec > buffers;
+            for ( auto const & buffer : context->buffers )
+            {
+                buffers.push_back( iovec{ buffer.get(), block_size_ } );
+            }
+            context->registered = context->ring->registerBuffers( buffers );
+            if ( !context->registered )
+            {
+                spdlog::debug( "Registering the read buffers failed, errno {}, reading into them unregistered", errno );
+            }
+        }
+#endif
+        return context;
+    }
+
+    void ReadPool::release( ContextPtr context )
+    {
+        // enough for the downloads usually running at once, the memory of a rush of them is given back
+        std::size_t const max_idle{ 64 };
+
+#ifdef TELEAUDIO_IO_URING
+        if ( !context || context->broken )
+        {
+            return;
+        }
+#else
+        if ( !context )
+        {
+            return;
+        }
+#endif
+        std::lock_guard lock{ mutex_ };
+        if ( idle_.size() < max_idle )
+        {
+            idle_.push_back( std::move( context ) );
+        }
+    }
+
+    ReadAhead::ReadAhead( ReadPool & pool, std::string_view const path, std::uint64_t const offset, std::uint64_t const length, bool const direct )
+        : pool_{ pool }, end_{ offset + length }, remaining_{ length }
+    {
+        std::string const name{ path };
+#ifdef _WIN32
+        // not worth the unbuffered alignment rules of Windows
+        fd_ = ::_open( name.c_str(), _O_RDONLY | _O_BINARY );
+#else
+#ifdef O_DIRECT
+        if ( direct )
+        {
+            fd_     = ::open( name.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT );
+            direct_ = fd_ >= 0;
+            if ( !direct_ )
+            {
+                spdlog::debug( "'{}' can't be opened with O_DIRECT, errno {}, reading it through the page cache", path, errno );
+            }
+        }
+#endif
+        if ( fd_ < 0 )
+        {
+            fd_ = ::open( name.c_str(), O_RDONLY | O_CLOEXEC );
+        }
+#endif
+        if ( fd_ < 0 )
+        {
+            spdlog::error( "Cannot open '{}' for reading.", path );
+            return;
+        }
+
+        context_ = pool_.acquire();
+        if ( !context_ )
+        {
+            spdlog::error( "Cannot set up the reads of '{}'.", path );
+            closeFile( fd_ );
+            fd_ = -1;
+            return;
+        }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+        if ( !direct_ )
+        {
+            ::posix_fadvise( fd_, static_cast< off_t >( offset ), static_cast< off_t >( length ), POSIX_FADV_SEQUENTIAL );
+        }
+#endif
+
+        // the blocks start on aligned offsets, the first one skips what comes before the range
+        next_offset_ = offset - offset % io_alignment;
+        blocks_.resize( pool_.depth() );
+        for ( std::size_t i{}; i < blocks_.size() && next_offset_ < end_; ++i )
+        {
+            submit( i );
+        }
+        blocks_[ 0 ].consumed = offset % io_alignment;
+    }
+
+    ReadAhead::~ReadAhead()
+    {
+        if ( fd_ < 0 )
+        {
+            return;
+        }
+
+        // the kernel may still be writing into the buffers
+        for ( std::size_t i{}; i < blocks_.size(); ++i )
+        {
+            if ( blocks_[ i ].in_flight )
+            {
+                [[ maybe_unused ]] auto const read{ wait( i ) };
+            }
+        }
+        closeFile( fd_ );
+        pool_.release( std::move( context_ ) );
+    }
+
+    std::size_t ReadAhead::read( std::span< std::byte > const buffer )
+    {
+        std::size_t copied{};
+        while ( copied < buffer.size() && remaining_ > 0 )
+        {
+            auto & block{ blocks_[ head_ ] };
+            if ( !wait( head_ ) )
+            {
+                spdlog::error( "Failed reading raw data at {} bytes.", block.offset + block.filled );
+                remaining_ = 0;
+                break;
+            }
+
+            auto const size{ static_cast< std::size_t >( std::min< std::uint64_t >( { block.filled - std::min( block.consumed, block.filled ), buffer.size() - copied, remaining_ } ) ) };
+            std::memcpy( buffer.data() + copied, context_->buffers[ head_ ].get() + block.consumed, size );
+            block.consumed += size;
+            copied         += size;
+            remaining_     -= size;
+
+            if ( block.consumed >= block.filled && remaining_ > 0 )
+            {
+                // the file got truncated in the meantime, the next block would leave a gap
+                if ( block.filled < block.length )
+                {
+                    spdlog::error( "Failed reading raw data, the file ended {} bytes early.", remaining_ );
+                    remaining_ = 0;
+                    break;
+                }
+                if ( next_offset_ < end_ )
+                {
+                    submit( head_ );
+                }
+                head_ = ( head_ + 1 ) % blocks_.size();
+            }
+        }
+        return copied;
+    }
+
+    void ReadAhead::submit( std::size_t const index )
+    {
+        auto const left  { end_ - next_offset_ };
+        auto const length{ static_cast< std::size_t >( std::min< std::uint64_t >( pool_.block_size(), direct_ ? alignUp( left ) : left ) ) };
+
+        auto & block{ blocks_[ index ] };
+        block         = Block{ next_offset_, length, 0, 0, true, false };
+        next_offset_ += pool_.block_size();
+        resume( index );
+    }
+
+    void ReadAhead::resume( std::size_t const index )
+    {
+        auto & block{ blocks_[ index ] };
+        auto * const buffer{ context_->buffers[ index ].get() + block.filled };
+        auto const   length{ block.length - block.filled };
+        auto const   offset{ block.offset + block.filled };
+
+#ifdef TELEAUDIO_IO_URING
+        if ( context_->ring )
+        {
+            auto const registered{ context_->registered ? static_cast< int >( index ) : -1 };
+            if ( !context_->ring->read( fd_, buffer, length, offset, registered, index ) )
+            {
+                context_->broken = true;
+                block.in_flight  = false;
+                block.failed     = true;
+            }
+            return;
+        }
+#endif
+
+#ifdef POSIX_FADV_WILLNEED
+        // the kernel reads it in the background, the pread of `wait` then only copies it
+        if ( !direct_ )
+        {
+            ::posix_fadvise( fd_, static_cast< off_t >( offset ), static_cast< off_t >( length ), POSIX_FADV_WILLNEED );
+        }
+#else
+        ( void )buffer;
+        ( void )offset;
+        ( void )length;
+#endif
+    }
+
+    bool ReadAhead::wait( std::size_t const index )
+    {
+        auto & block{ blocks_[ index ] };
+
+#ifdef TELEAUDIO_IO_URING
+        if ( context_->ring )
+        {
+            while ( block.in_flight )
+            {
+                io_uring_cqe cqe{};
+                if ( !context_->ring->complete( cqe ) )
+                {
+                    context_->broken = true;
+                    return false;
+                }
+
+                // the completions come in any order
+                auto & done{ blocks_[ static_cast< std::size_t >( cqe.user_data ) ] };
+                if ( cqe.res < 0 )
+                {
+                    spdlog::debug( "A read of {} bytes at {} failed, errno {}", done.length - done.filled, done.offset + done.filled, -cqe.res );
+                    done.in_flight = false;
+                    done.failed    = true;
+                    continue;
+                }
+
+                done.filled += static_cast< std::size_t >( cqe.res );
+                // a short read of a direct read is the end of the file, otherwise there may be more
+                auto const more{ cqe.res > 0 && done.filled < done.length && ( !direct_ || done.filled % io_alignment == 0 ) };
+                if ( more )
+                {
+                    resume( static_cast< std::size_t >( cqe.user_data ) );
+                }
+                else
+                {
+                    done.in_flight = false;
+                }
+            }
+            return !block.failed;
+        }
+#endif
+
+        while ( block.in_flight )
+        {
+            auto const res{ readAt( fd_, context_->buffers[ index ].get() + block.filled, block.length - block.filled, block.offset + block.filled ) };
+            if ( res < 0 )
+            {
+                block.failed = true;
+            }
+            else
+            {
+                block.filled += static_cast< std::size_t >( res );
+            }
+            block.in_flight = !block.failed && res > 0 && block.filled < block.length && ( !direct_ || block.filled % io_alignment == 0 );
+        }
+        return !block.failed;
+    }
+} // namespace FileUtils
@@ -0,0 +1,52 @@
+#include "ring_buffer.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace Teleaudio
+{
+    RingBuffer::RingBuffer( std::size_t const capacity )
+        : capacity_{ std::bit_ceil( std::max< std::size_t >( capacity, 1 ) ) }
+        , data_    { std::make_unique_for_overwrite< std::byte[] >( capacity_ ) }
+    {}
+
+    std::size_t RingBuffer::write( std::span< std::byte const > const data )
+    {
+        auto const position{ write_position_.load( std::memory_order_relaxed ) };
+        auto const read    { read_position_ .load( std::memory_order_acquire ) };
+
+        auto const size { std::min( data.size(), capacity_ - ( position - read ) ) };
+        auto const index{ position & ( capacity_ - 1 ) };
+        auto const first{ std::min( size, capacity_ - index ) };
+
+        // wrapping around the end
+        std::copy_n( data.data(),         first,        data_.get() + index );
+        std::copy_n( data.data() + first, size - first, data_.get()         );
+
+        // publishes the bytes to the consumer
+        write_position_.store( position + size, std::memory_order_release );
+        return size;
+    }
+
+    std::size_t RingBuffer::read( std::span< std::byte > const data )
+    {
+        auto const position{ read_position_ .load( std::memory_order_relaxed ) };
+        auto const written { write_position_.load( std::memory_order_acquire ) };
+
+        auto const size { std::min( data.size(), written - position ) };
+        auto const index{ position & ( capacity_ - 1 ) };
+        auto const first{ std::min( size, capacity_ - index ) };
+
+        std::copy_n( data_.get() + index, first,        data.data()         );
+        std::copy_n( data_.get(),         size - first, data.data() + first );
+
+        // hands the room back to the producer
+        read_position_.store( position + size, std::memory_order_release );
+        return size;
+    }
+
+    std::size_t RingBuffer::readable() const
+    {
+        return write_position_.load( std::memory_order_acquire ) - read_position_.load( std::memory_order_acquire );
+    }
+} // namespace Teleaudio
@@ -0,0 +1,128 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace Teleaudio
+{
+    TimerWheel::TimerWheel( std::chrono::milliseconds const resolution, std::size_t const slots )
+        : resolution_{ std::max< Clock::duration >( resolution, std::chrono::milliseconds{ 1 } ) }
+        , slots_     ( std::max< std::size_t >( slots, 1 ) )
+        , worker_    { [ this ]( std::stop_token const stop ) { work( stop ); } }
+    {}
+
+    TimerWheel::~TimerWheel()
+    {
+        stop();
+    }
+
+    bool TimerWheel::schedule( Clock::time_point const when, Task task )
+    {
+        std::lock_guard lock{ mutex_ };
+        if ( stopped_ )
+        {
+            return false;
+        }
+
+        // never into a slot the thread already went past
+        auto const tick{ std::max( tickOf( when ), next_tick_ ) };
+        slots_[ tick % slots_.size() ].push_back( { tick, std::move( task ) } );
+
+        // an idle thread sleeps until there's something to do
+        if ( pending_++ == 0 )
+        {
+            scheduled_.notify_one();
+        }
+        return true;
+    }
+
+    void TimerWheel::stop()
+    {
+        worker_.request_stop();
+        if ( worker_.joinable() )
+        {
+            worker_.join();
+        }
+
+        std::vector< Task > remaining;
+        {
+            std::lock_guard lock{ mutex_ };
+            stopped_ = true;
+            for ( auto & slot : slots_ )
+            {
+                for ( auto & timer : slot )
+                {
+                    remaining.push_back( std::move( timer.task ) );
+                }
+                slot.clear();
+            }
+            pending_ = 0;
+        }
+
+        for ( auto const & task : remaining )
+        {
+            task();
+        }
+    }
+
+    std::size_t TimerWheel::pending() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return pending_;
+    }
+
+    std::uint64_t TimerWheel::tickOf( Clock::time_point const when ) const
+    {
+        if ( when <= start_ )
+        {
+            return 0;
+        }
+        // rounded up, a task never runs early
+        return static_cast< std::uint64_t >( ( when - start_ + resolution_ - Clock::duration{ 1 } ) / resolution_ );
+    }
+
+    void TimerWheel::work( std::stop_token const & stop )
+    {
+        std::vector< Task > due;
+        while ( !stop.stop_requested() )
+        {
+            {
+                std::unique_lock lock{ mutex_ };
+                if ( pending_ == 0 )
+                {
+                    if ( !scheduled_.wait( lock, stop, [ this ] { return pending_ > 0; } ) )
+                    {
+                        return;
+                    }
+                    // nothing was pending, the ticks in between had nothing to expire
+                    next_tick_ = std::max( next_tick_, tickOf( Clock::now() ) );
+                }
+
+                // a tick is expired once it's over, a late thread catches up a tick at a time without sleeping
+                auto const tick_end{ start_ + resolution_ * static_cast< Clock::rep >( next_tick_ ) };
+                if ( Clock::now() < tick_end )
+                {
+                    scheduled_.wait_until( lock, stop, tick_end, [] { return false; } );
+                    continue;
+                }
+
+                auto & slot{ slots_[ next_tick_ % slots_.size() ] };
+                auto const later{ std::partition( slot.begin(), slot.end(), [ this ]( Timer const & timer ) { return timer.tick > next_tick_; } ) };
+                for ( auto it{ later }; it != slot.end(); ++it )
+                {
+                    due.push_back( std::move( it->task ) );
+                }
+                slot.erase( later, slot.end() );
+                pending_ -= due.size();
+                ++next_tick_;
+            }
+
+            // without the lock, so the tasks can schedule again
+            for ( auto const & task : due )
+            {
+                task();
+            }
+            due.clear();
+        }
+    }
+} // namespace Teleaudio
@@ -0,0 +1,781 @@
+#include "transcoder.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <numeric>
+
+namespace
+{
+    constexpr std::uint16_t pulse_code_modulation{ 1 };
+    constexpr std::uint16_t ieee_float           { 3 };
+
+    // also keeps the frame arithmetic of the resampler far from overflowing
+    constexpr std::uint32_t max_sample_rate{ 768000 };
+    constexpr std::uint16_t max_channels   { 64     };
+
+    // taps of the resampler when upsampling, downsampling needs proportionally more to keep the same transition band
+    constexpr std::size_t base_taps { 32   };
+    constexpr std::size_t max_taps  { 256  };
+    constexpr std::size_t max_phases{ 1024 };
+
+    constexpr float int8_scale { 128.0f        };
+    constexpr float int16_scale{ 32768.0f      };
+    constexpr float int24_scale{ 8388608.0f    };
+    constexpr float int32_scale{ 2147483648.0f };
+
+    // the biggest float below 2^31, anything bigger doesn't fit into an int32
+    constexpr float int32_max{ 2147483520.0f };
+
+#ifdef TELEAUDIO_AVX2
+    // The vectorized kernels convert as many samples as they can in whole vectors and return how many,
+    // the scalar loops take care of the rest. Both round the same way, so the result doesn't depend on the split.
+
+    TELEAUDIO_AVX2 std::size_t int8ToFloatAvx2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm256_set1_ps( 1.0f / int8_scale ) };
+        // flipping the top bit turns the unsigned samples into signed ones
+        auto const sign { _mm_set1_epi8( -128 ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_cvtepi8_epi32( _mm_xor_si128( _mm_loadl_epi64( reinterpret_cast< __m128i const * >( in + i ) ), sign ) ) };
+            _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( samples ), scale ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t int16ToFloatAvx2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm256_set1_ps( 1.0f / int16_scale ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_cvtepi16_epi32( _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 2 * i ) ) ) };
+            _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( samples ), scale ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t int24ToFloatAvx2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale { _mm256_set1_ps( 1.0f / int24_scale ) };
+        // the 4 samples in the first 12 bytes of a lane go to the upper 3 bytes of its 32 bit lanes, the shift back sign extends them
+        auto const spread{ _mm256_setr_epi8( -128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11,
+                                             -128, 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11 ) };
+        std::size_t i{};
+        // the second load reads 4 bytes past the 8 samples, they have to be there
+        for ( ; i + 10 <= count; i += 8 )
+        {
+            auto const bytes{ _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 3 * i ) ) ),
+                                                       _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 3 * i + 12 ) ), 1 ) };
+            auto const samples{ _mm256_srai_epi32( _mm256_shuffle_epi8( bytes, spread ), 8 ) };
+            _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( samples ), scale ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t int32ToFloatAvx2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm256_set1_ps( 1.0f / int32_scale ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_loadu_si256( reinterpret_cast< __m256i const * >( in + 4 * i ) ) };
+            _mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps( samples ), scale ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t floatToInt8Avx2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm256_set1_ps( int8_scale ) };
+        auto const minimum{ _mm256_set1_ps( -int8_scale ) };
+        auto const maximum{ _mm256_set1_ps( int8_scale - 1 ) };
+        auto const sign   { _mm_set1_epi8( -128 ) };
+        std::size_t i{};
+        for ( ; i + 16 <= count; i += 16 )
+        {
+            auto const low  { _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i     ), scale ), minimum ), maximum ) ) };
+            auto const high { _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i + 8 ), scale ), minimum ), maximum ) ) };
+            auto const words{ _mm256_permute4x64_epi64( _mm256_packs_epi32( low, high ), 0xd8 ) };
+            auto const bytes{ _mm_packs_epi16( _mm256_castsi256_si128( words ), _mm256_extracti128_si256( words, 1 ) ) };
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( out + i ), _mm_xor_si128( bytes, sign ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t floatToInt16Avx2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm256_set1_ps( int16_scale ) };
+        auto const minimum{ _mm256_set1_ps( -int16_scale ) };
+        auto const maximum{ _mm256_set1_ps( int16_scale - 1 ) };
+        std::size_t i{};
+        for ( ; i + 16 <= count; i += 16 )
+        {
+            auto const low { _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i     ), scale ), minimum ), maximum ) ) };
+            auto const high{ _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i + 8 ), scale ), minimum ), maximum ) ) };
+            // packing works within the 128 bit lanes, the permutation puts the halves back in order
+            auto const packed{ _mm256_permute4x64_epi64( _mm256_packs_epi32( low, high ), 0xd8 ) };
+            _mm256_storeu_si256( reinterpret_cast< __m256i * >( out + 2 * i ), packed );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t floatToInt24Avx2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm256_set1_ps( int24_scale ) };
+        auto const minimum{ _mm256_set1_ps( -int24_scale ) };
+        auto const maximum{ _mm256_set1_ps( int24_scale - 1 ) };
+        // the lower 3 bytes of every 32 bit lane to the front of its 128 bit lane, then the 24 bytes together
+        auto const pack   { _mm256_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128 ) };
+        auto const compact{ _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i ), scale ), minimum ), maximum ) ) };
+            auto const packed { _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( samples, pack ), compact ) };
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( out + 3 * i ), _mm256_castsi256_si128( packed ) );
+            _mm_storel_epi64( reinterpret_cast< __m128i * >( out + 3 * i + 16 ), _mm256_extracti128_si256( packed, 1 ) );
+        }
+        return i;
+    }
+
+    TELEAUDIO_AVX2 std::size_t floatToInt32Avx2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm256_set1_ps( int32_scale ) };
+        auto const minimum{ _mm256_set1_ps( -int32_scale ) };
+        auto const maximum{ _mm256_set1_ps( int32_max ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( _mm256_mul_ps( _mm256_loadu_ps( in + i ), scale ), minimum ), maximum ) ) };
+            _mm256_storeu_si256( reinterpret_cast< __m256i * >( out + 4 * i ), samples );
+        }
+        return i;
+    }
+
+    // `count` is a multiple of 8
+    TELEAUDIO_AVX2 float dotAvx2( float const * const x, float const * const h, std::size_t const count )
+    {
+        auto sum{ _mm256_setzero_ps() };
+        for ( std::size_t i{}; i < count; i += 8 )
+        {
+            sum = _mm256_fmadd_ps( _mm256_loadu_ps( x + i ), _mm256_loadu_ps( h + i ), sum );
+        }
+        auto quad{ _mm_add_ps( _mm256_castps256_ps128( sum ), _mm256_extractf128_ps( sum, 1 ) ) };
+        quad = _mm_add_ps( quad, _mm_movehl_ps( quad, quad ) );
+        quad = _mm_add_ss( quad, _mm_shuffle_ps( quad, quad, 1 ) );
+        return _mm_cvtss_f32( quad );
+    }
+#endif
+
+#ifdef TELEAUDIO_SSE2
+    std::size_t int8ToFloatSse2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm_set1_ps( 1.0f / int8_scale ) };
+        // flipping the top bit turns the unsigned samples into signed ones
+        auto const sign { _mm_set1_epi8( -128 ) };
+        std::size_t i{};
+        for ( ; i + 16 <= count; i += 16 )
+        {
+            auto const bytes{ _mm_xor_si128( _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + i ) ), sign ) };
+            // every sample goes to the top byte of a 32 bit lane, the arithmetic shift brings it back sign extended
+            auto const low  { _mm_unpacklo_epi8( bytes, bytes ) };
+            auto const high { _mm_unpackhi_epi8( bytes, bytes ) };
+            _mm_storeu_ps( out + i,      _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( low,  low  ), 24 ) ), scale ) );
+            _mm_storeu_ps( out + i + 4,  _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( low,  low  ), 24 ) ), scale ) );
+            _mm_storeu_ps( out + i + 8,  _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( high, high ), 24 ) ), scale ) );
+            _mm_storeu_ps( out + i + 12, _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( high, high ), 24 ) ), scale ) );
+        }
+        return i;
+    }
+
+    std::size_t int16ToFloatSse2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm_set1_ps( 1.0f / int16_scale ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const samples{ _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 2 * i ) ) };
+            // every sample goes to the upper half of a 32 bit lane, the arithmetic shift brings it back sign extended
+            auto const low { _mm_srai_epi32( _mm_unpacklo_epi16( samples, samples ), 16 ) };
+            auto const high{ _mm_srai_epi32( _mm_unpackhi_epi16( samples, samples ), 16 ) };
+            _mm_storeu_ps( out + i,     _mm_mul_ps( _mm_cvtepi32_ps( low  ), scale ) );
+            _mm_storeu_ps( out + i + 4, _mm_mul_ps( _mm_cvtepi32_ps( high ), scale ) );
+        }
+        return i;
+    }
+
+    std::size_t int24ToFloatSse2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm_set1_ps( 1.0f / int24_scale ) };
+        // SSE2 can't shuffle bytes, the samples are shifted into the upper 3 bytes of their lanes one by one instead
+        auto const first { _mm_set_epi32( 0,    0,    0,    -256 ) };
+        auto const second{ _mm_set_epi32( 0,    0,    -256, 0    ) };
+        auto const third { _mm_set_epi32( 0,    -256, 0,    0    ) };
+        auto const fourth{ _mm_set_epi32( -256, 0,    0,    0    ) };
+        std::size_t i{};
+        // the load reads 4 bytes past the 4 samples, they have to be there
+        for ( ; i + 6 <= count; i += 4 )
+        {
+            auto const bytes  { _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 3 * i ) ) };
+            auto const samples{ _mm_or_si128( _mm_or_si128( _mm_and_si128( _mm_slli_si128( bytes, 1 ), first ), _mm_and_si128( _mm_slli_si128( bytes, 2 ), second ) ),
+                                              _mm_or_si128( _mm_and_si128( _mm_slli_si128( bytes, 3 ), third ), _mm_and_si128( _mm_slli_si128( bytes, 4 ), fourth ) ) ) };
+            _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( samples, 8 ) ), scale ) );
+        }
+        return i;
+    }
+
+    std::size_t int32ToFloatSse2( std::byte const * const in, float * const out, std::size_t const count )
+    {
+        auto const scale{ _mm_set1_ps( 1.0f / int32_scale ) };
+        std::size_t i{};
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            auto const samples{ _mm_loadu_si128( reinterpret_cast< __m128i const * >( in + 4 * i ) ) };
+            _mm_storeu_ps( out + i, _mm_mul_ps( _mm_cvtepi32_ps( samples ), scale ) );
+        }
+        return i;
+    }
+
+    std::size_t floatToInt8Sse2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm_set1_ps( int8_scale ) };
+        auto const minimum{ _mm_set1_ps( -int8_scale ) };
+        auto const maximum{ _mm_set1_ps( int8_scale - 1 ) };
+        auto const sign   { _mm_set1_epi8( -128 ) };
+        std::size_t i{};
+        for ( ; i + 16 <= count; i += 16 )
+        {
+            __m128i words[ 2 ];
+            for ( std::size_t half{}; half < 2; ++half )
+            {
+                auto const * const samples{ in + i + 8 * half };
+                auto const low { _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( samples     ), scale ), minimum ), maximum ) ) };
+                auto const high{ _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( samples + 4 ), scale ), minimum ), maximum ) ) };
+                words[ half ] = _mm_packs_epi32( low, high );
+            }
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( out + i ), _mm_xor_si128( _mm_packs_epi16( words[ 0 ], words[ 1 ] ), sign ) );
+        }
+        return i;
+    }
+
+    std::size_t floatToInt16Sse2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm_set1_ps( int16_scale ) };
+        auto const minimum{ _mm_set1_ps( -int16_scale ) };
+        auto const maximum{ _mm_set1_ps( int16_scale - 1 ) };
+        std::size_t i{};
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            auto const low { _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( in + i     ), scale ), minimum ), maximum ) ) };
+            auto const high{ _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( in + i + 4 ), scale ), minimum ), maximum ) ) };
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( out + 2 * i ), _mm_packs_epi32( low, high ) );
+        }
+        return i;
+    }
+
+    std::size_t floatToInt24Sse2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm_set1_ps( int24_scale ) };
+        auto const minimum{ _mm_set1_ps( -int24_scale ) };
+        auto const maximum{ _mm_set1_ps( int24_scale - 1 ) };
+        // the lower 3 bytes of every lane, shifted together by byte shifts as SSE2 can't shuffle bytes
+        auto const first { _mm_set_epi32( 0,        0,        0,        0xffffff ) };
+        auto const second{ _mm_set_epi32( 0,        0,        0xffffff, 0        ) };
+        auto const third { _mm_set_epi32( 0,        0xffffff, 0,        0        ) };
+        auto const fourth{ _mm_set_epi32( 0xffffff, 0,        0,        0        ) };
+        std::size_t i{};
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            auto const samples{ _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( in + i ), scale ), minimum ), maximum ) ) };
+            auto const packed { _mm_or_si128( _mm_or_si128( _mm_and_si128( samples, first ), _mm_srli_si128( _mm_and_si128( samples, second ), 1 ) ),
+                                              _mm_or_si128( _mm_srli_si128( _mm_and_si128( samples, third ), 2 ), _mm_srli_si128( _mm_and_si128( samples, fourth ), 3 ) ) ) };
+            _mm_storel_epi64( reinterpret_cast< __m128i * >( out + 3 * i ), packed );
+            auto const rest{ _mm_cvtsi128_si32( _mm_srli_si128( packed, 8 ) ) };
+            std::memcpy( out + 3 * i + 8, &rest, sizeof( rest ) );
+        }
+        return i;
+    }
+
+    std::size_t floatToInt32Sse2( float const * const in, std::byte * const out, std::size_t const count )
+    {
+        auto const scale  { _mm_set1_ps( int32_scale ) };
+        auto const minimum{ _mm_set1_ps( -int32_scale ) };
+        auto const maximum{ _mm_set1_ps( int32_max ) };
+        std::size_t i{};
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            auto const samples{ _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( in + i ), scale ), minimum ), maximum ) ) };
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( out + 4 * i ), samples );
+        }
+        return i;
+    }
+
+    // `count` is a multiple of 4
+    float dotSse2( float const * const x, float const * const h, std::size_t const count )
+    {
+        auto sum{ _mm_setzero_ps() };
+        for ( std::size_t i{}; i < count; i += 4 )
+        {
+            sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( x + i ), _mm_loadu_ps( h + i ) ) );
+        }
+        sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+        sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+        return _mm_cvtss_f32( sum );
+    }
+#endif
+
+    // the widest kernel the CPU can run, on as many samples as it takes
+    template< typename In, typename Out >
+    [[ nodiscard ]] std::size_t vectorized( [[ maybe_unused ]] std::size_t ( * const avx2 )( In, Out, std::size_t ),
+                                            [[ maybe_unused ]] std::size_t ( * const sse2 )( In, Out, std::size_t ),
+                                            [[ maybe_unused ]] In const in, [[ maybe_unused ]] Out const out, [[ maybe_unused ]] std::size_t const count )
+    {
+#ifdef TELEAUDIO_AVX2
+        if ( Teleaudio::Cpu::hasAvx2() )
+        {
+            return avx2( in, out, count );
+        }
+#endif
+#ifdef TELEAUDIO_SSE2
+        return sse2( in, out, count );
+#else
+        return 0;
+#endif
+    }
+
+#ifndef TELEAUDIO_AVX2
+    // no AVX2 kernels to pick from
+    constexpr std::size_t ( * int8ToFloatAvx2  )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int16ToFloatAvx2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int24ToFloatAvx2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int32ToFloatAvx2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt8Avx2  )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt16Avx2 )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt24Avx2 )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt32Avx2 )( float const *, std::byte *, std::size_t ) = nullptr;
+#endif
+#ifndef TELEAUDIO_SSE2
+    constexpr std::size_t ( * int8ToFloatSse2  )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int16ToFloatSse2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int24ToFloatSse2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * int32ToFloatSse2 )( std::byte const *, float *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt8Sse2  )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt16Sse2 )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt24Sse2 )( float const *, std::byte *, std::size_t ) = nullptr;
+    constexpr std::size_t ( * floatToInt32Sse2 )( float const *, std::byte *, std::size_t ) = nullptr;
+#endif
+
+    [[ nodiscard ]] float dot( float const * const x, float const * const h, std::size_t const count )
+    {
+#ifdef TELEAUDIO_AVX2
+        if ( Teleaudio::Cpu::hasAvx2() )
+        {
+            return dotAvx2( x, h, count );
+        }
+#endif
+#ifdef TELEAUDIO_SSE2
+        return dotSse2( x, h, count );
+#else
+        float sum{};
+        for ( std::size_t i{}; i < count; ++i )
+        {
+            sum += x[ i ] * h[ i ];
+        }
+        return sum;
+#endif
+    }
+
+    template< typename Integer >
+    [[ nodiscard ]] Integer load( std::byte const * const sample )
+    {
+        Integer value;
+        std::memcpy( &value, sample, sizeof( value ) );
+        return value;
+    }
+
+    template< typename Integer >
+    void store( std::byte * const sample, Integer const value )
+    {
+        std::memcpy( sample, &value, sizeof( value ) );
+    }
+
+    // rounds to nearest, like the vectorized conversions
+    [[ nodiscard ]] std::int32_t quantize( float const sample, float const scale, float const maximum )
+    {
+        return static_cast< std::int32_t >( std::lrint( std::clamp( sample * scale, -scale, maximum ) ) );
+    }
+
+    // Converts `count` samples of `format` into floats between -1 and 1
+    void toFloat( WAV::FmtSubChunk const & format, std::byte const * const in, float * const out, std::size_t const count )
+    {
+        if ( format.audio_format == ieee_float )
+        {
+            std::memcpy( out, in, count * sizeof( float ) );
+            return;
+        }
+
+        switch ( format.bits_per_sample )
+        {
+            case 8:
+            {
+                // 8 bit samples are the only unsigned ones
+                for ( auto i{ vectorized( int8ToFloatAvx2, int8ToFloatSse2, in, out, count ) }; i < count; ++i )
+                {
+                    out[ i ] = static_cast< float >( static_cast< int >( in[ i ] ) - 128 ) / int8_scale;
+                }
+                break;
+            }
+            case 16:
+            {
+                for ( auto i{ vectorized( int16ToFloatAvx2, int16ToFloatSse2, in, out, count ) }; i < count; ++i )
+                {
+                    out[ i ] = static_cast< float >( load< std::int16_t >( in + 2 * i ) ) / int16_scale;
+                }
+                break;
+            }
+            case 24:
+            {
+                for ( auto i{ vectorized( int24ToFloatAvx2, int24ToFloatSse2, in, out, count ) }; i < count; ++i )
+                {
+                    auto const * const sample{ in + 3 * i };
+                    // assembled in the upper bytes, so the shift back sign extends it
+                    auto const value{ static_cast< std::int32_t >( ( static_cast< std::uint32_t >( sample[ 0 ] ) << 8  )
+                                                                 | ( static_cast< std::uint32_t >( sample[ 1 ] ) << 16 )
+                                                                 | ( static_cast< std::uint32_t >( sample[ 2 ] ) << 24 ) ) >> 8 };
+                    out[ i ] = static_cast< float >( value ) / int24_scale;
+                }
+                break;
+            }
+            case 32:
+            {
+                for ( auto i{ vectorized( int32ToFloatAvx2, int32ToFloatSse2, in, out, count ) }; i < count; ++i )
+                {
+                    out[ i ] = static_cast< float >( load< std::int32_t >( in + 4 * i ) ) / int32_scale;
+                }
+                break;
+            }
+        }
+    }
+
+    // Converts `count` floats into samples of `format`, clipping what's out of range
+    void fromFloat( WAV::FmtSubChunk const & format, float const * const in, std::byte * const out, std::size_t const count )
+    {
+        if ( format.audio_format == ieee_float )
+        {
+            std::memcpy( out, in, count * sizeof( float ) );
+            return;
+        }
+
+        switch ( format.bits_per_sample )
+        {
+            case 8:
+            {
+                for ( auto i{ vectorized( floatToInt8Avx2, floatToInt8Sse2, in, out, count ) }; i < count; ++i )
+                {
+                    out[ i ] = static_cast< std::byte >( quantize( in[ i ], int8_scale, int8_scale - 1 ) + 128 );
+                }
+                break;
+            }
+            case 16:
+            {
+                for ( auto i{ vectorized( floatToInt16Avx2, floatToInt16Sse2, in, out, count ) }; i < count; ++i )
+                {
+                    store( out + 2 * i, static_cast< std::int16_t >( quantize( in[ i ], int16_scale, int16_scale - 1 ) ) );
+                }
+                break;
+            }
+            case 24:
+            {
+                for ( auto i{ vectorized( floatToInt24Avx2, floatToInt24Sse2, in, out, count ) }; i < count; ++i )
+                {
+                    auto const value{ static_cast< std::uint32_t >( quantize( in[ i ], int24_scale, int24_scale - 1 ) ) };
+                    out[ 3 * i     ] = static_cast< std::byte >( value       );
+                    out[ 3 * i + 1 ] = static_cast< std::byte >( value >> 8  );
+                    out[ 3 * i + 2 ] = static_cast< std::byte >( value >> 16 );
+                }
+                break;
+            }
+            case 32:
+            {
+                for ( auto i{ vectorized( floatToInt32Avx2, floatToInt32Sse2, in, out, count ) }; i < count; ++i )
+                {
+                    store( out + 4 * i, quantize( in[ i ], int32_scale, int32_max ) );
+                }
+                break;
+            }
+        }
+    }
+
+    // Blackman window over -1 to 1
+    [[ nodiscard ]] double window( double const x )
+    {
+        return 0.42 + 0.5 * std::cos( std::numbers::pi * x ) + 0.08 * std::cos( 2 * std::numbers::pi * x );
+    }
+}
+
+namespace Teleaudio
+{
+    void samplesToFloat( WAV::FmtSubChunk const & format, std::byte const * const in, float * const out, std::size_t const count )
+    {
+        toFloat( format, in, out, count );
+    }
+
+    bool Transcoder::supports( WAV::FmtSubChunk const & format )
+    {
+        auto const integer{ format.audio_format == pulse_code_modulation && format.bits_per_sample % 8 == 0 && format.bits_per_sample >= 8 && format.bits_per_sample <= 32 };
+        auto const floats { format.audio_format == ieee_float && format.bits_per_sample == 32 };
+        return ( integer || floats )
+            && format.num_channels > 0 && format.num_channels <= max_channels
+            && format.sample_rate  > 0 && format.sample_rate  <= max_sample_rate
+            && format.block_align == format.num_channels * format.bits_per_sample / 8;
+    }
+
+    std::optional< WAV::FmtSubChunk > Transcoder::outputFormat( WAV::FmtSubChunk const & source, std::uint32_t const sample_rate, std::uint16_t const bits_per_sample, std::uint16_t const channels, bool const floating_point )
+    {
+        if ( !supports( source ) )
+        {
+            return std::nullopt;
+        }
+
+        WAV::FmtSubChunk target{ source };
+        if ( sample_rate > 0 )
+        {
+            target.sample_rate = sample_rate;
+        }
+        if ( channels > 0 )
+        {
+            target.num_channels = channels;
+        }
+        if ( floating_point )
+        {
+            if ( bits_per_sample != 0 && bits_per_sample != 32 )
+            {
+                return std::nullopt;
+            }
+            target.audio_format    = ieee_float;
+            target.bits_per_sample = 32;
+        }
+        else if ( bits_per_sample > 0 )
+        {
+            target.audio_format    = pulse_code_modulation;
+            target.bits_per_sample = bits_per_sample;
+        }
+        target.block_align = static_cast< std::uint16_t >( target.num_channels * target.bits_per_sample / 8 );
+        target.byte_rate   = target.sample_rate * target.block_align;
+
+        if ( !supports( target ) )
+        {
+            return std::nullopt;
+        }
+        return target;
+    }
+
+    Transcoder::Transcoder( WAV::FmtSubChunk const & source, WAV::FmtSubChunk const & target )
+        : source_{ source }
+        , target_{ target }
+        , mix_sources_( target.num_channels )
+        , history_( target.num_channels )
+    {
+        std::size_t const inputs { source_.num_channels };
+        std::size_t const outputs{ target_.num_channels };
+        for ( std::size_t channel{}; channel < outputs; ++channel )
+        {
+            auto & sources{ mix_sources_[ channel ] };
+            if ( outputs >= inputs )
+            {
+                sources.push_back( channel % inputs );
+                continue;
+            }
+
+            // the complete groups of inputs, one input of each per output
+            auto const grouped{ inputs - inputs % outputs };
+            for ( auto input{ channel }; input < grouped; input += outputs )
+            {
+                sources.push_back( input );
+            }
+
+            // the rest is shared by all the outputs, as a center channel would be
+            for ( auto input{ grouped }; input < inputs; ++input )
+            {
+                sources.push_back( input );
+            }
+        }
+
+        auto const common{ std::gcd( source_.sample_rate, target_.sample_rate ) };
+        up_   = target_.sample_rate / common;
+        down_ = source_.sample_rate / common;
+
+        if ( up_ != down_ )
+        {
+            // relative to the input rate, below the lower of the two Nyquist frequencies with some room for the transition band
+            auto const ratio { std::min( 1.0, static_cast< double >( up_ ) / static_cast< double >( down_ ) ) };
+            auto const cutoff{ 0.95 * ratio };
+
+            taps_   = std::min( ( static_cast< std::size_t >( std::ceil( base_taps / ratio ) ) + 7 ) / 8 * 8, max_taps );
+            phases_ = static_cast< std::size_t >( std::min< std::uint64_t >( up_, max_phases ) );
+            coefficients_.resize( phases_ * taps_ );
+
+            auto const half{ static_cast< double >( taps_ / 2 ) };
+            for ( std::size_t phase{}; phase < phases_; ++phase )
+            {
+                auto const fraction{ static_cast< double >( phase ) / static_cast< double >( phases_ ) };
+                auto const row     { coefficients_.begin() + static_cast< std::ptrdiff_t >( phase * taps_ ) };
+
+                double sum{};
+                for ( std::size_t tap{}; tap < taps_; ++tap )
+                {
+                    // distance of the input frame from the output frame
+                    auto const distance{ static_cast< double >( tap ) - ( half - 1 ) - fraction };
+                    auto const argument{ std::numbers::pi * cutoff * distance };
+                    auto const sinc    { distance == 0 ? 1.0 : std::sin( argument ) / argument };
+                    auto const value   { cutoff * sinc * window( distance / half ) };
+
+                    row[ static_cast< std::ptrdiff_t >( tap ) ] = static_cast< float >( value );
+                    sum += value;
+                }
+
+                // a constant signal keeps its level
+                std::for_each( row, row + static_cast< std::ptrdiff_t >( taps_ ), [ sum ]( float & value ) { value = static_cast< float >( value / sum ); } );
+            }
+        }
+
+        seek( 0 );
+    }
+
+    std::uint64_t Transcoder::outputFrames( std::uint64_t const input_frames ) const
+    {
+        return ( input_frames * up_ + down_ - 1 ) / down_;
+    }
+
+    std::uint64_t Transcoder::seek( std::uint64_t const output_frame )
+    {
+        for ( auto & channel : history_ )
+        {
+            channel.clear();
+        }
+
+        if ( up_ == down_ )
+        {
+            history_start_ = static_cast< std::int64_t >( output_frame );
+            return output_frame;
+        }
+
+        next_input_ = output_frame * down_ / up_;
+        next_phase_ = output_frame * down_ % up_;
+
+        // the frames before the start of the stream are silence
+        history_start_ = static_cast< std::int64_t >( next_input_ ) - static_cast< std::int64_t >( taps_ / 2 - 1 );
+        if ( history_start_ < 0 )
+        {
+            for ( auto & channel : history_ )
+            {
+                channel.resize( static_cast< std::size_t >( -history_start_ ) );
+            }
+            return 0;
+        }
+        return static_cast< std::uint64_t >( history_start_ );
+    }
+
+    void Transcoder::push( std::span< std::byte const > const input, std::vector< std::byte > & output )
+    {
+        auto const frames{ input.size() / source_.block_align };
+        input_scratch_.resize( frames * source_.num_channels );
+        toFloat( source_, input.data(), input_scratch_.data(), input_scratch_.size() );
+
+        for ( std::size_t channel{}; channel < history_.size(); ++channel )
+        {
+            auto const & sources{ mix_sources_[ channel ] };
+            auto       & mixed  { history_[ channel ] };
+
+            auto const start{ mixed.size() };
+            mixed.resize( start + frames );
+
+            auto const weight{ 1.0f / static_cast< float >( sources.size() ) };
+            for ( std::size_t frame{}; frame < frames; ++frame )
+            {
+                auto const * const samples{ input_scratch_.data() + frame * source_.num_channels };
+
+                float sum{};
+                for ( auto const source : sources )
+                {
+                    sum += samples[ source ];
+                }
+                mixed[ start + frame ] = sources.size() == 1 ? sum : sum * weight;
+            }
+        }
+
+        resample( output );
+    }
+
+    void Transcoder::finish( std::vector< std::byte > & output )
+    {
+        // the last output frames need as much silence after the end as the filter reaches
+        for ( auto & channel : history_ )
+        {
+            channel.resize( channel.size() + taps_ / 2 );
+        }
+        resample( output );
+    }
+
+    void Transcoder::resample( std::vector< std::byte > & output )
+    {
+        auto const channels{ history_.size() };
+        auto const frames  { history_.front().size() };
+
+        output_scratch_.clear();
+        if ( up_ == down_ )
+        {
+            // every mixed frame is an output frame
+            output_scratch_.resize( frames * channels );
+            for ( std::size_t channel{}; channel < channels; ++channel )
+            {
+                for ( std::size_t frame{}; frame < frames; ++frame )
+                {
+                    output_scratch_[ frame * channels + channel ] = history_[ channel ][ frame ];
+                }
+                history_[ channel ].clear();
+            }
+            history_start_ += static_cast< std::int64_t >( frames );
+        }
+        else
+        {
+            auto const half{ static_cast< std::int64_t >( taps_ / 2 ) };
+            auto const end { history_start_ + static_cast< std::int64_t >( frames ) };
+
+            // an output frame needs `half` more input frames after the one before it
+            output_scratch_.reserve( static_cast< std::size_t >( std::max< std::int64_t >( end - static_cast< std::int64_t >( next_input_ ), 0 ) ) * up_ / down_ * channels + channels );
+            while ( static_cast< std::int64_t >( next_input_ ) + half < end )
+            {
+                auto const row  { coefficients_.data() + next_phase_ * phases_ / up_ * taps_ };
+                auto const first{ static_cast< std::size_t >( static_cast< std::int64_t >( next_input_ ) - ( half - 1 ) - history_start_ ) };
+                for ( std::size_t channel{}; channel < channels; ++channel )
+                {
+                    output_scratch_.push_back( dot( history_[ channel ].data() + first, row, taps_ ) );
+                }
+
+                next_phase_ += down_;
+                next_input_ += next_phase_ / up_;
+                next_phase_ %= up_;
+            }
+
+            // the frames no output frame needs anymore
+            auto const needed{ std::clamp< std::int64_t >( static_cast< std::int64_t >( next_input_ ) - ( half - 1 ) - history_start_, 0, static_cast< std::int64_t >( frames ) ) };
+            for ( auto & channel : history_ )
+            {
+                channel.erase( channel.begin(), channel.begin() + needed );
+            }
+            history_start_ += needed;
+        }
+
+        auto const bytes_per_sample{ target_.bits_per_sample / 8u };
+        auto const start           { output.size() };
+        output.resize( start + output_scratch_.size() * bytes_per_sample );
+        fromFloat( target_, output_scratch_.data(), output.data() + start, output_scratch_.size() );
+    }
+} // namespace Teleaudio
@@ -0,0 +1,258 @@
+#include "utils.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FileUtils
+{
+#ifdef _WIN32
+    MappedRegion::MappedRegion( std::string_view const path )
+    {
+        auto const file{ CreateFileA( path.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr ) };
+        if ( file == INVALID_HANDLE_VALUE )
+        {
+            spdlog::error( "Cannot open '{}' for mapping.", path );
+            return;
+        }
+
+        LARGE_INTEGER file_size;
+        if ( !GetFileSizeEx( file, &file_size ) || file_size.QuadPart == 0 )
+        {
+            spdlog::error( "Cannot map '{}', it is empty or its size is unknown.", path );
+            CloseHandle( file );
+            return;
+        }
+
+        // the mapping keeps its own reference to the file
+        mapping_handle_ = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+        CloseHandle( file );
+        if ( mapping_handle_ == nullptr )
+        {
+            spdlog::error( "Creating a file mapping for '{}' failed.", path );
+            return;
+        }
+
+        address_ = MapViewOfFile( mapping_handle_, FILE_MAP_READ, 0, 0, 0 );
+        if ( address_ == nullptr )
+        {
+            spdlog::error( "Mapping a view of '{}' failed.", path );
+            CloseHandle( mapping_handle_ );
+            mapping_handle_ = nullptr;
+            return;
+        }
+        size_ = static_cast< std::size_t >( file_size.QuadPart );
+    }
+
+    void MappedRegion::unmap()
+    {
+        if ( address_ != nullptr )
+        {
+            UnmapViewOfFile( address_ );
+            CloseHandle( mapping_handle_ );
+        }
+        address_        = nullptr;
+        mapping_handle_ = nullptr;
+        size_           = 0;
+    }
+
+    void MappedRegion::advise( std::size_t, std::size_t, AccessHint ) const {}
+
+    bool writeAt( FILE * const file, std::uint64_t const offset, std::span< std::byte const > const data )
+    {
+        auto const handle{ reinterpret_cast< HANDLE >( ::_get_osfhandle( ::_fileno( file ) ) ) };
+
+        std::size_t written{};
+        while ( written < data.size() )
+        {
+            auto const position{ offset + written };
+
+            OVERLAPPED overlapped{};
+            overlapped.Offset     = static_cast< DWORD >( position       );
+            overlapped.OffsetHigh = static_cast< DWORD >( position >> 32 );
+
+            DWORD      res{};
+            auto const size{ static_cast< DWORD >( std::min< std::size_t >( data.size() - written, MAXDWORD ) ) };
+            if ( !WriteFile( handle, data.data() + written, size, &res, &overlapped ) )
+            {
+                spdlog::error( "Writing {} bytes at {} failed.", size, position );
+                return false;
+            }
+            written += res;
+        }
+        return true;
+    }
+
+    bool sync( FILE * const file )
+    {
+        return std::fflush( file ) == 0 && ::_commit( ::_fileno( file ) ) == 0;
+    }
+#else
+    MappedRegion::MappedRegion( std::string_view const path )
+    {
+        auto const fd{ ::open( path.data(), O_RDONLY | O_CLOEXEC ) };
+        if ( fd < 0 )
+        {
+            spdlog::error( "Cannot open '{}' for mapping.", path );
+            return;
+        }
+
+        struct stat file_stat{};
+        if ( ::fstat( fd, &file_stat ) != 0 || file_stat.st_size == 0 )
+        {
+            spdlog::error( "Cannot map '{}', it is empty or its size is unknown.", path );
+            ::close( fd );
+            return;
+        }
+
+        auto const size{ static_cast< std::size_t >( file_stat.st_size ) };
+
+        // the mapping keeps its own reference to the file
+        auto * const address{ ::mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 ) };
+        ::close( fd );
+        if ( address == MAP_FAILED )
+        {
+            spdlog::error( "Mapping '{}' failed.", path );
+            return;
+        }
+
+        address_ = address;
+        size_    = size;
+    }
+
+    void MappedRegion::unmap()
+    {
+        if ( address_ != nullptr )
+        {
+            ::munmap( address_, size_ );
+        }
+        address_ = nullptr;
+        size_    = 0;
+    }
+
+    void MappedRegion::advise( std::size_t const offset, std::size_t const length, AccessHint const hint ) const
+    {
+        if ( !valid() || offset >= size_ )
+        {
+            return;
+        }
+
+        auto const advice
+        {
+            [ hint ]
+            {
+                switch( hint )
+                {
+                    case AccessHint::Sequential: return MADV_SEQUENTIAL;
+                    case AccessHint::Random:     return MADV_RANDOM;
+                    case AccessHint::WillNeed:   return MADV_WILLNEED;
+                    case AccessHint::Normal:
+                    default:                     return MADV_NORMAL;
+                }
+            }()
+        };
+
+        // madvise wants a page aligned address
+        auto const page_size    { static_cast< std::size_t >( ::sysconf( _SC_PAGESIZE ) ) };
+        auto const aligned_start{ offset - offset % page_size                             };
+        auto const aligned_len  { std::min( length, size_ - offset ) + ( offset - aligned_start ) };
+
+        if ( ::madvise( static_cast< std::byte * >( address_ ) + aligned_start, aligned_len, advice ) != 0 )
+        {
+            spdlog::debug( "madvise failed, the hint is ignored" );
+        }
+    }
+
+    bool writeAt( FILE * const file, std::uint64_t const offset, std::span< std::byte const > const data )
+    {
+        auto const fd{ ::fileno( file ) };
+
+        std::size_t written{};
+        while ( written < data.size() )
+        {
+            auto const res{ ::pwrite( fd, data.data() + written, data.size() - written, static_cast< off_t >( offset + written ) ) };
+            if ( res < 0 )
+            {
+                if ( errno == EINTR )
+                {
+                    continue;
+                }
+                spdlog::error( "Writing {} bytes at {} failed, errno {}.", data.size() - written, offset + written, errno );
+                return false;
+            }
+            written += static_cast< std::size_t >( res );
+        }
+        return true;
+    }
+
+    bool sync( FILE * const file )
+    {
+        return std::fflush( file ) == 0 && ::fsync( ::fileno( file ) ) == 0;
+    }
+#endif
+
+    std::string temporaryPath( std::string_view const path )
+    {
+#ifdef _WIN32
+        auto const process{ ::_getpid() };
+#else
+        auto const process{ ::getpid() };
+#endif
+        return std::string{ path } + "." + std::to_string( process ) + "." + std::to_string( std::hash< std::thread::id >{}( std::this_thread::get_id() ) ) + ".tmp";
+    }
+
+    std::optional< Stamp > stamp( std::filesystem::path const & file )
+    {
+        std::error_code ec;
+        auto const size { std::filesystem::file_size( file, ec ) };
+        if ( ec )
+        {
+            return std::nullopt;
+        }
+        auto const mtime{ std::filesystem::last_write_time( file, ec ) };
+        if ( ec )
+        {
+            return std::nullopt;
+        }
+        return Stamp{ static_cast< std::int64_t >( mtime.time_since_epoch().count() ), size };
+    }
+
+    MappedRegion::MappedRegion( MappedRegion && other ) noexcept
+    {
+        *this = std::move( other );
+    }
+
+    MappedRegion & MappedRegion::operator=( MappedRegion && other ) noexcept
+    {
+        if ( this != &other )
+        {
+            unmap();
+            address_ = std::exchange( other.address_, nullptr );
+            size_    = std::exchange( other.size_,    0       );
+#ifdef _WIN32
+            mapping_handle_ = std::exchange( other.mapping_handle_, nullptr );
+#endif
+        }
+        return *this;
+    }
+
+    MappedRegion::~MappedRegion()
+    {
+        unmap();
+    }
+} // namespace FileUtils
@@ -3,12 +3,148 @@
 
 #include "utils.hpp"
 
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+namespace
+{
+    // a little endian value at `offset` into `bytes`
+    template< typename T >
+    [[ nodiscard ]] T load( std::span< std::byte const > const bytes, std::size_t const offset )
+    {
+        T value{};
+        std::memcpy( &value, bytes.data() + offset, sizeof( value ) );
+        return value;
+    }
+
+    // Walks the chunks of a .wav file, `read( offset, buffer )` has to fill the whole buffer from that offset of the file
+    template< typename Read >
+    [[ nodiscard ]] std::optional< WAV::Layout > walk( Read const & read )
+    {
+        std::array< std::byte, 12 > riff;
+        if ( !read( 0, riff ) )
+        {
+            spdlog::error( "Too short for a .wav file." );
+            return std::nullopt;
+        }
+
+        auto const id{ load< std::array< std::byte, 4 > >( riff, 0 ) };
+        if ( ( id != WAV::MagicBytes::RIFF && id != WAV::MagicBytes::RF64 ) || load< std::array< std::byte, 4 > >( riff, 8 ) != WAV::MagicBytes::WAVE )
+        {
+            spdlog::error( "Not a RIFF WAVE file." );
+            return std::nullopt;
+        }
+
+        WAV::Layout layout;
+        layout.rf64 = id == WAV::MagicBytes::RF64;
+
+        // the sizes of RF64 files are in the ds64 chunk that follows
+        auto const bytes_before_chunk_size{ 8 };
+        std::uint64_t riff_end     { bytes_before_chunk_size + std::uint64_t{ load< std::uint32_t >( riff, 4 ) } };
+        std::uint64_t rf64_data_size{};
+
+        bool has_format{};
+        bool has_data  {};
+
+        // some writers get the RIFF size wrong, so it only ends the walk once the samples are found
+        for ( std::uint64_t position{ riff.size() }; !has_data || position + bytes_before_chunk_size <= riff_end; )
+        {
+            std::array< std::byte, 8 > header;
+            if ( !read( position, header ) )
+            {
+                break;
+            }
+
+            WAV::ChunkInfo chunk
+            {
+                .id     = load< std::array< std::byte, 4 > >( header, 0 ),
+                .offset = position + header.size(),
+                .size   = load< std::uint32_t >( header, 4 )
+            };
+
+            if ( chunk.id == WAV::MagicBytes::ds64 && layout.rf64 )
+            {
+                std::array< std::byte, 24 > body;
+                if ( chunk.size < body.size() || !read( chunk.offset, body ) )
+                {
+                    spdlog::error( "The ds64 chunk of an RF64 file is cut short." );
+                    return std::nullopt;
+                }
+                riff_end       = bytes_before_chunk_size + load< std::uint64_t >( body, 0 );
+                rf64_data_size = load< std::uint64_t >( body, 8 );
+            }
+            else if ( chunk.id == WAV::MagicBytes::fmt )
+            {
+                // the plain format, its extension and the extensible one
+                std::array< std::byte, 40 > body{};
+                auto const size{ static_cast< std::size_t >( std::min< std::uint64_t >( chunk.size, body.size() ) ) };
+                if ( size < 16 || !read( chunk.offset, std::span{ body }.first( size ) ) )
+                {
+                    spdlog::error( "The fmt chunk is {} bytes long, too short for a format.", chunk.size );
+                    return std::nullopt;
+                }
+
+                auto & format{ layout.format };
+                format.subchunk1_id    = WAV::MagicBytes::fmt;
+                format.subchunk1_size  = 16;
+                format.audio_format    = load< std::uint16_t >( body, 0  );
+                format.num_channels    = load< std::uint16_t >( body, 2  );
+                format.sample_rate     = load< std::uint32_t >( body, 4  );
+                format.byte_rate       = load< std::uint32_t >( body, 8  );
+                format.block_align     = load< std::uint16_t >( body, 12 );
+                format.bits_per_sample = load< std::uint16_t >( body, 14 );
+                layout.valid_bits_per_sample = format.bits_per_sample;
+
+                if ( format.audio_format == WAV::format_extensible )
+                {
+                    if ( size < body.size() )
+                    {
+                        spdlog::error( "The extensible fmt chunk is {} bytes long, too short for its extension.", chunk.size );
+                        return std::nullopt;
+                    }
+                    // the sub format GUID starts with the format code
+                    layout.valid_bits_per_sample = load< std::uint16_t >( body, 18 );
+                    layout.channel_mask          = load< std::uint32_t >( body, 20 );
+                    format.audio_format          = load< std::uint16_t >( body, 24 );
+                }
+                has_format = true;
+            }
+            else if ( chunk.id == WAV::MagicBytes::data && !has_data )
+            {
+                if ( layout.rf64 && chunk.size == UINT32_MAX )
+                {
+                    chunk.size = rf64_data_size;
+                }
+                layout.data_offset = chunk.offset;
+                layout.data_size   = chunk.size;
+                has_data           = true;
+            }
+
+            if ( layout.chunk_count < layout.chunks.size() )
+            {
+                layout.chunks[ layout.chunk_count++ ] = chunk;
+            }
+
+            // the bodies are padded to an even size
+            position = chunk.offset + chunk.size + chunk.size % 2;
+        }
+
+        if ( !has_format || !has_data )
+        {
+            spdlog::error( "No {} chunk in the .wav file.", has_format ? "data" : "fmt" );
+            return std::nullopt;
+        }
+        return layout;
+    }
+}
+
 namespace WAV
 {
     // validations
     bool RiffChunk::valid() const
     {
-        auto const magic_bytes_match{ id == MagicBytes::RIFF && format == MagicBytes::WAVE };
+        auto const magic_bytes_match{ ( id == MagicBytes::RIFF || id == MagicBytes::RF64 ) && format == MagicBytes::WAVE };
         return magic_bytes_match;
     }
 
@@ -23,7 +159,7 @@ namespace WAV
             && expected_block_align == block_align;
     }
 
-    bool DataSubChunk::valid() const
+    bool DataSubChunkView::valid() const
     {
         auto const magic_bytes_match{ subchunk2_id == MagicBytes::data };
         return magic_bytes_match;
@@ -31,42 +167,77 @@ namespace WAV
 
     bool File::valid() const
     {
-        auto const riffValid  { riff.valid()   };
-        auto const formatValid{ format.valid() };
-        auto const dataValid  { data.valid()   };
-
-        // the subchunk sizes denote the size of the _rest of the current chunk_
-        auto const bytes_before_subchunk_size{ 8 };
-        auto const expected_chunk_size
+        if ( buffer_.size < header_size )
         {
-            4 +
-            ( bytes_before_subchunk_size + format.subchunk1_size ) +
-            ( bytes_before_subchunk_size +   data.subchunk2_size )
-        };
+            return false;
+        }
 
-        return riffValid && formatValid && dataValid && expected_chunk_size;
+        auto const riffValid  { riff().valid()   };
+        auto const formatValid{ format().valid() };
+        auto const dataValid  { data().valid()   };
+
+        // every announced sample has to be there
+        auto const complete{ data().data.size() == data().subchunk2_size };
+
+        return riffValid && formatValid && dataValid && complete;
     }
 
-    DataSubChunk DataSubChunk::copy() const
+    ChunkInfo const * Layout::find( std::array< std::byte, 4 > const & id ) const
     {
-        auto buffer{ std::make_unique< std::byte[] >( subchunk2_size ) };
-        std::copy_n( data.get(), subchunk2_size, buffer.get() );
+        auto const chunk{ std::find_if( index().begin(), index().end(), [ & ]( ChunkInfo const & info ) { return info.id == id; } ) };
+        return chunk == index().end() ? nullptr : &*chunk;
+    }
+
+    std::optional< Layout > parseLayout( std::span< std::byte const > const bytes )
+    {
+        return walk( [ bytes ]( std::uint64_t const offset, std::span< std::byte > const buffer )
+        {
+            if ( offset > bytes.size() || buffer.size() > bytes.size() - offset )
+            {
+                return false;
+            }
+            std::memcpy( buffer.data(), bytes.data() + offset, buffer.size() );
+            return true;
+        } );
+    }
 
-        return DataSubChunk{ subchunk2_id, subchunk2_size, std::move( buffer ) };
+    std::optional< Layout > parseLayout( FILE * const file )
+    {
+        return walk( [ file ]( std::uint64_t const offset, std::span< std::byte > const buffer )
+        {
+            return FileUtils::seek( file, offset ) && std::fread( buffer.data(), 1, buffer.size(), file ) == buffer.size();
+        } );
     }
 
-    File::File( FmtSubChunk const metadata, std::byte * raw_data, std::uint32_t const subchunk2_size )
+    DataSubChunkView File::data() const
     {
-        data.data.reset( raw_data );
-        data.subchunk2_size = subchunk2_size;
+        DataSubChunkView view;
 
-        format = metadata;
+        auto const data_header{ buffer_.get() + sizeof( RiffChunk ) + sizeof( FmtSubChunk ) };
+        std::memcpy( view.subchunk2_id.data(), data_header,                           view.subchunk2_id.size()      );
+        std::memcpy( &view.subchunk2_size,     data_header + view.subchunk2_id.size(), sizeof( view.subchunk2_size ) );
 
+        view.data = { buffer_.get() + header_size, std::min< std::size_t >( view.subchunk2_size, buffer_.size - header_size ) };
+        return view;
+    }
+
+    File::File( FmtSubChunk const & metadata, std::uint32_t const subchunk2_size )
+        : buffer_{ header_size + subchunk2_size }
+    {
         // the subchunk sizes denote the size of the _rest of the current chunk_
         auto const bytes_before_subchunk_size{ 8 };
-        riff.size = static_cast< std::uint32_t >( MagicBytes::RIFF.size() )
-                  + bytes_before_subchunk_size + format.subchunk1_size
-                  + bytes_before_subchunk_size +   data.subchunk2_size;
+        RiffChunk const riff
+        {
+            static_cast< std::uint32_t >( MagicBytes::RIFF.size() )
+                + bytes_before_subchunk_size + metadata.subchunk1_size
+                + bytes_before_subchunk_size + subchunk2_size
+        };
+
+        auto output_iterator{ buffer_.get() };
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &riff           ), sizeof( riff           ), output_iterator );
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &metadata       ), sizeof( metadata       ), output_iterator );
+        output_iterator = std::copy_n( MagicBytes::data.data()                                 , MagicBytes::data.size()   , output_iterator );
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &subchunk2_size ), sizeof( subchunk2_size ), output_iterator );
     }
 
     File::File( std::string_view const filename )
@@ -77,55 +248,30 @@ namespace WAV
             return;
         }
 
-        // TODO: possible optimization - mmap
+        // the headers tell how big the buffer has to be
+        auto const layout{ parseLayout( file_handle.get() ) };
+        if ( !layout )
         {
-            auto       buffer{ std::make_unique< std::byte[] >( sizeof( RiffChunk ) )                };
-            auto const res   { std::fread( buffer.get(), 1, sizeof( RiffChunk ), file_handle.get() ) };
-            if ( res != sizeof( RiffChunk ) )
-            {
-                spdlog::error( "Failed reading riff chunk, read {} bytes, but should have read {} bytes.", res, sizeof( WAV::RiffChunk ) );
-                return;
-            }
-            riff = *reinterpret_cast< RiffChunk * >( buffer.get() );
+            spdlog::error( "Failed parsing the headers of '{}'.", filename );
+            return;
         }
+        if ( layout->data_size > UINT32_MAX - header_size )
         {
-            auto       buffer{ std::make_unique< std::byte[] >( sizeof( FmtSubChunk ) )                };
-            auto const res   { std::fread( buffer.get(), 1, sizeof( FmtSubChunk ), file_handle.get() ) };
-            if ( res != sizeof( FmtSubChunk ) )
-            {
-                spdlog::error( "Failed reading format subchunk, read {} bytes, but should have read {} bytes.", res, sizeof( WAV::FmtSubChunk ) );
-                return;
-            }
-            format = *reinterpret_cast< FmtSubChunk * >( buffer.get() );
+            spdlog::error( "'{}' holds {} bytes of samples, too many to be loaded.", filename, layout->data_size );
+            return;
         }
-        {
-            {
-                // reading only the id and datasize
-                std::array< std::byte, 8 > buffer;
-                auto const res{ std::fread( buffer.data(), 1, buffer.size(), file_handle.get() ) };
-                if ( res != buffer.size() )
-                {
-                    spdlog::error( "Failed reading data subchunk info, read {} bytes, but should have read {} bytes.", res, buffer.size() );
-                    return;
-                }
+        auto const subchunk2_size{ static_cast< std::uint32_t >( layout->data_size ) };
 
-                // copy magic bytes
-                std::copy_n( buffer.data(), data.subchunk2_id.size(), data.subchunk2_id.data() );
+        // the samples go behind the normalized headers
+        File loaded{ layout->format, subchunk2_size };
 
-                // copy the size of the raw data
-                data.subchunk2_size = *reinterpret_cast< std::uint32_t * >( buffer.data() + 4 );
-            }
-            {
-                // reading the raw samples
-                auto       buffer{ std::make_unique< std::byte[] >( data.subchunk2_size )                };
-                auto const res   { std::fread( buffer.get(), 1, data.subchunk2_size, file_handle.get() ) };
-                if ( res != data.subchunk2_size )
-                {
-                    spdlog::error( "Failed reading raw data chunk, read {} bytes, but should have read {} bytes.", res, data.subchunk2_size );
-                }
-                data.data.swap( buffer );
-            }
+        auto const res{ FileUtils::seek( file_handle.get(), layout->data_offset ) ? std::fread( loaded.samples().data(), 1, subchunk2_size, file_handle.get() ) : 0 };
+        if ( res != subchunk2_size )
+        {
+            spdlog::error( "Failed reading raw data chunk, read {} bytes, but should have read {} bytes.", res, subchunk2_size );
+            loaded.buffer_.size = header_size + res;
         }
+        buffer_ = std::move( loaded.buffer_ );
 
         if ( !valid() )
         {
@@ -142,11 +288,11 @@ namespace WAV
             return false;
         }
 
-        auto const buffer{ copyInMemory() };
-        auto const res{ std::fwrite( buffer.get(), 1, buffer.size, file_handle.get() ) };
-        if ( res != buffer.size )
+        // the buffer already is the file, so it goes out in one go
+        auto const res{ std::fwrite( buffer_.get(), 1, buffer_.size, file_handle.get() ) };
+        if ( res != buffer_.size )
         {
-            spdlog::error( "Writing to {} failed, written {} bytes, but should have written {}.", path, res, buffer.size );
+            spdlog::error( "Writing to {} failed, written {} bytes, but should have written {}.", path, res, buffer_.size );
             return false;
         }
 
@@ -154,20 +300,258 @@ namespace WAV
         return true;
     }
 
-    // TODO: this is unnecessary overhead, we should construct WAV::File serialized on heap,
-    // not have it both partially stack and heap based
-    Utils::OwningBuffer File::copyInMemory() const
+    MappedFile::MappedFile( std::string_view const filename )
+        : region_{ filename }
+    {
+        if ( !region_.valid() )
+        {
+            return;
+        }
+
+        auto const bytes { region_.bytes() };
+        auto const parsed{ parseLayout( bytes ) };
+        if ( !parsed )
+        {
+            spdlog::error( "Failed parsing the headers of '{}'.", filename );
+            return;
+        }
+        layout = *parsed;
+        format = layout.format;
+
+        auto const bytes_available{ bytes.size() - std::min< std::uint64_t >( layout.data_offset, bytes.size() ) };
+        if ( layout.data_size > bytes_available )
+        {
+            spdlog::error( "Data subchunk of '{}' claims {} bytes, but only {} are available.", filename, layout.data_size, bytes_available );
+        }
+        data.subchunk2_size = static_cast< std::uint32_t >( std::min< std::uint64_t >( layout.data_size, UINT32_MAX ) );
+        data.data           = bytes.subspan( bytes.size() - bytes_available, static_cast< std::size_t >( std::min< std::uint64_t >( layout.data_size, bytes_available ) ) );
+
+        region_.advise( layout.data_offset, data.data.size(), FileUtils::AccessHint::Sequential );
+        region_.advise( layout.data_offset, data.data.size(), FileUtils::AccessHint::WillNeed   );
+
+        if ( !valid() )
+        {
+            spdlog::error( "Mapped file from '{}' is not valid.", filename );
+        }
+    }
+
+    bool MappedFile::valid() const
+    {
+        return region_.valid()
+            && format.valid()
+            && data.valid()
+            && data.data.size() == layout.data_size;
+    }
+
+    FileReader::FileReader( std::string_view const filename )
+        : file_{ FileUtils::openFile( filename, FileUtils::FileOpenMode::ReadBinary ) }
+    {
+        if ( !file_ )
+        {
+            return;
+        }
+
+        auto const parsed{ parseLayout( file_.get() ) };
+        if ( !parsed || !FileUtils::seek( file_.get(), parsed->data_offset ) )
+        {
+            spdlog::error( "Failed parsing the headers of '{}'.", filename );
+            file_.reset();
+            return;
+        }
+        layout           = *parsed;
+        format           = layout.format;
+        data_size        = layout.data_size;
+        bytes_remaining_ = data_size;
+
+        if ( !valid() )
+        {
+            spdlog::error( "Header of '{}' is not valid.", filename );
+        }
+    }
+
+    bool FileReader::valid() const
+    {
+        return file_
+            && format.valid();
+    }
+
+    std::size_t FileReader::read( std::span< std::byte > const buffer )
+    {
+        if ( !file_ || bytes_remaining_ == 0 )
+        {
+            return 0;
+        }
+
+        auto const bytes_to_read{ std::min< std::size_t >( buffer.size(), bytes_remaining_ ) };
+        auto const res          { std::fread( buffer.data(), 1, bytes_to_read, file_.get() ) };
+        if ( res != bytes_to_read )
+        {
+            spdlog::error( "Failed reading raw data, read {} bytes, but should have read {} bytes.", res, bytes_to_read );
+            // the file got truncated in the meantime, nothing more to read
+            bytes_remaining_ = 0;
+            return res;
+        }
+
+        bytes_remaining_ -= res;
+        return res;
+    }
+
+    bool FileReader::seek( std::uint64_t const offset )
+    {
+        if ( !file_ || offset > data_size )
+        {
+            return false;
+        }
+
+        if ( !FileUtils::seek( file_.get(), layout.data_offset + offset ) )
+        {
+            spdlog::error( "Seeking to {} bytes into the samples failed.", offset );
+            return false;
+        }
+
+        bytes_remaining_ = data_size - offset;
+        return true;
+    }
+
+    FileWriter::FileWriter( std::string_view const filename, FmtSubChunk const & format, std::uint64_t const subchunk2_size )
+        : file_{ FileUtils::openFile( filename, FileUtils::FileOpenMode::WriteBinary ) }, subchunk2_size_{ subchunk2_size }, header_size_{ headerSize( subchunk2_size ) }
+    {
+        if ( !file_ )
+        {
+            spdlog::error( "Cannot open output file '{}' for writing.", filename );
+            return;
+        }
+
+        // the subchunk sizes denote the size of the _rest of the current chunk_,
+        // in an RF64 file they're all ones and the actual sizes are in the ds64 chunk
+        auto const bytes_before_subchunk_size{ 8 };
+        auto const rf64                      { needsRf64( subchunk2_size ) };
+        std::uint64_t const riff_size        { header_size_ - bytes_before_subchunk_size + subchunk2_size };
+        std::uint32_t const data_size        { rf64 ? UINT32_MAX : static_cast< std::uint32_t >( subchunk2_size ) };
+
+        RiffChunk riff{ rf64 ? UINT32_MAX : static_cast< std::uint32_t >( riff_size ) };
+        if ( rf64 )
+        {
+            riff.id = MagicBytes::RF64;
+        }
+
+        std::array< std::byte, rf64_header_size > header;
+
+        auto output_iterator{ header.data() };
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &riff ), sizeof( riff ), output_iterator );
+        if ( rf64 )
+        {
+            std::uint32_t const chunk_size  { ds64_size };
+            std::uint64_t const sample_count{ subchunk2_size / std::max< std::uint16_t >( format.block_align, 1 ) };
+            std::uint32_t const table_length{};
+
+            output_iterator = std::copy_n( MagicBytes::ds64.data()                               , MagicBytes::ds64.size() , output_iterator );
+            output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &chunk_size     ), sizeof( chunk_size     ), output_iterator );
+            output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &riff_size      ), sizeof( riff_size      ), output_iterator );
+            output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &subchunk2_size ), sizeof( subchunk2_size ), output_iterator );
+            output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &sample_count   ), sizeof( sample_count   ), output_iterator );
+            output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &table_length   ), sizeof( table_length   ), output_iterator );
+        }
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &format    ), sizeof( format    ), output_iterator );
+        output_iterator = std::copy_n( MagicBytes::data.data()                            , MagicBytes::data.size(), output_iterator );
+        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &data_size ), sizeof( data_size ), output_iterator );
+
+#ifdef __linux__
+        // reserving the space up front keeps the file from fragmenting while it trickles in,
+        // the size is kept so an interrupted download shows how far it got.
+        // Not all file systems support it, so a failure is fine
+        if ( ::fallocate( ::fileno( file_.get() ), FALLOC_FL_KEEP_SIZE, 0, static_cast< off_t >( header_size_ + subchunk2_size ) ) != 0 )
+        {
+            spdlog::debug( "Could not preallocate '{}'", filename );
+        }
+#endif
+
+        // flushed right away, samples may be written behind the back of the stream with `writeAt`
+        if ( std::fwrite( header.data(), 1, header_size_, file_.get() ) != header_size_ || std::fflush( file_.get() ) != 0 )
+        {
+            spdlog::error( "Writing the header of '{}' failed.", filename );
+            file_.reset();
+        }
+    }
+
+    FileWriter::FileWriter( std::string_view const filename, std::uint64_t const subchunk2_size, std::uint64_t const bytes_written )
+        : file_{ FileUtils::openFile( filename, FileUtils::FileOpenMode::UpdateBinary ) }, subchunk2_size_{ subchunk2_size }, header_size_{ headerSize( subchunk2_size ) }, bytes_written_{ bytes_written }
+    {
+        if ( !file_ )
+        {
+            spdlog::error( "Cannot open output file '{}' for resuming.", filename );
+            return;
+        }
+
+        // anything past the samples that made it is overwritten
+        if ( bytes_written_ > subchunk2_size_ || !FileUtils::seek( file_.get(), header_size_ + bytes_written_ ) )
+        {
+            spdlog::error( "Cannot resume '{}' after {} bytes of samples.", filename, bytes_written );
+            file_.reset();
+        }
+    }
+
+    bool FileWriter::write( std::span< std::byte const > const samples )
+    {
+        if ( !file_ )
+        {
+            return false;
+        }
+
+        if ( samples.size() > subchunk2_size_ - bytes_written_ )
+        {
+            spdlog::error( "Received {} bytes more than announced.", samples.size() - ( subchunk2_size_ - bytes_written_ ) );
+            return false;
+        }
+
+        auto const res{ std::fwrite( samples.data(), 1, samples.size(), file_.get() ) };
+        bytes_written_ += res;
+        if ( res != samples.size() )
+        {
+            spdlog::error( "Writing samples failed, written {} bytes, but should have written {}.", res, samples.size() );
+            return false;
+        }
+        return true;
+    }
+
+    bool FileWriter::writeAt( std::uint64_t const offset, std::span< std::byte const > const samples )
     {
-        Utils::OwningBuffer buffer{ size_in_bytes() };
+        if ( !file_ )
+        {
+            return false;
+        }
+
+        if ( offset > subchunk2_size_ || samples.size() > subchunk2_size_ - offset )
+        {
+            spdlog::error( "Samples at {} to {} don't fit into {} bytes.", offset, offset + samples.size(), subchunk2_size_ );
+            return false;
+        }
+
+        if ( !FileUtils::writeAt( file_.get(), header_size_ + offset, samples ) )
+        {
+            return false;
+        }
 
-        auto output_iterator{ buffer.get() };
+        bytes_written_ += samples.size();
+        return true;
+    }
 
-        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &riff           ), sizeof( riff   )                                           , output_iterator );
-        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &format         ), sizeof( format )                                           , output_iterator );
-        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( &data           ), sizeof( data.subchunk2_id ) + sizeof( data.subchunk2_size ), output_iterator );
-        output_iterator = std::copy_n( reinterpret_cast< std::byte const * >( data.data.get() ), data.subchunk2_size                                        , output_iterator );
+    bool FileWriter::finish()
+    {
+        if ( !file_ )
+        {
+            return false;
+        }
+
+        auto const flushed{ std::fflush( file_.get() ) == 0 };
+        file_.reset();
 
-        return buffer;
+        if ( bytes_written_ != subchunk2_size_ )
+        {
+            spdlog::error( "Written {} bytes of samples, but raw data size is {}", bytes_written_.load(), subchunk2_size_ );
+            return false;
+        }
+        return flushed;
     }
 
 } // namespace WAV
@@ -1,11 +1,48 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <numbers>
+#include <numeric>
+#include <random>
+#include <thread>
 
+#include "audio_client.hpp"
+#include "audio_server.hpp"
+#include "broadcaster.hpp"
+#include "catalog.hpp"
+#include "checksums.hpp"
+#include "chunk_sizer.hpp"
+#include "codec.hpp"
+#include "file_cache.hpp"
+#include "metrics.hpp"
+#include "pack_store.hpp"
+#include "peaks.hpp"
+#include "playback.hpp"
+#include "read_ahead.hpp"
+#include "ring_buffer.hpp"
+#include "timer_wheel.hpp"
+#include "transcoder.hpp"
 #include "wav.hpp"
 #include "src/resources.hpp"
 
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 inline static std::filesystem::path const resources{ RESOURCES_PATH };
 
+// A path in the temporary directory that's only used by this run of the tests, so runs in parallel don't collide
+[[ nodiscard ]] static std::filesystem::path testPath( std::string_view const name )
+{
+    static std::string const run{ fmt::format( "{:08x}", std::random_device{}() ) };
+    return std::filesystem::temp_directory_path() / fmt::format( "teleaudio_{}_{}", run, name );
+}
+
 TEST( TeleaudioTest, ParseNonExistantFile )
 {
     WAV::File const f{ "this_does_not_exist.wav" };
@@ -25,7 +62,7 @@ TEST( TeleaudioTest, CompareParsedInMemoryFileWithFileOnDisk )
     auto const filepath{ resources / "AMAZING_clean.wav" };
 
     WAV::File const wav_file{ filepath.string() };
-    auto      const copy{ wav_file.copyInMemory() };
+    auto      const in_memory{ wav_file.bytes() };
 
     auto const file_on_disk{ FileUtils::openFile( filepath.string(), FileUtils::FileOpenMode::ReadBinary ) };
 
@@ -35,10 +72,2171 @@ TEST( TeleaudioTest, CompareParsedInMemoryFileWithFileOnDisk )
 
     ASSERT_EQ( filesize, std::fread( buffer.get(), 1, filesize, file_on_disk.get() ) );
 
-    ASSERT_EQ( 0, std::memcmp( copy.data.get(), buffer.get(), filesize ) );
+    ASSERT_EQ( filesize, in_memory.size() );
+    ASSERT_EQ( 0, std::memcmp( in_memory.data(), buffer.get(), filesize ) );
+}
+
+TEST( TeleaudioTest, MapNonExistantFile )
+{
+    WAV::MappedFile const f{ "this_does_not_exist.wav" };
+
+    ASSERT_FALSE( f.valid() );
+}
+
+TEST( TeleaudioTest, CompareMappedFileWithLoadedFile )
+{
+    auto const filepath{ resources / "AMAZING_clean.wav" };
+
+    WAV::File       const loaded{ filepath.string() };
+    WAV::MappedFile const mapped{ filepath.string() };
+
+    ASSERT_TRUE( mapped.valid() );
+    ASSERT_EQ( loaded.data().subchunk2_size, mapped.data.data.size() );
+    ASSERT_EQ( loaded.format().sample_rate,  mapped.format.sample_rate );
+
+    ASSERT_EQ( 0, std::memcmp( loaded.data().data.data(), mapped.data.data.data(), mapped.data.data.size() ) );
+}
+
+TEST( TeleaudioTest, ReadFileInChunks )
+{
+    auto const filepath{ resources / "AMAZING_clean.wav" };
+
+    WAV::File       const loaded{ filepath.string() };
+    WAV::FileReader       reader{ filepath.string() };
+
+    ASSERT_TRUE( reader.valid() );
+    ASSERT_EQ( loaded.data().subchunk2_size, reader.data_size );
+
+    std::vector< std::byte > streamed;
+    std::array< std::byte, 1000 > chunk;
+    while ( auto const bytes_read{ reader.read( chunk ) } )
+    {
+        streamed.insert( streamed.end(), chunk.begin(), chunk.begin() + static_cast< std::ptrdiff_t >( bytes_read ) );
+    }
+
+    ASSERT_EQ( 0u, reader.bytes_remaining() );
+    ASSERT_EQ( loaded.data().subchunk2_size, streamed.size() );
+    ASSERT_EQ( 0, std::memcmp( loaded.data().data.data(), streamed.data(), streamed.size() ) );
+}
+
+TEST( TeleaudioTest, ParseChunksInAnyOrder )
+{
+    auto const append{ []( std::vector< std::byte > & bytes, auto const value )
+    {
+        auto const * const raw{ reinterpret_cast< std::byte const * >( &value ) };
+        bytes.insert( bytes.end(), raw, raw + sizeof( value ) );
+    } };
+    auto const append_chunk{ [ & ]( std::vector< std::byte > & bytes, char const ( & id )[ 5 ], std::uint32_t const size )
+    {
+        bytes.insert( bytes.end(), reinterpret_cast< std::byte const * >( id ), reinterpret_cast< std::byte const * >( id ) + 4 );
+        append( bytes, size );
+    } };
+
+    // 24 bit samples in 32 bit containers, as WAVE_FORMAT_EXTENSIBLE, between chunks the parser doesn't know
+    std::vector< std::byte > samples( 6 * 8 );
+    std::iota( reinterpret_cast< std::uint8_t * >( samples.data() ), reinterpret_cast< std::uint8_t * >( samples.data() + samples.size() ), std::uint8_t{ 1 } );
+
+    std::vector< std::byte > bytes;
+    append_chunk( bytes, "RIFF", 0 );
+    append_chunk( bytes, "WAVE", 0 );
+    bytes.resize( 12 );
+    append_chunk( bytes, "JUNK", 3 );
+    bytes.resize( bytes.size() + 4 ); // padded to an even size
+    append_chunk( bytes, "fmt ", 40 );
+    append( bytes, WAV::format_extensible );
+    append( bytes, std::uint16_t{ 2 } );
+    append( bytes, std::uint32_t{ 48'000 } );
+    append( bytes, std::uint32_t{ 48'000 * 8 } );
+    append( bytes, std::uint16_t{ 8 } );
+    append( bytes, std::uint16_t{ 32 } );
+    append( bytes, std::uint16_t{ 22 } );
+    append( bytes, std::uint16_t{ 24 } );
+    append( bytes, std::uint32_t{ 3 } );
+    append( bytes, std::uint16_t{ 1 } ); // PCM
+    bytes.resize( bytes.size() + 14 );
+    append_chunk( bytes, "fact", 4 );
+    append( bytes, std::uint32_t{ 6 } );
+    append_chunk( bytes, "LIST", 10 );
+    bytes.resize( bytes.size() + 10 );
+    append_chunk( bytes, "data", static_cast< std::uint32_t >( samples.size() ) );
+    auto const data_offset{ bytes.size() };
+    bytes.insert( bytes.end(), samples.begin(), samples.end() );
+    append_chunk( bytes, "LIST", 2 );
+    bytes.resize( bytes.size() + 2 );
+
+    auto const riff_size{ static_cast< std::uint32_t >( bytes.size() - 8 ) };
+    std::memcpy( bytes.data() + 4, &riff_size, sizeof( riff_size ) );
+
+    auto const layout{ WAV::parseLayout( bytes ) };
+    ASSERT_TRUE( layout.has_value() );
+    ASSERT_TRUE( layout->format.valid() );
+    ASSERT_FALSE( layout->rf64 );
+    ASSERT_EQ( 1, layout->format.audio_format );
+    ASSERT_EQ( 32, layout->format.bits_per_sample );
+    ASSERT_EQ( 24, layout->valid_bits_per_sample );
+    ASSERT_EQ( 3u, layout->channel_mask );
+    ASSERT_EQ( data_offset, layout->data_offset );
+    ASSERT_EQ( samples.size(), layout->data_size );
+    ASSERT_EQ( 6u, layout->index().size() );
+    ASSERT_NE( nullptr, layout->find( { std::byte{ 'f' }, std::byte{ 'a' }, std::byte{ 'c' }, std::byte{ 't' } } ) );
+    ASSERT_EQ( bytes.size() - 2, layout->index().back().offset );
+
+    // the readers stream the samples from where they are, the loaded file is normalized
+    auto const path{ testPath( "chunks.wav" ) };
+    {
+        auto const file{ FileUtils::openFile( path.string(), FileUtils::FileOpenMode::WriteBinary ) };
+        ASSERT_EQ( bytes.size(), std::fwrite( bytes.data(), 1, bytes.size(), file.get() ) );
+    }
+
+    WAV::FileReader reader{ path.string() };
+    ASSERT_TRUE( reader.valid() );
+    ASSERT_TRUE( reader.seek( 8 ) );
+    std::array< std::byte, 64 > read;
+    ASSERT_EQ( samples.size() - 8, reader.read( read ) );
+    ASSERT_EQ( 0, std::memcmp( samples.data() + 8, read.data(), samples.size() - 8 ) );
+
+    WAV::MappedFile const mapped{ path.string() };
+    ASSERT_TRUE( mapped.valid() );
+    ASSERT_EQ( 0, std::memcmp( samples.data(), mapped.data.data.data(), samples.size() ) );
+
+    WAV::File const loaded{ path.string() };
+    ASSERT_TRUE( loaded.valid() );
+    ASSERT_EQ( 16u, loaded.format().subchunk1_size );
+    ASSERT_EQ( 0, std::memcmp( samples.data(), loaded.data().data.data(), samples.size() ) );
+    std::filesystem::remove( path );
+
+    // RF64 takes the sizes from ds64, they may not fit into 32 bits
+    std::vector< std::byte > rf64;
+    append_chunk( rf64, "RF64", UINT32_MAX );
+    append_chunk( rf64, "WAVE", 0 );
+    rf64.resize( 12 );
+    append_chunk( rf64, "ds64", 28 );
+    append( rf64, std::uint64_t{ 6'000'000'100 } );
+    append( rf64, std::uint64_t{ 6'000'000'000 } );
+    append( rf64, std::uint64_t{ 1'500'000'000 } );
+    append( rf64, std::uint32_t{ 0 } );
+    append_chunk( rf64, "fmt ", 16 );
+    append( rf64, std::uint16_t{ 1 } );
+    append( rf64, std::uint16_t{ 2 } );
+    append( rf64, std::uint32_t{ 48'000 } );
+    append( rf64, std::uint32_t{ 48'000 * 6 } );
+    append( rf64, std::uint16_t{ 6 } );
+    append( rf64, std::uint16_t{ 24 } );
+    append_chunk( rf64, "data", UINT32_MAX );
+
+    auto const large{ WAV::parseLayout( rf64 ) };
+    ASSERT_TRUE( large.has_value() );
+    ASSERT_TRUE( large->rf64 );
+    ASSERT_EQ( 6'000'000'000u, large->data_size );
+    ASSERT_EQ( rf64.size(), large->data_offset );
+    ASSERT_TRUE( large->format.valid() );
+
+    // no data chunk at all
+    ASSERT_FALSE( WAV::parseLayout( std::span{ bytes }.first( data_offset - 8 ) ).has_value() );
+}
+
+TEST( TeleaudioTest, WriteFileInChunks )
+{
+    auto const source{ resources / "AMAZING_clean.wav" };
+    auto const target{ testPath( "written.wav" ) };
+
+    WAV::File const loaded{ source.string() };
+    {
+        WAV::FileWriter writer{ target.string(), loaded.format(), loaded.data().subchunk2_size };
+        ASSERT_TRUE( writer.valid() );
+
+        auto const samples{ loaded.data().data };
+        for ( std::size_t offset{}; offset < samples.size(); offset += 1000 )
+        {
+            ASSERT_TRUE( writer.write( samples.subspan( offset, std::min< std::size_t >( 1000, samples.size() - offset ) ) ) );
+        }
+        // nothing fits past the announced size
+        ASSERT_FALSE( writer.write( samples.first( 1 ) ) );
+        ASSERT_TRUE( writer.finish() );
+    }
+
+    WAV::File const written{ target.string() };
+    ASSERT_TRUE( written.valid() );
+    ASSERT_EQ( loaded.data().subchunk2_size, written.data().subchunk2_size );
+    ASSERT_EQ( 0, std::memcmp( loaded.data().data.data(), written.data().data.data(), loaded.data().subchunk2_size ) );
+
+    std::filesystem::remove( target );
+}
+
+TEST( TeleaudioTest, CacheSharesLoadedFiles )
+{
+    Teleaudio::FileCache cache{ 1024 * 1024 };
+
+    auto const before{ Teleaudio::Metrics::collect() };
+    auto const first { cache.get( resources / "AMAZING_clean.wav" ) };
+    auto const second{ cache.get( resources / "AMAZING_clean.wav" ) };
+    auto const after { Teleaudio::Metrics::collect() };
+
+    ASSERT_NE( nullptr, first );
+    ASSERT_EQ( first.get(), second.get() );
+
+    auto const statistics{ cache.statistics() };
+    ASSERT_EQ( 1u, statistics.hits   );
+    ASSERT_EQ( 1u, statistics.misses );
+    ASSERT_EQ( std::filesystem::file_size( resources / "AMAZING_clean.wav" ), statistics.bytes_used );
+
+    // and exported with the other metrics
+    ASSERT_EQ( 1, after.counter( Teleaudio::Metrics::Counter::FileCacheHits   ) - before.counter( Teleaudio::Metrics::Counter::FileCacheHits   ) );
+    ASSERT_EQ( 1, after.counter( Teleaudio::Metrics::Counter::FileCacheMisses ) - before.counter( Teleaudio::Metrics::Counter::FileCacheMisses ) );
+}
+
+TEST( TeleaudioTest, CacheEvictsLeastRecentlyUsed )
+{
+    auto const amazing{ resources / "AMAZING_clean.wav" };
+    auto const boring { resources / "BORING_clean.wav"  };
+
+    // room for only one of them
+    Teleaudio::FileCache cache{ std::filesystem::file_size( amazing ) };
+
+    auto const held{ cache.get( amazing ) };
+    ASSERT_NE( nullptr, cache.get( boring ) );
+
+    auto const statistics{ cache.statistics() };
+    ASSERT_EQ( 1u, statistics.evictions );
+    ASSERT_EQ( std::filesystem::file_size( boring ), statistics.bytes_used );
+
+    // evicted, but still usable by whoever holds it
+    ASSERT_TRUE( held->valid() );
+}
+
+TEST( TeleaudioTest, CatalogReadsHeaders )
+{
+    Teleaudio::Catalog catalog{ resources };
+
+    auto const entries{ catalog.list( "." ) };
+    ASSERT_TRUE( entries.has_value() );
+    ASSERT_EQ( 3u, entries->size() );
+    ASSERT_EQ( "AMAZING_clean.wav", entries->front().name );
+
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const & amazing{ entries->front() };
+    ASSERT_TRUE( amazing.valid );
+    ASSERT_EQ( std::filesystem::file_size( resources / "AMAZING_clean.wav" ), amazing.size );
+    ASSERT_EQ( original.format().sample_rate, amazing.format.sample_rate );
+    ASSERT_EQ( original.data().subchunk2_size, amazing.raw_data_size );
+
+    ASSERT_TRUE ( catalog.stat( "AMAZING_clean.wav" ).has_value() );
+    ASSERT_FALSE( catalog.stat( "../clean_wavs/AMAZING_clean.wav" ).has_value() );
+    ASSERT_FALSE( catalog.stat( "does_not_exist.wav" ).has_value() );
+    ASSERT_FALSE( catalog.list( "no_such_directory" ).has_value() );
+}
+
+#ifdef __linux__
+TEST( TeleaudioTest, CatalogFollowsTheStorage )
+{
+    auto const storage{ testPath( "catalog" ) };
+    std::filesystem::remove_all( storage );
+    std::filesystem::create_directories( storage );
+
+    Teleaudio::Catalog catalog{ storage };
+
+    // the changes arrive on the watcher thread
+    auto const eventually{ [ & ]( std::string_view const directory, std::size_t const files )
+    {
+        for ( int i{}; i < 200; ++i )
+        {
+            if ( auto const entries{ catalog.list( directory ) }; entries.has_value() && entries->size() == files )
+            {
+                return true;
+            }
+            std::this_thread::sleep_for( std::chrono::milliseconds{ 10 } );
+        }
+        return false;
+    } };
+
+    std::filesystem::copy_file( resources / "AMAZING_clean.wav", storage / "AMAZING_clean.wav" );
+    ASSERT_TRUE( eventually( "", 1 ) );
+
+    std::filesystem::create_directories( storage / "nested" );
+    std::filesystem::copy_file( resources / "BORING_clean.wav", storage / "nested" / "BORING_clean.wav" );
+    ASSERT_TRUE( eventually( "nested", 1 ) );
+    ASSERT_EQ( 2u, catalog.size() );
+
+    std::filesystem::remove( storage / "AMAZING_clean.wav" );
+    ASSERT_TRUE( eventually( "", 0 ) );
+
+    std::filesystem::remove_all( storage );
+}
+#endif
+
+TEST( TeleaudioTest, AdaptiveChunksGrowWhileThroughputHolds )
+{
+    using namespace std::chrono_literals;
+
+    Teleaudio::ChunkSizer sizer{ 1024, 8 * 1024, true };
+
+    // constant latency per write, so bigger chunks mean more throughput
+    for ( int i{}; i < 100; ++i )
+    {
+        sizer.record( sizer.current(), 1ms );
+    }
+    ASSERT_EQ( 8u * 1024, sizer.current() );
+
+    Teleaudio::ChunkSizer fixed{ 1024, 8 * 1024, false };
+    for ( int i{}; i < 100; ++i )
+    {
+        fixed.record( fixed.current(), 1ms );
+    }
+    ASSERT_EQ( 1024u, fixed.current() );
+}
+
+TEST( TeleaudioTest, AdaptiveChunksSettleWhenThroughputDrops )
+{
+    using namespace std::chrono_literals;
+
+    Teleaudio::ChunkSizer sizer{ 1024, 64 * 1024, true };
+
+    // latency grows faster than the chunks past 4 KiB
+    for ( int i{}; i < 200; ++i )
+    {
+        auto const chunk{ sizer.current() };
+        sizer.record( chunk, chunk <= 4096 ? 1ms : 10ms );
+    }
+    ASSERT_EQ( 4096u, sizer.current() );
+}
+
+TEST( TeleaudioTest, CodecRoundTripIsBitExact )
+{
+    std::mt19937 random{ 1989 };
+
+    for ( std::uint16_t const bits : std::initializer_list< std::uint16_t >{ 8, 16, 24, 32 } )
+    {
+        for ( std::uint16_t const channels : std::initializer_list< std::uint16_t >{ 1, 2, 3 } )
+        {
+            WAV::FmtSubChunk const format
+            {
+                .subchunk1_size  = 16,
+                .audio_format    = 1,
+                .num_channels    = channels,
+                .sample_rate     = 44100,
+                .byte_rate       = 44100u * channels * bits / 8,
+                .block_align     = static_cast< std::uint16_t >( channels * bits / 8 ),
+                .bits_per_sample = bits
+            };
+            ASSERT_TRUE( Teleaudio::DeltaRiceCodec::supports( format ) );
+            Teleaudio::DeltaRiceCodec const codec{ format };
+
+            // a tone, noise at full scale and a partial frame at the end
+            std::vector< std::byte > samples( 1000u * format.block_align + format.block_align - 1 );
+            for ( std::size_t i{}; i < samples.size(); ++i )
+            {
+                auto const tone{ std::sin( static_cast< double >( i / format.block_align ) * 0.05 ) * 100.0 };
+                samples[ i ] = i < samples.size() / 2 ? static_cast< std::byte >( static_cast< int >( tone ) >> ( 8 * ( i % ( bits / 8 ) ) ) )
+                                                      : static_cast< std::byte >( random() );
+            }
+
+            for ( auto const chunk : { std::span< std::byte const >{ samples }, std::span< std::byte const >{ samples }.first( samples.size() / 2 ), std::span< std::byte const >{} } )
+            {
+                auto const encoded{ codec.encode( chunk ) };
+
+                std::vector< std::byte > decoded;
+                ASSERT_TRUE( codec.decode( encoded, decoded ) );
+                ASSERT_EQ( chunk.size(), decoded.size() );
+                ASSERT_TRUE( std::equal( chunk.begin(), chunk.end(), decoded.begin() ) );
+
+                if ( !chunk.empty() )
+                {
+                    std::vector< std::byte > rejected;
+                    ASSERT_FALSE( codec.decode( std::span{ encoded }.first( encoded.size() - 1 ), rejected ) );
+                }
+            }
+        }
+    }
+}
+
+TEST( TeleaudioTest, CodecShrinksRecordedSpeech )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    ASSERT_TRUE( Teleaudio::DeltaRiceCodec::supports( original.format() ) );
+
+    Teleaudio::DeltaRiceCodec const codec{ original.format() };
+    auto const encoded{ codec.encode( original.data().data ) };
+    ASSERT_LT( encoded.size(), original.data().data.size() * 3 / 4 );
+
+    std::vector< std::byte > decoded;
+    ASSERT_TRUE( codec.decode( encoded, decoded ) );
+    ASSERT_TRUE( std::equal( decoded.begin(), decoded.end(), original.data().data.begin(), original.data().data.end() ) );
+}
+
+namespace
+{
+    [[ nodiscard ]] WAV::FmtSubChunk pcmFormat( std::uint32_t const sample_rate, std::uint16_t const bits, std::uint16_t const channels )
+    {
+        return
+        {
+            .subchunk1_size  = 16,
+            .audio_format    = 1,
+            .num_channels    = channels,
+            .sample_rate     = sample_rate,
+            .byte_rate       = sample_rate * channels * bits / 8,
+            .block_align     = static_cast< std::uint16_t >( channels * bits / 8 ),
+            .bits_per_sample = bits
+        };
+    }
+
+    // A 16 bit tone at half the full scale
+    [[ nodiscard ]] std::vector< std::byte > tone( std::size_t const frames, std::uint16_t const channels, double const cycles_per_frame )
+    {
+        std::vector< std::byte > samples( frames * channels * 2 );
+        for ( std::size_t frame{}; frame < frames; ++frame )
+        {
+            for ( std::size_t channel{}; channel < channels; ++channel )
+            {
+                auto const value{ static_cast< std::int16_t >( std::lround( 16384 * std::sin( 2 * std::numbers::pi * cycles_per_frame * static_cast< double >( frame ) ) ) ) };
+                std::memcpy( samples.data() + ( frame * channels + channel ) * 2, &value, 2 );
+            }
+        }
+        return samples;
+    }
+
+    [[ nodiscard ]] std::vector< std::byte > transcode( Teleaudio::Transcoder & transcoder, std::span< std::byte const > const input, std::size_t const chunk, std::size_t const block_align )
+    {
+        std::vector< std::byte > output;
+        for ( std::size_t offset{}; offset < input.size(); offset += chunk * block_align )
+        {
+            transcoder.push( input.subspan( offset, std::min( chunk * block_align, input.size() - offset ) ), output );
+        }
+        transcoder.finish( output );
+        return output;
+    }
+}
+
+TEST( TeleaudioTest, TranscoderConvertsSampleTypes )
+{
+    auto const source{ pcmFormat( 44100, 16, 2 ) };
+    auto const input { tone( 1001, 2, 0.01 ) };
+
+    // 16 bit samples fit into 24 and 32 bits and floats without losing anything
+    for ( auto const & [ bits, floating_point ] : { std::pair{ 24, false }, std::pair{ 32, false }, std::pair{ 0, true } } )
+    {
+        auto const wider{ Teleaudio::Transcoder::outputFormat( source, 0, static_cast< std::uint16_t >( bits ), 0, floating_point ) };
+        ASSERT_TRUE( wider.has_value() );
+        ASSERT_TRUE( wider->valid() );
+
+        Teleaudio::Transcoder there{ source, *wider  };
+        Teleaudio::Transcoder back { *wider, source  };
+        auto const converted{ transcode( there, input, 100, source.block_align ) };
+        ASSERT_EQ( input.size() / 2 * wider->bits_per_sample / 8, converted.size() );
+
+        auto const restored{ transcode( back, converted, 100, wider->block_align ) };
+        ASSERT_EQ( input, restored );
+    }
+
+    // stereo is averaged into mono and mono copied into both channels
+    auto const mono{ Teleaudio::Transcoder::outputFormat( source, 0, 0, 1, false ) };
+    ASSERT_TRUE( mono.has_value() );
+    Teleaudio::Transcoder down{ source, *mono };
+    Teleaudio::Transcoder up  { *mono, source };
+    ASSERT_EQ( input, transcode( up, transcode( down, input, 64, source.block_align ), 64, mono->block_align ) );
+
+    // channels are mixed by their place in the frame, what's left over of a downmix goes into every output
+    auto const samples_of{ []( std::initializer_list< std::int16_t > const values )
+    {
+        std::vector< std::byte > bytes( values.size() * sizeof( std::int16_t ) );
+        std::memcpy( bytes.data(), std::data( values ), bytes.size() );
+        return bytes;
+    } };
+    auto const three{ pcmFormat( 44100, 16, 3 ) };
+    auto const four { pcmFormat( 44100, 16, 4 ) };
+    Teleaudio::Transcoder down_mix{ three, source };
+    Teleaudio::Transcoder up_mix  { source, four };
+    ASSERT_EQ( samples_of( { 200, 250, -200, -250 } ), transcode( down_mix, samples_of( { 100, 200, 300, -100, -200, -300 } ), 64, three.block_align ) );
+    ASSERT_EQ( samples_of( { 100, -200, 100, -200 } ), transcode( up_mix, samples_of( { 100, -200 } ), 64, source.block_align ) );
+
+    ASSERT_FALSE( Teleaudio::Transcoder::outputFormat( source, 0, 12, 0, false ).has_value() );
+    ASSERT_FALSE( Teleaudio::Transcoder::outputFormat( source, 0, 16, 0, true  ).has_value() );
+}
+
+TEST( TeleaudioTest, TranscoderKernelsMatchTheScalarConversion )
+{
+    std::mt19937 random{ 7 };
+    for ( std::uint16_t const bits : { std::uint16_t{ 8 }, std::uint16_t{ 24 } } )
+    {
+        auto const format{ pcmFormat( 44100, bits, 1 ) };
+        auto const floats{ Teleaudio::Transcoder::outputFormat( format, 0, 0, 0, true ) };
+        ASSERT_TRUE( floats.has_value() );
+        auto const scale{ bits == 8 ? 128.0f : 8388608.0f };
+        auto const bytes_per_sample{ std::size_t{ bits } / 8 };
+
+        // the extremes, then anything, and a count the vectors don't divide
+        std::vector< std::int32_t > values{ -static_cast< std::int32_t >( scale ), static_cast< std::int32_t >( scale ) - 1, -1, 0, 1 };
+        std::uniform_int_distribution< std::int32_t > any{ -static_cast< std::int32_t >( scale ), static_cast< std::int32_t >( scale ) - 1 };
+        while ( values.size() < 1003 )
+        {
+            values.push_back( any( random ) );
+        }
+
+        std::vector< std::byte > samples( values.size() * bytes_per_sample );
+        for ( std::size_t i{}; i < values.size(); ++i )
+        {
+            // 8 bit samples are unsigned
+            auto const stored{ static_cast< std::uint32_t >( bits == 8 ? values[ i ] + 128 : values[ i ] ) };
+            for ( std::size_t byte{}; byte < bytes_per_sample; ++byte )
+            {
+                samples[ i * bytes_per_sample + byte ] = static_cast< std::byte >( stored >> ( 8 * byte ) );
+            }
+        }
+        std::vector< float > converted( values.size() );
+        Teleaudio::samplesToFloat( format, samples.data(), converted.data(), converted.size() );
+        for ( std::size_t i{}; i < values.size(); ++i )
+        {
+            ASSERT_EQ( static_cast< float >( values[ i ] ) / scale, converted[ i ] ) << bits << " bit sample " << i;
+        }
+
+        // out of range, halfway between two samples and anything else, rounded to nearest even and clipped
+        std::vector< float > inputs{ -1.5f, 1.5f, 1.0f, -1.0f, 0.5f / scale, 1.5f / scale, -2.5f / scale };
+        std::uniform_real_distribution< float > anything{ -1.1f, 1.1f };
+        while ( inputs.size() < 1003 )
+        {
+            inputs.push_back( anything( random ) );
+        }
+        Teleaudio::Transcoder quantizer{ *floats, format };
+        auto const quantized{ transcode( quantizer, std::as_bytes( std::span{ inputs } ), 97, floats->block_align ) };
+        ASSERT_EQ( inputs.size() * bytes_per_sample, quantized.size() );
+        for ( std::size_t i{}; i < inputs.size(); ++i )
+        {
+            std::uint32_t stored{};
+            for ( std::size_t byte{}; byte < bytes_per_sample; ++byte )
+            {
+                stored |= static_cast< std::uint32_t >( quantized[ i * bytes_per_sample + byte ] ) << ( 8 * byte );
+            }
+            auto const value{ bits == 8 ? static_cast< std::int32_t >( stored ) - 128 : static_cast< std::int32_t >( stored << 8 ) >> 8 };
+            ASSERT_EQ( std::lrint( std::clamp( inputs[ i ] * scale, -scale, scale - 1 ) ), value ) << bits << " bit sample " << i;
+        }
+    }
+}
+
+TEST( TeleaudioTest, TranscoderResamplesInRanges )
+{
+    auto const source{ pcmFormat( 44100, 16, 1 ) };
+    auto const target{ Teleaudio::Transcoder::outputFormat( source, 48000, 0, 0, false ) };
+    ASSERT_TRUE( target.has_value() );
+
+    std::size_t const frames{ 4410 };
+    auto const input{ tone( frames, 1, 1000.0 / 44100 ) };
+
+    Teleaudio::Transcoder whole{ source, *target };
+    auto const output{ transcode( whole, input, 1000, source.block_align ) };
+    ASSERT_EQ( whole.outputFrames( frames ) * 2, output.size() );
+    ASSERT_EQ( 4800u, whole.outputFrames( frames ) );
+
+    // still the same tone, away from the edges where the filter sees the silence around it
+    auto const expected{ tone( 4800, 1, 1000.0 / 48000 ) };
+    for ( std::size_t frame{ 100 }; frame < 4700; ++frame )
+    {
+        std::int16_t actual, ideal;
+        std::memcpy( &actual, output.data()   + frame * 2, 2 );
+        std::memcpy( &ideal,  expected.data() + frame * 2, 2 );
+        ASSERT_NEAR( ideal, actual, 100 ) << "frame " << frame;
+    }
+
+    // neither the size of the pushed chunks nor starting in the middle changes a single output frame
+    Teleaudio::Transcoder chunked{ source, *target };
+    ASSERT_EQ( output, transcode( chunked, input, 7, source.block_align ) );
+
+    for ( std::uint64_t const start : { 1, 1234, 4799 } )
+    {
+        Teleaudio::Transcoder range{ source, *target };
+        auto const first_input{ range.seek( start ) };
+        auto const tail{ transcode( range, std::span{ input }.subspan( first_input * 2 ), 500, source.block_align ) };
+        ASSERT_GE( tail.size(), output.size() - start * 2 );
+        ASSERT_TRUE( std::equal( output.begin() + static_cast< std::ptrdiff_t >( start * 2 ), output.end(), tail.begin() ) ) << "start " << start;
+    }
+}
+
+TEST( TeleaudioTest, DownloadOverLoopback )
+{
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+    client.SetPreferredChunkSize( 1000 );
+
+    auto const output{ testPath( "loopback.wav" ) };
+    ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+
+    WAV::File const original  { ( resources / "AMAZING_clean.wav" ).string() };
+    WAV::File const downloaded{ output.string() };
+
+    ASSERT_EQ( original.data().subchunk2_size, downloaded.data().subchunk2_size );
+    ASSERT_EQ( 0, std::memcmp( original.data().data.data(), downloaded.data().data.data(), original.data().subchunk2_size ) );
+
+    std::filesystem::remove( output );
+}
+
+TEST( TeleaudioTest, CancelledDownloadsAreFinished )
+{
+    using namespace Teleaudio::Metrics;
+
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async = async;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        auto const stub{ Teleaudio::AudioService::NewStub( grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) ) };
+        auto const before{ collect() };
+        {
+            grpc::ClientContext context;
+            Teleaudio::File     request;
+            request.set_name      ( "AMAZING_clean.wav" );
+            request.set_chunk_size( 100 );
+
+            auto reader{ stub->Download( &context, request ) };
+            Teleaudio::AudioData data;
+            ASSERT_TRUE( reader->Read( &data ) );
+            ASSERT_TRUE( reader->Read( &data ) );
+            context.TryCancel();
+            while ( reader->Read( &data ) ) {}
+            ASSERT_EQ( grpc::StatusCode::CANCELLED, reader->Finish().error_code() );
+        }
+        {
+            grpc::ClientContext      context;
+            Teleaudio::StreamRequest request;
+            request.mutable_file()->set_name      ( "AMAZING_clean.wav" );
+            request.mutable_file()->set_chunk_size( 100 );
+
+            auto reader{ stub->Stream( &context, request ) };
+            Teleaudio::AudioData data;
+            ASSERT_TRUE( reader->Read( &data ) );
+            ASSERT_TRUE( reader->Read( &data ) );
+            context.TryCancel();
+            while ( reader->Read( &data ) ) {}
+            ASSERT_EQ( grpc::StatusCode::CANCELLED, reader->Finish().error_code() );
+        }
+
+        // the server notices the broken streams on its next write and is done with the call
+        auto const active{ [ & ] { return collect().counter( Counter::ActiveStreams ) - before.counter( Counter::ActiveStreams ); } };
+        for ( int i{}; i < 500 && active() != 0; ++i )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds{ 10 } );
+        }
+        ASSERT_EQ( 0, active() );
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+        auto const output{ testPath( "after_cancel.wav" ) };
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+        std::filesystem::remove( output );
+    }
+}
+
+TEST( TeleaudioTest, DownloadChunksAreSerializedMessages )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    // the chunks are framed by hand, they have to be what protobuf makes of them, up to lengths taking three bytes of varint
+    for ( bool const async : { false, true } )
+    {
+        for ( std::uint32_t const chunk_size : { 100u, 1000u, 200000u } )
+        {
+            Teleaudio::ServerOptions options;
+            options.async = async;
+            Teleaudio::Server server{ resources.string(), 0, options };
+
+            auto const channel{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+            grpc::ClientContext context;
+            Teleaudio::File     request;
+            request.set_name      ( "AMAZING_clean.wav" );
+            request.set_chunk_size( chunk_size );
+
+            // the messages as they come over the wire
+            std::unique_ptr< grpc::ClientReader< grpc::ByteBuffer > > reader
+            {
+                grpc::internal::ClientReaderFactory< grpc::ByteBuffer >::Create
+                (
+                    channel.get(),
+                    grpc::internal::RpcMethod{ "/Teleaudio.AudioService/Download", grpc::internal::RpcMethod::SERVER_STREAMING },
+                    &context,
+                    request
+                )
+            };
+
+            std::string      received;
+            std::size_t      messages{};
+            grpc::ByteBuffer message;
+            while ( reader->Read( &message ) )
+            {
+                std::vector< grpc::Slice > slices;
+                ASSERT_TRUE( message.Dump( &slices ).ok() );
+
+                std::string bytes;
+                for ( auto const & slice : slices )
+                {
+                    bytes.append( reinterpret_cast< char const * >( slice.begin() ), slice.size() );
+                }
+
+                Teleaudio::AudioData data;
+                ASSERT_TRUE( data.ParseFromString( bytes ) );
+                ASSERT_EQ( data.SerializeAsString(), bytes );
+                ASSERT_EQ( messages == 0, data.has_metadata() );
+
+                received += data.rawdata();
+                ++messages;
+            }
+            ASSERT_TRUE( reader->Finish().ok() );
+
+            ASSERT_EQ( original.data().subchunk2_size, received.size() );
+            ASSERT_EQ( 0, std::memcmp( original.data().data.data(), received.data(), received.size() ) );
+            ASSERT_EQ( 1 + ( received.size() + chunk_size - 1 ) / chunk_size, messages );
+        }
+    }
+}
+
+TEST( TeleaudioTest, DownloadCompressedOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async = async;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        auto const channel{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+        // the chunks really are encoded
+        {
+            auto const stub{ Teleaudio::AudioService::NewStub( channel ) };
+
+            grpc::ClientContext context;
+            Teleaudio::File     request;
+            request.set_name      ( "AMAZING_clean.wav" );
+            request.set_chunk_size( 4096 );
+            request.set_codec     ( Teleaudio::PAYLOAD_DELTA_RICE );
+
+            auto reader{ stub->Download( &context, request ) };
+
+            Teleaudio::AudioData data;
+            ASSERT_TRUE( reader->Read( &data ) );
+            ASSERT_EQ( Teleaudio::PAYLOAD_DELTA_RICE, data.metadata().codec() );
+
+            std::size_t encoded_chunks{};
+            while ( reader->Read( &data ) )
+            {
+                encoded_chunks += data.has_encodeddata() ? 1 : 0;
+            }
+            ASSERT_TRUE( reader->Finish().ok() );
+            ASSERT_GT( encoded_chunks, 0u );
+        }
+
+        Teleaudio::AudioClient client{ channel };
+        client.SetPreferredChunkSize( 1000 );
+        client.SetCompression( true );
+
+        auto const output{ testPath( "compressed.wav" ) };
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+
+        WAV::File const downloaded{ output.string() };
+        ASSERT_EQ( original.data().subchunk2_size, downloaded.data().subchunk2_size );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), downloaded.data().data.data(), original.data().subchunk2_size ) );
+
+        std::filesystem::remove( output );
+    }
+}
+
+TEST( TeleaudioTest, DownloadConvertedOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    for ( std::size_t const cache_size : { 0, 1024 * 1024 } )
+    {
+        Teleaudio::ServerOptions options;
+        options.cache_size = cache_size;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+        client.SetPreferredChunkSize( 1000 );
+        client.SetOutputFormat( { .sample_rate = 48000, .bits_per_sample = 16, .channels = 2 } );
+
+        auto const output  { testPath( "converted.wav" ) };
+        auto const parallel{ testPath( "converted_parallel.wav" ) };
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+        ASSERT_TRUE( client.DownloadParallel( "AMAZING_clean.wav", parallel.string(), 3 ) );
+
+        WAV::File const converted{ output.string() };
+        ASSERT_TRUE( converted.valid() );
+        ASSERT_EQ( 48000u, converted.format().sample_rate );
+        ASSERT_EQ( 2u,     converted.format().num_channels );
+
+        Teleaudio::Transcoder const transcoder{ original.format(), converted.format() };
+        ASSERT_EQ( transcoder.outputFrames( original.data().subchunk2_size / 2 ) * 4, converted.data().subchunk2_size );
+
+        // every range is converted on its own and still lines up
+        WAV::File const converted_in_parallel{ parallel.string() };
+        ASSERT_TRUE( std::ranges::equal( converted.bytes(), converted_in_parallel.bytes() ) );
+
+        std::filesystem::remove( output );
+        std::filesystem::remove( parallel );
+    }
+}
+
+TEST( TeleaudioTest, StatOverLoopback )
+{
+    // the asynchronous server keeps serving these synchronously
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async             = async;
+        options.completion_queues = 1;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+        auto const listing{ client.ListDetailed() };
+        ASSERT_EQ( 3u, listing.size() );
+
+        auto const info{ client.Stat( "AMAZING_clean.wav" ) };
+        ASSERT_TRUE( info.has_value() );
+        ASSERT_TRUE( info->valid() );
+        ASSERT_EQ( 1u, info->channels() );
+        ASSERT_EQ( 41920u, info->raw_data_size() );
+        ASSERT_NEAR( 41920.0 / info->sample_rate() / 2, info->duration(), 1e-9 );
+
+        ASSERT_FALSE( client.Stat( "does_not_exist.wav" ).has_value() );
+    }
+}
+
+TEST( TeleaudioTest, ListInPages )
+{
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+    auto const list{ [ & ]( Teleaudio::ListRequest const & request )
+    {
+        std::vector< std::vector< std::string > > pages;
+        EXPECT_TRUE( client.ListStream( request, [ & ]( Teleaudio::FileInfoList const & page )
+        {
+            auto & names{ pages.emplace_back() };
+            for ( auto const & file : page.files() )
+            {
+                names.push_back( file.name() );
+            }
+            return true;
+        } ) );
+        return pages;
+    } };
+
+    Teleaudio::ListRequest request;
+    request.set_page_size( 2 );
+    ASSERT_EQ( ( std::vector< std::vector< std::string > >{ { "AMAZING_clean.wav", "BORING_clean.wav" }, { "Engineer_s1.wav" } } ), list( request ) );
+
+    request.set_start_after( "AMAZING_clean.wav" );
+    ASSERT_EQ( ( std::vector< std::vector< std::string > >{ { "BORING_clean.wav", "Engineer_s1.wav" } } ), list( request ) );
+
+    Teleaudio::ListRequest filtered;
+    filtered.set_prefix( "B" );
+    ASSERT_EQ( ( std::vector< std::vector< std::string > >{ { "BORING_clean.wav" } } ), list( filtered ) );
+
+    // AMAZING is the longer of the two 16 bit files
+    filtered.Clear();
+    filtered.set_bits_per_sample( 16 );
+    filtered.set_min_duration( 0.9 );
+    ASSERT_EQ( ( std::vector< std::vector< std::string > >{ { "AMAZING_clean.wav" } } ), list( filtered ) );
+
+    Teleaudio::ListRequest missing;
+    missing.set_path( "no_such_directory" );
+    ASSERT_FALSE( client.ListStream( missing, []( Teleaudio::FileInfoList const & ) { return true; } ) );
+}
+
+TEST( TeleaudioTest, DownloadRangeAlignedToSampleFrames )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    struct Range
+    {
+        std::uint32_t offset;
+        std::uint32_t length;
+        std::uint32_t expected_length;
+    };
+
+    // the file is 16 bit mono, so the range snaps to even bytes: the second one ends in the middle of a frame
+    for ( auto const & [ offset, length, expected_length ] : { Range{ 1001, 99, 100 }, Range{ 1001, 100, 102 } } )
+    {
+        // streamed from the disk and from the cached mapping
+        for ( std::size_t const cache_size : { 0, 1024 * 1024 } )
+        {
+            Teleaudio::ServerOptions options;
+            options.cache_size = cache_size;
+            Teleaudio::Server server{ resources.string(), 0, options };
+
+            auto const stub{ Teleaudio::AudioService::NewStub( grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) ) };
+
+            grpc::ClientContext context;
+            Teleaudio::File     request;
+            request.set_name  ( "AMAZING_clean.wav" );
+            request.set_offset( offset );
+            request.set_length( length );
+
+            auto reader{ stub->Download( &context, request ) };
+
+            Teleaudio::AudioData data;
+            ASSERT_TRUE( reader->Read( &data ) );
+            ASSERT_TRUE( data.has_metadata() );
+
+            ASSERT_EQ( 1000u,           data.metadata().offset() );
+            ASSERT_EQ( expected_length, data.metadata().length() );
+
+            std::string received;
+            while ( reader->Read( &data ) )
+            {
+                received += data.rawdata();
+            }
+            ASSERT_TRUE( reader->Finish().ok() );
+
+            ASSERT_EQ( expected_length, received.size() );
+            ASSERT_EQ( 0, std::memcmp( original.data().data.data() + 1000, received.data(), received.size() ) );
+        }
+    }
+}
+
+TEST( TeleaudioTest, DownloadRangeOfRf64File )
+{
+    auto const directory{ testPath( "rf64" ) };
+    std::filesystem::create_directories( directory );
+    auto const path{ directory / "large.wav" };
+
+    // past 4 GiB of samples the sizes are in the ds64 chunk, the samples are a hole in the file but for the range
+    auto const          format   { pcmFormat( 8000, 16, 1 ) };
+    std::uint64_t const data_size{ std::uint64_t{ 5 } << 30 };
+    std::uint64_t const offset   { ( std::uint64_t{ 4 } << 30 ) + 1000 };
+    ASSERT_TRUE( WAV::needsRf64( data_size ) );
+    {
+        std::vector< std::byte > header;
+        auto const append{ [ &header ]( auto const & value )
+        {
+            auto const bytes{ std::as_bytes( std::span{ &value, 1 } ) };
+            header.insert( header.end(), bytes.begin(), bytes.end() );
+        } };
+        append( WAV::MagicBytes::RF64 );
+        append( std::uint32_t{ UINT32_MAX } );
+        append( WAV::MagicBytes::WAVE );
+        append( WAV::MagicBytes::ds64 );
+        append( std::uint32_t{ WAV::ds64_size } );
+        append( WAV::rf64_header_size - 8 + data_size );
+        append( data_size );
+        append( data_size / format.block_align );
+        append( std::uint32_t{} );
+        append( format );
+        append( WAV::MagicBytes::data );
+        append( std::uint32_t{ UINT32_MAX } );
+        ASSERT_EQ( WAV::rf64_header_size, header.size() );
+
+        auto const file{ FileUtils::openFile( path.string(), FileUtils::FileOpenMode::WriteBinary ) };
+        ASSERT_TRUE( file );
+        ASSERT_EQ( header.size(), std::fwrite( header.data(), 1, header.size(), file.get() ) );
+    }
+    std::filesystem::resize_file( path, WAV::rf64_header_size + data_size );
+
+    std::vector< std::byte > range( 100 );
+    std::iota( reinterpret_cast< std::uint8_t * >( range.data() ), reinterpret_cast< std::uint8_t * >( range.data() + range.size() ), std::uint8_t{ 1 } );
+    {
+        WAV::FileWriter writer{ path.string(), data_size, 0 };
+        ASSERT_TRUE( writer.writeAt( offset, range ) );
+    }
+
+    WAV::FileReader const reader{ path.string() };
+    ASSERT_TRUE( reader.valid() );
+    ASSERT_TRUE( reader.layout.rf64 );
+    ASSERT_EQ( data_size,              reader.data_size );
+    ASSERT_EQ( WAV::rf64_header_size, reader.layout.data_offset );
+
+    Teleaudio::Server server{ directory.string(), 0 };
+    auto const stub{ Teleaudio::AudioService::NewStub( grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) ) };
+
+    grpc::ClientContext context;
+    Teleaudio::File     request;
+    request.set_name  ( "large.wav" );
+    request.set_offset( offset + 1 );
+    request.set_length( 99 );
+
+    auto reader_stream{ stub->Download( &context, request ) };
+
+    Teleaudio::AudioData data;
+    ASSERT_TRUE( reader_stream->Read( &data ) );
+    ASSERT_TRUE( data.has_metadata() );
+    ASSERT_EQ( data_size, data.metadata().rawdatasize() );
+    ASSERT_EQ( offset,    data.metadata().offset() );
+    ASSERT_EQ( 100u,      data.metadata().length() );
+
+    std::string received;
+    while ( reader_stream->Read( &data ) )
+    {
+        received += data.rawdata();
+    }
+    ASSERT_TRUE( reader_stream->Finish().ok() );
+
+    ASSERT_EQ( range.size(), received.size() );
+    ASSERT_EQ( 0, std::memcmp( range.data(), received.data(), received.size() ) );
+
+    std::filesystem::remove_all( directory );
+}
+
+TEST( TeleaudioTest, ResumeInterruptedDownload )
+{
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+    auto const output{ testPath( "resumed.wav" ) };
+    ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+
+    // cutting the download short in the middle of a sample frame
+    std::filesystem::resize_file( output, WAV::header_size + 10'001 );
+
+    ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string(), true ) );
+
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    WAV::File const resumed { output.string() };
+
+    ASSERT_TRUE( resumed.valid() );
+    ASSERT_EQ( original.data().subchunk2_size, resumed.data().subchunk2_size );
+    ASSERT_EQ( 0, std::memcmp( original.data().data.data(), resumed.data().data.data(), original.data().subchunk2_size ) );
+
+    std::filesystem::remove( output );
+}
+
+TEST( TeleaudioTest, DownloadInParallelRanges )
+{
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+    client.SetPreferredChunkSize( 1000 );
+
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const output{ testPath( "parallel.wav" ) };
+
+    // 0 lets the client pick, which is a single stream for a file this small
+    for ( std::size_t const streams : { 0, 3, 7 } )
+    {
+        ASSERT_TRUE( client.DownloadParallel( "AMAZING_clean.wav", output.string(), streams ) );
+
+        WAV::File const downloaded{ output.string() };
+        ASSERT_TRUE( downloaded.valid() );
+        ASSERT_EQ( original.data().subchunk2_size, downloaded.data().subchunk2_size );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), downloaded.data().data.data(), original.data().subchunk2_size ) );
+    }
+
+    ASSERT_FALSE( client.DownloadParallel( "does_not_exist.wav", output.string(), 2 ) );
+
+    // the metadata the ranges are planned from comes without any samples
+    auto const stub{ Teleaudio::AudioService::NewStub( grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) ) };
+    grpc::ClientContext context;
+    Teleaudio::File     request;
+    request.set_name         ( "AMAZING_clean.wav" );
+    request.set_metadata_only( true );
+
+    auto reader{ stub->Download( &context, request ) };
+    Teleaudio::AudioData data;
+    ASSERT_TRUE( reader->Read( &data ) );
+    ASSERT_TRUE( data.has_metadata() );
+    ASSERT_EQ( original.data().subchunk2_size, data.metadata().rawdatasize() );
+    ASSERT_EQ( 0u, data.metadata().length() );
+    ASSERT_FALSE( reader->Read( &data ) );
+    ASSERT_TRUE( reader->Finish().ok() );
+
+    std::filesystem::remove( output );
+}
+
+TEST( TeleaudioTest, DownloadManyOverLoopback )
+{
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+    client.SetPreferredChunkSize( 1000 );
+
+    auto const output{ testPath( "batch" ) };
+    std::vector< std::string > const files{ "AMAZING_clean.wav", "does_not_exist.wav", "BORING_clean.wav", "../AMAZING_clean.wav", "/AMAZING_clean.wav" };
+
+    std::size_t updates{};
+    auto const results{ client.DownloadMany( files, output.string(), 2, [ &updates ]( Teleaudio::DownloadProgress const & ){ ++updates; } ) };
+
+    ASSERT_EQ( files.size(), results.size() );
+    ASSERT_TRUE ( results[ 0 ].ok );
+    ASSERT_FALSE( results[ 1 ].ok );
+    ASSERT_TRUE ( results[ 2 ].ok );
+    ASSERT_FALSE( results[ 3 ].ok );
+    ASSERT_FALSE( results[ 4 ].ok );
+    ASSERT_FALSE( std::filesystem::exists( output / files[ 1 ] ) );
+    ASSERT_FALSE( std::filesystem::exists( output.parent_path() / "AMAZING_clean.wav" ) );
+    ASSERT_GT( updates, files.size() );
+
+    for ( auto const index : { 0, 2 } )
+    {
+        WAV::File const original  { ( resources / files[ index ] ).string() };
+        WAV::File const downloaded{ ( output    / files[ index ] ).string() };
+
+        ASSERT_EQ( original.data().subchunk2_size, results[ index ].bytes_received );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), downloaded.data().data.data(), original.data().subchunk2_size ) );
+    }
+
+    std::filesystem::remove_all( output );
+}
+
+TEST( TeleaudioTest, PackStoreFollowsTheStorage )
+{
+    auto const storage{ testPath( "pack_storage" ) };
+    auto const packs  { testPath( "packs" )        };
+    std::filesystem::remove_all( storage );
+    std::filesystem::remove_all( packs   );
+    std::filesystem::create_directories( storage );
+    std::filesystem::copy_file( resources / "AMAZING_clean.wav", storage / "AMAZING_clean.wav" );
+    std::filesystem::copy_file( resources / "BORING_clean.wav",  storage / "BORING_clean.wav"  );
+
+    WAV::File const original{ ( storage / "AMAZING_clean.wav" ).string() };
+    {
+        Teleaudio::PackStore store{ storage, packs, 4096, std::uint64_t{ 1 } << 30 };
+
+        ASSERT_FALSE( store.pack( "../AMAZING_clean.wav" ) );
+        ASSERT_TRUE ( store.pack( "AMAZING_clean.wav" ) );
+
+        auto const pack{ store.get( "AMAZING_clean.wav" ) };
+        ASSERT_NE( nullptr, pack );
+        ASSERT_EQ( pack, store.get( "AMAZING_clean.wav" ) );
+        ASSERT_EQ( 1 + ( original.data().subchunk2_size + 4095 ) / 4096, pack->messages() );
+
+        // the very messages a download of the whole file sends
+        Teleaudio::AudioData data;
+        auto const metadata{ pack->message( 0 ) };
+        ASSERT_TRUE( data.ParseFromArray( metadata.data(), static_cast< int >( metadata.size() ) ) );
+        ASSERT_EQ( original.data().subchunk2_size, data.metadata().rawdatasize() );
+        ASSERT_EQ( original.format().sample_rate,  data.metadata().samplerate()  );
+
+        std::string samples;
+        for ( std::size_t i{ 1 }; i < pack->messages(); ++i )
+        {
+            auto const message{ pack->message( i ) };
+            ASSERT_TRUE( data.ParseFromArray( message.data(), static_cast< int >( message.size() ) ) );
+            ASSERT_EQ( pack->samples( i ), data.rawdata().size() );
+            samples += data.rawdata();
+        }
+        ASSERT_EQ( original.data().subchunk2_size, samples.size() );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), samples.data(), samples.size() ) );
+
+        // a modified file isn't served from its old pack
+        auto const file{ storage / "AMAZING_clean.wav" };
+        std::filesystem::last_write_time( file, std::filesystem::last_write_time( file ) + std::chrono::hours{ 1 } );
+        ASSERT_EQ( nullptr, store.get( "AMAZING_clean.wav" ) );
+        ASSERT_TRUE( store.pack( "AMAZING_clean.wav" ) );
+        auto const repacked{ store.get( "AMAZING_clean.wav" ) };
+        ASSERT_NE( nullptr, repacked );
+        ASSERT_NE( pack,    repacked );
+    }
+
+    // only the temporary files left long ago are removed, another server may still be writing the others
+    auto const fresh{ packs / "BORING_clean.wav.pack.1.2.tmp" };
+    auto const stale{ packs / "BORING_clean.wav.pack.3.4.tmp" };
+    std::ofstream{ fresh } << "fresh";
+    std::ofstream{ stale } << "stale";
+    std::filesystem::last_write_time( stale, std::filesystem::file_time_type::clock::now() - std::chrono::hours{ 2 } );
+
+    // room for only one of them, the packs from before count against the budget
+    {
+        Teleaudio::PackStore store{ storage, packs, 4096, std::filesystem::file_size( packs / "AMAZING_clean.wav.pack" ) };
+        ASSERT_TRUE( store.pack( "BORING_clean.wav" ) );
+        ASSERT_FALSE( std::filesystem::exists( packs / "AMAZING_clean.wav.pack" ) );
+        ASSERT_TRUE ( std::filesystem::exists( packs / "BORING_clean.wav.pack"  ) );
+        ASSERT_EQ( std::filesystem::file_size( packs / "BORING_clean.wav.pack" ), store.bytes_used() );
+        ASSERT_TRUE ( std::filesystem::exists( fresh ) );
+        ASSERT_FALSE( std::filesystem::exists( stale ) );
+    }
+
+    std::filesystem::remove_all( storage );
+    std::filesystem::remove_all( packs   );
+}
+
+TEST( TeleaudioTest, DownloadPackedOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    auto const packs{ testPath( "served_packs" ) };
+    for ( bool const async : { false, true } )
+    {
+        std::filesystem::remove_all( packs );
+
+        Teleaudio::ServerOptions options;
+        options.async          = async;
+        options.pack_directory = packs.string();
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+        auto const output{ testPath( "packed.wav" ) };
+
+        // the first download gets the file packed in the background
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+        for ( int i{}; i < 500 && !std::filesystem::exists( packs / "AMAZING_clean.wav.pack" ); ++i )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds{ 10 } );
+        }
+        ASSERT_TRUE( std::filesystem::exists( packs / "AMAZING_clean.wav.pack" ) );
+
+        auto const before{ Teleaudio::Metrics::collect() };
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+        auto const after { Teleaudio::Metrics::collect() };
+        ASSERT_EQ( 1, after.counter( Teleaudio::Metrics::Counter::PackedDownloads ) - before.counter( Teleaudio::Metrics::Counter::PackedDownloads ) );
+
+        WAV::File const downloaded{ output.string() };
+        ASSERT_EQ( original.data().subchunk2_size, downloaded.data().subchunk2_size );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), downloaded.data().data.data(), original.data().subchunk2_size ) );
+        ASSERT_EQ( original.format().sample_rate, downloaded.format().sample_rate );
+        std::filesystem::remove( output );
+    }
+
+    std::filesystem::remove_all( packs );
+}
+
+TEST( TeleaudioTest, BroadcastEvictsSlowSubscribers )
+{
+    // ten messages of one byte each, counting how many times they're produced
+    int produced{};
+    auto const make_broadcast{ [ &produced ]( std::size_t const capacity )
+    {
+        return std::make_shared< Teleaudio::Broadcast >( grpc::ByteBuffer{}, [ &produced ]( grpc::ByteBuffer & message, std::uint32_t & samples )
+        {
+            if ( produced == 10 )
+            {
+                return false;
+            }
+            auto const value{ static_cast< char >( produced++ ) };
+            grpc::Slice slice{ &value, 1 };
+            message = grpc::ByteBuffer{ &slice, 1 };
+            samples = 1;
+            return true;
+        }, capacity );
+    } };
+
+    auto const value_of{ []( grpc::ByteBuffer const & message )
+    {
+        std::vector< grpc::Slice > slices;
+        EXPECT_TRUE( message.Dump( &slices ).ok() );
+        return static_cast< int >( *slices.at( 0 ).begin() );
+    } };
+
+    {
+        auto const broadcast{ make_broadcast( 4 ) };
+        auto       fast{ Teleaudio::Broadcast::subscribe( broadcast ) };
+        auto       slow{ Teleaudio::Broadcast::subscribe( broadcast ) };
+        ASSERT_TRUE( fast.has_value() );
+        ASSERT_TRUE( slow.has_value() );
+
+        grpc::ByteBuffer message;
+        for ( int i{}; i < 3; ++i )
+        {
+            ASSERT_EQ( Teleaudio::Broadcast::Next::Message, fast->next( message ) );
+            ASSERT_EQ( i, value_of( message ) );
+        }
+
+        // the start is still in the ring, a late subscriber replays it
+        auto late{ Teleaudio::Broadcast::subscribe( broadcast ) };
+        ASSERT_TRUE( late.has_value() );
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Message, late->next( message ) );
+        ASSERT_EQ( 0, value_of( message ) );
+
+        for ( int i{ 3 }; i < 10; ++i )
+        {
+            ASSERT_EQ( Teleaudio::Broadcast::Next::Message, fast->next( message ) );
+            ASSERT_EQ( i, value_of( message ) );
+        }
+        ASSERT_EQ( Teleaudio::Broadcast::Next::End, fast->next( message ) );
+        ASSERT_EQ( 10u, fast->bytes_received() );
+
+        // the others fell behind by more than the ring holds
+        ASSERT_FALSE( Teleaudio::Broadcast::subscribe( broadcast ).has_value() );
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Evicted, slow->next( message ) );
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Evicted, late->next( message ) );
+        ASSERT_EQ( 1u, late->bytes_received() );
+        ASSERT_EQ( 2u, broadcast->evictions() );
+        ASSERT_EQ( 10, produced );
+    }
+
+    // subscribers keeping up get every message, produced only once
+    produced = 0;
+    {
+        Teleaudio::Broadcaster broadcaster;
+        std::vector< Teleaudio::Broadcast::Subscription > subscriptions;
+        for ( int i{}; i < 3; ++i )
+        {
+            auto subscription{ broadcaster.subscribe( "key", [ & ]{ return make_broadcast( 4 ); } ) };
+            ASSERT_TRUE( subscription.has_value() );
+            subscriptions.push_back( std::move( *subscription ) );
+        }
+
+        grpc::ByteBuffer message;
+        for ( int i{}; i < 10; ++i )
+        {
+            for ( auto & subscription : subscriptions )
+            {
+                ASSERT_EQ( Teleaudio::Broadcast::Next::Message, subscription.next( message ) );
+                ASSERT_EQ( i, value_of( message ) );
+            }
+        }
+        for ( auto & subscription : subscriptions )
+        {
+            ASSERT_EQ( Teleaudio::Broadcast::Next::End, subscription.next( message ) );
+        }
+        ASSERT_EQ( 10, produced );
+    }
+
+    // the producer runs without the lock, the messages already in the ring can be read meanwhile
+    produced = 0;
+    {
+        std::promise< void > release;
+        auto const           released{ release.get_future().share() };
+        std::atomic< bool >  producing{ false };
+
+        auto const broadcast{ std::make_shared< Teleaudio::Broadcast >( grpc::ByteBuffer{}, [ & ]( grpc::ByteBuffer & message, std::uint32_t & samples )
+        {
+            if ( produced == 2 )
+            {
+                return false;
+            }
+            if ( produced == 1 )
+            {
+                producing = true;
+                released.wait();
+            }
+            auto const value{ static_cast< char >( produced++ ) };
+            grpc::Slice slice{ &value, 1 };
+            message = grpc::ByteBuffer{ &slice, 1 };
+            samples = 1;
+            return true;
+        }, 4 ) };
+        auto first { Teleaudio::Broadcast::subscribe( broadcast ) };
+        auto second{ Teleaudio::Broadcast::subscribe( broadcast ) };
+        ASSERT_TRUE( first.has_value() );
+        ASSERT_TRUE( second.has_value() );
+
+        grpc::ByteBuffer message;
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Message, first->next( message ) );
+
+        std::jthread producer{ [ & ]
+        {
+            grpc::ByteBuffer next;
+            EXPECT_EQ( Teleaudio::Broadcast::Next::Message, first->next( next ) );
+            EXPECT_EQ( 1, value_of( next ) );
+        } };
+        while ( !producing )
+        {
+            std::this_thread::yield();
+        }
+
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Message, second->next( message ) );
+        ASSERT_EQ( 0, value_of( message ) );
+
+        release.set_value();
+        producer.join();
+
+        ASSERT_EQ( Teleaudio::Broadcast::Next::Message, second->next( message ) );
+        ASSERT_EQ( 1, value_of( message ) );
+        ASSERT_EQ( Teleaudio::Broadcast::Next::End, first->next( message ) );
+        ASSERT_EQ( Teleaudio::Broadcast::Next::End, second->next( message ) );
+        ASSERT_EQ( 2, produced );
+    }
+}
+
+TEST( TeleaudioTest, DownloadBroadcastOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async          = async;
+        options.broadcast_ring = 4;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        auto const channel{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+        // a paced stream subscribes first, the downloads overtake it and get it evicted
+        std::string streamed;
+        std::jthread listener{ [ & ]
+        {
+            Teleaudio::AudioClient client{ channel };
+            EXPECT_TRUE( client.Stream( "AMAZING_clean.wav",
+                                        []( Teleaudio::AudioMetadata const & ) { return true; },
+                                        [ & ]( std::span< std::byte const > const chunk )
+                                        {
+                                            streamed.append( reinterpret_cast< char const * >( chunk.data() ), chunk.size() );
+                                            return true;
+                                        },
+                                        std::chrono::milliseconds{ 100 } ) );
+        } };
+        std::this_thread::sleep_for( std::chrono::milliseconds{ 50 } );
+
+        std::vector< std::filesystem::path > outputs;
+        {
+            std::vector< std::jthread > clients;
+            for ( int i{}; i < 4; ++i )
+            {
+                auto const & output{ outputs.emplace_back( testPath( fmt::format( "broadcast_{}.wav", i ) ) ) };
+                clients.emplace_back( [ &, output, compress = i % 2 == 1 ]
+                {
+                    Teleaudio::AudioClient client{ channel };
+                    client.SetCompression( compress );
+                    EXPECT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+                } );
+            }
+        }
+        listener.join();
+
+        for ( auto const & output : outputs )
+        {
+            WAV::File const copy{ output.string() };
+            ASSERT_EQ( original.data().subchunk2_size, copy.data().subchunk2_size );
+            ASSERT_EQ( 0, std::memcmp( original.data().data.data(), copy.data().data.data(), original.data().subchunk2_size ) );
+            std::filesystem::remove( output );
+        }
+
+        ASSERT_EQ( original.data().subchunk2_size, streamed.size() );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), streamed.data(), streamed.size() ) );
+    }
+}
+
+TEST( TeleaudioTest, TimerWheelRunsTasksWhenDue )
+{
+    Teleaudio::TimerWheel wheel{ std::chrono::milliseconds{ 2 }, 8 };
+
+    auto const start{ Teleaudio::TimerWheel::Clock::now() };
+
+    // further out than a turn of the wheel, in reverse order
+    std::mutex                                              mutex;
+    std::vector< std::pair< int, std::chrono::nanoseconds > > ran;
+    for ( int const delay : { 40, 25, 5, 0 } )
+    {
+        ASSERT_TRUE( wheel.schedule( start + std::chrono::milliseconds{ delay }, [ &, delay ]
+        {
+            std::lock_guard lock{ mutex };
+            ran.emplace_back( delay, Teleaudio::TimerWheel::Clock::now() - start );
+        } ) );
+    }
+    ASSERT_EQ( 4u, wheel.pending() );
+
+    for ( int i{}; i < 500 && wheel.pending() > 0; ++i )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds{ 5 } );
+    }
+
+    std::vector< int > const order{ 0, 5, 25, 40 };
+
+    std::lock_guard lock{ mutex };
+    ASSERT_EQ( order.size(), ran.size() );
+    for ( std::size_t i{}; i < ran.size(); ++i )
+    {
+        ASSERT_EQ( order[ i ], ran[ i ].first );
+        ASSERT_GE( ran[ i ].second, std::chrono::milliseconds{ ran[ i ].first } );
+    }
+}
+
+TEST( TeleaudioTest, TimerWheelRunsPendingTasksWhenStopped )
+{
+    Teleaudio::TimerWheel wheel;
+
+    bool ran{ false };
+    ASSERT_TRUE( wheel.schedule( Teleaudio::TimerWheel::Clock::now() + std::chrono::hours{ 1 }, [ & ] { ran = true; } ) );
+
+    wheel.stop();
+    ASSERT_TRUE ( ran );
+    ASSERT_FALSE( wheel.schedule( Teleaudio::TimerWheel::Clock::now(), [] {} ) );
+}
+
+TEST( TeleaudioTest, StreamPacedOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const duration{ std::chrono::duration< double >( static_cast< double >( original.data().subchunk2_size ) / original.format().byte_rate ) };
+    auto const lead    { std::chrono::milliseconds{ 300 } };
+
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async = async;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+        client.SetPreferredChunkSize( 2048 );
+
+        std::string samples;
+        auto const start{ std::chrono::steady_clock::now() };
+        ASSERT_TRUE( client.Stream( "AMAZING_clean.wav",
+                                    []( Teleaudio::AudioMetadata const & ) { return true; },
+                                    [ & ]( std::span< std::byte const > const chunk )
+                                    {
+                                        samples.append( reinterpret_cast< char const * >( chunk.data() ), chunk.size() );
+                                        return true;
+                                    },
+                                    lead ) );
+        auto const elapsed{ std::chrono::steady_clock::now() - start };
+
+        // the last chunk can't go out before the playback is a lead away from it
+        auto const last_chunk{ std::chrono::duration< double >( static_cast< double >( original.data().subchunk2_size - 2048 ) / original.format().byte_rate ) };
+        ASSERT_GE( elapsed, last_chunk - lead );
+        ASSERT_LT( elapsed, duration + std::chrono::seconds{ 2 } );
+
+        ASSERT_EQ( original.data().subchunk2_size, samples.size() );
+        ASSERT_EQ( 0, std::memcmp( original.data().data.data(), samples.data(), samples.size() ) );
+    }
+}
+
+TEST( TeleaudioTest, RingBufferWrapsAround )
+{
+    Teleaudio::RingBuffer ring{ 5 };
+    ASSERT_EQ( 8u, ring.capacity() );
+
+    std::array< std::byte, 6 > in { std::byte{ 1 }, std::byte{ 2 }, std::byte{ 3 }, std::byte{ 4 }, std::byte{ 5 }, std::byte{ 6 } };
+    std::array< std::byte, 6 > out{};
+
+    ASSERT_EQ( 6u, ring.write( in ) );
+    ASSERT_EQ( 4u, ring.read( std::span{ out }.first( 4 ) ) );
+
+    // across the end of the buffer, and only as much as fits
+    ASSERT_EQ( 6u, ring.write( in ) );
+    ASSERT_EQ( 0u, ring.write( in ) );
+    ASSERT_EQ( 8u, ring.readable() );
+
+    ASSERT_EQ( 2u, ring.read( std::span{ out }.first( 2 ) ) );
+    ASSERT_EQ( std::byte{ 5 }, out[ 0 ] );
+    ASSERT_EQ( std::byte{ 6 }, out[ 1 ] );
+    ASSERT_EQ( 6u, ring.read( out ) );
+    ASSERT_EQ( in, out );
+    ASSERT_EQ( 0u, ring.read( out ) );
 }
 
-// TODO: add tests for network communication/streaming, maybe a python script that launches both
+TEST( TeleaudioTest, RingBufferHandsBytesBetweenThreads )
+{
+    Teleaudio::RingBuffer ring{ 1000 };
+
+    std::vector< std::byte > sent( 1 << 18 );
+    for ( std::size_t i{}; i < sent.size(); ++i )
+    {
+        sent[ i ] = static_cast< std::byte >( i * 7 + i / 251 );
+    }
+
+    std::vector< std::byte > received;
+    std::jthread consumer{ [ & ]
+    {
+        std::array< std::byte, 333 > buffer;
+        while ( received.size() < sent.size() )
+        {
+            auto const size{ ring.read( buffer ) };
+            if ( size == 0 )
+            {
+                std::this_thread::yield();
+            }
+            received.insert( received.end(), buffer.begin(), buffer.begin() + static_cast< std::ptrdiff_t >( size ) );
+        }
+    } };
+
+    for ( std::span< std::byte const > rest{ sent }; !rest.empty(); )
+    {
+        auto const size{ ring.write( rest.first( std::min< std::size_t >( rest.size(), 777 ) ) ) };
+        if ( size == 0 )
+        {
+            std::this_thread::yield();
+        }
+        rest = rest.subspan( size );
+    }
+    consumer.join();
+
+    ASSERT_EQ( sent, received );
+}
+
+TEST( TeleaudioTest, PlayerCountsUnderruns )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const samples{ original.data().data };
+
+    Teleaudio::PlaybackOptions options;
+    options.jitter_buffer = std::chrono::milliseconds{ 50  };
+    options.period        = std::chrono::milliseconds{ 10  };
+    options.ring          = std::chrono::milliseconds{ 500 };
+
+    Teleaudio::NullSink sink;
+    Teleaudio::Player   player{ sink, original.format(), options };
+    ASSERT_TRUE( player.start( original.data().subchunk2_size ) );
+
+    // a tenth of a second, and the rest only long after it's been played
+    auto const first{ original.format().byte_rate / 10 };
+    ASSERT_TRUE( player.push( samples.first( first ) ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds{ 300 } );
+    ASSERT_TRUE( player.push( samples.subspan( first ) ) );
+
+    auto const statistics{ player.finish() };
+    ASSERT_TRUE( statistics.ok );
+    ASSERT_GE( statistics.underruns, 1u );
+    ASSERT_EQ( samples.size(), statistics.bytes_played );
+    ASSERT_EQ( samples.size() + statistics.silence_played, sink.bytes_played() );
+
+    // the device kept playing silence while the rest didn't arrive, that's most of the 200 ms gap
+    ASSERT_GE( statistics.silence_played, original.format().byte_rate / 10 );
+
+    // a sink that ran dry plays from when the samples show up, not in a hurry to catch up
+    Teleaudio::NullSink dry;
+    ASSERT_TRUE( dry.open( original.format(), 0 ) );
+    auto const period{ samples.first( original.format().byte_rate / 100 ) };
+    ASSERT_TRUE( dry.write( period ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
+    auto const resumed{ std::chrono::steady_clock::now() };
+    for ( int i{}; i < 6; ++i )
+    {
+        ASSERT_TRUE( dry.write( period ) );
+    }
+    ASSERT_GE( std::chrono::steady_clock::now() - resumed, std::chrono::milliseconds{ 50 } );
+}
+
+TEST( TeleaudioTest, PlayOverLoopback )
+{
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    Teleaudio::Server server{ resources.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+    auto const output{ testPath( "played.wav" ) };
+    Teleaudio::FileSink sink{ output.string() };
+
+    auto const statistics{ client.Play( "AMAZING_clean.wav", sink ) };
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_TRUE( statistics->ok );
+    ASSERT_EQ( 0u, statistics->underruns );
+    ASSERT_EQ( original.data().subchunk2_size, statistics->bytes_played );
+
+    // played from the start, so the file is the original
+    WAV::File const played{ output.string() };
+    ASSERT_TRUE( played.valid() );
+    ASSERT_EQ( original.data().subchunk2_size, played.data().subchunk2_size );
+    ASSERT_EQ( 0, std::memcmp( original.data().data.data(), played.data().data.data(), original.data().subchunk2_size ) );
+
+    std::filesystem::remove( output );
+}
+
+TEST( TeleaudioTest, Crc32cMatchesTheBitwiseDefinition )
+{
+    auto const bitwise{ []( std::span< std::byte const > const data )
+    {
+        std::uint32_t crc{ 0xFFFFFFFF };
+        for ( auto const byte : data )
+        {
+            crc ^= static_cast< std::uint32_t >( byte );
+            for ( int bit{}; bit < 8; ++bit )
+            {
+                crc = ( crc & 1 ) != 0 ? ( crc >> 1 ) ^ 0x82F63B78 : crc >> 1;
+            }
+        }
+        return ~crc;
+    } };
+
+    std::string_view const check{ "123456789" };
+    ASSERT_EQ( 0xE3069283, Teleaudio::crc32c( std::as_bytes( std::span{ check } ) ) );
+    ASSERT_EQ( 0u,         Teleaudio::crc32c( {} ) );
+
+    std::mt19937 random{ 7 };
+    std::vector< std::byte > data( 100'003 );
+    std::generate( data.begin(), data.end(), [ & ] { return static_cast< std::byte >( random() ); } );
+    auto const whole{ bitwise( data ) };
+    ASSERT_EQ( whole, Teleaudio::crc32c( data ) );
+
+    // continued and combined at any split, the short and long paths alike
+    for ( std::size_t const split : { 0, 1, 7, 3071, 3072, 50'000, 100'003 } )
+    {
+        auto const first { std::span< std::byte const >{ data }.first( split ) };
+        auto const second{ std::span< std::byte const >{ data }.subspan( split ) };
+        ASSERT_EQ( whole, Teleaudio::crc32c( second, Teleaudio::crc32c( first ) ) );
+        ASSERT_EQ( whole, Teleaudio::crc32cCombine( Teleaudio::crc32c( first ), Teleaudio::crc32c( second ), Teleaudio::crc32cShift( second.size() ) ) );
+    }
+}
+
+TEST( TeleaudioTest, SyncFetchesOnlyChangedBlocks )
+{
+    WAV::File const template_file{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const      block_size   { Teleaudio::checksumBlockSize( template_file.format().block_align ) };
+
+    auto const storage{ testPath( "sync_storage" ) };
+    auto const output { testPath( "synced.wav" ) };
+    std::filesystem::remove_all( storage );
+    std::filesystem::remove( output );
+    std::filesystem::create_directories( storage );
+
+    // five and a bit blocks of noise
+    std::mt19937 random{ 11 };
+    std::vector< std::byte > samples( 5 * block_size + 1000 );
+    std::generate( samples.begin(), samples.end(), [ & ] { return static_cast< std::byte >( random() ); } );
+    auto const write_source{ [ & ]
+    {
+        WAV::FileWriter writer{ ( storage / "long.wav" ).string(), template_file.format(), static_cast< std::uint32_t >( samples.size() ) };
+        ASSERT_TRUE( writer.write( samples ) );
+        ASSERT_TRUE( writer.finish() );
+    } };
+    write_source();
+
+    auto const overwrite{ []( std::filesystem::path const & path, std::uint64_t const offset, std::string_view const bytes )
+    {
+        auto const file{ FileUtils::openFile( path.string(), FileUtils::FileOpenMode::UpdateBinary ) };
+        ASSERT_TRUE( FileUtils::writeAt( file.get(), WAV::header_size + offset, std::as_bytes( std::span{ bytes } ) ) );
+    } };
+
+    auto const matches{ [ & ]
+    {
+        WAV::File const synced{ output.string() };
+        return synced.valid() && synced.data().subchunk2_size == samples.size()
+            && std::memcmp( synced.data().data.data(), samples.data(), samples.size() ) == 0;
+    } };
+
+    Teleaudio::Server server{ storage.string(), 0 };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+    // nothing to compare with yet
+    auto statistics{ client.Sync( "long.wav", output.string() ) };
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_EQ( 6u, statistics->blocks );
+    ASSERT_EQ( 6u, statistics->blocks_fetched );
+    ASSERT_TRUE( matches() );
+
+    statistics = client.Sync( "long.wav", output.string() );
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_TRUE( statistics->unchanged );
+    ASSERT_EQ( 0u, statistics->blocks_fetched );
+
+    // a damaged block
+    overwrite( output, 2 * block_size + 10, "damage" );
+    statistics = client.Sync( "long.wav", output.string() );
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_FALSE( statistics->unchanged );
+    ASSERT_EQ( 1u, statistics->blocks_fetched );
+    ASSERT_EQ( block_size, statistics->bytes_fetched );
+    ASSERT_TRUE( matches() );
+
+    // a copy cut short in the middle of a block
+    std::filesystem::resize_file( output, WAV::header_size + 3 * block_size + 5 );
+    statistics = client.Sync( "long.wav", output.string() );
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_EQ( 3u, statistics->blocks_fetched );
+    ASSERT_EQ( 2 * block_size + 1000, statistics->bytes_fetched );
+    ASSERT_TRUE( matches() );
+
+    // the file changing on the server, the checksums follow it
+    // at the same size, so only the modification time tells, which may not tick on coarse file systems unless it's set
+    samples[ 4 * block_size + 3 ] ^= std::byte{ 0xFF };
+    auto const modified{ std::filesystem::last_write_time( storage / "long.wav" ) + std::chrono::seconds{ 2 } };
+    write_source();
+    std::filesystem::last_write_time( storage / "long.wav", modified );
+    statistics = client.Sync( "long.wav", output.string() );
+    ASSERT_TRUE( statistics.has_value() );
+    ASSERT_EQ( 1u, statistics->blocks_fetched );
+    ASSERT_TRUE( matches() );
+
+    // a download of the whole file breaking off halfway leaves the copy alone, and nothing else behind
+    std::filesystem::resize_file( storage / "long.wav", WAV::header_size + 2 * block_size );
+    ASSERT_FALSE( client.Sync( "long.wav", output.string() ).has_value() );
+    ASSERT_TRUE( matches() );
+    for ( auto const & entry : std::filesystem::directory_iterator{ output.parent_path() } )
+    {
+        ASSERT_FALSE( entry.path().filename().string().starts_with( output.filename().string() + "." ) );
+    }
+
+    std::filesystem::remove( output );
+    std::filesystem::remove_all( storage );
+}
+
+TEST( TeleaudioTest, MetricsHistogramPercentiles )
+{
+    using namespace Teleaudio::Metrics;
+
+    // every value lands in a bucket less than 1/16 of it wide
+    for ( std::uint64_t value{ 1 }; value < ( std::uint64_t{ 1 } << 40 ); value = value * 3 / 2 + 1 )
+    {
+        auto const bucket{ bucketOf( value ) };
+        ASSERT_LT( value, bucketEnd( bucket ) );
+        ASSERT_LE( bucket == 0 ? 0 : bucketEnd( bucket - 1 ), value );
+        ASSERT_LE( bucketEnd( bucket ) - ( bucket == 0 ? 0 : bucketEnd( bucket - 1 ) ), std::max< std::uint64_t >( 1, value / 16 ) );
+    }
+
+    auto const before{ collect() };
+
+    // 1 to 1000 microseconds, recorded from threads that are gone by the time they're collected
+    {
+        std::vector< std::jthread > threads;
+        for ( int t{}; t < 4; ++t )
+        {
+            threads.emplace_back( [ t ]
+            {
+                for ( int i{ t + 1 }; i <= 1000; i += 4 )
+                {
+                    record( Histogram::WriteStall, std::chrono::microseconds{ i } );
+                    add( Counter::MessagesSent );
+                }
+            } );
+        }
+    }
+
+    auto const after{ collect() };
+    ASSERT_EQ( 1000, after.counter( Counter::MessagesSent ) - before.counter( Counter::MessagesSent ) );
+
+    // the loopback tests write chunks too
+    auto         histogram{ after.histogram( Histogram::WriteStall ) };
+    auto const & earlier  { before.histogram( Histogram::WriteStall ) };
+    for ( std::size_t bucket{}; bucket < bucket_count; ++bucket )
+    {
+        histogram.buckets[ bucket ] -= earlier.buckets[ bucket ];
+    }
+    histogram.count -= earlier.count;
+    histogram.sum   -= earlier.sum;
+    histogram.max    = 1000000;
+
+    ASSERT_EQ( 1000u,      histogram.count );
+    ASSERT_EQ( 500500000u, histogram.sum );
+    for ( auto const & [ quantile, expected ] : { std::pair{ 0.5, 500.0 }, std::pair{ 0.99, 990.0 }, std::pair{ 1.0, 1000.0 } } )
+    {
+        auto const microseconds{ std::chrono::duration< double, std::micro >( histogram.percentile( quantile ) ).count() };
+        ASSERT_GE( microseconds, expected );
+        ASSERT_LE( microseconds, expected * 17 / 16 );
+    }
+
+    Snapshot only_these;
+    only_these.histograms[ static_cast< std::size_t >( Histogram::WriteStall ) ] = histogram;
+    auto const text{ prometheus( only_these ) };
+    ASSERT_NE( std::string::npos, text.find( "teleaudio_write_stall_seconds_bucket{le=\"0.000524288\"} 524\n" ) );
+    ASSERT_NE( std::string::npos, text.find( "teleaudio_write_stall_seconds_bucket{le=\"+Inf\"} 1000\n" ) );
+    ASSERT_NE( std::string::npos, text.find( "teleaudio_write_stall_seconds_count 1000\n" ) );
+
+    // the same bounds whether anything landed in them or not, from 2^10 to 2^44 nanoseconds and +Inf
+    auto const bounds{ []( std::string_view const exported, std::string_view const metric )
+    {
+        std::size_t count{};
+        for ( auto at{ exported.find( metric ) }; at != std::string_view::npos; at = exported.find( metric, at + 1 ) )
+        {
+            ++count;
+        }
+        return count;
+    } };
+    ASSERT_EQ( 36u, bounds( text, "teleaudio_write_stall_seconds_bucket{" ) );
+    ASSERT_EQ( 36u, bounds( text, "teleaudio_list_latency_seconds_bucket{" ) );
+    ASSERT_NE( std::string::npos, text.find( "teleaudio_list_latency_seconds_bucket{le=\"1.024e-06\"} 0\n" ) );
+    ASSERT_NE( std::string::npos, text.find( "teleaudio_write_stall_seconds_bucket{le=\"1.024e-06\"} 1\n" ) );
+}
+
+TEST( TeleaudioTest, GetMetricsOverLoopback )
+{
+    using namespace Teleaudio::Metrics;
+
+    auto const before{ collect() };
+
+    for ( bool const async : { false, true } )
+    {
+        Teleaudio::ServerOptions options;
+        options.async = async;
+        Teleaudio::Server server{ resources.string(), 0, options };
+
+        Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+        ASSERT_FALSE( client.List().empty() );
+
+        auto const output{ testPath( "metrics.wav" ) };
+        ASSERT_TRUE( client.Download( "AMAZING_clean.wav", output.string() ) );
+        std::filesystem::remove( output );
+
+        auto const report{ client.GetMetrics() };
+        ASSERT_TRUE( report.has_value() );
+        ASSERT_EQ( counter_count,   static_cast< std::size_t >( report->counters_size() ) );
+        ASSERT_EQ( histogram_count, static_cast< std::size_t >( report->histograms_size() ) );
+        for ( auto const & histogram : report->histograms() )
+        {
+            if ( histogram.name() == name( Histogram::FirstByte ) )
+            {
+                ASSERT_GE( histogram.count(), 1u );
+                ASSERT_GT( histogram.max(), 0.0 );
+                ASSERT_LE( histogram.p50(), histogram.p99() );
+            }
+        }
+        ASSERT_NE( std::string::npos, report->prometheus().find( "teleaudio_download_calls_total" ) );
+    }
+
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+
+    // the servers are gone, so every call has been accounted for
+    auto const after{ collect() };
+    auto const delta{ [ & ]( Counter const which ) { return after.counter( which ) - before.counter( which ); } };
+    ASSERT_EQ( 2, delta( Counter::ListCalls ) );
+    ASSERT_EQ( 2, delta( Counter::DownloadCalls ) );
+    ASSERT_EQ( 0, delta( Counter::ActiveStreams ) );
+    ASSERT_EQ( 2 * std::int64_t{ original.data().subchunk2_size }, delta( Counter::BytesSent ) );
+    ASSERT_EQ( 2u, after.histogram( Histogram::DownloadDuration ).count - before.histogram( Histogram::DownloadDuration ).count );
+
+#ifndef _WIN32
+    Exporter const exporter{ 0 };
+    ASSERT_NE( 0, exporter.port() );
+
+    auto const fd{ ::socket( AF_INET, SOCK_STREAM, 0 ) };
+    ASSERT_GE( fd, 0 );
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons( exporter.port() );
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    ASSERT_EQ( 0, ::connect( fd, reinterpret_cast< sockaddr const * >( &address ), sizeof( address ) ) );
+
+    std::string_view const request{ "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n" };
+    ASSERT_EQ( static_cast< ssize_t >( request.size() ), ::send( fd, request.data(), request.size(), 0 ) );
+
+    std::string              scraped;
+    std::array< char, 4096 > buffer;
+    for ( ssize_t received{}; ( received = ::recv( fd, buffer.data(), buffer.size(), 0 ) ) > 0; )
+    {
+        scraped.append( buffer.data(), static_cast< std::size_t >( received ) );
+    }
+    ::close( fd );
+
+    ASSERT_TRUE( scraped.starts_with( "HTTP/1.1 200 OK\r\n" ) );
+    ASSERT_NE( std::string::npos, scraped.find( "# TYPE teleaudio_active_streams gauge\n" ) );
+    ASSERT_NE( std::string::npos, scraped.find( "teleaudio_first_byte_seconds_bucket{le=\"+Inf\"}" ) );
+#endif
+}
+
+TEST( TeleaudioTest, PeaksMatchTheSamples )
+{
+    auto const storage{ testPath( "peaks_storage" ) };
+    auto const sidecars{ testPath( "peaks" ) };
+    std::filesystem::remove_all( storage );
+    std::filesystem::remove_all( sidecars );
+    std::filesystem::create_directories( storage );
+
+    // a bit over a top level of peaks, not a whole number of buckets of any level
+    std::uint64_t const frames{ 300001 };
+    std::mt19937        random{ 17 };
+
+    // two channels go through the vectorized kernels, three through the scalar one
+    for ( auto const & [ bits, floating_point, channels ] : { std::tuple{ 8, false, 2 }, std::tuple{ 16, false, 3 }, std::tuple{ 24, false, 2 },
+                                                            std::tuple{ 32, false, 1 }, std::tuple{ 32, true, 2 } } )
+    {
+        auto format{ pcmFormat( 8000, static_cast< std::uint16_t >( bits ), static_cast< std::uint16_t >( channels ) ) };
+        format.audio_format = floating_point ? 3 : 1;
+
+        std::vector< std::byte > bytes( frames * format.block_align );
+        if ( floating_point )
+        {
+            std::uniform_real_distribution< float > sample{ -1.0f, 1.0f };
+            for ( std::size_t i{}; i < bytes.size(); i += 4 )
+            {
+                auto const value{ sample( random ) };
+                std::memcpy( bytes.data() + i, &value, 4 );
+            }
+        }
+        else
+        {
+            std::generate( bytes.begin(), bytes.end(), [ & ] { return static_cast< std::byte >( random() ); } );
+        }
+
+        auto const name{ fmt::format( "{}{}_{}.wav", floating_point ? "f" : "i", bits, channels ) };
+        WAV::FileWriter writer{ ( storage / name ).string(), format, static_cast< std::uint32_t >( bytes.size() ) };
+        ASSERT_TRUE( writer.write( bytes ) );
+        ASSERT_TRUE( writer.finish() );
+
+        std::vector< float > samples( frames * format.num_channels );
+        Teleaudio::samplesToFloat( format, bytes.data(), samples.data(), samples.size() );
+
+        // the exact peaks, while the merged ones may reach into the neighbouring frames of a bucket
+        auto const check{ [ & ]( Teleaudio::PeakOverview const & overview, bool const exact )
+        {
+            ASSERT_EQ( overview.buckets * format.num_channels, overview.peaks.size() );
+            for ( std::size_t bucket{}; bucket < overview.buckets; ++bucket )
+            {
+                auto const first{ overview.start_frame + bucket * overview.frames / overview.buckets };
+                auto const last { overview.start_frame + ( bucket + 1 ) * overview.frames / overview.buckets };
+                for ( std::uint16_t channel{}; channel < format.num_channels; ++channel )
+                {
+                    float  low{ 2.0f }, high{ -2.0f };
+                    double squares{};
+                    for ( auto frame{ first }; frame < last; ++frame )
+                    {
+                        auto const sample{ samples[ frame * format.num_channels + channel ] };
+                        low      = std::min( low,  sample );
+                        high     = std::max( high, sample );
+                        squares += static_cast< double >( sample ) * sample;
+                    }
+
+                    auto const & peak{ overview.peaks[ bucket * format.num_channels + channel ] };
+                    if ( exact )
+                    {
+                        ASSERT_EQ( low,  peak.min );
+                        ASSERT_EQ( high, peak.max );
+                        ASSERT_NEAR( squares / static_cast< double >( last - first ), peak.mean_square, 1e-4 );
+                    }
+                    else
+                    {
+                        ASSERT_LE( peak.min, low  );
+                        ASSERT_GE( peak.max, high );
+                    }
+                }
+            }
+        } };
+
+        Teleaudio::PeakStore store{ storage, sidecars, 0 };
+
+        // buckets of 4096 frames, merged from the peaks of 512 frames
+        auto overview{ store.overview( name, 0, 64 * 4096, 64 ) };
+        ASSERT_TRUE( overview.has_value() );
+        ASSERT_EQ( 64u, overview->buckets );
+        check( *overview, true );
+
+        // the whole file, merged from a coarser level
+        overview = store.overview( name, 0, 0, 100 );
+        ASSERT_TRUE( overview.has_value() );
+        ASSERT_EQ( frames, overview->frames );
+        check( *overview, false );
+
+        // zoomed in past the first level, computed from the samples
+        overview = store.overview( name, 12345, 1000, 100 );
+        ASSERT_TRUE( overview.has_value() );
+        check( *overview, true );
+
+        // fewer frames than buckets, and a range running past the end
+        overview = store.overview( name, frames - 10, 100, 50 );
+        ASSERT_TRUE( overview.has_value() );
+        ASSERT_EQ( 10u, overview->buckets );
+        check( *overview, true );
+
+        // another store loads the sidecar the first one left
+        ASSERT_TRUE( std::filesystem::exists( sidecars / ( name + ".peaks" ) ) );
+        Teleaudio::PeakStore reloaded{ storage, sidecars, 0 };
+        overview = reloaded.overview( name, 0, 64 * 4096, 64 );
+        ASSERT_TRUE( overview.has_value() );
+        check( *overview, true );
+
+        // the summaries written to a sidecar are mapped from it, not held in memory
+        ASSERT_EQ( 0u, store.bytes_used() );
+        ASSERT_EQ( 0u, reloaded.bytes_used() );
+
+        // without a sidecar they are, as long as they fit into the budget
+        Teleaudio::PeakStore in_memory{ storage, {}, std::uint64_t{ 1 } << 30 };
+        ASSERT_TRUE( in_memory.overview( name, 0, 0, 100 ).has_value() );
+        ASSERT_GT( in_memory.bytes_used(), 0u );
+
+        Teleaudio::PeakStore no_room{ storage, {}, 0 };
+        overview = no_room.overview( name, 0, 64 * 4096, 64 );
+        ASSERT_TRUE( overview.has_value() );
+        check( *overview, true );
+        ASSERT_EQ( 0u, no_room.bytes_used() );
+    }
+
+    Teleaudio::PeakStore store{ storage, {}, 0 };
+    ASSERT_FALSE( store.overview( "missing.wav", 0, 0, 10 ).has_value() );
+    ASSERT_FALSE( store.overview( "../teleaudio_peaks_storage/i8_2.wav", 0, 0, 10 ).has_value() );
+
+    std::filesystem::remove_all( storage );
+    std::filesystem::remove_all( sidecars );
+}
+
+TEST( TeleaudioTest, GetPeaksOverLoopback )
+{
+    auto const sidecars{ testPath( "peaks_loopback" ) };
+    std::filesystem::remove_all( sidecars );
+
+    Teleaudio::ServerOptions options;
+    options.peaks_directory = sidecars.string();
+    Teleaudio::Server server{ resources.string(), 0, options };
+
+    Teleaudio::AudioClient client{ grpc::CreateChannel( "localhost:" + std::to_string( server.port() ), grpc::InsecureChannelCredentials() ) };
+
+    WAV::File const original{ ( resources / "AMAZING_clean.wav" ).string() };
+    auto const      frames  { original.data().subchunk2_size / original.format().block_align };
+
+    auto const peaks{ client.GetPeaks( "AMAZING_clean.wav", 32 ) };
+    ASSERT_TRUE( peaks.has_value() );
+    ASSERT_EQ( original.format().num_channels, peaks->channels() );
+    ASSERT_EQ( original.format().sample_rate,  peaks->sample_rate() );
+    ASSERT_EQ( frames, peaks->frames() );
+    ASSERT_EQ( 32u, peaks->buckets() );
+    ASSERT_EQ( 32 * peaks->channels(), static_cast< std::uint32_t >( peaks->rms_size() ) );
+    for ( int i{}; i < peaks->rms_size(); ++i )
+    {
+        ASSERT_LE( peaks->min( i ), peaks->max( i ) );
+        ASSERT_LE( peaks->rms( i ), std::max( -peaks->min( i ), peaks->max( i ) ) );
+    }
+    ASSERT_TRUE( std::filesystem::exists( sidecars / "AMAZING_clean.wav.peaks" ) );
+
+    // a range of it
+    auto const range{ client.GetPeaks( "AMAZING_clean.wav", 10, 100, 20 ) };
+    ASSERT_TRUE( range.has_value() );
+    ASSERT_EQ( 100u, range->start_frame() );
+    ASSERT_EQ( 20u,  range->frames() );
+    ASSERT_EQ( 10u,  range->buckets() );
+
+    ASSERT_FALSE( client.GetPeaks( "missing.wav", 32 ).has_value() );
+
+    std::filesystem::remove_all( sidecars );
+}
+
+TEST( TeleaudioTest, ReadAheadReadsRanges )
+{
+    auto const path{ testPath( "read_ahead.bin" ) };
+
+    // a bit over a hundred blocks, ending in the middle of one
+    std::mt19937 random{ 5 };
+    std::vector< std::byte > contents( 100 * 8192 + 1234 );
+    std::generate( contents.begin(), contents.end(), [ & ] { return static_cast< std::byte >( random() ); } );
+    {
+        auto const file{ FileUtils::openFile( path.string(), FileUtils::FileOpenMode::WriteBinary ) };
+        ASSERT_TRUE( FileUtils::writeAt( file.get(), 0, contents ) );
+    }
+
+    for ( auto const backend : { FileUtils::IoBackend::Pread, FileUtils::IoBackend::Uring } )
+    {
+        FileUtils::ReadPool pool{ backend, 8000, 3 };
+        ASSERT_EQ( 8192u, pool.block_size() );
+
+        for ( bool const direct : { false, true } )
+        {
+            // unaligned ranges, the whole file and one running up to its end
+            for ( auto const & [ offset, length ] : { std::pair< std::size_t, std::size_t >{ 44, 300000 }, std::pair< std::size_t, std::size_t >{ 0, contents.size() },
+                                                   std::pair< std::size_t, std::size_t >{ 8191, contents.size() - 8191 }, std::pair< std::size_t, std::size_t >{ 5, 10 } } )
+            {
+                FileUtils::ReadAhead reader{ pool, path.string(), offset, length, direct };
+                ASSERT_TRUE( reader.valid() );
+
+                // in pieces that don't line up with the blocks
+                std::vector< std::byte > read;
+                std::array< std::byte, 3001 > piece;
+                for ( std::size_t size{}; ( size = reader.read( piece ) ) > 0; )
+                {
+                    read.insert( read.end(), piece.begin(), piece.begin() + static_cast< std::ptrdiff_t >( size ) );
+                }
+                ASSERT_EQ( 0u, reader.bytes_remaining() );
+                ASSERT_EQ( length, read.size() );
+                ASSERT_TRUE( std::equal( read.begin(), read.end(), contents.begin() + static_cast< std::ptrdiff_t >( offset ) ) );
+            }
+        }
+
+        // a reader stopping halfway leaves its buffers for the next one
+        {
+            FileUtils::ReadAhead reader{ pool, path.string(), 0, contents.size(), false };
+            std::array< std::byte, 100 > piece;
+            ASSERT_EQ( piece.size(), reader.read( piece ) );
+        }
+        FileUtils::ReadAhead reader{ pool, path.string(), 0, 100, false };
+        std::array< std::byte, 100 > piece;
+        ASSERT_EQ( piece.size(), reader.read( piece ) );
+        ASSERT_TRUE( std::equal( piece.begin(), piece.end(), contents.begin() ) );
+    }
+
+    // a file shorter than the range ends it early
+    FileUtils::ReadPool pool{ FileUtils::IoBackend::Uring, 8192, 2 };
+    FileUtils::ReadAhead reader{ pool, path.string(), 0, contents.size() + 100, false };
+    std::vector< std::byte > all( contents.size() + 100 );
+    std::size_t total{};
+    for ( std::size_t size{}; ( size = reader.read( std::span{ all }.subspan( total ) ) ) > 0; )
+    {
+        total += size;
+    }
+    ASSERT_EQ( contents.size(), total );
+
+    ASSERT_FALSE( ( FileUtils::ReadAhead{ pool, ( path.string() + ".missing" ), 0, 10, false }.valid() ) );
+
+    std::filesystem::remove( path );
+}
 
 int main ( int argc, char ** argv )
 {